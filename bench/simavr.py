@@ -0,0 +1,186 @@
+#!/usr/bin/env python3
+"""Run the AVR kernel benchmarks under simavr and compare with a baseline.
+
+    pio run -e simavr
+    ./simavr.py                      # run, print results, check baseline
+    ./simavr.py --json out.json      # also write the results
+    ./simavr.py --update-baseline    # accept the current numbers
+
+Per kernel it reports the cycles and stack bytes measured on the simulated
+ATmega328 (see src/avr/main.cpp) and the flash taken by the code the kernel
+pulls in, from the symbol sizes in the ELF. simavr is cycle exact and the
+kernels are deterministic, so any growth is a real change; the tolerance
+only exists to absorb toolchain noise. Exit status is 1 on a regression, a
+failed kernel or a kernel with no baseline numbers yet.
+"""
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+ELF = os.path.join(HERE, ".pio", "build", "simavr", "firmware.elf")
+BASELINE = os.path.join(HERE, "baseline-simavr.json")
+F_CPU = 8000000
+
+# Symbols (demangled) that make up each piece of code a kernel can pull in
+GROUPS = {
+    "sha256": r"SHA256::|Hash::|HMAC",
+    "aes": r"AES",
+    "ecc": r"uECC|EccPoint|XYcZ|vli_|jacobian|x_side|apply_z|regularize_k|secp160r1",
+    "node": r"NodeCore<|NodeRadio::|LoRaClass::",
+    "log": r"^log[A-Z]|LogWriter|logWrite|logPut",
+}
+
+KERNEL_GROUPS = [
+    (r"^hmac_", ["sha256"]),
+    (r"^aes_", ["aes"]),
+    (r"^ecd(h|sa)_", ["ecc"]),
+    (r"^log_", ["log"]),
+    (r"^(send_data|handle_command)_", ["node", "sha256", "aes"]),
+]
+
+METRICS = ["cycles", "stack", "flash"]
+
+
+def tool(name):
+    return os.environ.get(name.upper().replace("-", "_"), name)
+
+
+def run_simavr(elf, timeout):
+    cmd = [tool("simavr"), "-m", "atmega328p", "-f", str(F_CPU), elf]
+    out = subprocess.run(cmd, capture_output=True, text=True, timeout=timeout)
+    results, done = {}, False
+    # simavr echoes UART lines with its own prefix and colors, match loosely
+    for line in (out.stdout + out.stderr).splitlines():
+        m = re.search(r"BENCH (\{.*\})", line)
+        if m:
+            r = json.loads(m.group(1))
+            results[r.pop("kernel")] = r
+        elif "BENCH done" in line:
+            done = True
+    if not done:
+        sys.exit("simavr run did not finish:\n" + out.stdout + out.stderr)
+    return results
+
+
+def symbol_sizes(elf):
+    out = subprocess.run([tool("avr-nm"), "--print-size", "--size-sort", "-C", elf],
+                         capture_output=True, text=True, check=True).stdout
+    sizes = []
+    for line in out.splitlines():
+        parts = line.split(None, 3)
+        # Only code in flash: t/T (text) symbols
+        if len(parts) == 4 and parts[2] in "tTwW":
+            sizes.append((parts[3], int(parts[1], 16)))
+    return sizes
+
+
+def group_flash(sizes):
+    flash = {}
+    for group, pattern in GROUPS.items():
+        flash[group] = sum(size for name, size in sizes if re.search(pattern, name))
+    return flash
+
+
+def image_size(elf):
+    out = subprocess.run([tool("avr-size"), "-A", elf],
+                         capture_output=True, text=True, check=True).stdout
+    sections = {}
+    for line in out.splitlines():
+        parts = line.split()
+        if len(parts) >= 2 and parts[0].startswith(".") and parts[1].isdigit():
+            sections[parts[0]] = int(parts[1])
+    return {
+        "flash": sections.get(".text", 0) + sections.get(".data", 0),
+        "ram": sections.get(".data", 0) + sections.get(".bss", 0),
+    }
+
+
+def collect(elf, timeout):
+    kernels = run_simavr(elf, timeout)
+    flash = group_flash(symbol_sizes(elf))
+    for name, r in kernels.items():
+        groups = next((g for pattern, g in KERNEL_GROUPS if re.search(pattern, name)), [])
+        r["flash"] = sum(flash[g] for g in groups)
+        r["us"] = round(r["cycles"] * 1e6 / F_CPU, 1)
+    return {"target": "atmega328p@8MHz", "image": image_size(elf), "kernels": kernels}
+
+
+def compare(current, baseline, tolerance):
+    failures = []
+    for name in sorted(baseline.get("kernels", {})):
+        if name not in current["kernels"]:
+            failures.append("%s: missing from this run" % name)
+    for name, r in sorted(current["kernels"].items()):
+        if not r.get("ok", True):
+            failures.append("%s: kernel reported a wrong result" % name)
+        base = baseline.get("kernels", {}).get(name)
+        if not base:
+            failures.append("%s: not in the baseline" % name)
+            continue
+        for metric in METRICS:
+            old, new = base.get(metric), r[metric]
+            # An empty baseline checks nothing; --update-baseline fills it
+            if old is None:
+                failures.append("%s: no baseline %s" % (name, metric))
+                continue
+            if new > old * (1 + tolerance / 100.0):
+                failures.append("%s: %s %d -> %d (+%.1f%%)"
+                                % (name, metric, old, new, 100.0 * (new - old) / max(old, 1)))
+    return failures
+
+
+def print_table(current, baseline):
+    print("%-22s %12s %10s %7s %7s %9s" % ("kernel", "cycles", "us", "stack", "flash", "vs base"))
+    for name, r in sorted(current["kernels"].items()):
+        base = baseline.get("kernels", {}).get(name, {}).get("cycles")
+        delta = "%+.1f%%" % (100.0 * (r["cycles"] - base) / base) if base else "-"
+        print("%-22s %12d %10.1f %7d %7d %9s"
+              % (name, r["cycles"], r["us"], r["stack"], r["flash"], delta))
+    image = current["image"]
+    print("\nimage: %d bytes flash, %d bytes static RAM" % (image["flash"], image["ram"]))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("--elf", default=ELF)
+    ap.add_argument("--baseline", default=BASELINE)
+    ap.add_argument("--json", help="write the results to this file")
+    ap.add_argument("--tolerance", type=float, default=1.0, help="allowed growth in percent")
+    ap.add_argument("--timeout", type=float, default=600)
+    ap.add_argument("--update-baseline", action="store_true")
+    args = ap.parse_args()
+
+    current = collect(args.elf, args.timeout)
+
+    baseline = {}
+    if os.path.exists(args.baseline):
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+
+    print_table(current, baseline)
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(current, f, indent=2, sort_keys=True)
+            f.write("\n")
+
+    if args.update_baseline:
+        with open(args.baseline, "w") as f:
+            json.dump(current, f, indent=2, sort_keys=True)
+            f.write("\n")
+        print("baseline updated")
+        return 0
+
+    failures = compare(current, baseline, args.tolerance)
+    for failure in failures:
+        print("REGRESSION " + failure)
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,67 @@
+#pragma once
+
+// simavr stand-in for the sandeepmistry LoRa library: simavr has no
+// SX1276, so packets go to and come from one frame buffer in RAM. Only the
+// API the node firmware uses is provided. NodeRadio's burst check finds
+// no chip behind SPI and keeps to these calls.
+//
+// endPacket() is where a frame leaves the firmware, and the only point a
+// kernel can be stopped at before the LED blink that follows a send, so
+// it calls onHandOff (see main.cpp).
+
+#include <Arduino.h>
+
+class LoRaClass {
+public:
+  uint8_t frame[128];
+  uint8_t len = 0;   // Bytes written since beginPacket(), or to deliver
+  void (*onHandOff)() = nullptr;
+
+  void setPins(int, int, int) {}
+  int begin(long) { return 1; }
+
+  void setSpreadingFactor(int) {}
+  void setSignalBandwidth(long) {}
+  void setSyncWord(int) {}
+
+  int beginPacket(int = false) {
+    len = 0;
+    return 1;
+  }
+
+  int endPacket(bool = false) {
+    if (onHandOff) onHandOff();
+    return 1;
+  }
+
+  size_t write(uint8_t b) { return write(&b, 1); }
+
+  size_t write(const uint8_t* buffer, size_t size) {
+    if (size > sizeof(frame) - len) size = sizeof(frame) - len;
+    memcpy(frame + len, buffer, size);
+    len += size;
+    return size;
+  }
+
+  void onReceive(void (*callback)(int)) { onReceive_ = callback; }
+  void receive(int = 0) {}
+  void idle() {}
+  void sleep() {}
+
+  // The frame as the radio's DIO0 interrupt would hand it over
+  void deliver() {
+    pos_ = 0;
+    if (onReceive_) onReceive_(len);
+  }
+
+  int available() { return len - pos_; }
+  int read() { return pos_ < len ? frame[pos_++] : -1; }
+  int packetRssi() { return -60; }
+  float packetSnr() { return 9.5f; }
+
+private:
+  void (*onReceive_)(int) = nullptr;
+  uint8_t pos_ = 0;
+};
+
+extern LoRaClass LoRa;
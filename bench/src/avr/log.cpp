@@ -0,0 +1,30 @@
+// DEBUG_LOG() calls as the node makes them, into an empty ring. The ring
+// is never drained here.
+//
+// These need DEBUG on, and the node kernels in main.cpp are timed as the
+// firmware ships, with it off, so they get a translation unit of their
+// own. Nothing here uses the inline log functions that differ between
+// the two (logDrain() and friends).
+
+#define DEBUG 1
+
+#include <Arduino.h>
+
+#include <NodeLog.h>
+
+static const uint8_t KEY[16] = {
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+  0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+
+static uint32_t counter = 1000;
+
+void logEmpty() {
+  logRing.head = 0;
+  logRing.used = 0;
+  logRing.dropped = 0;
+}
+
+void logMessage() { DEBUG_LOG("[N] HMAC OK"); }
+void logCounters() { DEBUG_LOG("[N] Hub challenge - Hub TX: %u, Hub RX: %u", counter, counter + 1); }
+void logBytes() { DEBUG_LOG("[N] Key: %h", logHex(KEY, 16)); }
@@ -0,0 +1,292 @@
+// Cycle counts for the firmware hot paths on the real ATmega328 at 8 MHz,
+// meant to run under simavr (see bench/simavr.py):
+//
+//   simavr -m atmega328p -f 8000000 .pio/build/simavr/firmware.elf
+//
+// Each kernel is timed with Timer1 at clk/1 plus an overflow count, so the
+// numbers are exact cycles, minus the cost of an empty call. Stack depth is
+// measured by painting the free RAM below the stack pointer before the
+// kernel and scanning for the deepest byte it touched. Results go out on
+// the UART as one line per kernel:
+//
+//   BENCH {"kernel":"hmac_33","cycles":123456,"stack":210,"ok":true}
+//
+// sendData() and handleCommand() are NodeCore's own, on a node booted from
+// a provisioned EEPROM. simavr has no SX1276, so the radio is the stand-in
+// in LoRa.h, and a node kernel stops where the frame is handed to it or
+// the command to the device: what follows a send is an LED blink, and a
+// command is handled from loop(), which goes on with its own timers. When
+// everything has run the CPU sleeps with interrupts off, which ends the
+// simulation.
+
+#include <Arduino.h>
+#include <EEPROM.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <avr/wdt.h>
+
+#include <NodeCore.h>
+
+const uint8_t SERIAL_ID[16] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0xbe,
+  0xac, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01
+};
+
+const uint8_t SESSION_KEY[16] = {
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+  0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+
+const char MSG_10[] = "state;true";
+const char MSG_48[] = "diag;stack;1234;567;8;padding-padding-padding-";
+
+// log.cpp
+void logEmpty();
+void logMessage();
+void logCounters();
+void logBytes();
+
+LoRaClass LoRa;
+
+static HmacScratch hmac;
+static AES128 aes;
+static uint8_t data[64];
+static uint8_t block[16];
+static uint8_t mac[32];
+static uint8_t pub[40], priv[21], peerPub[40], peerPriv[21], secret[20];
+static uint8_t hash[32], signature[40];
+static bool kernelOk;
+
+// Cycle counter --------------------------------------------------------------
+
+static volatile uint16_t overflows;
+
+ISR(TIMER1_OVF_vect) {
+  overflows++;
+}
+
+static void cyclesBegin() {
+  TCCR1A = 0;
+  TCCR1B = _BV(CS10);  // Normal mode, clk/1
+  TIMSK1 = _BV(TOIE1);
+}
+
+static uint32_t cycles() {
+  uint8_t sreg = SREG;
+  cli();
+  uint16_t lo = TCNT1;
+  uint16_t hi = overflows;
+  // Overflow pending but not serviced yet
+  if ((TIFR1 & _BV(TOV1)) && lo < 0x8000) hi++;
+  SREG = sreg;
+  return ((uint32_t)hi << 16) | lo;
+}
+
+// Cycles at the point a node kernel is done, 0 until it gets there
+static uint32_t handOff;
+
+static void stamp() {
+  if (!handOff) handOff = cycles();
+}
+
+// Deterministic RNG so key generation takes the same path on every run
+static uint32_t rngState = 0x2545F491;
+
+static int benchRng(uint8_t* d, unsigned s) {
+  for (unsigned i = 0; i < s; i++) {
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    d[i] = rngState;
+  }
+  return 1;
+}
+
+// Node ----------------------------------------------------------------------
+
+struct BenchDevice {
+  const char* expected = nullptr;
+
+  void begin() {}
+
+  template <class Node>
+  void poll(Node&) {}
+
+  template <class Node>
+  void handleCommand(Node&, const char* cmd) {
+    stamp();
+    kernelOk = expected && strcmp(cmd, expected) == 0;
+  }
+
+  template <class Node>
+  void trigger(Node&, uint8_t) {}
+
+  bool rxWindows() const { return false; }
+
+  const char* telemetryState() const { return "bench"; }
+};
+
+static NodeCore<BenchDevice> node(SERIAL_ID);
+
+// Adopted, with SESSION_KEY as its session key
+static void nodeBegin() {
+  EEPROM.put(EE_MAGIC_ADDR, (uint16_t)EE_MAGIC);
+  for (uint8_t i = 0; i < 16; i++) EEPROM.update(EE_KEY_ADDR + i, SESSION_KEY[i]);
+
+  LoRa.onHandOff = stamp;
+  node.begin();
+  wdt_disable();  // Nothing here feeds it between kernels
+}
+
+// Kernels -------------------------------------------------------------------
+
+static void nop() {}
+
+// computeHMAC() without the scratch lease
+static void hmacOver(uint8_t len) {
+  hmacBegin(hmac, SESSION_KEY, 16);
+  hmacUpdate(hmac, data, len);
+  hmacFinish(hmac, mac);
+}
+
+static void hmac33() { hmacOver(33); }
+static void hmac64() { hmacOver(64); }
+
+static void aesSetKey() { aes.setKey(SESSION_KEY, 16); }
+static void aesEncrypt() { aes.encryptBlock(block, block); }
+static void aesDecrypt() { aes.decryptBlock(block, block); }
+
+static void ecdhMakeKey() { kernelOk = uECC_make_key(pub, priv, uECC_secp160r1()); }
+static void ecdhShared() { kernelOk = uECC_shared_secret(peerPub, priv, secret, uECC_secp160r1()); }
+
+// MSG_RESYNC, once per node and epoch
+static void ecdsaVerify() { kernelOk = uECC_verify(peerPub, hash, 32, signature, uECC_secp160r1()); }
+
+static void send10() {
+  node.sendData(MSG_10);
+  kernelOk = LoRa.len == SecureFrame<uint8_t>::lenFor(sizeof(MSG_10) - 1);
+}
+
+static void send48() {
+  node.sendData(MSG_48);
+  kernelOk = LoRa.len == SecureFrame<uint8_t>::lenFor(sizeof(MSG_48) - 1);
+}
+
+// The hub's MSG_COMMAND has the layout and IV of the node's MSG_DATA, so
+// the frame the send kernel before left in the radio becomes one with
+// another type and MAC, under a counter the node has not seen yet
+static void commandSetup(const char* expected) {
+  SecureFrame<uint8_t> frame(LoRa.frame, LoRa.len);
+  frame.data()[0] = MSG_COMMAND;
+  hmacBegin(hmac, SESSION_KEY, 16);
+  hmacUpdate(hmac, frame.data(), frame.signedLen());
+  hmacFinish(hmac, frame.hmac());
+  node.device().expected = expected;
+}
+
+static void command10Setup() { commandSetup(MSG_10); }
+static void command48Setup() { commandSetup(MSG_48); }
+
+// From the radio interrupt through loop() to the device
+static void command() {
+  kernelOk = false;
+  LoRa.deliver();
+  node.loop();
+}
+
+// Runner --------------------------------------------------------------------
+
+extern uint8_t _end;
+extern char* __brkval;
+
+static uint32_t overhead;
+
+struct Measurement {
+  uint32_t cycles;
+  uint16_t stack;
+};
+
+static Measurement __attribute__((noinline)) measure(void (*kernel)()) {
+  // Paint everything below our own frame; the loop only uses registers
+  uint8_t* top = (uint8_t*)SP;
+  uint8_t* bottom = __brkval ? (uint8_t*)__brkval : &_end;
+  for (uint8_t* p = bottom; p < top; p++) *p = STACK_CANARY;
+
+  handOff = 0;
+  uint32_t start = cycles();
+  kernel();
+  uint32_t end = handOff ? handOff : cycles();
+
+  uint8_t* p = bottom;
+  while (p < top && *p == STACK_CANARY) p++;
+
+  Measurement m;
+  m.cycles = end - start;
+  m.stack = top - p;
+  return m;
+}
+
+static void run(const __FlashStringHelper* name, void (*kernel)(), void (*setup)() = nullptr) {
+  if (setup) setup();
+  kernelOk = true;
+  Measurement m = measure(kernel);
+
+  Serial.print(F("BENCH {\"kernel\":\""));
+  Serial.print(name);
+  Serial.print(F("\",\"cycles\":"));
+  Serial.print(m.cycles > overhead ? m.cycles - overhead : 0);
+  Serial.print(F(",\"stack\":"));
+  Serial.print(m.stack);
+  Serial.print(F(",\"ok\":"));
+  Serial.print(kernelOk ? F("true") : F("false"));
+  Serial.println(F("}"));
+}
+
+void setup() {
+  Serial.begin(38400);
+
+  // The node runs on millis(), so it boots first. The primitives then
+  // run without its ISR, the node kernels with it, as on the node.
+  nodeBegin();
+  TIMSK0 = 0;
+  cyclesBegin();
+  sei();
+
+  overhead = measure(nop).cycles;
+
+  for (uint8_t i = 0; i < 64; i++) data[i] = i;
+
+  uECC_set_rng(&benchRng);
+  uECC_make_key(peerPub, peerPriv, uECC_secp160r1());
+  for (uint8_t i = 0; i < 32; i++) hash[i] = i;
+  uECC_sign(peerPriv, hash, 32, signature, uECC_secp160r1());
+
+  run(F("hmac_33"), hmac33);
+  run(F("hmac_64"), hmac64);
+  run(F("aes_set_key"), aesSetKey);
+  run(F("aes_encrypt_block"), aesEncrypt);
+  run(F("aes_decrypt_block"), aesDecrypt);
+  run(F("ecdh_make_key"), ecdhMakeKey);
+  run(F("ecdh_shared_secret"), ecdhShared);
+  run(F("ecdsa_verify"), ecdsaVerify);
+  run(F("log_message"), logMessage, logEmpty);
+  run(F("log_counters"), logCounters, logEmpty);
+  run(F("log_hex"), logBytes, logEmpty);
+
+  TIMSK0 = _BV(TOIE0);
+  run(F("send_data_10"), send10);
+  run(F("handle_command_10"), command, command10Setup);
+  run(F("send_data_48"), send48);
+  run(F("handle_command_48"), command, command48Setup);
+
+  Serial.println(F("BENCH done"));
+  Serial.flush();
+
+  // simavr exits when the CPU sleeps with interrupts disabled
+  cli();
+  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  sleep_enable();
+  sleep_cpu();
+}
+
+void loop() {}
@@ -0,0 +1,308 @@
+// Host microbenchmarks for the node core and the hub protocol engine.
+//
+// Times the crypto primitives, the full TX/RX paths of NodeCore against
+// the host HAL and the hub side of the same frames, so a change to the hot
+// paths can be compared before and after on the same machine:
+//
+//   program [iterations]
+//
+// Numbers are host wall-clock time, not AVR cycles. They are only useful
+// relative to each other and to an earlier run.
+
+#include <NodeCore.h>
+#include <HubEngine.h>
+
+#include <chrono>
+#include <functional>
+
+const uint8_t SERIAL_ID[16] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0xbe,
+  0xac, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01
+};
+
+const uint8_t SESSION_KEY[16] = {
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+  0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+
+struct BenchDevice {
+  unsigned long commands = 0;
+  unsigned long triggers = 0;
+
+  void begin() {}
+
+  template <class Node>
+  void poll(Node&) {}
+
+  template <class Node>
+  void handleCommand(Node&, const char*) { commands++; }
+
+  template <class Node>
+  void trigger(Node&, uint8_t) { triggers++; }
+
+  bool rxWindows() const { return false; }
+
+  const char* telemetryState() const { return "bench"; }
+};
+
+static NodeCore<BenchDevice> node(SERIAL_ID);
+static ScratchArena hub;  // Hub side scratch for the raw HMAC runs
+static unsigned long txFrames = 0;
+
+static uint8_t lastFrame[HUB_FRAME_MAX];
+static uint8_t lastFrameLen = 0;
+
+static void captureFrame(hal::Board&, const uint8_t* frame, uint8_t len) {
+  memcpy(lastFrame, frame, len);
+  lastFrameLen = len;
+  txFrames++;
+}
+
+template <class Fn>
+static void bench(const char* name, unsigned long iterations, Fn fn) {
+  auto start = std::chrono::steady_clock::now();
+  for (unsigned long i = 0; i < iterations; i++) fn(i);
+  auto end = std::chrono::steady_clock::now();
+
+  double ns = std::chrono::duration<double, std::nano>(end - start).count();
+  printf("%-24s %8lu %12.1f ns/op\n", name, iterations, ns / iterations);
+}
+
+int main(int argc, char** argv) {
+  unsigned long n = argc > 1 ? strtoul(argv[1], nullptr, 10) : 10000;
+  if (n == 0) n = 1;
+
+  uint8_t data[64];
+  uint8_t out[32];
+  for (int i = 0; i < 64; i++) data[i] = i;
+
+  printf("%-24s %8s %15s\n", "benchmark", "iters", "time");
+
+  bench("hmac 33B", n, [&](unsigned long) {
+    computeHMAC(hub, SESSION_KEY, 16, data, 33, out);
+  });
+
+  bench("hmac 64B", n, [&](unsigned long) {
+    computeHMAC(hub, SESSION_KEY, 16, data, 64, out);
+  });
+
+  AES128 aes;
+  aes.setKey(SESSION_KEY, 16);
+  bench("aes128 encrypt block", n, [&](unsigned long) {
+    aes.encryptBlock(out, data);
+  });
+  bench("aes128 decrypt block", n, [&](unsigned long) {
+    aes.decryptBlock(out, data);
+  });
+
+  uECC_set_rng(&getRng);
+  uint8_t pub[40], priv[21], secret[20];
+  unsigned long ecdh = n / 100 ? n / 100 : 1;
+  bench("ecdh make key", ecdh, [&](unsigned long) {
+    uECC_make_key(pub, priv, uECC_secp160r1());
+  });
+  bench("ecdh shared secret", ecdh, [&](unsigned long) {
+    uECC_shared_secret(pub, priv, secret, uECC_secp160r1());
+  });
+
+  // Boot an adopted node and sync it with a hub challenge
+  SessionTable sessions(16);
+  HubEngine engine(sessions);
+  HubSession* session = engine.addSession(SERIAL_ID, SESSION_KEY);
+  session->txCounter = 1000;
+
+  hal::provision(hal::defaultBoard, SESSION_KEY);
+  hal::defaultBoard.radio.transmit = captureFrame;
+  node.begin();
+
+  uint8_t nonce[8] = {0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A};
+  uint8_t frame[HUB_FRAME_MAX];
+  size_t len = engine.buildChallenge(*session, nonce, frame);
+  hal::deliver(hal::defaultBoard, frame, len, -60, 9.5f);
+  node.loop();
+
+  HubEvent ev;
+  if (!node.isReady() || engine.receive(lastFrame, lastFrameLen, ev) != HUB_OK) {
+    fprintf(stderr, "node did not sync\n");
+    return 1;
+  }
+
+  bench("sendData 10B", n, [&](unsigned long) {
+    node.sendData("state;true");
+  });
+
+  // Hub side of the last data frame; the counter is rewound so every run
+  // takes the full verify and decrypt path
+  uint8_t data10[HUB_FRAME_MAX];
+  uint8_t data10Len = lastFrameLen;
+  memcpy(data10, lastFrame, lastFrameLen);
+
+  bench("sendData 48B", n, [&](unsigned long) {
+    node.sendData("diag;stack;1234;567;8;padding-padding-padding-");
+  });
+
+  bench("hub receive data 10B", n, [&](unsigned long) {
+    session->rxExpected = 0;
+    engine.receive(data10, data10Len, ev);
+  });
+
+  bench("hub receive data 48B", n, [&](unsigned long) {
+    session->rxExpected = 0;
+    engine.receive(lastFrame, lastFrameLen, ev);
+  });
+
+  // A burst of uplinks from many nodes, as after a site-wide power restore.
+  // Frames are commands re-typed as MSG_DATA and re-signed, which gives the
+  // hub a valid data frame from each session without running 256 nodes.
+  const size_t burst = 4096, burstNodes = 256;
+  SessionTable burstTable(burstNodes);
+  HubEngine burstEngine(burstTable);
+  static uint8_t burstFrames[burst][HUB_FRAME_MAX];
+  static const uint8_t* burstPtrs[burst];
+  static size_t burstLens[burst];
+  static HubEvent burstEvents[burst];
+  static HubStatus burstStatus[burst];
+  static HmacJob jobs[burst];
+  static bool ok[burst];
+
+  for (size_t i = 0; i < burstNodes; i++) {
+    uint8_t id[16], key[16];
+    memcpy(id, SERIAL_ID, 16);
+    id[14] = i >> 8;
+    id[15] = i;
+    for (int j = 0; j < 16; j++) key[j] = i * 31 + j;
+    burstEngine.addSession(id, key);
+  }
+
+  for (size_t i = 0; i < burst; i++) {
+    uint8_t id[16];
+    memcpy(id, SERIAL_ID, 16);
+    id[14] = (i % burstNodes) >> 8;
+    id[15] = i % burstNodes;
+    HubSession* s = burstTable.find(id);
+
+    // Mix of 10B telemetry and 48B diagnostics
+    const char* text = i % 4 ? "state;true" : "diag;stack;1234;567;8;padding-padding-padding-";
+    size_t frameLen = burstEngine.buildCommand(*s, text, strlen(text), nonce, burstFrames[i]);
+    burstFrames[i][0] = MSG_DATA;
+    computeHMAC(hub, s->key, 16, burstFrames[i], frameLen - WIRE_HMAC_LEN,
+                burstFrames[i] + frameLen - WIRE_HMAC_LEN);
+
+    burstPtrs[i] = burstFrames[i];
+    burstLens[i] = frameLen;
+    jobs[i] = HmacJob{s->key, 16, burstFrames[i], frameLen - WIRE_HMAC_LEN,
+                      burstFrames[i] + frameLen - WIRE_HMAC_LEN};
+  }
+
+  unsigned long bursts = n / 1000 ? n / 1000 : 1;
+  HmacImpl impls[] = {HMAC_SCALAR, HMAC_SSE2, HMAC_AVX2};
+  for (HmacImpl impl : impls) {
+    if (impl > hmacBestImpl()) break;
+
+    size_t verified = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned long b = 0; b < bursts; b++) verified += verifyHmacBatch(jobs, burst, ok, impl);
+    auto end = std::chrono::steady_clock::now();
+
+    double s = std::chrono::duration<double>(end - start).count();
+    char name[32];
+    snprintf(name, sizeof(name), "verify batch %s", hmacImplName(impl));
+    printf("%-24s %8lu %12.0f frames/s%s\n", name, bursts * burst, bursts * burst / s,
+           verified == bursts * burst ? "" : "  MISMATCH");
+  }
+
+  // Whole hub path, one frame at a time and as a batch. Counters are
+  // rewound before each burst so every frame is accepted.
+  size_t accepted[2] = {0, 0};
+  for (int batched = 0; batched < 2; batched++) {
+    double s = 0;
+    for (unsigned long b = 0; b < bursts; b++) {
+      burstTable.forEach([](HubSession& s) { s.rxExpected = 0; });
+
+      auto start = std::chrono::steady_clock::now();
+      if (batched) {
+        burstEngine.receiveBatch(burstPtrs, burstLens, burst, burstEvents, burstStatus);
+      } else {
+        for (size_t i = 0; i < burst; i++) {
+          burstStatus[i] = burstEngine.receive(burstPtrs[i], burstLens[i], burstEvents[i]);
+        }
+      }
+      auto end = std::chrono::steady_clock::now();
+      s += std::chrono::duration<double>(end - start).count();
+
+      for (size_t i = 0; i < burst; i++) accepted[batched] += burstStatus[i] == HUB_OK;
+    }
+    printf("%-24s %8lu %12.0f frames/s\n", batched ? "hub receive batch" : "hub receive one by one",
+           bursts * burst, bursts * burst / s);
+  }
+  if (accepted[0] != accepted[1]) {
+    fprintf(stderr, "receiveBatch accepted %zu frames, receive %zu\n", accepted[1], accepted[0]);
+    return 1;
+  }
+
+  bench("hub build command", n, [&](unsigned long) {
+    engine.buildCommand(*session, "siren;true", 10, nonce, frame);
+  });
+
+  bench("loop idle", n, [&](unsigned long) {
+    node.loop();
+  });
+
+  // Frames are built up front so only the node side is timed
+  static uint8_t commands[256][HUB_FRAME_MAX];
+  static uint8_t commandLen[256];
+  unsigned long batches = (n + 255) / 256;
+  auto deliverLoop = [&](const char* name, const std::function<size_t(uint8_t*)>& build) {
+    double ns = 0;
+    for (unsigned long b = 0; b < batches; b++) {
+      for (int i = 0; i < 256; i++) commandLen[i] = build(commands[i]);
+      auto start = std::chrono::steady_clock::now();
+      for (int i = 0; i < 256; i++) {
+        hal::deliver(hal::defaultBoard, commands[i], commandLen[i], -60, 9.5f);
+        node.loop();
+      }
+      auto end = std::chrono::steady_clock::now();
+      ns += std::chrono::duration<double, std::nano>(end - start).count();
+    }
+    printf("%-24s %8lu %12.1f ns/op\n", name, batches * 256, ns / (batches * 256));
+  };
+
+  deliverLoop("command + loop", [&](uint8_t* out) {
+    return engine.buildCommand(*session, "siren;true", 10, nonce, out);
+  });
+  deliverLoop("trigger + loop", [&](uint8_t* out) {
+    return engine.buildTrigger(*session, TRIGGER_ON, out);
+  });
+
+  // One command over and over: all but the first end at the counter check
+  uint8_t replayed[HUB_FRAME_MAX];
+  size_t replayedLen = engine.buildCommand(*session, "siren;true", 10, nonce, replayed);
+  deliverLoop("replayed command + loop", [&](uint8_t* out) {
+    memcpy(out, replayed, replayedLen);
+    return replayedLen;
+  });
+
+  // Session lookups at gateway scale, serial IDs shaped like real ones
+  const size_t gateway = 10000;
+  SessionTable table(gateway);
+  static uint8_t ids[gateway][16];
+  for (size_t i = 0; i < gateway; i++) {
+    memset(ids[i], 0, 16);
+    ids[i][6] = 0x40;
+    ids[i][7] = i & 1 ? 0x75 : 0x24;
+    ids[i][8] = 0xa0;
+    ids[i][13] = i >> 16;
+    ids[i][14] = i >> 8;
+    ids[i][15] = i;
+    table.insert(ids[i]);
+  }
+
+  unsigned long found = 0;
+  bench("session find (10k)", n, [&](unsigned long i) {
+    found += table.find(ids[(i * 7919) % gateway]) != nullptr;
+  });
+
+  printf("\n%lu frames sent, %lu commands and %lu triggers handled, %lu sessions found\n",
+         txFrames, node.device().commands, node.device().triggers, found);
+  return 0;
+}
@@ -0,0 +1,124 @@
+// OTA bootloader: OtaBoot (NodeOtaBoot.h) on the ATmega328.
+//
+// Plain avr-libc, no Arduino core, to fit the 2 KB boot section. The SPI
+// flash is driven straight from the registers: SCK, MOSI and MISO on the
+// hardware SPI pins, chip select on D9 (the OTA_FLASH_CS default). The
+// radio's select on D10 is held high so it stays off the bus.
+
+#include <avr/io.h>
+#include <avr/boot.h>
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <avr/wdt.h>
+
+#include <NodeOtaBoot.h>
+
+#define FLASH_CS _BV(PB1)   // D9
+#define RADIO_CS _BV(PB2)   // D10, also SS: an output keeps the SPI master
+
+#define CMD_WRITE_ENABLE 0x06
+#define CMD_READ_STATUS 0x05
+#define CMD_READ 0x03
+#define CMD_PAGE_PROGRAM 0x02
+#define CMD_SECTOR_ERASE 0x20
+#define CMD_WAKE 0xAB
+
+static uint8_t spi(uint8_t b) {
+  SPDR = b;
+  while (!(SPSR & _BV(SPIF)));
+  return SPDR;
+}
+
+static void select() { PORTB &= ~FLASH_CS; }
+static void deselect() { PORTB |= FLASH_CS; }
+
+static void command(uint8_t cmd) {
+  select();
+  spi(cmd);
+  deselect();
+}
+
+static void commandAt(uint8_t cmd, uint32_t addr) {
+  select();
+  spi(cmd);
+  spi(addr >> 16);
+  spi(addr >> 8);
+  spi(addr);
+}
+
+static void waitReady() {
+  select();
+  spi(CMD_READ_STATUS);
+  while (spi(0) & 0x01);
+  deselect();
+}
+
+struct BootPort {
+  void readRecord(OtaRecord& r) {
+    eeprom_read_block(&r, (const void*)OTA_RECORD_ADDR, sizeof(r));
+  }
+
+  void writeRecord(const OtaRecord& r) {
+    eeprom_update_block(&r, (void*)OTA_RECORD_ADDR, sizeof(r));
+  }
+
+  void flashRead(uint32_t addr, uint8_t* buf, uint16_t len) {
+    commandAt(CMD_READ, addr);
+    while (len--) *buf++ = spi(0);
+    deselect();
+  }
+
+  void flashProgram(uint32_t addr, const uint8_t* buf, uint16_t len) {
+    command(CMD_WRITE_ENABLE);
+    commandAt(CMD_PAGE_PROGRAM, addr);
+    while (len--) spi(*buf++);
+    deselect();
+    waitReady();
+  }
+
+  void flashErase(uint32_t addr) {
+    command(CMD_WRITE_ENABLE);
+    commandAt(CMD_SECTOR_ERASE, addr);
+    deselect();
+    waitReady();
+  }
+
+  uint8_t appRead(uint16_t addr) {
+    return pgm_read_byte(addr);
+  }
+
+  void appWritePage(uint16_t addr, const uint8_t* page) {
+    boot_page_erase(addr);
+    boot_spm_busy_wait();
+    for (uint16_t i = 0; i < SPM_PAGESIZE; i += 2) {
+      boot_page_fill(addr + i, page[i] | (page[i + 1] << 8));
+    }
+    boot_page_write(addr);
+    boot_spm_busy_wait();
+    boot_rww_enable();
+  }
+};
+
+int main() {
+  // The application resets through the watchdog, which stays armed with
+  // its 15 ms timeout until cleared here
+  MCUSR = 0;
+  wdt_disable();
+
+  DDRB |= FLASH_CS | RADIO_CS | _BV(PB3) | _BV(PB5);
+  PORTB |= FLASH_CS | RADIO_CS;
+  SPCR = _BV(SPE) | _BV(MSTR);
+  SPSR = _BV(SPI2X);  // F_CPU / 2
+  command(CMD_WAKE);
+
+  BootPort port;
+  OtaBoot<BootPort, SPM_PAGESIZE>(port).run();
+
+  // Hand the pins back as the application expects them after reset
+  SPCR = 0;
+  SPSR = 0;
+  DDRB = 0;
+  PORTB = 0;
+
+  asm volatile("jmp 0");
+}
@@ -0,0 +1,60 @@
+#include "BulkTransfer.h"
+
+BulkTransfer::BulkTransfer(HubEngine& engine, HubSession& session, uint8_t kind,
+                           const uint8_t* data, size_t len, const uint8_t* nonce,
+                           uint32_t nowMs, uint32_t retryMs)
+  : engine_(engine),
+    session_(session),
+    buf_(bulkPaddedLen(BULK_LEN_MAX)),
+    sender_(buf_.data(), buf_.size(), retryMs) {
+  started_ = len <= BULK_LEN_MAX && sender_.start(kind, data, len, nonce, nowMs);
+}
+
+size_t BulkTransfer::poll(uint32_t nowMs, uint8_t* out) {
+  uint8_t index;
+  switch (sender_.next(nowMs, index)) {
+    case BULK_SEND_OFFER:
+      return engine_.buildBulkOffer(session_, sender_, out);
+    case BULK_SEND_FRAGMENT:
+      return engine_.buildBulkFragment(session_, sender_, index, out);
+    default:
+      return 0;
+  }
+}
+
+void BulkTransfer::onAck(const HubEvent& ev, uint32_t nowMs) {
+  if (ev.type != MSG_BULK_ACK_UP || ev.counter != sender_.counter()) return;
+
+  BulkAckFrame<const uint8_t> frame(ev.bulk);
+  sender_.onAck(frame.state(), frame.received(), nowMs);
+}
+
+size_t BulkReceiver::onFrame(HubEngine& engine, HubSession& s, const HubEvent& ev,
+                             uint32_t nowMs, uint8_t* out) {
+  complete_ = false;
+  if (assembly_.expired(nowMs)) assembly_.clear();
+
+  if (ev.type == MSG_BULK_OFFER_UP) {
+    uint8_t state = assembly_.offer(BulkOfferFrame<const uint8_t>(ev.bulk), nowMs);
+    return engine.buildBulkAck(s, ev.counter, state, 0, out);
+  }
+  if (ev.type != MSG_BULK_FRAGMENT_UP) return 0;
+
+  BulkFragmentFrame<const uint8_t> frame(ev.bulk, ev.bulkLen);
+  if (!assembly_.fits(frame)) {
+    if (!frame.poll()) return 0;
+    uint8_t state = assembly_.finished(ev.counter) ? BULK_DONE : BULK_UNKNOWN;
+    return engine.buildBulkAck(s, ev.counter, state, 0, out);
+  }
+
+  if (!assembly_.fragment(frame, nowMs)) {
+    if (!frame.poll()) return 0;
+    return engine.buildBulkAck(s, ev.counter, BULK_RECEIVING, assembly_.received(), out);
+  }
+
+  uint8_t chain[WIRE_BLOCK_LEN];
+  uint8_t block[WIRE_BLOCK_LEN];
+  uint8_t state = assembly_.open(aes_, s.key, s.serialId, chain, block);
+  complete_ = state == BULK_DONE;
+  return engine.buildBulkAck(s, ev.counter, state, assembly_.received(), out);
+}
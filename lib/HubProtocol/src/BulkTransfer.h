@@ -0,0 +1,75 @@
+#pragma once
+
+// Bulk transfers as the hub drives them (NodeWire.h, NodeBulk.h).
+//
+// BulkTransfer sends one payload to one node, like an OtaTransfer: the
+// caller polls it for frames whenever it may transmit and feeds it the
+// node's MSG_BULK_ACK_UP events. Every offer takes a command counter, so
+// the data is encrypted again for each one it sends.
+//
+// BulkReceiver puts together what one node sends up: it takes the node's
+// offers and fragments and hands back the acks to send. Keep one per node
+// next to the session; it holds the largest transfer, BULK_LEN_MAX bytes.
+//
+// Neither does I/O or keeps a clock.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <vector>
+
+#include "HubEngine.h"
+
+class BulkTransfer {
+public:
+  // nonce is the transfer's for its life, a fresh one from the caller
+  BulkTransfer(HubEngine& engine, HubSession& session, uint8_t kind, const uint8_t* data,
+               size_t len, const uint8_t* nonce, uint32_t nowMs, uint32_t retryMs);
+
+  // False if len is over BULK_LEN_MAX; such a transfer is finished at once
+  bool started() const { return started_; }
+  bool finished() const { return !sender_.active(); }
+
+  // BULK_DONE once the node has it, else BULK_* why not
+  uint8_t result() const { return started_ ? sender_.result() : BULK_TOO_BIG; }
+  uint8_t kind() const { return sender_.kind(); }
+  size_t len() const { return sender_.len(); }
+
+  HubSession& session() const { return session_; }
+
+  // Next frame to put on the air, 0 if none is due at nowMs
+  size_t poll(uint32_t nowMs, uint8_t* out);
+
+  // MSG_BULK_ACK_UP from this node
+  void onAck(const HubEvent& ev, uint32_t nowMs);
+
+private:
+  HubEngine& engine_;
+  HubSession& session_;
+  std::vector<uint8_t> buf_;
+  BulkSender sender_;
+  bool started_;
+};
+
+class BulkReceiver {
+public:
+  BulkReceiver() : buf_(bulkPaddedLen(BULK_LEN_MAX)), assembly_(buf_.data(), buf_.size()) {}
+
+  // MSG_BULK_OFFER_UP or MSG_BULK_FRAGMENT_UP from the node of s. The ack
+  // to send goes into out, 0 if there is none. complete() then tells
+  // whether the frame finished a transfer.
+  size_t onFrame(HubEngine& engine, HubSession& s, const HubEvent& ev, uint32_t nowMs,
+                 uint8_t* out);
+
+  // The last onFrame() handed over a transfer, at data()
+  bool complete() const { return complete_; }
+  uint8_t kind() const { return assembly_.kind(); }
+  const uint8_t* data() const { return assembly_.data(); }
+  size_t len() const { return assembly_.len(); }
+
+private:
+  std::vector<uint8_t> buf_;
+  BulkAssembly assembly_;
+  AES128 aes_;
+  bool complete_ = false;
+};
@@ -0,0 +1,313 @@
+#include "HmacBatch.h"
+
+#include <string.h>
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HMAC_X86 1
+#include <immintrin.h>
+#else
+#define HMAC_X86 0
+#endif
+
+#define HMAC_MAX_LANES 8
+
+static const uint32_t K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t H0[8] = {
+  0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static inline uint32_t load32be(const uint8_t* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// Message schedule words of every lane, laid out w[t][lane]
+template <int L>
+static inline void loadWords(uint32_t w[16][L], const uint8_t* const* blocks) {
+  for (int l = 0; l < L; l++) {
+    for (int t = 0; t < 16; t++) w[t][l] = load32be(blocks[l] + 4 * t);
+  }
+}
+
+// Scalar
+
+static inline uint32_t rotr(uint32_t x, int n) {
+  return (x >> n) | (x << (32 - n));
+}
+
+static void compressScalar(uint32_t st[8][1], const uint8_t* const* blocks) {
+  uint32_t w[64];
+  for (int t = 0; t < 16; t++) w[t] = load32be(blocks[0] + 4 * t);
+  for (int t = 16; t < 64; t++) {
+    uint32_t s0 = rotr(w[t - 15], 7) ^ rotr(w[t - 15], 18) ^ (w[t - 15] >> 3);
+    uint32_t s1 = rotr(w[t - 2], 17) ^ rotr(w[t - 2], 19) ^ (w[t - 2] >> 10);
+    w[t] = w[t - 16] + s0 + w[t - 7] + s1;
+  }
+
+  uint32_t a = st[0][0], b = st[1][0], c = st[2][0], d = st[3][0];
+  uint32_t e = st[4][0], f = st[5][0], g = st[6][0], h = st[7][0];
+
+  for (int t = 0; t < 64; t++) {
+    uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[t] + w[t];
+    uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g; g = f; f = e; e = d + t1;
+    d = c; c = b; b = a; a = t1 + t2;
+  }
+
+  st[0][0] += a; st[1][0] += b; st[2][0] += c; st[3][0] += d;
+  st[4][0] += e; st[5][0] += f; st[6][0] += g; st[7][0] += h;
+}
+
+#if HMAC_X86
+
+// The SIMD rounds are the scalar ones with every operation widened to a
+// vector of lanes. Neither SSE2 nor AVX2 has a 32-bit rotate.
+
+#define ROTR4(x, n) _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - (n)))
+
+static void compressSse2(uint32_t st[8][4], const uint8_t* const* blocks) {
+  uint32_t raw[16][4];
+  loadWords<4>(raw, blocks);
+
+  __m128i w[64];
+  for (int t = 0; t < 16; t++) w[t] = _mm_loadu_si128((const __m128i*)raw[t]);
+  for (int t = 16; t < 64; t++) {
+    __m128i x = w[t - 15], y = w[t - 2];
+    __m128i s0 = _mm_xor_si128(_mm_xor_si128(ROTR4(x, 7), ROTR4(x, 18)), _mm_srli_epi32(x, 3));
+    __m128i s1 = _mm_xor_si128(_mm_xor_si128(ROTR4(y, 17), ROTR4(y, 19)), _mm_srli_epi32(y, 10));
+    w[t] = _mm_add_epi32(_mm_add_epi32(w[t - 16], s0), _mm_add_epi32(w[t - 7], s1));
+  }
+
+  __m128i v[8];
+  for (int i = 0; i < 8; i++) v[i] = _mm_loadu_si128((const __m128i*)st[i]);
+  __m128i a = v[0], b = v[1], c = v[2], d = v[3], e = v[4], f = v[5], g = v[6], h = v[7];
+
+  for (int t = 0; t < 64; t++) {
+    __m128i s1 = _mm_xor_si128(_mm_xor_si128(ROTR4(e, 6), ROTR4(e, 11)), ROTR4(e, 25));
+    __m128i ch = _mm_xor_si128(_mm_and_si128(e, f), _mm_andnot_si128(e, g));
+    __m128i t1 = _mm_add_epi32(_mm_add_epi32(h, s1),
+                               _mm_add_epi32(_mm_add_epi32(ch, _mm_set1_epi32(K[t])), w[t]));
+    __m128i s0 = _mm_xor_si128(_mm_xor_si128(ROTR4(a, 2), ROTR4(a, 13)), ROTR4(a, 22));
+    __m128i maj = _mm_xor_si128(_mm_xor_si128(_mm_and_si128(a, b), _mm_and_si128(a, c)),
+                                _mm_and_si128(b, c));
+    __m128i t2 = _mm_add_epi32(s0, maj);
+    h = g; g = f; f = e; e = _mm_add_epi32(d, t1);
+    d = c; c = b; b = a; a = _mm_add_epi32(t1, t2);
+  }
+
+  __m128i r[8] = {a, b, c, d, e, f, g, h};
+  for (int i = 0; i < 8; i++) {
+    _mm_storeu_si128((__m128i*)st[i], _mm_add_epi32(v[i], r[i]));
+  }
+}
+
+#define ROTR8(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+
+__attribute__((target("avx2")))
+static void compressAvx2(uint32_t st[8][8], const uint8_t* const* blocks) {
+  uint32_t raw[16][8];
+  loadWords<8>(raw, blocks);
+
+  __m256i w[64];
+  for (int t = 0; t < 16; t++) w[t] = _mm256_loadu_si256((const __m256i*)raw[t]);
+  for (int t = 16; t < 64; t++) {
+    __m256i x = w[t - 15], y = w[t - 2];
+    __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(x, 7), ROTR8(x, 18)), _mm256_srli_epi32(x, 3));
+    __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(y, 17), ROTR8(y, 19)), _mm256_srli_epi32(y, 10));
+    w[t] = _mm256_add_epi32(_mm256_add_epi32(w[t - 16], s0), _mm256_add_epi32(w[t - 7], s1));
+  }
+
+  __m256i v[8];
+  for (int i = 0; i < 8; i++) v[i] = _mm256_loadu_si256((const __m256i*)st[i]);
+  __m256i a = v[0], b = v[1], c = v[2], d = v[3], e = v[4], f = v[5], g = v[6], h = v[7];
+
+  for (int t = 0; t < 64; t++) {
+    __m256i s1 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(e, 6), ROTR8(e, 11)), ROTR8(e, 25));
+    __m256i ch = _mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g));
+    __m256i t1 = _mm256_add_epi32(_mm256_add_epi32(h, s1),
+                                  _mm256_add_epi32(_mm256_add_epi32(ch, _mm256_set1_epi32(K[t])), w[t]));
+    __m256i s0 = _mm256_xor_si256(_mm256_xor_si256(ROTR8(a, 2), ROTR8(a, 13)), ROTR8(a, 22));
+    __m256i maj = _mm256_xor_si256(_mm256_xor_si256(_mm256_and_si256(a, b), _mm256_and_si256(a, c)),
+                                   _mm256_and_si256(b, c));
+    __m256i t2 = _mm256_add_epi32(s0, maj);
+    h = g; g = f; f = e; e = _mm256_add_epi32(d, t1);
+    d = c; c = b; b = a; a = _mm256_add_epi32(t1, t2);
+  }
+
+  __m256i r[8] = {a, b, c, d, e, f, g, h};
+  for (int i = 0; i < 8; i++) {
+    _mm256_storeu_si256((__m256i*)st[i], _mm256_add_epi32(v[i], r[i]));
+  }
+}
+
+#endif  // HMAC_X86
+
+HmacImpl hmacBestImpl() {
+#if HMAC_X86
+  static const HmacImpl best = __builtin_cpu_supports("avx2") ? HMAC_AVX2 : HMAC_SSE2;
+  return best;
+#else
+  return HMAC_SCALAR;
+#endif
+}
+
+const char* hmacImplName(HmacImpl impl) {
+  switch (impl) {
+    case HMAC_SSE2: return "sse2";
+    case HMAC_AVX2: return "avx2";
+    default: return "scalar";
+  }
+}
+
+// One SHA-256 message as seen by a lane: a 64-byte key block (key ^ pad)
+// followed by msg and the standard padding
+struct LaneStream {
+  const uint8_t* key;
+  size_t keyLen;
+  uint8_t pad;
+  const uint8_t* msg;
+  size_t msgLen;
+
+  size_t blocks() const { return 1 + (msgLen + 9 + 63) / 64; }
+
+  void block(size_t b, uint8_t* out) const {
+    if (b == 0) {
+      memset(out, pad, 64);
+      for (size_t i = 0; i < keyLen; i++) out[i] ^= key[i];
+      return;
+    }
+
+    size_t off = (b - 1) * 64;
+    memset(out, 0, 64);
+    if (off < msgLen) {
+      size_t n = std::min<size_t>(64, msgLen - off);
+      memcpy(out, msg + off, n);
+    }
+    if (msgLen >= off && msgLen < off + 64) out[msgLen - off] = 0x80;
+
+    if (b == blocks() - 1) {
+      uint64_t bits = (uint64_t)(64 + msgLen) * 8;
+      for (int i = 0; i < 8; i++) out[56 + i] = (uint8_t)(bits >> (56 - 8 * i));
+    }
+  }
+};
+
+// Hash L streams side by side. Lanes that run out of blocks keep hashing
+// their last block; their digest was already taken when they finished.
+template <int L, void (*Compress)(uint32_t (*)[L], const uint8_t* const*)>
+static void hashLanes(const LaneStream* streams, int lanes, uint8_t (*digest)[32]) {
+  alignas(32) uint32_t st[8][L];
+  alignas(32) uint8_t buf[L][64];
+  const uint8_t* ptr[L];
+  size_t count[L];
+  size_t maxBlocks = 0;
+
+  for (int l = 0; l < L; l++) {
+    const LaneStream& s = streams[l < lanes ? l : 0];
+    count[l] = l < lanes ? s.blocks() : 0;
+    maxBlocks = std::max(maxBlocks, count[l]);
+    for (int i = 0; i < 8; i++) st[i][l] = H0[i];
+    ptr[l] = buf[l];
+    memset(buf[l], 0, 64);
+  }
+
+  for (size_t b = 0; b < maxBlocks; b++) {
+    for (int l = 0; l < lanes; l++) {
+      if (b < count[l]) streams[l].block(b, buf[l]);
+    }
+
+    Compress(st, ptr);
+
+    for (int l = 0; l < lanes; l++) {
+      if (b + 1 != count[l]) continue;
+      for (int i = 0; i < 8; i++) {
+        digest[l][4 * i] = st[i][l] >> 24;
+        digest[l][4 * i + 1] = st[i][l] >> 16;
+        digest[l][4 * i + 2] = st[i][l] >> 8;
+        digest[l][4 * i + 3] = st[i][l];
+      }
+    }
+  }
+}
+
+template <int L, void (*Compress)(uint32_t (*)[L], const uint8_t* const*)>
+static void hmacLanes(const HmacJob* const* jobs, int lanes, uint8_t (*out)[32]) {
+  LaneStream inner[L];
+  LaneStream outer[L];
+  uint8_t innerDigest[L][32];
+
+  for (int l = 0; l < lanes; l++) {
+    const HmacJob& j = *jobs[l];
+    inner[l] = LaneStream{j.key, j.keyLen, 0x36, j.data, j.len};
+  }
+  hashLanes<L, Compress>(inner, lanes, innerDigest);
+
+  for (int l = 0; l < lanes; l++) {
+    const HmacJob& j = *jobs[l];
+    outer[l] = LaneStream{j.key, j.keyLen, 0x5C, innerDigest[l], 32};
+  }
+  hashLanes<L, Compress>(outer, lanes, out);
+}
+
+template <int L, void (*Compress)(uint32_t (*)[L], const uint8_t* const*)>
+static void hmacAll(const HmacJob* jobs, size_t n, uint8_t (*out)[32]) {
+  // Similar lengths share a group so lanes finish together
+  std::vector<size_t> order(n);
+  for (size_t i = 0; i < n; i++) order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return jobs[a].len / 64 < jobs[b].len / 64;
+  });
+
+  for (size_t i = 0; i < n; i += L) {
+    int lanes = (int)std::min<size_t>(L, n - i);
+    const HmacJob* group[L];
+    uint8_t digest[L][32];
+    for (int l = 0; l < lanes; l++) group[l] = &jobs[order[i + l]];
+
+    hmacLanes<L, Compress>(group, lanes, digest);
+
+    for (int l = 0; l < lanes; l++) memcpy(out[order[i + l]], digest[l], 32);
+  }
+}
+
+void hmacBatch(const HmacJob* jobs, size_t n, uint8_t (*out)[32], HmacImpl impl) {
+#if HMAC_X86
+  if (impl == HMAC_AVX2 && hmacBestImpl() == HMAC_AVX2) {
+    hmacAll<8, compressAvx2>(jobs, n, out);
+    return;
+  }
+  if (impl != HMAC_SCALAR) {
+    hmacAll<4, compressSse2>(jobs, n, out);
+    return;
+  }
+#endif
+  (void)impl;
+  hmacAll<1, compressScalar>(jobs, n, out);
+}
+
+size_t verifyHmacBatch(const HmacJob* jobs, size_t n, bool* ok, HmacImpl impl) {
+  std::vector<uint8_t> macs(n * 32);
+  uint8_t (*out)[32] = reinterpret_cast<uint8_t (*)[32]>(macs.data());
+  hmacBatch(jobs, n, out, impl);
+
+  size_t good = 0;
+  for (size_t i = 0; i < n; i++) {
+    uint8_t diff = 0;
+    for (int k = 0; k < 32; k++) diff |= out[i][k] ^ jobs[i].mac[k];
+    ok[i] = diff == 0;
+    good += ok[i];
+  }
+  return good;
+}
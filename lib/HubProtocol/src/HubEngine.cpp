@@ -0,0 +1,548 @@
+#include "HubEngine.h"
+
+#include <string.h>
+
+#include <uECC.h>
+
+HubSession* HubEngine::addSession(const uint8_t* serialId, const uint8_t* key, uint32_t epoch) {
+  HubSession* s = sessions_.insert(serialId);
+  if (!s) return nullptr;
+
+  memcpy(s->key, key, 16);
+  s->flags = 0;
+  s->epoch = epoch;
+  return s;
+}
+
+void HubEngine::hmac(const uint8_t* key, const uint8_t* data, size_t len, uint8_t* out) {
+  sha_.resetHMAC(key, 16);
+  sha_.update(data, len);
+  sha_.finalizeHMAC(key, 16, out, WIRE_HMAC_LEN);
+}
+
+bool HubEngine::verify(const uint8_t* key, const uint8_t* data, size_t len, const uint8_t* mac) {
+  uint8_t expected[WIRE_HMAC_LEN];
+  hmac(key, data, len, expected);
+
+  uint8_t diff = 0;
+  for (int i = 0; i < WIRE_HMAC_LEN; i++) diff |= expected[i] ^ mac[i];
+  return diff == 0;
+}
+
+void HubEngine::iv(const uint8_t* serialId, uint32_t counter, const uint8_t* nonce, uint8_t* out) {
+  memcpy(out, serialId, 4);
+  wireWriteU32(out + 4, counter);
+  memcpy(out + 8, nonce, WIRE_NONCE_LEN);
+}
+
+HubStatus HubEngine::receive(const uint8_t* frame, size_t len, HubEvent& ev) {
+  size_t signedLen;
+  HubStatus status = locate(frame, len, ev, signedLen);
+  if (status != HUB_OK) return status;
+
+  if (signedLen && !verify(ev.session->key, frame, signedLen, frame + signedLen)) {
+    return HUB_BAD_HMAC;
+  }
+  return complete(frame, len, ev);
+}
+
+void HubEngine::receiveBatch(const uint8_t* const* frames, const size_t* lens, size_t n,
+                             HubEvent* events, HubStatus* status) {
+  jobs_.clear();
+  jobIndex_.clear();
+
+  for (size_t i = 0; i < n; i++) {
+    size_t signedLen;
+    status[i] = locate(frames[i], lens[i], events[i], signedLen);
+    if (status[i] != HUB_OK || !signedLen) continue;
+
+    jobs_.push_back(HmacJob{events[i].session->key, 16, frames[i], signedLen,
+                            frames[i] + signedLen});
+    jobIndex_.push_back(i);
+  }
+
+  verified_.resize(jobs_.size());
+  verifyHmacBatch(jobs_.data(), jobs_.size(), (bool*)verified_.data());
+  for (size_t j = 0; j < jobs_.size(); j++) {
+    if (!verified_[j]) status[jobIndex_[j]] = HUB_BAD_HMAC;
+  }
+
+  // Counters move in frame order, as if received one by one
+  for (size_t i = 0; i < n; i++) {
+    if (status[i] == HUB_OK) status[i] = complete(frames[i], lens[i], events[i]);
+  }
+}
+
+HubStatus HubEngine::locate(const uint8_t* p, size_t len, HubEvent& ev, size_t& signedLen) {
+  ev.session = nullptr;
+  ev.pubKey = nullptr;
+  ev.textLen = 0;
+  ev.text[0] = 0;
+  ev.replyLen = 0;
+  ev.diag = nullptr;
+  ev.bulk = nullptr;
+  ev.bulkLen = 0;
+  signedLen = 0;
+
+  if (len < 1 + WIRE_ID_LEN || len > HUB_FRAME_MAX) return HUB_MALFORMED;
+
+  ev.type = p[0];
+  ev.serialId = p + WIRE_ID;
+
+  switch (p[0]) {
+    case MSG_DISCOVERY:
+      return DiscoveryFrame<const uint8_t>(p, len).valid() ? HUB_OK : HUB_MALFORMED;
+
+    case MSG_ADOPT_REQ: {
+      AdoptRequestFrame<const uint8_t> frame(p, len);
+      if (!frame.valid()) return HUB_MALFORMED;
+      ev.pubKey = frame.pubKey();
+      return HUB_OK;
+    }
+
+    case MSG_CHALLENGE:
+    case MSG_CHALLENGE_RSP:
+      if (!ChallengeFrame<const uint8_t>(p, len).valid()) return HUB_MALFORMED;
+      signedLen = ChallengeFrame<const uint8_t>::SIGNED_LEN;
+      break;
+
+    case MSG_DATA: {
+      SecureFrame<const uint8_t> frame(p, len);
+      if (!frame.valid()) return HUB_MALFORMED;
+      signedLen = frame.signedLen();
+      break;
+    }
+
+    case MSG_DIAG:
+      if (!DiagFrame<const uint8_t>(p, len).valid()) return HUB_MALFORMED;
+      signedLen = DiagFrame<const uint8_t>::SIGNED_LEN;
+      break;
+
+    case MSG_OTA_STATUS:
+      if (!OtaStatusFrame<const uint8_t>(p, len).valid()) return HUB_MALFORMED;
+      signedLen = OtaStatusFrame<const uint8_t>::SIGNED_LEN;
+      break;
+
+    case MSG_BULK_OFFER_UP:
+      if (!BulkOfferFrame<const uint8_t>(p, len).valid()) return HUB_MALFORMED;
+      signedLen = BulkOfferFrame<const uint8_t>::SIGNED_LEN;
+      break;
+
+    case MSG_BULK_FRAGMENT_UP: {
+      BulkFragmentFrame<const uint8_t> frame(p, len);
+      if (!frame.valid()) return HUB_MALFORMED;
+      signedLen = frame.signedLen();
+      break;
+    }
+
+    case MSG_BULK_ACK_UP:
+      if (!BulkAckFrame<const uint8_t>(p, len).valid()) return HUB_MALFORMED;
+      signedLen = BulkAckFrame<const uint8_t>::SIGNED_LEN;
+      break;
+
+    default:
+      return HUB_MALFORMED;
+  }
+
+  ev.session = sessions_.find(p + WIRE_ID);
+  return ev.session ? HUB_OK : HUB_UNKNOWN_NODE;
+}
+
+HubStatus HubEngine::complete(const uint8_t* p, size_t len, HubEvent& ev) {
+  switch (p[0]) {
+    case MSG_CHALLENGE:
+      return completeChallenge(p, ev);
+    case MSG_CHALLENGE_RSP:
+      return completeChallengeResponse(p, ev);
+    case MSG_DATA:
+      return completeData(p, len, ev);
+    case MSG_DIAG:
+      return completeDiag(p, ev);
+    case MSG_OTA_STATUS:
+      return completeOtaStatus(p, ev);
+    case MSG_BULK_OFFER_UP:
+    case MSG_BULK_FRAGMENT_UP:
+    case MSG_BULK_ACK_UP:
+      return completeBulk(p, len, ev);
+    default:
+      return HUB_OK;
+  }
+}
+
+// Node-initiated sync: adopt the node's TX counter and tell it ours
+HubStatus HubEngine::completeChallenge(const uint8_t* p, HubEvent& ev) {
+  HubSession* s = ev.session;
+  ChallengeFrame<const uint8_t> in(p);
+
+  uint32_t nodeTx = in.tx();
+  s->rxExpected = nodeTx;
+  s->flags |= HUB_SESSION_SYNCED;
+
+  ChallengeFrame<uint8_t> r(ev.reply);
+  r.setHeader(MSG_CHALLENGE_RSP, in.serialId());
+  r.setTx(s->txCounter);
+  r.setRx(nodeTx);
+  memcpy(r.nonce(), in.nonce(), WIRE_NONCE_LEN);
+  hmac(s->key, r.data(), r.SIGNED_LEN, r.hmac());
+  ev.replyLen = r.LEN;
+
+  return HUB_OK;
+}
+
+// Answer to a buildChallenge(): the node reports its TX counter
+HubStatus HubEngine::completeChallengeResponse(const uint8_t* p, HubEvent& ev) {
+  HubSession* s = ev.session;
+  ChallengeFrame<const uint8_t> in(p);
+
+  if (!(s->flags & HUB_SESSION_CHALLENGED) ||
+      memcmp(in.nonce(), s->challengeNonce, WIRE_NONCE_LEN) != 0) {
+    return HUB_BAD_NONCE;
+  }
+
+  s->rxExpected = in.tx();
+  s->flags = (s->flags & ~HUB_SESSION_CHALLENGED) | HUB_SESSION_SYNCED;
+  return HUB_OK;
+}
+
+HubStatus HubEngine::completeData(const uint8_t* p, size_t len, HubEvent& ev) {
+  HubSession* s = ev.session;
+  SecureFrame<const uint8_t> frame(p, len);  // valid() in locate()
+
+  uint32_t counter = frame.counter();
+  ev.counter = counter;
+  if (counter < s->rxExpected) return HUB_REPLAY;
+
+  size_t ciphertextLen = frame.ciphertextLen();
+  uint8_t origLen = frame.origLen();
+
+  uint8_t chain[WIRE_BLOCK_LEN];
+  iv(frame.serialId(), counter, frame.nonce(), chain);
+
+  const uint8_t* ciphertext = frame.ciphertext();
+  uint8_t* plaintext = (uint8_t*)ev.text;
+
+  aes_.setKey(s->key, 16);
+  for (size_t i = 0; i < ciphertextLen; i += WIRE_BLOCK_LEN) {
+    aes_.decryptBlock(plaintext + i, ciphertext + i);
+    for (int j = 0; j < WIRE_BLOCK_LEN; j++) plaintext[i + j] ^= chain[j];
+    memcpy(chain, ciphertext + i, WIRE_BLOCK_LEN);
+  }
+
+  // 0x80 then zeros, at least one byte
+  uint8_t bad = plaintext[origLen] ^ 0x80;
+  for (size_t i = origLen + 1; i < ciphertextLen; i++) bad |= plaintext[i];
+  if (bad) return HUB_MALFORMED;
+
+  s->rxExpected = counter + 1;
+  ev.text[origLen] = 0;
+  ev.textLen = origLen;
+  return HUB_OK;
+}
+
+// Same counter sequence as MSG_DATA, nothing to decrypt
+HubStatus HubEngine::completeDiag(const uint8_t* p, HubEvent& ev) {
+  HubSession* s = ev.session;
+  DiagFrame<const uint8_t> frame(p);
+
+  uint32_t counter = frame.counter();
+  ev.counter = counter;
+  if (counter < s->rxExpected) return HUB_REPLAY;
+
+  s->rxExpected = counter + 1;
+  ev.diag = frame.payload();
+  return HUB_OK;
+}
+
+// Same counter sequence as MSG_DATA
+HubStatus HubEngine::completeOtaStatus(const uint8_t* p, HubEvent& ev) {
+  HubSession* s = ev.session;
+  OtaStatusFrame<const uint8_t> frame(p);
+
+  uint32_t counter = frame.counter();
+  ev.counter = counter;
+  if (counter < s->rxExpected) return HUB_REPLAY;
+
+  s->rxExpected = counter + 1;
+  ev.otaUpdateId = frame.updateId();
+  ev.otaState = frame.state();
+  ev.otaNext = frame.next();
+  return HUB_OK;
+}
+
+// An offer takes a node counter like MSG_DATA; fragments and acks carry
+// the counter of the offer they belong to
+HubStatus HubEngine::completeBulk(const uint8_t* p, size_t len, HubEvent& ev) {
+  HubSession* s = ev.session;
+
+  if (p[0] == MSG_BULK_OFFER_UP) {
+    uint32_t counter = BulkOfferFrame<const uint8_t>(p).counter();
+    ev.counter = counter;
+    if (counter < s->rxExpected) return HUB_REPLAY;
+    s->rxExpected = counter + 1;
+  } else if (p[0] == MSG_BULK_FRAGMENT_UP) {
+    ev.counter = BulkFragmentFrame<const uint8_t>(p, len).counter();
+  } else {
+    ev.counter = BulkAckFrame<const uint8_t>(p).counter();
+  }
+
+  ev.bulk = p;
+  ev.bulkLen = len;
+  return HUB_OK;
+}
+
+bool decodeDiag(const uint8_t* p, HubDiag& out) {
+  if (p[DIAG_OFF_VERSION] != DIAG_VERSION) return false;
+
+  for (int i = 0; i < DIAG_STATS; i++) {
+    out.stats[i] = p[DIAG_OFF_STATS + 2 * i] | (p[DIAG_OFF_STATS + 2 * i + 1] << 8);
+  }
+  memcpy(out.rssi, p + DIAG_OFF_RSSI, DIAG_HIST_BINS);
+  memcpy(out.snr, p + DIAG_OFF_SNR, DIAG_HIST_BINS);
+  out.worstLoopMs = p[DIAG_OFF_WORST_LOOP] | (p[DIAG_OFF_WORST_LOOP + 1] << 8);
+  out.worstTriggerUs = p[DIAG_OFF_WORST_TRIGGER] | (p[DIAG_OFF_WORST_TRIGGER + 1] << 8);
+  return true;
+}
+
+size_t HubEngine::seal(uint8_t type, const uint8_t* id, const uint8_t* key, uint32_t counter,
+                       const uint8_t* plaintext, size_t len, const uint8_t* nonce, uint8_t* out) {
+  if (SecureFrame<uint8_t>::lenFor(len) > HUB_FRAME_MAX) return 0;
+  SecureFrame<uint8_t> frame(out, SecureFrame<uint8_t>::lenFor(len));
+  size_t paddedLen = frame.ciphertextLen();
+
+  frame.setHeader(type, id);
+  frame.setCounter(counter);
+  memcpy(frame.nonce(), nonce, WIRE_NONCE_LEN);
+  frame.setOrigLen(len);
+
+  uint8_t chain[WIRE_BLOCK_LEN];
+  iv(id, counter, nonce, chain);
+
+  uint8_t* ciphertext = frame.ciphertext();
+  aes_.setKey(key, 16);
+  for (size_t i = 0; i < paddedLen; i += WIRE_BLOCK_LEN) {
+    uint8_t block[WIRE_BLOCK_LEN];
+    for (int j = 0; j < WIRE_BLOCK_LEN; j++) {
+      size_t k = i + j;
+      uint8_t b = k < len ? plaintext[k] : (k == len ? 0x80 : 0x00);
+      block[j] = b ^ chain[j];
+    }
+    aes_.encryptBlock(ciphertext + i, block);
+    memcpy(chain, ciphertext + i, WIRE_BLOCK_LEN);
+  }
+
+  hmac(key, out, frame.signedLen(), frame.hmac());
+  return frame.len();
+}
+
+size_t HubEngine::buildCommand(HubSession& s, const char* cmd, size_t len,
+                               const uint8_t* nonce, uint8_t* out) {
+  if (SecureFrame<uint8_t>::lenFor(len) > HUB_FRAME_MAX) return 0;
+  return seal(MSG_COMMAND, s.serialId, s.key, s.txCounter++, (const uint8_t*)cmd, len, nonce, out);
+}
+
+size_t HubEngine::buildGroupJoin(HubSession& s, const HubGroup& g, const uint8_t* nonce,
+                                 uint8_t* out) {
+  uint8_t join[WIRE_GROUP_JOIN_LEN];
+  memcpy(join + WIRE_GROUP_JOIN_ID, g.id, WIRE_ID_LEN);
+  memcpy(join + WIRE_GROUP_JOIN_KEY, g.key, 16);
+  wireWriteU32(join + WIRE_GROUP_JOIN_COUNTER, g.txCounter);
+
+  size_t len = seal(MSG_GROUP_JOIN, s.serialId, s.key, s.txCounter++, join, sizeof(join),
+                    nonce, out);
+  memset(join, 0, sizeof(join));
+  return len;
+}
+
+size_t HubEngine::buildGroupCommand(HubGroup& g, const char* cmd, size_t len,
+                                    const uint8_t* nonce, uint8_t* out) {
+  if (SecureFrame<uint8_t>::lenFor(len) > HUB_FRAME_MAX) return 0;
+  return seal(MSG_GROUP_COMMAND, g.id, g.key, g.txCounter++, (const uint8_t*)cmd, len, nonce, out);
+}
+
+size_t HubEngine::trigger(const uint8_t* id, const uint8_t* key, uint32_t counter,
+                          uint8_t action, uint8_t* out) {
+  TriggerFrame<uint8_t> frame(out);
+  frame.setHeader(MSG_TRIGGER, id);
+  frame.setCounter(counter);
+  frame.setAction(action);
+
+  uint8_t block[WIRE_BLOCK_LEN];
+  frame.sign(aes_, key, block);
+  return frame.LEN;
+}
+
+size_t HubEngine::buildTrigger(HubSession& s, uint8_t action, uint8_t* out) {
+  return trigger(s.serialId, s.key, s.txCounter++, action, out);
+}
+
+size_t HubEngine::buildGroupTrigger(HubGroup& g, uint8_t action, uint8_t* out) {
+  return trigger(g.id, g.key, g.txCounter++, action, out);
+}
+
+size_t HubEngine::buildChallenge(HubSession& s, const uint8_t* nonce, uint8_t* out) {
+  ChallengeFrame<uint8_t> frame(out);
+  frame.setHeader(MSG_CHALLENGE, s.serialId);
+  frame.setTx(s.txCounter);
+  frame.setRx(s.rxExpected);
+  memcpy(frame.nonce(), nonce, WIRE_NONCE_LEN);
+  hmac(s.key, out, frame.SIGNED_LEN, frame.hmac());
+
+  memcpy(s.challengeNonce, nonce, WIRE_NONCE_LEN);
+  s.flags |= HUB_SESSION_CHALLENGED;
+  return frame.LEN;
+}
+
+size_t HubEngine::buildDiscoveryAck(const uint8_t* serialId, uint8_t* out) {
+  DiscoveryFrame<uint8_t> frame(out);
+  frame.setHeader(MSG_DISCOVERY_ACK, serialId);
+  return frame.LEN;
+}
+
+size_t HubEngine::buildRetry(const uint8_t* serialId, uint16_t waitMs, uint8_t* out) {
+  RetryFrame<uint8_t> frame(out);
+  frame.setHeader(MSG_RETRY, serialId);
+  frame.setWaitMs(waitMs);
+  return frame.LEN;
+}
+
+size_t HubEngine::buildBeacon(uint16_t seq, uint16_t periodMs, uint8_t flags, uint8_t* out) {
+  BeaconFrame<uint8_t> frame(out);
+  out[0] = MSG_BEACON;
+  frame.setSeq(seq);
+  frame.setPeriod(periodMs);
+  frame.setFlags(flags);
+  return frame.LEN;
+}
+
+size_t HubEngine::buildResync(uint32_t epoch, const uint8_t* hubPrivKey, uint8_t* out) {
+  ResyncFrame<uint8_t> frame(out);
+  out[0] = MSG_RESYNC;
+  frame.setEpoch(epoch);
+
+  uint8_t hash[32];
+  sha_.reset();
+  sha_.update(out, frame.SIGNED_LEN);
+  sha_.finalize(hash, sizeof(hash));
+  if (!uECC_sign(hubPrivKey, hash, sizeof(hash), frame.signature(), uECC_secp160r1())) return 0;
+  return frame.LEN;
+}
+
+void HubEngine::resync(HubSession& s, const uint8_t* adoptionKey, uint32_t epoch) {
+  if (s.epoch >= epoch) return;
+
+  uint8_t in[WIRE_RESYNC_SIGNED_LEN];
+  in[0] = MSG_RESYNC;
+  wireWriteU32(in + WIRE_RESYNC_EPOCH, epoch);
+
+  uint8_t mac[WIRE_HMAC_LEN];
+  hmac(adoptionKey, in, sizeof(in), mac);
+  memcpy(s.key, mac, 16);
+
+  s.epoch = epoch;
+  s.txCounter = 0;
+  s.rxExpected = 0;
+  s.flags = HUB_SESSION_SYNCED;
+}
+
+size_t HubEngine::buildOtaOffer(HubSession& s, const OtaUpdate& u, uint8_t* out) {
+  OtaOfferFrame<uint8_t> frame(out);
+  frame.setHeader(MSG_OTA_OFFER, s.serialId);
+  frame.setCounter(s.txCounter++);
+  frame.setUpdateId(u.id);
+  frame.setBaseCrc(u.baseCrc);
+  frame.setImageLen(u.imageLen);
+  frame.setDeltaLen(u.delta.size());
+  memcpy(frame.signature(), u.signature, WIRE_SIGNATURE_LEN);
+  hmac(s.key, out, frame.SIGNED_LEN, frame.hmac());
+  return frame.LEN;
+}
+
+size_t HubEngine::buildOtaChunk(HubSession& s, const OtaUpdate& u, uint16_t offset, uint8_t* out) {
+  if (offset >= u.delta.size()) return 0;
+  size_t n = u.delta.size() - offset;
+  if (n > WIRE_OTA_CHUNK_MAX) n = WIRE_OTA_CHUNK_MAX;
+
+  OtaChunkFrame<uint8_t> frame(out, OtaChunkFrame<uint8_t>::lenFor(n));
+  frame.setHeader(MSG_OTA_CHUNK, s.serialId);
+  frame.setUpdateId(u.id);
+  frame.setOffset(offset);
+  memcpy(frame.delta(), u.delta.data() + offset, n);
+  hmac(s.key, out, frame.signedLen(), frame.hmac());
+  return frame.len();
+}
+
+size_t HubEngine::buildBulkOffer(HubSession& s, BulkSender& t, uint8_t* out) {
+  uint8_t chain[WIRE_BLOCK_LEN];
+  uint8_t block[WIRE_BLOCK_LEN];
+  t.seal(aes_, s.key, s.serialId, s.txCounter++, chain, block);
+
+  BulkOfferFrame<uint8_t> frame(out);
+  frame.setHeader(MSG_BULK_OFFER, s.serialId);
+  t.offer(frame);
+  hmac(s.key, out, frame.SIGNED_LEN, frame.hmac());
+  return frame.LEN;
+}
+
+size_t HubEngine::buildBulkFragment(HubSession& s, const BulkSender& t, uint8_t index,
+                                    uint8_t* out) {
+  BulkFragmentFrame<uint8_t> frame(out, BulkFragmentFrame<uint8_t>::lenFor(t.fragmentLen(index)));
+  frame.setHeader(MSG_BULK_FRAGMENT, s.serialId);
+  t.fragment(frame, index);
+  hmac(s.key, out, frame.signedLen(), frame.hmac());
+  return frame.len();
+}
+
+size_t HubEngine::buildBulkAck(HubSession& s, uint32_t counter, uint8_t state, uint16_t received,
+                               uint8_t* out) {
+  BulkAckFrame<uint8_t> frame(out);
+  frame.setHeader(MSG_BULK_ACK, s.serialId);
+  frame.setCounter(counter);
+  frame.setState(state);
+  frame.setReceived(received);
+  hmac(s.key, out, frame.SIGNED_LEN, frame.hmac());
+  return frame.LEN;
+}
+
+HubStatus HubEngine::adopt(const uint8_t* serialId, const uint8_t* nodePubKey,
+                           const uint8_t* hubPrivKey, const uint8_t* hubPubKey, uint32_t epoch,
+                           uint8_t* out, size_t& outLen, HubSession** session) {
+  outLen = 0;
+
+  uint8_t secret[20];
+  if (!uECC_shared_secret(nodePubKey, hubPrivKey, secret, uECC_secp160r1())) {
+    return HUB_CRYPTO_FAIL;
+  }
+
+  // Same XOR fold as the node
+  uint8_t key[16];
+  for (int i = 0; i < 16; i++) key[i] = secret[i] ^ secret[(i + 4) % 20];
+  memset(secret, 0, sizeof(secret));
+
+  HubSession* s = sessions_.insert(serialId);
+  if (!s) return HUB_TABLE_FULL;
+
+  // A re-adopted node starts over with fresh counters
+  memcpy(s->key, key, 16);
+  s->txCounter = 0;
+  s->rxExpected = 0;
+  s->flags = 0;
+  s->epoch = epoch;
+  if (session) *session = s;
+
+  AdoptResponseFrame<uint8_t> frame(out);
+  frame.setHeader(MSG_ADOPT_RSP, serialId);
+  frame.setStatus(1);
+  memcpy(frame.hubPubKey(), hubPubKey, WIRE_PUBKEY_LEN);
+  frame.setEpoch(epoch);
+  outLen = frame.LEN;
+  return HUB_OK;
+}
+
+size_t HubEngine::buildAdoptReject(const uint8_t* serialId, uint8_t* out) {
+  AdoptResponseFrame<uint8_t> frame(out);
+  frame.setHeader(MSG_ADOPT_RSP, serialId);
+  frame.setStatus(0);
+  memset(frame.hubPubKey(), 0, WIRE_PUBKEY_LEN);
+  frame.setEpoch(0);
+  return frame.LEN;
+}
@@ -0,0 +1,211 @@
+#pragma once
+
+// Hub side of the node protocol: the counterpart of NodeCore.
+//
+// Parses and verifies node frames, decrypts MSG_DATA, answers node
+// challenges, and builds commands, hub challenges, discovery ACKs,
+// adoption responses, retry hints, firmware update frames, multicast
+// group commands, siren triggers, beacons, key epochs and bulk transfer
+// frames. Sessions live in a SessionTable owned by the caller. The wire
+// format is documented in NodeWire.h.
+//
+// Sessions hold the key for their epoch. The adoption key every epoch's
+// key is derived from is the caller's to store, with the current epoch,
+// next to the session table.
+//
+// The engine does no I/O and keeps no clock. Nonces and beacon timing come
+// from the caller, who also decides what to do with discovery and adoption
+// requests. One engine is not thread safe; give each gateway thread its
+// own.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <AES.h>
+#include <SHA256.h>
+#include <NodeWire.h>
+#include <NodeFrame.h>
+#include <NodeBulk.h>
+
+#include <vector>
+
+#include "HmacBatch.h"
+#include "OtaDelta.h"
+#include "SessionTable.h"
+
+#define HUB_FRAME_MAX 255
+#define HUB_TEXT_MAX (HUB_FRAME_MAX - WIRE_SECURE_HEADER_LEN - WIRE_HMAC_LEN)
+
+enum HubStatus : uint8_t {
+  HUB_OK,
+  HUB_MALFORMED,      // Wrong length, unknown type or bad padding
+  HUB_UNKNOWN_NODE,   // No session for the SERIAL_ID
+  HUB_BAD_HMAC,
+  HUB_REPLAY,         // Counter below the expected one
+  HUB_BAD_NONCE,      // Challenge response to no or another challenge
+  HUB_TABLE_FULL,
+  HUB_CRYPTO_FAIL,    // ECDH failed
+};
+
+// Result of receive()
+struct HubEvent {
+  uint8_t type;                 // MSG_* of the frame
+  const uint8_t* serialId;      // Into the frame
+  HubSession* session;          // nullptr for discovery and adoption requests
+  const uint8_t* pubKey;        // MSG_ADOPT_REQ: node public key, into the frame
+
+  uint32_t counter;             // MSG_DATA, MSG_BULK_*_UP
+  char text[HUB_TEXT_MAX + 1];  // MSG_DATA: plaintext, NUL terminated
+  uint8_t textLen;
+
+  uint8_t reply[WIRE_CHALLENGE_LEN];  // MSG_CHALLENGE: response to send
+  uint8_t replyLen;
+
+  const uint8_t* diag;          // MSG_DIAG: payload, into the frame
+
+  uint16_t otaUpdateId;         // MSG_OTA_STATUS
+  uint8_t otaState;             // OTA_* from NodeWire.h
+  uint16_t otaNext;
+
+  const uint8_t* bulk;          // MSG_BULK_*_UP: the frame, for BulkReceiver
+  size_t bulkLen;               // or BulkTransfer
+};
+
+// A multicast group, kept by the caller like the session table. The
+// caller picks the ID and key at random; see NodeWire.h.
+struct HubGroup {
+  uint8_t id[WIRE_ID_LEN];
+  uint8_t key[16];
+  uint32_t txCounter;           // Next counter for group commands
+};
+
+// Decoded MSG_DIAG payload, see NodeWire.h
+struct HubDiag {
+  uint16_t stats[DIAG_STATS];   // Indexed by DIAG_RX_* / DIAG_TX_*
+  uint8_t rssi[DIAG_HIST_BINS];
+  uint8_t snr[DIAG_HIST_BINS];
+  uint16_t worstLoopMs;
+  uint16_t worstTriggerUs;
+};
+
+// False for a payload version this hub does not know
+bool decodeDiag(const uint8_t* payload, HubDiag& out);
+
+class HubEngine {
+public:
+  explicit HubEngine(SessionTable& sessions) : sessions_(sessions) {}
+
+  SessionTable& sessions() { return sessions_; }
+
+  // Register an adopted node, e.g. when loading sessions from storage.
+  // key is the session key for epoch.
+  HubSession* addSession(const uint8_t* serialId, const uint8_t* key, uint32_t epoch = 0);
+
+  HubStatus receive(const uint8_t* frame, size_t len, HubEvent& ev);
+
+  // receive() for a burst of frames, with every HMAC verified in one
+  // verifyHmacBatch() call. Frames are otherwise handled in order, so the
+  // result is the same as calling receive() on each.
+  void receiveBatch(const uint8_t* const* frames, const size_t* lens, size_t n,
+                    HubEvent* events, HubStatus* status);
+
+  // Encrypted MSG_COMMAND. Returns the frame length, 0 if cmd is too long.
+  size_t buildCommand(HubSession& s, const char* cmd, size_t len,
+                      const uint8_t* nonce, uint8_t* out);
+
+  // MSG_GROUP_JOIN: g's ID, key and next counter for one member, sealed
+  // like a command under its session key
+  size_t buildGroupJoin(HubSession& s, const HubGroup& g, const uint8_t* nonce, uint8_t* out);
+
+  // MSG_GROUP_COMMAND: one frame every member of g accepts. Returns the
+  // frame length, 0 if cmd is too long.
+  size_t buildGroupCommand(HubGroup& g, const char* cmd, size_t len,
+                           const uint8_t* nonce, uint8_t* out);
+
+  // MSG_TRIGGER for one node or a whole group, on the same counter as
+  // their commands. action is TRIGGER_ON or TRIGGER_OFF.
+  size_t buildTrigger(HubSession& s, uint8_t action, uint8_t* out);
+  size_t buildGroupTrigger(HubGroup& g, uint8_t action, uint8_t* out);
+
+  // Hub-initiated counter sync. The node answers with MSG_CHALLENGE_RSP.
+  size_t buildChallenge(HubSession& s, const uint8_t* nonce, uint8_t* out);
+
+  size_t buildDiscoveryAck(const uint8_t* serialId, uint8_t* out);
+
+  // MSG_RETRY: ask a node to repeat its discovery, challenge or adoption
+  // request after waitMs instead of answering it now
+  size_t buildRetry(const uint8_t* serialId, uint16_t waitMs, uint8_t* out);
+
+  // MSG_BEACON for every node, every periodMs with seq counting up. flags
+  // is BEACON_PENDING when frames held for sleeping nodes follow it.
+  size_t buildBeacon(uint16_t seq, uint16_t periodMs, uint8_t flags, uint8_t* out);
+
+  // MSG_RESYNC for every node, signed with the hub's adoption key pair;
+  // uECC_set_rng() must have been called. 0 if signing failed.
+  size_t buildResync(uint32_t epoch, const uint8_t* hubPrivKey, uint8_t* out);
+
+  // What a node does on that MSG_RESYNC: the session key for epoch from
+  // adoptionKey, counters from zero and in sync. Sessions already at epoch
+  // or past it are left alone.
+  void resync(HubSession& s, const uint8_t* adoptionKey, uint32_t epoch);
+
+  // Firmware update announcement, takes a command counter
+  size_t buildOtaOffer(HubSession& s, const OtaUpdate& u, uint8_t* out);
+
+  // Delta bytes from offset, up to WIRE_OTA_CHUNK_MAX. 0 past the end.
+  size_t buildOtaChunk(HubSession& s, const OtaUpdate& u, uint16_t offset, uint8_t* out);
+
+  // MSG_BULK_OFFER for t under the next command counter, its data sealed
+  // again under that counter
+  size_t buildBulkOffer(HubSession& s, BulkSender& t, uint8_t* out);
+
+  // MSG_BULK_FRAGMENT index of t, as BulkSender::next() gave it
+  size_t buildBulkFragment(HubSession& s, const BulkSender& t, uint8_t index, uint8_t* out);
+
+  // MSG_BULK_ACK for the node's transfer offered under counter
+  size_t buildBulkAck(HubSession& s, uint32_t counter, uint8_t state, uint16_t received,
+                      uint8_t* out);
+
+  // Accept an adoption request: ECDH with the node's public key, derive
+  // the session key and build the MSG_ADOPT_RSP into out. The node joins
+  // the current epoch with the adoption key as its session key.
+  HubStatus adopt(const uint8_t* serialId, const uint8_t* nodePubKey,
+                  const uint8_t* hubPrivKey, const uint8_t* hubPubKey, uint32_t epoch,
+                  uint8_t* out, size_t& outLen, HubSession** session = nullptr);
+
+  size_t buildAdoptReject(const uint8_t* serialId, uint8_t* out);
+
+private:
+  // Shape checks and session lookup. signedLen is the HMAC-covered
+  // length, 0 for frames without an HMAC.
+  HubStatus locate(const uint8_t* p, size_t len, HubEvent& ev, size_t& signedLen);
+
+  // Everything after a good HMAC
+  HubStatus complete(const uint8_t* p, size_t len, HubEvent& ev);
+  HubStatus completeChallenge(const uint8_t* p, HubEvent& ev);
+  HubStatus completeChallengeResponse(const uint8_t* p, HubEvent& ev);
+  HubStatus completeData(const uint8_t* p, size_t len, HubEvent& ev);
+  HubStatus completeDiag(const uint8_t* p, HubEvent& ev);
+  HubStatus completeOtaStatus(const uint8_t* p, HubEvent& ev);
+  HubStatus completeBulk(const uint8_t* p, size_t len, HubEvent& ev);
+
+  // Encrypted and authenticated SecureFrame of any type
+  size_t seal(uint8_t type, const uint8_t* id, const uint8_t* key, uint32_t counter,
+              const uint8_t* plaintext, size_t len, const uint8_t* nonce, uint8_t* out);
+
+  size_t trigger(const uint8_t* id, const uint8_t* key, uint32_t counter, uint8_t action,
+                 uint8_t* out);
+
+  void hmac(const uint8_t* key, const uint8_t* data, size_t len, uint8_t* out);
+  bool verify(const uint8_t* key, const uint8_t* data, size_t len, const uint8_t* mac);
+  void iv(const uint8_t* serialId, uint32_t counter, const uint8_t* nonce, uint8_t* out);
+
+  SessionTable& sessions_;
+  SHA256 sha_;
+  AES128 aes_;
+
+  // receiveBatch() work lists, kept to avoid reallocating per burst
+  std::vector<HmacJob> jobs_;
+  std::vector<size_t> jobIndex_;
+  std::vector<uint8_t> verified_;
+};
@@ -0,0 +1,155 @@
+#include "OtaDelta.h"
+
+#include <string.h>
+
+#include <SHA256.h>
+#include <uECC.h>
+#include <NodeDelta.h>
+#include <NodeOtaBoot.h>
+
+#define HASH_BITS 14
+#define CHAIN_MAX 32  // Candidates tried per position
+
+uint32_t otaCrc(const uint8_t* p, size_t len) {
+  uint32_t crc = OTA_CRC_INIT;
+  for (size_t i = 0; i < len; i++) crc = otaCrc32(crc, p[i]);
+  return otaCrcFinish(crc);
+}
+
+static uint32_t hash4(const uint8_t* p) {
+  uint32_t v = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+  return (v * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static void flushLiterals(std::vector<uint8_t>& out, const uint8_t* p, size_t n) {
+  while (n) {
+    size_t take = n < DELTA_LITERAL_MAX ? n : DELTA_LITERAL_MAX;
+    out.push_back(DELTA_LITERAL | (take - 1));
+    out.insert(out.end(), p, p + take);
+    p += take;
+    n -= take;
+  }
+}
+
+std::vector<uint8_t> otaEncodeDelta(const uint8_t* base, size_t baseLen,
+                                    const uint8_t* image, size_t imageLen) {
+  // Base positions by the hash of their next 4 bytes, newest first
+  std::vector<int32_t> head(1 << HASH_BITS, -1);
+  std::vector<int32_t> chain(baseLen, -1);
+  for (size_t i = 0; i + DELTA_COPY_MIN <= baseLen; i++) {
+    uint32_t h = hash4(base + i);
+    chain[i] = head[h];
+    head[h] = i;
+  }
+
+  std::vector<uint8_t> out;
+  size_t literal = 0;  // Start of pending literal bytes
+  size_t pos = 0;
+
+  while (pos < imageLen) {
+    size_t left = imageLen - pos;
+
+    size_t copyLen = 0, copyFrom = 0;
+    if (left >= DELTA_COPY_MIN) {
+      size_t max = left < DELTA_COPY_MAX ? left : DELTA_COPY_MAX;
+      int tries = 0;
+      for (int32_t c = head[hash4(image + pos)]; c >= 0 && tries < CHAIN_MAX;
+           c = chain[c], tries++) {
+        size_t n = 0;
+        while (n < max && c + n < baseLen && base[c + n] == image[pos + n]) n++;
+        if (n > copyLen) {
+          copyLen = n;
+          copyFrom = c;
+        }
+      }
+    }
+
+    size_t run = 1;
+    while (run < left && run < DELTA_FILL_MAX && image[pos + run] == image[pos]) run++;
+
+    if (copyLen >= DELTA_COPY_MIN && copyLen >= run && copyFrom <= 0xFFFF) {
+      flushLiterals(out, image + literal, pos - literal);
+      size_t n = copyLen - DELTA_COPY_MIN;
+      out.push_back(DELTA_COPY | (n >> 8));
+      out.push_back(n);
+      out.push_back(copyFrom);
+      out.push_back(copyFrom >> 8);
+      pos += copyLen;
+      literal = pos;
+    } else if (run >= DELTA_FILL_MIN) {
+      flushLiterals(out, image + literal, pos - literal);
+      out.push_back(DELTA_FILL | (run - DELTA_FILL_MIN));
+      out.push_back(image[pos]);
+      pos += run;
+      literal = pos;
+    } else {
+      pos++;
+    }
+  }
+
+  flushLiterals(out, image + literal, pos - literal);
+  return out;
+}
+
+namespace {
+
+struct VectorSink {
+  const uint8_t* base;
+  size_t baseLen;
+  size_t imageLen;
+  std::vector<uint8_t>& out;
+
+  bool literal(const uint8_t* p, uint16_t len) {
+    if (len > imageLen - out.size()) return false;
+    out.insert(out.end(), p, p + len);
+    return true;
+  }
+
+  bool copy(uint16_t from, uint16_t len) {
+    if (len > imageLen - out.size() || from > baseLen || len > baseLen - from) return false;
+    out.insert(out.end(), base + from, base + from + len);
+    return true;
+  }
+
+  bool fill(uint8_t b, uint16_t len) {
+    if (len > imageLen - out.size()) return false;
+    out.insert(out.end(), len, b);
+    return true;
+  }
+};
+
+}  // namespace
+
+bool otaApplyDelta(const uint8_t* base, size_t baseLen, const uint8_t* delta,
+                   size_t deltaLen, size_t imageLen, std::vector<uint8_t>& out) {
+  out.clear();
+  VectorSink sink{base, baseLen, imageLen, out};
+  OtaDeltaDecoder decoder;
+  return decoder.feed(delta, deltaLen, sink) && decoder.idle() && out.size() == imageLen;
+}
+
+bool otaPrepare(uint16_t id, const uint8_t* base, size_t baseLen,
+                const uint8_t* image, size_t imageLen,
+                const uint8_t* signingKey, OtaUpdate& out) {
+  if (id == OTA_FACTORY_ID) return false;
+  if (baseLen > OTA_IMAGE_MAX || imageLen == 0 || imageLen > OTA_IMAGE_MAX) return false;
+
+  out.id = id;
+  out.baseCrc = otaCrc(base, baseLen);
+  out.imageLen = imageLen;
+  out.delta = otaEncodeDelta(base, baseLen, image, imageLen);
+
+  // Offsets and lengths on the air are uint16
+  std::vector<uint8_t> check;
+  if (out.delta.size() > 0xFFFF ||
+      !otaApplyDelta(base, baseLen, out.delta.data(), out.delta.size(), imageLen, check) ||
+      memcmp(check.data(), image, imageLen) != 0) {
+    return false;
+  }
+
+  uint8_t hash[32];
+  SHA256 sha;
+  sha.update(image, imageLen);
+  sha.finalize(hash, sizeof(hash));
+  return uECC_sign(signingKey, hash, sizeof(hash), out.signature, uECC_secp160r1());
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+// Building firmware updates for MSG_OTA_OFFER / MSG_OTA_CHUNK.
+//
+// otaEncodeDelta() turns a new image into the NodeDelta.h operation
+// stream against the image the nodes run now. otaPrepare() adds what the
+// offer carries: the base CRC the node checks before accepting, and the
+// vendor's secp160r1 signature over SHA-256 of the new image, which the
+// node checks against its built-in key before handing the image to the
+// bootloader. tools/ota/ota.py does the same offline.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <NodeWire.h>
+
+#include <vector>
+
+struct OtaUpdate {
+  uint16_t id;                              // Never OTA_FACTORY_ID
+  uint32_t baseCrc;
+  uint16_t imageLen;
+  uint8_t signature[WIRE_SIGNATURE_LEN];
+  std::vector<uint8_t> delta;
+};
+
+// CRC-32 as otaCrc32() on the node
+uint32_t otaCrc(const uint8_t* p, size_t len);
+
+// Greedy: at each position the longest COPY from the base (4-byte hash
+// chains), a FILL for runs, otherwise literal bytes
+std::vector<uint8_t> otaEncodeDelta(const uint8_t* base, size_t baseLen,
+                                    const uint8_t* image, size_t imageLen);
+
+// Reference decoder, with the node's bounds. False if the delta is
+// malformed or does not produce exactly imageLen bytes.
+bool otaApplyDelta(const uint8_t* base, size_t baseLen, const uint8_t* delta,
+                   size_t deltaLen, size_t imageLen, std::vector<uint8_t>& out);
+
+// Delta, CRC and signature in one. signingKey is the 21 byte secp160r1
+// private key; uECC_set_rng() must have been called. False if id is
+// OTA_FACTORY_ID, an image is too large, the delta does not round-trip or
+// signing fails.
+bool otaPrepare(uint16_t id, const uint8_t* base, size_t baseLen,
+                const uint8_t* image, size_t imageLen,
+                const uint8_t* signingKey, OtaUpdate& out);
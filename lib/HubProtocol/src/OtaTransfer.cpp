@@ -0,0 +1,70 @@
+#include "OtaTransfer.h"
+
+size_t OtaTransfer::windowEnd() const {
+  size_t end = acked_ + OTA_WINDOW * WIRE_OTA_CHUNK_MAX;
+  return end < update_.delta.size() ? end : update_.delta.size();
+}
+
+size_t OtaTransfer::poll(uint32_t nowMs, uint8_t* out) {
+  switch (phase_) {
+    case OTA_PHASE_OFFERING:
+    case OTA_PHASE_BOOTING:
+      if (!due(nowMs)) return 0;
+      if (retries_++ >= OTA_RETRIES) {
+        phase_ = OTA_PHASE_FAILED;
+        return 0;
+      }
+      deadline_ = nowMs + retryMs_;
+      return engine_.buildOtaOffer(session_, update_, out);
+
+    case OTA_PHASE_SENDING: {
+      if (sent_ >= windowEnd()) {
+        if (!due(nowMs)) return 0;
+        if (retries_++ >= OTA_RETRIES) {
+          phase_ = OTA_PHASE_FAILED;
+          return 0;
+        }
+        sent_ = acked_;  // Go back to what the node last confirmed
+      }
+
+      size_t len = engine_.buildOtaChunk(session_, update_, sent_, out);
+      sent_ += OtaChunkFrame<uint8_t>(out, len).deltaLen();
+      if (sent_ >= windowEnd()) deadline_ = nowMs + retryMs_;
+      return len;
+    }
+
+    default:
+      return 0;
+  }
+}
+
+void OtaTransfer::onStatus(const HubEvent& ev, uint32_t nowMs) {
+  if (ev.otaUpdateId != update_.id || finished()) return;
+  result_ = ev.otaState;
+
+  switch (ev.otaState) {
+    case OTA_READY:
+    case OTA_PROGRESS:
+      if (phase_ == OTA_PHASE_BOOTING) return;  // Late report from before the reboot
+      phase_ = OTA_PHASE_SENDING;
+      if (ev.otaNext > update_.delta.size()) return;
+      acked_ = ev.otaNext;
+      sent_ = ev.otaNext;
+      retries_ = 0;
+      break;
+
+    case OTA_STAGED:
+      phase_ = OTA_PHASE_BOOTING;
+      retries_ = 0;
+      deadline_ = nowMs + OTA_BOOT_WAIT_MS;
+      break;
+
+    case OTA_CONFIRMED:
+      phase_ = OTA_PHASE_DONE;
+      break;
+
+    default:  // Rolled back, wrong base, bad image, no store
+      phase_ = OTA_PHASE_FAILED;
+      break;
+  }
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+// One node's firmware update as the hub drives it: the offer, the delta a
+// window at a time, then the reboot and the node's confirmation.
+//
+// Go-back-N: the hub sends OTA_WINDOW chunks from the last offset the node
+// reported and waits for its MSG_OTA_STATUS. A report moves the window to
+// the node's next offset. Without one within retryMs the window goes out
+// again from the old offset, and the node's report on the repeats tells
+// the hub where it really is. After OTA_RETRIES silent windows in a row
+// the transfer fails.
+//
+// Like HubEngine it does no I/O and keeps no clock: the caller polls it
+// for frames whenever it may transmit (that is where duty-cycle pacing
+// goes) and feeds it the node's status events.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "HubEngine.h"
+#include "OtaDelta.h"
+
+#define OTA_RETRIES 8
+#define OTA_BOOT_WAIT_MS 120000UL  // Node reboot and counter sync before asking again
+
+enum OtaPhase : uint8_t {
+  OTA_PHASE_OFFERING,
+  OTA_PHASE_SENDING,
+  OTA_PHASE_BOOTING,   // Staged, waiting for OTA_CONFIRMED or OTA_ROLLED_BACK
+  OTA_PHASE_DONE,      // Node runs the update
+  OTA_PHASE_FAILED,    // See result()
+};
+
+class OtaTransfer {
+public:
+  OtaTransfer(HubEngine& engine, HubSession& session, const OtaUpdate& update,
+              uint32_t retryMs)
+    : engine_(engine), session_(session), update_(update), retryMs_(retryMs) {}
+
+  OtaPhase phase() const { return phase_; }
+  bool finished() const { return phase_ == OTA_PHASE_DONE || phase_ == OTA_PHASE_FAILED; }
+
+  // Last state the node reported, OTA_* from NodeWire.h
+  uint8_t result() const { return result_; }
+
+  HubSession& session() const { return session_; }
+
+  // Next frame to put on the air, 0 if none is due at nowMs
+  size_t poll(uint32_t nowMs, uint8_t* out);
+
+  // MSG_OTA_STATUS from this node
+  void onStatus(const HubEvent& ev, uint32_t nowMs);
+
+private:
+  bool due(uint32_t nowMs) const { return (int32_t)(nowMs - deadline_) >= 0; }
+  size_t windowEnd() const;
+
+  HubEngine& engine_;
+  HubSession& session_;
+  const OtaUpdate& update_;
+  uint32_t retryMs_;
+
+  OtaPhase phase_ = OTA_PHASE_OFFERING;
+  uint8_t result_ = OTA_READY;
+  uint8_t retries_ = 0;
+  uint32_t deadline_ = 0;
+  uint16_t acked_ = 0;  // The node has every delta byte before this
+  uint16_t sent_ = 0;   // Next chunk offset in the current window
+};
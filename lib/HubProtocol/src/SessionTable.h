@@ -0,0 +1,143 @@
+#pragma once
+
+// Per-node hub sessions in an open-addressing hash table keyed by the
+// 16-byte SERIAL_ID.
+//
+// Lookups run on every received frame, so the table is laid out for them:
+//
+//   - one byte per slot in a separate tag array (0 = empty, otherwise
+//     0x80 | top 7 bits of the hash), so a probe scans 64 slots per cache
+//     line and only touches a session whose tag already matches
+//   - sessions are 64 bytes and 64-byte aligned, one cache line each
+//   - linear probing with backward-shift deletion, so there are no
+//     tombstones and probe sequences stay short after churn
+//
+// Capacity is fixed at construction (rounded up to a power of two) and
+// inserts fail once the table is 7/8 full, so memory use is known up
+// front. Pointers returned by find() and insert() stay valid until the
+// entry is erased.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <vector>
+
+#define HUB_SESSION_SYNCED 0x01      // Counters agreed since the node booted
+#define HUB_SESSION_CHALLENGED 0x02  // Hub challenge outstanding
+
+struct alignas(64) HubSession {
+  uint8_t serialId[16];
+  uint8_t key[16];
+  uint32_t txCounter;             // Next counter for frames to the node
+  uint32_t rxExpected;            // Lowest counter accepted from the node
+  uint8_t challengeNonce[8];      // Nonce of the outstanding hub challenge
+  uint8_t flags;
+  uint32_t epoch;                 // Key epoch the session key is for (MSG_RESYNC)
+  void* user;                     // Owner's per-node state
+};
+
+static_assert(sizeof(HubSession) == 64, "HubSession should be one cache line");
+
+class SessionTable {
+public:
+  explicit SessionTable(size_t capacity) {
+    size_t n = 8;
+    while (n < capacity + capacity / 7) n <<= 1;
+    tags_.assign(n, 0);
+    slots_.resize(n);
+    mask_ = n - 1;
+  }
+
+  size_t size() const { return size_; }
+  size_t capacity() const { return (mask_ + 1) - (mask_ + 1) / 8; }
+
+  HubSession* find(const uint8_t* serialId) {
+    uint64_t h = hash(serialId);
+    uint8_t tag = tagOf(h);
+
+    for (size_t i = h & mask_;; i = (i + 1) & mask_) {
+      if (tags_[i] == 0) return nullptr;
+      if (tags_[i] == tag && memcmp(slots_[i].serialId, serialId, 16) == 0) {
+        return &slots_[i];
+      }
+    }
+  }
+
+  // Existing session for serialId, or a new zeroed one. nullptr when full.
+  HubSession* insert(const uint8_t* serialId) {
+    uint64_t h = hash(serialId);
+    uint8_t tag = tagOf(h);
+
+    size_t i = h & mask_;
+    for (;; i = (i + 1) & mask_) {
+      if (tags_[i] == 0) break;
+      if (tags_[i] == tag && memcmp(slots_[i].serialId, serialId, 16) == 0) {
+        return &slots_[i];
+      }
+    }
+
+    if (size_ >= capacity()) return nullptr;
+
+    tags_[i] = tag;
+    memset(&slots_[i], 0, sizeof(HubSession));
+    memcpy(slots_[i].serialId, serialId, 16);
+    size_++;
+    return &slots_[i];
+  }
+
+  bool erase(const uint8_t* serialId) {
+    HubSession* s = find(serialId);
+    if (!s) return false;
+
+    // Shift following entries of the same probe run back into the hole
+    size_t hole = s - slots_.data();
+    for (size_t i = (hole + 1) & mask_; tags_[i] != 0; i = (i + 1) & mask_) {
+      size_t home = hash(slots_[i].serialId) & mask_;
+      if (((i - home) & mask_) >= ((i - hole) & mask_)) {
+        tags_[hole] = tags_[i];
+        slots_[hole] = slots_[i];
+        hole = i;
+      }
+    }
+
+    tags_[hole] = 0;
+    size_--;
+    return true;
+  }
+
+  template <class Fn>
+  void forEach(Fn fn) {
+    for (size_t i = 0; i <= mask_; i++) {
+      if (tags_[i]) fn(slots_[i]);
+    }
+  }
+
+  // Serial IDs are mostly constant bytes with a short varying tail, so
+  // both halves go through a full 64-bit finalizer
+  static uint64_t hash(const uint8_t* serialId) {
+    uint64_t a, b;
+    memcpy(&a, serialId, 8);
+    memcpy(&b, serialId + 8, 8);
+    return mix(a ^ mix(b + 0x9E3779B97F4A7C15ULL));
+  }
+
+private:
+  static uint64_t mix(uint64_t x) {
+    x ^= x >> 33;
+    x *= 0xFF51AFD7ED558CCDULL;
+    x ^= x >> 33;
+    x *= 0xC4CEB9FE1A85EC53ULL;
+    x ^= x >> 33;
+    return x;
+  }
+
+  static uint8_t tagOf(uint64_t h) {
+    return 0x80 | (uint8_t)(h >> 57);
+  }
+
+  std::vector<uint8_t> tags_;
+  std::vector<HubSession> slots_;
+  size_t mask_ = 0;
+  size_t size_ = 0;
+};
@@ -0,0 +1,63 @@
+#pragma once
+
+// Retry schedule for requests the hub may not answer: discovery, the
+// counter sync challenge and adoption.
+//
+// After a site loses power every node boots at the same moment, and fixed
+// intervals from boot keep them retrying in lockstep, colliding every
+// time. So:
+//
+//   - the first try goes out at a random time within a spread after start()
+//   - every try doubles the step, from base up to max, and the wait is
+//     drawn from the upper half of the step ("equal jitter"): nodes drift
+//     apart, none retries sooner than half its step
+//   - a MSG_RETRY from the hub replaces the next wait, capped at max and
+//     stretched by up to a quarter so the nodes it told do not come back
+//     together
+//
+// random() must be seeded per node (NodeCore::begin() does).
+
+#include <Arduino.h>
+
+class Backoff {
+public:
+  Backoff(uint32_t baseMs, uint32_t maxMs) : baseMs_(baseMs), maxMs_(maxMs) {}
+
+  // First try within spreadMs from now
+  void start(unsigned long now, uint32_t spreadMs) {
+    active_ = true;
+    tries_ = 0;
+    at_ = now + random(spreadMs + 1);
+  }
+
+  void stop() { active_ = false; }
+
+  bool active() const { return active_; }
+  uint8_t tries() const { return tries_; }
+
+  bool due(unsigned long now) const { return active_ && (long)(now - at_) >= 0; }
+
+  // A try went out at now
+  void sent(unsigned long now) {
+    uint32_t step = baseMs_;
+    for (uint8_t i = 0; i < tries_ && step < maxMs_; i++) step <<= 1;
+    if (step > maxMs_) step = maxMs_;
+
+    at_ = now + step / 2 + random(step / 2 + 1);
+    if (tries_ < 255) tries_++;
+  }
+
+  // The hub asked for waitMs
+  void hint(unsigned long now, uint32_t waitMs) {
+    if (!active_) return;
+    if (waitMs > maxMs_) waitMs = maxMs_;
+    at_ = now + waitMs + random(waitMs / 4 + 1);
+  }
+
+private:
+  uint32_t baseMs_;
+  uint32_t maxMs_;
+  unsigned long at_ = 0;
+  uint8_t tries_ = 0;
+  bool active_ = false;
+};
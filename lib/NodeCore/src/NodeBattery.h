@@ -0,0 +1,176 @@
+#pragma once
+
+// Battery monitor: samples the divider on its own schedule and serves
+// cached, filtered values to telemetry.
+//
+// One sample = one divider activation, a reference settle and
+// BATTERY_SAMPLES conversions taken in ADC noise reduction sleep. Millivolts
+// are computed in fixed point, percentages come from a PROGMEM discharge
+// curve with linear interpolation, and a slow filter gives a mV/hour trend.
+
+#include <Arduino.h>
+#if defined(__AVR__)
+#include <avr/sleep.h>
+#include <avr/interrupt.h>
+#endif
+
+#include "NodeConfig.h"
+#include "NodeEnergy.h"
+
+#define BATTERY_INTERVAL 60000UL  // ms between samples
+#define BATTERY_SAMPLES 8
+
+// mV = sum * BATTERY_MV_Q16 >> 16 for a sum of BATTERY_SAMPLES 10-bit reads
+// (VREF in volts * 1000, divider scale, averaging, all folded into one
+// constant at compile time)
+#define BATTERY_MV_Q16 ((uint32_t)(VREF * 1000.0 * SCALE * 65536.0 / (1023.0 * BATTERY_SAMPLES) + 0.5))
+
+struct BatteryCurvePoint {
+  uint16_t mV;
+  uint8_t percent;
+};
+
+// Li-ion discharge curve, highest voltage first
+static const BatteryCurvePoint BATTERY_CURVE[] PROGMEM = {
+  {4200, 100},
+  {4100, 90},
+  {4000, 80},
+  {3900, 70},
+  {3800, 60},
+  {3700, 50},
+  {3600, 40},
+  {3500, 30},
+  {3400, 20},
+  {3300, 10},
+  {3200, 5},
+  {3000, 0},
+};
+
+#define BATTERY_CURVE_LEN (sizeof(BATTERY_CURVE) / sizeof(BATTERY_CURVE[0]))
+
+#if defined(__AVR__)
+// Only used to wake the CPU from ADC noise reduction sleep
+EMPTY_INTERRUPT(ADC_vect);
+#endif
+
+inline uint8_t batteryPercentFromMillivolts(uint16_t mV) {
+  BatteryCurvePoint hi, lo;
+  memcpy_P(&hi, &BATTERY_CURVE[0], sizeof(hi));
+  if (mV >= hi.mV) return hi.percent;
+
+  for (uint8_t i = 1; i < BATTERY_CURVE_LEN; i++) {
+    memcpy_P(&lo, &BATTERY_CURVE[i], sizeof(lo));
+    if (mV >= lo.mV) {
+      return lo.percent + (uint8_t)((uint32_t)(mV - lo.mV) * (hi.percent - lo.percent) / (hi.mV - lo.mV));
+    }
+    hi = lo;
+  }
+  return 0;
+}
+
+class BatteryMonitor {
+public:
+  uint16_t millivolts() const { return (filteredQ3_ + 4) >> 3; }
+  uint8_t percent() const { return batteryPercentFromMillivolts(millivolts()); }
+  int16_t trendMvPerHour() const { return trend_; }
+  bool hasSample() const { return sampled_; }
+
+  bool due() const {
+    return !sampled_ || (millis() - lastSample_ >= BATTERY_INTERVAL);
+  }
+
+  // A receiving radio is idled for the conversions themselves (about 1 ms):
+  // an RX edge on DIO0 cannot be latched while the I/O clock is stopped. A
+  // radio in sleep or standby is left there.
+  template <class Radio>
+  void sample(Radio& radio) {
+    lastSample_ = millis();
+
+    // Activate divider by connecting it to ground
+    pinMode(DIV_PIN, OUTPUT);
+    digitalWrite(DIV_PIN, LOW);
+    energyMark(ENERGY_ADC, ENERGY_ON);
+
+    // Internal 1.1V reference for better accuracy
+    selectInput();
+    delay(3);                     // Let reference stabilize
+    delay(5);                     // Let divider settle
+
+    bool receiving = radio.receiving();
+    if (receiving) radio.idle();
+    uint16_t sum = 0;
+    {
+      EnergySpan energy(ENERGY_CPU, ENERGY_CPU_SLEEP);
+      convert();                  // Discard first reading
+      for (uint8_t i = 0; i < BATTERY_SAMPLES; i++) {
+        sum += convert();
+      }
+    }
+    if (receiving) radio.receive();
+
+    // Deactivate divider to save power
+    pinMode(DIV_PIN, INPUT);
+    energyMark(ENERGY_ADC, ENERGY_OFF);
+
+    update((uint16_t)(((uint32_t)sum * BATTERY_MV_Q16 + 0x8000) >> 16));
+  }
+
+private:
+  void update(uint16_t mV) {
+    uint16_t sampleQ3 = mV << 3;  // Q3 keeps 8191 mV in 16 bits
+    if (!sampled_) {
+      filteredQ3_ = sampleQ3;
+      sampled_ = true;
+      return;
+    }
+
+    // Voltage: EMA with alpha 1/4
+    uint16_t prev = filteredQ3_;
+    filteredQ3_ = prev + ((int16_t)(sampleQ3 - prev) >> 2);
+
+    // Trend: EMA (alpha 1/8) of the filtered change, scaled to one hour
+    int32_t perHour = ((int32_t)(int16_t)(filteredQ3_ - prev) * (3600000UL / BATTERY_INTERVAL)) >> 3;
+    trend_ += (int16_t)((perHour - trend_) >> 3);
+  }
+
+#if defined(__AVR__)
+  void selectInput() {
+    // REFS1|REFS0 = internal 1.1V, MUX = VBAT_PIN channel
+    ADMUX = _BV(REFS1) | _BV(REFS0) | ((VBAT_PIN - A0) & 0x07);
+  }
+
+  uint16_t convert() {
+    ADCSRA |= _BV(ADIE);
+    set_sleep_mode(SLEEP_MODE_ADC);
+    sleep_enable();
+    // Entering ADC noise reduction sleep starts the conversion
+    sleep_cpu();
+    // Another interrupt may have woken us early: sleep again until done.
+    // ADSC is checked with interrupts off and sei() guarantees sleep_cpu()
+    // runs before a pending ADC interrupt, so the wake-up cannot be lost.
+    for (;;) {
+      cli();
+      if (!(ADCSRA & _BV(ADSC))) break;
+      sei();
+      sleep_cpu();
+    }
+    sei();
+    sleep_disable();
+    ADCSRA &= ~_BV(ADIE);
+    return ADC;
+  }
+#else
+  void selectInput() {
+    analogReference(INTERNAL);
+  }
+
+  uint16_t convert() {
+    return analogRead(VBAT_PIN);
+  }
+#endif
+
+  uint16_t filteredQ3_ = 0;
+  int16_t trend_ = 0;
+  unsigned long lastSample_ = 0;
+  bool sampled_ = false;
+};
@@ -0,0 +1,148 @@
+#pragma once
+
+// Receive windows synchronized to the hub's MSG_BEACON, for nodes that
+// sleep radio and MCU while on backup power.
+//
+// Every beacon opens a window: the node wakes shortly before the beacon is
+// due, takes it and sleeps again, unless the beacon has BEACON_PENDING set.
+// Then frames held for sleeping nodes follow, and the node listens until
+// BEACON_LISTEN_MS pass without one. The hub holds everything for a
+// sleeping node until its next beacon, so the beacon period bounds the
+// command latency.
+//
+// Time is local millis(). While the node sleeps that runs on the watchdog
+// oscillator, which is only good to about 10% and moves with temperature
+// and supply (NodeSleep.h), so nothing is taken at its nominal rate:
+//
+//   - the length of a period is measured, not assumed: each beacon's
+//     error against its predicted arrival, spread over the periods since
+//     the one before, corrects the estimate by half
+//   - the window opens BEACON_LEAD_MS (the beacon's time on air) plus a
+//     margin early and closes a margin late. The margin is twice the last
+//     error per period, at least BEACON_DRIFT_PERMILLE of the period,
+//     times the periods since the last beacon heard, so every miss
+//     widens the next window
+//   - unsettle() drops the margin back to BEACON_SLEEP_PERMILLE when the
+//     node starts or stops sleeping and the clock changes hands
+//
+// After BEACON_MISSED_MAX misses in a row the lock is gone and the node
+// listens continuously until it hears a beacon again.
+//
+// Beacons carry no MAC, so one beacon proves nothing. A lock, and any
+// change of period while locked, takes two that agree: the second must
+// carry the first's period, the sequence number that many periods on and
+// arrive when that predicts, give or take BEACON_SLEEP_PERMILLE. While
+// locked both must also fall inside the window, so a forger cannot move
+// a locked node to another period or phase with beacons of its own; in
+// the window it competes with the hub's beacon as a jammer would. A
+// locked beacon's count of periods is the window's, not its sequence
+// number, which a forged one could have set to anything.
+
+#include <Arduino.h>
+
+#include "NodeConfig.h"
+
+class BeaconSync {
+public:
+  bool locked() const { return locked_; }
+  uint16_t period() const { return periodMs_; }
+
+  // A beacon heard at local time now. A locked node only takes beacons
+  // inside the current window; false for any other, and for the first of
+  // two that would set up a new period, which changes nothing but the
+  // candidate.
+  bool onBeacon(uint16_t seq, uint16_t periodMs, unsigned long now) {
+    if (!periodMs) return false;
+
+    if (locked_) {
+      if ((long)(now - windowStart()) < 0 || (long)(now - windowEnd()) > 0) return false;
+      if (periodMs == periodMs_) {
+        track(now);
+        return true;
+      }
+    }
+
+    uint16_t periods = seq - candidateSeq_;
+    if (periodMs != candidatePeriodMs_ || !periods || periods > BEACON_MISSED_MAX + 1 ||
+        !agrees(periods, now)) {
+      candidatePeriodMs_ = periodMs;
+      candidateSeq_ = seq;
+      candidateAt_ = now;
+      return false;
+    }
+
+    // The first measurement of the period, taken over the two beacons
+    periodMs_ = periodMs;
+    periodQ4_ = ((uint32_t)(now - candidateAt_) << 4) / periods;
+    unsettle();
+    candidatePeriodMs_ = 0;
+
+    locked_ = true;
+    last_ = now;
+    missed_ = 0;
+    return true;
+  }
+
+  // The local clock is about to run on another oscillator
+  void unsettle() {
+    marginMs_ = (uint32_t)periodMs_ * BEACON_SLEEP_PERMILLE / 1000;
+  }
+
+  // The current window closed without its beacon. False once the lock is
+  // gone.
+  bool miss() {
+    if (++missed_ > BEACON_MISSED_MAX) locked_ = false;
+    return locked_;
+  }
+
+  // Current window, in local millis()
+  unsigned long windowStart() const {
+    return expected(missed_ + 1) - BEACON_LEAD_MS - widening();
+  }
+
+  unsigned long windowEnd() const {
+    return expected(missed_ + 1) + widening();
+  }
+
+private:
+  // A beacon in the current window, of the period locked to
+  void track(unsigned long now) {
+    uint16_t periods = missed_ + 1;
+    long error = (long)(now - expected(periods));
+    long perPeriodQ4 = error * 16 / periods;
+    periodQ4_ += perPeriodQ4 / 2;
+
+    uint16_t floor = (uint32_t)periodMs_ * BEACON_DRIFT_PERMILLE / 1000;
+    long margin = 2 * labs(perPeriodQ4) / 16;
+    marginMs_ = margin > floor ? margin : floor;
+
+    last_ = now;
+    missed_ = 0;
+  }
+
+  // Does a beacon periods on from the candidate arrive when it predicts?
+  bool agrees(uint16_t periods, unsigned long now) const {
+    uint32_t span = (uint32_t)periods * candidatePeriodMs_;
+    long error = (long)(now - candidateAt_ - span);
+    return (uint32_t)labs(error) <= span / 1000 * BEACON_SLEEP_PERMILLE + BEACON_GUARD_MS;
+  }
+
+  unsigned long expected(uint16_t periods) const {
+    return last_ + (uint32_t)(periods * periodQ4_ >> 4);
+  }
+
+  uint32_t widening() const {
+    return BEACON_GUARD_MS + (uint32_t)(missed_ + 1) * marginMs_;
+  }
+
+  bool locked_ = false;
+  uint16_t periodMs_ = 0;    // As the hub announces it
+  uint32_t periodQ4_ = 0;    // As measured in local ms, 1/16 ms units
+  uint16_t marginMs_ = 0;    // Widening per period since the last beacon
+  unsigned long last_ = 0;   // Local time the last beacon arrived
+  uint8_t missed_ = 0;       // Windows since then without a beacon
+
+  uint16_t candidatePeriodMs_ = 0;  // A beacon's period not yet confirmed, 0 for none
+  uint16_t candidateSeq_ = 0;
+  unsigned long candidateAt_ = 0;
+};
@@ -0,0 +1,406 @@
+#pragma once
+
+// Bulk transfers: payloads larger than one frame, in either direction
+// (protocol in NodeWire.h). Both ends keep one of each:
+//
+//   BulkSender     the data, encrypted in place, and which fragments go
+//                  out next from the receiver's last bitmap
+//   BulkAssembly   the fragments of one transfer in a bounded buffer, then
+//                  decrypted in place and checked as a whole
+//
+// Neither does I/O or keeps a clock: the node drives them from loop()
+// (NodeCore.h), the hub from BulkTransfer and BulkReceiver. The
+// ciphertext is the only copy, so a node needs no more RAM than its
+// buffer: BULK_BUFFER bytes, shared by both directions, a transfer at a
+// time. A transfer that does not fit is refused with BULK_TOO_BIG.
+//
+// Off on the node unless BULK_ENABLED is 1. Plain C++ without Arduino,
+// like NodeFrame.h, so the hub uses the same code.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "NodeFrame.h"
+#include "NodeOtaBoot.h"  // otaCrc32()
+
+#ifndef BULK_ENABLED
+#define BULK_ENABLED 0
+#endif
+
+#ifndef BULK_BUFFER
+#define BULK_BUFFER 256  // Node buffer, ciphertext bytes: up to 255 bytes of plaintext
+#endif
+
+#define BULK_RETRY_MS 3000UL     // Node: offer or window again without an ack
+#define BULK_RETRIES 8           // Tries in a row without progress before the sender gives up
+#define BULK_TIMEOUT_MS 60000UL  // Receiver: transfer dropped this long after its last fragment
+
+// Sender phases
+#define BULK_IDLE 0
+#define BULK_OFFERING 1  // Offer out, waiting for the first ack
+#define BULK_SENDING 2   // Windows of fragments out
+#define BULK_FINISHED 3  // See result()
+
+#define BULK_NO_ANSWER 6  // result(): no ack after BULK_RETRIES tries, never on the wire
+
+// BulkSender::next()
+#define BULK_SEND_NONE 0
+#define BULK_SEND_OFFER 1
+#define BULK_SEND_FRAGMENT 2
+
+static_assert(BULK_BUFFER % WIRE_BLOCK_LEN == 0, "BULK_BUFFER must be whole blocks");
+
+// Ciphertext bytes: plaintext plus at least one padding byte, whole blocks
+inline uint16_t bulkPaddedLen(uint16_t len) {
+  return (len / WIRE_BLOCK_LEN + 1) * WIRE_BLOCK_LEN;
+}
+
+inline uint8_t bulkFragments(uint16_t len) {
+  return (bulkPaddedLen(len) + BULK_FRAGMENT_MAX - 1) / BULK_FRAGMENT_MAX;
+}
+
+// Ciphertext bytes in fragment index, the last one may be short
+inline uint8_t bulkFragmentLen(uint16_t len, uint8_t index) {
+  uint16_t left = bulkPaddedLen(len) - (uint16_t)index * BULK_FRAGMENT_MAX;
+  return left < BULK_FRAGMENT_MAX ? left : BULK_FRAGMENT_MAX;
+}
+
+// received bits of a whole transfer of count fragments
+inline uint16_t bulkAll(uint8_t count) {
+  return count >= BULK_FRAGMENTS_MAX ? 0xFFFF : (uint16_t)((1u << count) - 1);
+}
+
+inline uint32_t bulkCrc(const uint8_t* p, uint16_t len) {
+  uint32_t crc = OTA_CRC_INIT;
+  for (uint16_t i = 0; i < len; i++) crc = otaCrc32(crc, p[i]);
+  return otaCrcFinish(crc);
+}
+
+// IV of a transfer, as for every encrypted frame: ID[0..3] + counter + nonce
+inline void bulkIv(const uint8_t* id, uint32_t counter, const uint8_t* nonce, uint8_t* iv) {
+  memcpy(iv, id, 4);
+  wireWriteU32(iv + 4, counter);
+  memcpy(iv + 8, nonce, WIRE_NONCE_LEN);
+}
+
+// Pads len bytes of plaintext in buf and encrypts them in place (CBC).
+// buf holds bulkPaddedLen(len) bytes. aes has its key set.
+template <class Cipher>
+void bulkEncrypt(Cipher& aes, uint8_t* buf, uint16_t len, const uint8_t* iv) {
+  uint16_t padded = bulkPaddedLen(len);
+  buf[len] = 0x80;
+  memset(buf + len + 1, 0, padded - len - 1);
+
+  const uint8_t* chain = iv;
+  for (uint16_t i = 0; i < padded; i += WIRE_BLOCK_LEN) {
+    for (uint8_t j = 0; j < WIRE_BLOCK_LEN; j++) buf[i + j] ^= chain[j];
+    aes.encryptBlock(buf + i, buf + i);
+    chain = buf + i;
+  }
+}
+
+// Decrypts padded bytes in place. chain starts as the IV; block is one
+// block of scratch for the ciphertext the next block chains on.
+template <class Cipher>
+void bulkDecrypt(Cipher& aes, uint8_t* buf, uint16_t padded, uint8_t* chain, uint8_t* block) {
+  for (uint16_t i = 0; i < padded; i += WIRE_BLOCK_LEN) {
+    memcpy(block, buf + i, WIRE_BLOCK_LEN);
+    aes.decryptBlock(buf + i, block);
+    for (uint8_t j = 0; j < WIRE_BLOCK_LEN; j++) buf[i + j] ^= chain[j];
+    memcpy(chain, block, WIRE_BLOCK_LEN);
+  }
+}
+
+// One transfer out at a time. Selective repeat: each window is the first
+// BULK_WINDOW fragments the receiver's bitmap lacks, the last one polled.
+// Without an ack within retryMs, plus up to half again drawn from the
+// transfer's nonce so senders that started together drift apart, the
+// window goes out again; after BULK_RETRIES windows or offers in a row
+// that bring nothing new the transfer fails with BULK_NO_ANSWER.
+class BulkSender {
+public:
+  BulkSender(uint8_t* buf, uint16_t capacity, uint32_t retryMs)
+    : buf_(buf), capacity_(capacity), retryMs_(retryMs) {}
+
+  uint8_t phase() const { return phase_; }
+  bool active() const { return phase_ == BULK_OFFERING || phase_ == BULK_SENDING; }
+
+  // BULK_DONE once delivered, else the receiver's reason, BULK_BUSY if it
+  // stayed busy, or BULK_NO_ANSWER
+  uint8_t result() const { return result_; }
+
+  uint32_t counter() const { return counter_; }
+  uint8_t kind() const { return kind_; }
+  uint16_t len() const { return len_; }
+  uint16_t received() const { return received_; }
+
+  // Takes len bytes of data (which may already be in the buffer) for a new
+  // transfer. False while one is running or if it does not fit.
+  bool start(uint8_t kind, const uint8_t* data, uint16_t len, const uint8_t* nonce,
+             uint32_t nowMs) {
+    if (active() || len > BULK_LEN_MAX || bulkPaddedLen(len) > capacity_) return false;
+
+    memmove(buf_, data, len);
+    kind_ = kind;
+    len_ = len;
+    crc_ = bulkCrc(buf_, len);
+    memcpy(nonce_, nonce, WIRE_NONCE_LEN);
+    memcpy(&jitter_, nonce, sizeof(jitter_));
+    count_ = bulkFragments(len);
+    sealed_ = false;
+
+    phase_ = BULK_OFFERING;
+    result_ = BULK_RECEIVING;
+    tries_ = 0;
+    received_ = 0;
+    pending_ = 0;
+    deadline_ = nowMs;
+    return true;
+  }
+
+  // What is due at nowMs. BULK_SEND_OFFER: seal() under the next counter
+  // of the sender's sequence, then offer(). BULK_SEND_FRAGMENT: fragment()
+  // with index, which has BULK_POLL on the last of a window.
+  uint8_t next(uint32_t nowMs, uint8_t& index) {
+    if (phase_ == BULK_OFFERING) {
+      if (!due(nowMs) || !retry()) return BULK_SEND_NONE;
+      deadline_ = nowMs + waitMs();
+      return BULK_SEND_OFFER;
+    }
+    if (phase_ != BULK_SENDING) return BULK_SEND_NONE;
+
+    if (!pending_) {
+      if (!due(nowMs) || !retry()) return BULK_SEND_NONE;
+      refill();  // No ack, the same fragments again
+    }
+
+    uint8_t i = 0;
+    while (!(pending_ >> i & 1)) i++;
+    pending_ &= ~(1u << i);
+    index = i;
+    if (!pending_) {
+      index |= BULK_POLL;
+      deadline_ = nowMs + waitMs();
+    }
+    return BULK_SEND_FRAGMENT;
+  }
+
+  // An ack with counter(); the caller has checked its MAC
+  void onAck(uint8_t state, uint16_t received, uint32_t nowMs) {
+    if (!active()) return;
+
+    switch (state) {
+      case BULK_RECEIVING: {
+        uint16_t more = received & bulkAll(count_) & ~received_;
+        if (phase_ == BULK_OFFERING || more) {
+          tries_ = 0;
+        } else if (!retry()) {
+          return;
+        }
+        phase_ = BULK_SENDING;
+        result_ = BULK_RECEIVING;
+        received_ |= more;
+        refill();
+        break;
+      }
+
+      case BULK_BUSY:
+      case BULK_UNKNOWN:
+        // Offer again: at once if the receiver lost the transfer, later if
+        // its buffer is taken
+        phase_ = BULK_OFFERING;
+        result_ = state;
+        received_ = 0;
+        pending_ = 0;
+        deadline_ = state == BULK_BUSY ? nowMs + waitMs() : nowMs;
+        break;
+
+      default:  // Done, or failed for good
+        phase_ = BULK_FINISHED;
+        result_ = state;
+        break;
+    }
+  }
+
+  // Encrypts the data under counter for a new offer; the data sealed for
+  // an earlier offer is decrypted first. aes, chain and block as for
+  // bulkDecrypt().
+  template <class Cipher>
+  void seal(Cipher& aes, const uint8_t* key, const uint8_t* id, uint32_t counter,
+            uint8_t* chain, uint8_t* block) {
+    aes.setKey(key, 16);
+    if (sealed_) {
+      bulkIv(id, counter_, nonce_, chain);
+      bulkDecrypt(aes, buf_, bulkPaddedLen(len_), chain, block);
+    }
+    counter_ = counter;
+    bulkIv(id, counter_, nonce_, chain);
+    bulkEncrypt(aes, buf_, len_, chain);
+    sealed_ = true;
+  }
+
+  void offer(const BulkOfferFrame<uint8_t>& f) const {
+    f.setCounter(counter_);
+    f.setKind(kind_);
+    f.setSize(len_);
+    f.setCrc(crc_);
+    memcpy(f.nonce(), nonce_, WIRE_NONCE_LEN);
+  }
+
+  // Ciphertext bytes of fragment index, for the length of its frame
+  uint8_t fragmentLen(uint8_t index) const { return bulkFragmentLen(len_, index & ~BULK_POLL); }
+
+  // Fragment index from next() into f, a view of fragmentLen(index) bytes
+  void fragment(const BulkFragmentFrame<uint8_t>& f, uint8_t index) const {
+    uint8_t i = index & ~BULK_POLL;
+    f.setCounter(counter_);
+    f.setIndex(i, index & BULK_POLL);
+    memcpy(f.cipher(), buf_ + (uint16_t)i * BULK_FRAGMENT_MAX, f.cipherLen());
+  }
+
+private:
+  bool due(uint32_t nowMs) const { return (int32_t)(nowMs - deadline_) >= 0; }
+
+  uint32_t waitMs() {
+    jitter_ = jitter_ * 1103515245UL + 12345;
+    return retryMs_ + (jitter_ >> 16) % (retryMs_ / 2 + 1);
+  }
+
+  bool retry() {
+    if (tries_++ < BULK_RETRIES) return true;
+    phase_ = BULK_FINISHED;
+    if (result_ != BULK_BUSY) result_ = BULK_NO_ANSWER;
+    return false;
+  }
+
+  // The first BULK_WINDOW fragments still missing. With none missing but
+  // no BULK_DONE yet, the last one polls the receiver for it again.
+  void refill() {
+    pending_ = 0;
+    uint8_t n = 0;
+    for (uint8_t i = 0; i < count_ && n < BULK_WINDOW; i++) {
+      if (received_ >> i & 1) continue;
+      pending_ |= 1u << i;
+      n++;
+    }
+    if (!pending_) pending_ = 1u << (count_ - 1);
+  }
+
+  uint8_t* buf_;
+  uint16_t capacity_;
+  uint32_t retryMs_;
+
+  uint8_t phase_ = BULK_IDLE;
+  uint8_t result_ = BULK_RECEIVING;
+  uint8_t tries_ = 0;
+  uint32_t deadline_ = 0;
+  uint32_t jitter_ = 0;
+
+  uint32_t counter_ = 0;  // Of the last offer
+  uint8_t kind_ = 0;
+  uint16_t len_ = 0;
+  uint32_t crc_ = 0;
+  uint8_t nonce_[WIRE_NONCE_LEN];
+  uint8_t count_ = 0;
+  bool sealed_ = false;   // buf_ holds ciphertext under counter_
+
+  uint16_t received_ = 0;  // Bitmap, from the receiver's acks
+  uint16_t pending_ = 0;   // Left in this window
+};
+
+// One transfer in at a time. A new offer replaces whatever was in
+// progress; the sender of that one gets BULK_UNKNOWN when it polls.
+class BulkAssembly {
+public:
+  BulkAssembly(uint8_t* buf, uint16_t capacity) : buf_(buf), capacity_(capacity) {}
+
+  bool active() const { return active_; }
+  uint32_t counter() const { return counter_; }
+  uint8_t kind() const { return kind_; }
+  uint16_t len() const { return len_; }
+  uint16_t received() const { return received_; }
+
+  // Plaintext after open() returned BULK_DONE
+  const uint8_t* data() const { return buf_; }
+
+  // counter is the last transfer handed over: its sender may have missed
+  // the BULK_DONE and polls again
+  bool finished(uint32_t counter) const { return done_ && counter == doneCounter_; }
+
+  // An authenticated offer. BULK_RECEIVING, or BULK_TOO_BIG.
+  uint8_t offer(const BulkOfferFrame<const uint8_t>& f, uint32_t nowMs) {
+    active_ = false;
+    if (f.size() > BULK_LEN_MAX || bulkPaddedLen(f.size()) > capacity_) return BULK_TOO_BIG;
+
+    counter_ = f.counter();
+    kind_ = f.kind();
+    len_ = f.size();
+    crc_ = f.crc();
+    memcpy(nonce_, f.nonce(), WIRE_NONCE_LEN);
+    count_ = bulkFragments(len_);
+    received_ = 0;
+    heardMs_ = nowMs;
+    active_ = true;
+    return BULK_RECEIVING;
+  }
+
+  // Before the MAC: a fragment of this transfer, at its index and length
+  bool fits(const BulkFragmentFrame<const uint8_t>& f) const {
+    return active_ && f.counter() == counter_ && f.index() < count_ &&
+           f.cipherLen() == bulkFragmentLen(len_, f.index());
+  }
+
+  // An authenticated fragment that fits(). True once every one is in.
+  bool fragment(const BulkFragmentFrame<const uint8_t>& f, uint32_t nowMs) {
+    memcpy(buf_ + (uint16_t)f.index() * BULK_FRAGMENT_MAX, f.cipher(), f.cipherLen());
+    received_ |= 1u << f.index();
+    heardMs_ = nowMs;
+    return received_ == bulkAll(count_);
+  }
+
+  // Every fragment in: decrypts the transfer in place and checks padding
+  // and CRC. BULK_DONE with the plaintext at data(), or BULK_BAD_CRC;
+  // the transfer is over either way. chain and block as for bulkDecrypt().
+  template <class Cipher>
+  uint8_t open(Cipher& aes, const uint8_t* key, const uint8_t* id, uint8_t* chain,
+               uint8_t* block) {
+    active_ = false;
+    uint16_t padded = bulkPaddedLen(len_);
+    aes.setKey(key, 16);
+    bulkIv(id, counter_, nonce_, chain);
+    bulkDecrypt(aes, buf_, padded, chain, block);
+
+    uint8_t bad = buf_[len_] ^ 0x80;
+    for (uint16_t i = len_ + 1; i < padded; i++) bad |= buf_[i];
+    if (bad || bulkCrc(buf_, len_) != crc_) return BULK_BAD_CRC;
+
+    done_ = true;
+    doneCounter_ = counter_;
+    return BULK_DONE;
+  }
+
+  // Nothing heard of the transfer for BULK_TIMEOUT_MS
+  bool expired(uint32_t nowMs) const {
+    return active_ && (int32_t)(nowMs - heardMs_) > (int32_t)BULK_TIMEOUT_MS;
+  }
+
+  void clear() { active_ = false; }
+
+private:
+  uint8_t* buf_;
+  uint16_t capacity_;
+
+  bool active_ = false;
+  uint32_t counter_ = 0;  // Of the offer
+  uint8_t kind_ = 0;
+  uint16_t len_ = 0;
+  uint32_t crc_ = 0;
+  uint8_t nonce_[WIRE_NONCE_LEN];
+  uint8_t count_ = 0;
+  uint16_t received_ = 0;
+  uint32_t heardMs_ = 0;
+
+  bool done_ = false;
+  uint32_t doneCounter_ = 0;
+};
@@ -0,0 +1,208 @@
+#pragma once
+
+// Radio capture: every frame heard on air, with when and how it arrived,
+// one line per record on a serial port or in a file:
+//
+//   @C <record in hex>
+//
+// like the energy trace and the log, so a capture can share a serial
+// stream with them. Records, little-endian:
+//
+//   CAPTURE_SETUP  type version bandwidth(u32) codingRate(u8)
+//                    preamble(u16) syncWord(u8)                          10
+//   CAPTURE_FRAME  type us(u32) frequency(u32) sf(u8) rssi(i16) snr(i8)
+//                    frame                                           13 + n
+//   CAPTURE_LOST   type count(u16)                                        3
+//
+// us is when the frame ended on air (the receive interrupt), on the
+// writer's clock: it wraps after 71 minutes, readers unwrap it, and only
+// differences mean anything. snr is in quarter dB. A frame the writer sent
+// itself (the hub stand-in captures its downlink too) has CAPTURE_TX in sf
+// and its TX power in rssi. The setup record gives the radio settings for
+// the airtime of the frames after it. CAPTURE_LOST counts frames heard but
+// dropped because the writer fell behind.
+//
+// Writers: the sniffer firmware (sniffer/) and the simulator's hub
+// (sim --capture). Readers: tools/capture/capture.py, which decodes,
+// verifies and counts, and the replay in the simulator and HalMain.cpp,
+// through captureParse().
+
+#include <stdint.h>
+#include <string.h>
+
+#define CAPTURE_VERSION 1
+
+#define CAPTURE_SETUP 1
+#define CAPTURE_FRAME 2
+#define CAPTURE_LOST 3
+
+#define CAPTURE_SETUP_LEN 10
+#define CAPTURE_FRAME_HEADER_LEN 13
+#define CAPTURE_LOST_LEN 3
+
+#define CAPTURE_TX 0x80  // In sf: sent by the writer
+#define CAPTURE_SF 0x0F
+
+// One record as hex on Out, anything with write(uint8_t)
+template <class Out>
+class CaptureLine {
+public:
+  explicit CaptureLine(Out& out) : out_(out) {
+    out_.write((uint8_t)'@');
+    out_.write((uint8_t)'C');
+    out_.write((uint8_t)' ');
+  }
+
+  ~CaptureLine() { out_.write((uint8_t)'\n'); }
+
+  void u8(uint8_t b) {
+    out_.write(hex(b >> 4));
+    out_.write(hex(b & 0x0F));
+  }
+
+  void u16(uint16_t v) {
+    u8(v);
+    u8(v >> 8);
+  }
+
+  void u32(uint32_t v) {
+    u16(v);
+    u16(v >> 16);
+  }
+
+private:
+  static uint8_t hex(uint8_t n) { return n < 10 ? '0' + n : 'a' + n - 10; }
+
+  Out& out_;
+};
+
+template <class Out>
+inline void captureSetup(Out& out, uint32_t bandwidth, uint8_t codingRate,
+                         uint16_t preamble, uint8_t syncWord) {
+  CaptureLine<Out> line(out);
+  line.u8(CAPTURE_SETUP);
+  line.u8(CAPTURE_VERSION);
+  line.u32(bandwidth);
+  line.u8(codingRate);
+  line.u16(preamble);
+  line.u8(syncWord);
+}
+
+template <class Out>
+inline void captureFrame(Out& out, uint32_t us, uint32_t frequency, uint8_t sf,
+                         bool tx, int16_t rssi, float snr,
+                         const uint8_t* frame, uint8_t len) {
+  int q = (int)(snr * 4 + (snr < 0 ? -0.5f : 0.5f));
+  if (q < -128) q = -128;
+  if (q > 127) q = 127;
+
+  CaptureLine<Out> line(out);
+  line.u8(CAPTURE_FRAME);
+  line.u32(us);
+  line.u32(frequency);
+  line.u8((sf & CAPTURE_SF) | (tx ? CAPTURE_TX : 0));
+  line.u16((uint16_t)rssi);
+  line.u8((uint8_t)(int8_t)q);
+  for (uint8_t i = 0; i < len; i++) line.u8(frame[i]);
+}
+
+template <class Out>
+inline void captureLost(Out& out, uint16_t count) {
+  CaptureLine<Out> line(out);
+  line.u8(CAPTURE_LOST);
+  line.u16(count);
+}
+
+// Turns the wrapping us of the records, in the order read, into a 64-bit
+// time. A step back of less than half the range is taken as one.
+class CaptureClock {
+public:
+  int64_t operator()(uint32_t us) {
+    if (!started_) {
+      at_ = us;
+      started_ = true;
+    } else {
+      at_ += (int32_t)(us - (uint32_t)at_);
+    }
+    return at_;
+  }
+
+private:
+  int64_t at_ = 0;
+  bool started_ = false;
+};
+
+// A record read back; fields of other types are left alone
+struct CaptureRecord {
+  uint8_t type;
+
+  uint32_t bandwidth;
+  uint8_t codingRate;
+  uint16_t preamble;
+  uint8_t syncWord;
+
+  uint32_t us;
+  uint32_t frequency;
+  uint8_t sf;
+  bool tx;
+  int16_t rssi;
+  float snr;
+  uint8_t len;
+  uint8_t frame[255];
+
+  uint16_t lost;
+};
+
+inline int captureNibble(char c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// Reads the record of a "@C" line, which may follow other output on the
+// same line. False for any other line and for malformed records.
+inline bool captureParse(const char* line, CaptureRecord& r) {
+  const char* p = strstr(line, "@C ");
+  if (!p) return false;
+  p += 3;
+
+  uint8_t b[CAPTURE_FRAME_HEADER_LEN + 255];
+  uint16_t n = 0;
+  for (;;) {
+    int hi = captureNibble(p[0]);
+    if (hi < 0) break;
+    int lo = captureNibble(p[1]);
+    if (lo < 0 || n == sizeof(b)) return false;
+    b[n++] = (uint8_t)(hi << 4 | lo);
+    p += 2;
+  }
+  if (!n) return false;
+
+  r.type = b[0];
+  switch (r.type) {
+    case CAPTURE_SETUP:
+      if (n != CAPTURE_SETUP_LEN || b[1] != CAPTURE_VERSION) return false;
+      r.bandwidth = b[2] | (uint32_t)b[3] << 8 | (uint32_t)b[4] << 16 | (uint32_t)b[5] << 24;
+      r.codingRate = b[6];
+      r.preamble = b[7] | b[8] << 8;
+      r.syncWord = b[9];
+      return true;
+    case CAPTURE_FRAME:
+      if (n < CAPTURE_FRAME_HEADER_LEN + 1) return false;
+      r.us = b[1] | (uint32_t)b[2] << 8 | (uint32_t)b[3] << 16 | (uint32_t)b[4] << 24;
+      r.frequency = b[5] | (uint32_t)b[6] << 8 | (uint32_t)b[7] << 16 | (uint32_t)b[8] << 24;
+      r.sf = b[9] & CAPTURE_SF;
+      r.tx = b[9] & CAPTURE_TX;
+      r.rssi = (int16_t)(b[10] | b[11] << 8);
+      r.snr = (int8_t)b[12] / 4.0f;
+      r.len = n - CAPTURE_FRAME_HEADER_LEN;
+      memcpy(r.frame, b + CAPTURE_FRAME_HEADER_LEN, r.len);
+      return true;
+    case CAPTURE_LOST:
+      if (n != CAPTURE_LOST_LEN) return false;
+      r.lost = b[1] | b[2] << 8;
+      return true;
+  }
+  return false;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "NodeWire.h"
+
+// Debug mode - define before including NodeCore.h, 0 for production (no
+// serial output). The log is tokenized, see NodeLog.h.
+#ifndef DEBUG
+#define DEBUG 0
+#endif
+
+// LoRa pins for Pro Mini
+#ifndef RFM95_CS
+#define RFM95_CS 10
+#endif
+#ifndef RFM95_RST
+#define RFM95_RST A0
+#endif
+#ifndef RFM95_DIO0
+#define RFM95_DIO0 2
+#endif
+
+// Other pins shared by every node type
+#ifndef BTN_PIN
+#define BTN_PIN 4
+#endif
+#ifndef LED_PIN
+#define LED_PIN 13
+#endif
+#ifndef VBAT_PIN
+#define VBAT_PIN A1
+#endif
+#ifndef DIV_PIN
+#define DIV_PIN 3
+#endif
+
+// Battery voltage divider values
+#define RTOP 1000000.0
+#define RBOT 330000.0
+#define SCALE ((RTOP + RBOT) / RBOT)
+#define VREF 1.100
+
+#define FREQ 868E6
+#define SYNC_WORD 0x34  // Ours, not the LoRaWAN one
+
+#define EE_MAGIC 0xAB12
+#define EE_MAGIC_ADDR 0
+#define EE_PRIV_ADDR 2
+#define EE_KEY_ADDR 23 // 2 + 21 bytes for private key
+
+// SERIAL_ID, written from the build on first boot and kept from then on,
+// so every node can run the same (OTA) image
+#define EE_SERIAL_MAGIC 0x5E1D
+#define EE_SERIAL_MAGIC_ADDR 40
+#define EE_SERIAL_ADDR 42 // 16 bytes, up to 57
+
+// Multicast group (NodeWire.h), one per node. The counter in EEPROM is a
+// bound saved GROUP_COUNTER_RESERVE ahead of the last group frame taken,
+// rewritten only once a frame passes it. A reboot resumes from the bound,
+// so it cannot reopen the replay window; the price is that up to
+// GROUP_COUNTER_RESERVE group frames after a reboot are refused as old.
+#define EE_GROUP_MAGIC 0x6E70
+#define EE_GROUP_MAGIC_ADDR 96    // After the OTA record (NodeOtaBoot.h)
+#define EE_GROUP_ID_ADDR 98
+#define EE_GROUP_KEY_ADDR 114
+#define EE_GROUP_COUNTER_ADDR 130 // 4 bytes, up to 133
+#define GROUP_COUNTER_RESERVE 32  // Group counters skipped at most by a reboot
+
+// Key epochs (MSG_RESYNC in NodeWire.h): the hub's public key from
+// adoption, the epoch adopted in and the one the session key is for. The
+// key at EE_KEY_ADDR stays the adoption key, every epoch's key is derived
+// from it. Without the magic the node was adopted before epochs and only
+// syncs by challenge.
+#define EE_RESYNC_MAGIC 0x7E5C
+#define EE_RESYNC_MAGIC_ADDR 134
+#define EE_HUB_PUB_ADDR 136       // 40 bytes
+#define EE_ADOPT_EPOCH_ADDR 176
+#define EE_EPOCH_ADDR 180         // 4 bytes, up to 183
+
+// Scheduling (ms)
+#define DISCOVERY_INTERVAL 5000   // First backoff step (NodeBackoff.h)
+#define CHALLENGE_INTERVAL 5000   // First backoff step
+#define ADOPT_INTERVAL 10000      // First backoff step, after the button press
+#define RETRY_MAX 60000UL         // Longest backoff step and longest MSG_RETRY taken
+#define BOOT_SPREAD 3000          // First discovery or challenge within this after boot
+#define ADOPT_TRIES 5             // Adoption requests per button press
+#define TELEMETRY_INTERVAL 5000
+#define DIAG_INTERVAL 3600000UL
+#define GROUP_REPLY_SPREAD 3000 // Members answer a group command at random within this
+
+// Beacon windows (NodeBeacon.h), for nodes whose device asks for them
+#define BEACON_LEAD_MS 40           // Beacon time on air at SF7, plus radio start-up
+#define BEACON_GUARD_MS 4           // Window margin with a perfectly known clock
+#define BEACON_DRIFT_PERMILLE 5     // Least margin per period, in 1/1000 of it
+#define BEACON_SLEEP_PERMILLE 100   // Margin while the sleep clock is unmeasured
+#define BEACON_MISSED_MAX 6         // Misses in a row before the lock is given up
+#define BEACON_LISTEN_MS 300        // After a frame, a send or a BEACON_PENDING beacon
+#define BEACON_TELEMETRY_INTERVAL 600000UL  // Replaces TELEMETRY_INTERVAL while sleeping
@@ -0,0 +1,1865 @@
+#pragma once
+
+// Shared node core: radio, crypto, adoption, session, counter sync and
+// scheduling. Device behavior plugs in as a compile-time policy:
+//
+//   struct MyDevice {
+//     void begin();                                          // pins, initial state
+//     template <class Node> void poll(Node& node);           // called every loop()
+//     template <class Node> void handleCommand(Node& node, const char* cmd);
+//     template <class Node> void trigger(Node& node, uint8_t action); // MSG_TRIGGER
+//     template <class Node> void bulk(Node& node, uint8_t kind,      // BULK_ENABLED
+//                                     const uint8_t* data, uint16_t len);
+//     bool rxWindows() const;                                // sleep between beacons
+//     const char* telemetryState() const;                    // last telemetry field
+//   };
+//
+//   NodeCore<MyDevice> node(SERIAL_ID);
+//
+// SERIAL_ID is only the factory identity: begin() stores it in EEPROM on
+// the first boot and uses the stored one from then on, so a firmware
+// update built for the fleet keeps every node's identity.
+//
+// Everything is resolved at compile time, so a node type only pays flash for
+// the hooks it actually implements.
+//
+// handleCommand() runs while the decrypted command still occupies the cipher
+// scratch slice, so replies must go through queueResponse(), not sendData().
+// Commands to a multicast group the node has joined arrive the same way.
+//
+// trigger() is the fast path: a MSG_TRIGGER is checked with two AES blocks
+// and handed over before the loop does anything else, so the device should
+// switch its output first and only then queue its reply.
+//
+// bulk() hands over a bulk transfer from the hub (NodeBulk.h), whole and
+// checked. The data sits in the node's one bulk buffer and is only valid
+// during the call; sendBulk() from there may pass it straight back.
+//
+// rxWindows() true (a siren on backup power) lets the node sleep radio and
+// MCU between MSG_BEACON receive windows once it is locked to the hub's
+// beacons (NodeBeacon.h). The node tells the hub with "rx;beacon", and
+// "rx;continuous" when it listens all the time again, so the hub knows to
+// hold its frames for the next beacon. A device that needs its timers
+// (sleep stops them) calls stayAwake() from poll() meanwhile.
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <LoRa.h>
+#include <uECC.h>
+#include <EEPROM.h>
+#include <avr/wdt.h>
+#include <AES.h>
+
+#include "NodeConfig.h"
+#include "NodeScratch.h"
+#include "NodeFrame.h"
+#include "NodeCrypto.h"
+#include "NodeBattery.h"
+#include "NodeEnergy.h"
+#include "NodeLog.h"
+#include "NodeStack.h"
+#include "NodeStats.h"
+#include "NodeGuard.h"
+#include "NodeRadio.h"
+#include "NodeBeacon.h"
+#include "NodeBackoff.h"
+#include "NodeSleep.h"
+#include "NodeOta.h"
+#include "NodeBulk.h"
+
+inline void blink(int n, int d = 100) {
+  for (int i = 0; i < n; i++) {
+    digitalWrite(LED_PIN, HIGH);
+    energyMark(ENERGY_LED, ENERGY_ON);
+    delay(d);
+    digitalWrite(LED_PIN, LOW);
+    energyMark(ENERGY_LED, ENERGY_OFF);
+    delay(d);
+  }
+  // Boot blinks a lot before loop() first flushes; the node is only
+  // waiting here anyway
+  logFlush();
+  energyFlush();
+}
+
+inline int getRng(uint8_t *d, unsigned s) {
+  for (unsigned i = 0; i < s; i++) {
+    d[i] = random(256);
+  }
+  return 1;
+}
+
+inline int freeRam() {
+#if defined(__AVR__)
+  extern int __heap_start, *__brkval;
+  int v;
+  return (int)&v - (__brkval == 0 ? (int)&__heap_start : (int)__brkval);
+#else
+  return 0;
+#endif
+}
+
+inline void softReset() {
+  logFlush();
+#if defined(__AVR__)
+  asm volatile ("  jmp 0");
+#else
+  halReset();
+#endif
+}
+
+template <class Device>
+class NodeCore {
+public:
+  explicit NodeCore(const uint8_t* serialId) {
+    memcpy(serialId_, serialId, sizeof(serialId_));
+  }
+
+  Device& device() { return device_; }
+  const uint8_t* serialId() const { return serialId_; }
+
+  bool isAdopted() const { return adopted_; }
+  bool isReady() const { return adopted_ && countersSynced_; }
+
+  // Queue a response to be sent from loop() instead of from the RX path
+  void queueResponse(const char* msg) {
+    strncpy(pendingMsg_, msg, sizeof(pendingMsg_) - 1);
+    pendingMsg_[sizeof(pendingMsg_) - 1] = 0;
+    pendingResponse_ = true;
+  }
+
+  // Keep this loop() from sleeping until the next beacon window
+  void stayAwake() { awake_ = true; }
+
+#if BULK_ENABLED
+  // Hand len bytes to the hub as one bulk transfer of kind (BULK_* in
+  // NodeWire.h), sent from loop() once the node is in sync. The data is
+  // copied. False while the buffer holds a transfer in either direction,
+  // or if len does not fit it.
+  bool sendBulk(uint8_t kind, const uint8_t* data, uint16_t len) {
+    if (bulkRx_.active()) return false;
+
+    uint8_t nonce[WIRE_NONCE_LEN];
+    for (uint8_t i = 0; i < WIRE_NONCE_LEN; i++) nonce[i] = random(256);
+    if (!bulkTx_.start(kind, data, len, nonce, millis())) return false;
+
+    DEBUG_LOG("[N] Bulk out: kind %u, %u bytes", kind, len);
+    return true;
+  }
+
+  bool bulkBusy() const { return bulkTx_.active() || bulkRx_.active(); }
+#endif
+
+  void begin() {
+    // Disable watchdog initially
+    wdt_disable();
+
+#if DEBUG || ENERGY_TRACE
+    Serial.begin(38400);
+    delay(1000);
+#endif
+
+    DEBUG_LOG("[N] Start, RAM: %d", freeRam());
+
+    pinMode(LED_PIN, OUTPUT);
+    pinMode(BTN_PIN, INPUT_PULLUP);
+    pinMode(VBAT_PIN, INPUT);
+    pinMode(DIV_PIN, INPUT);
+    device_.begin();
+
+    blink(3);
+
+    LoRa.setPins(RFM95_CS, RFM95_RST, RFM95_DIO0);
+
+    if (!LoRa.begin(FREQ)) {
+      DEBUG_LOG("[N] LoRa FAIL!");
+      while (1) blink(1, 500);
+    }
+
+    radio_.setSpreadingFactor(7);
+    LoRa.setSignalBandwidth(125E3);
+    LoRa.setSyncWord(SYNC_WORD);
+    radio_.begin();
+
+    // Read initial battery voltage
+    battery_.sample(radio_);
+    DEBUG_LOG("[N] Battery: %umV (%u%%)", battery_.millivolts(), battery_.percent());
+
+    loadSerialId();
+    seedRandom();
+#if OTA_ENABLED
+    ota_.begin();
+    otaTrial_ = ota_.onTrial();
+#endif
+
+    DEBUG_LOG("[N] LoRa OK");
+    DEBUG_LOG("[N] Freq: %u MHz", (uint16_t)(FREQ / 1E6));
+
+    if (load()) {
+      adopted_ = true;
+      DEBUG_LOG("[N] Loaded");
+      blink(5);
+    } else {
+      // Add delay and print before key gen
+      delay(100);
+      DEBUG_LOG("[N] RAM before keygen: %d", freeRam());
+    }
+
+    instance_ = this;
+    LoRa.onReceive(onRx);
+    radio_.receive();
+
+    DEBUG_LOG("[N] Ready, RAM: %d", freeRam());
+
+    // Challenge to sync counters if adopted, else look for a hub. Not at
+    // once: after a power cut every node on the site boots together.
+    if (adopted_) {
+      challenge_.start(millis(), BOOT_SPREAD);
+    } else {
+      discovery_.start(millis(), BOOT_SPREAD);
+    }
+
+    stackCheckpoint(STACK_PATH_BOOT);
+
+    // Enable watchdog timer (8 second timeout)
+    wdt_enable(WDTO_8S);
+    DEBUG_LOG("[N] Watchdog enabled");
+  }
+
+  void loop() {
+    // Reset watchdog at start of each loop iteration
+    wdt_reset();
+    unsigned long loopStart = micros();
+
+    // Handle frame received by the ISR, first thing so a trigger waits for
+    // nothing
+    if (scratch_.rxLen) {
+      dispatch(scratch_.rx, scratch_.rxLen);
+      scratch_.rxLen = 0; // Release rx slice to the ISR
+      stackCheckpoint(STACK_PATH_RX);
+      saveGroupCounter();
+    }
+
+    // Events so far, printed outside any traced path
+    logEndLine();
+    energyFlush();
+
+    pollBeacon();
+
+    // Handle deferred response
+    if (pendingResponse_ && !transmitting_ && (long)(millis() - replyAt_) >= 0) {
+      pendingResponse_ = false;
+      delay(50); // Small delay to avoid collision
+      sendData(pendingMsg_);
+    }
+
+    device_.poll(*this);
+
+#if OTA_ENABLED
+    pollOta();
+#endif
+
+#if BULK_ENABLED
+    pollBulk();
+#endif
+
+    if (battery_.due()) {
+      battery_.sample(radio_);
+    }
+
+    // Button handling
+    if (digitalRead(BTN_PIN) == LOW) {
+      if (!btnDown_) {
+        btnDown_ = true;
+        delay(50);
+
+        unsigned long t = millis();
+        while (digitalRead(BTN_PIN) == LOW) {
+          if (millis() - t > 3000) {
+            DEBUG_LOG("[N] RESET...");
+            clear();
+            while (digitalRead(BTN_PIN) == LOW);
+            delay(1000);
+            softReset();
+          }
+        }
+
+        if (millis() - t < 3000) {
+          if (!adopted_) {
+            adopt_.start(millis(), 0);
+          }
+        }
+      }
+    } else {
+      btnDown_ = false;
+    }
+
+    // Retries back off until the hub answers (NodeBackoff.h)
+    if (!adopted_ && adopt_.due(millis())) {
+      if (adopt_.tries() < ADOPT_TRIES) {
+        adopt_.sent(millis());
+        sendAdopt();
+      } else {
+        DEBUG_LOG("[N] No adoption, press again");
+        adopt_.stop();
+      }
+    }
+
+    // Discovery when not adopted (and not yet acknowledged)
+    if (!adopted_ && !discoveryAcked_ && discovery_.due(millis())) {
+      discovery_.sent(millis());
+      sendDiscovery();
+    }
+
+    // Challenge until the counters are synced, or the hub has confirmed
+    // them after a MSG_RESYNC we could not check
+    if (adopted_ && challenge_.due(millis())) {
+      challenge_.sent(millis());
+      DEBUG_LOG("[N] Challenge, try %u", challenge_.tries());
+      sendChallenge();
+    }
+
+    unsigned long telemetryInterval = windows_ ? BEACON_TELEMETRY_INTERVAL : TELEMETRY_INTERVAL;
+    if (adopted_ && countersSynced_ && (millis() - lastSend_ > telemetryInterval)) {
+      lastSend_ = millis();
+
+      uint16_t battVoltage = battery_.millivolts();
+      uint8_t battPercent = battery_.percent();
+
+      char m[48];
+      snprintf(m, sizeof(m), "telemetry;%u;%u;%s",
+               battVoltage,
+               battPercent,
+               device_.telemetryState());
+      sendData(m);
+
+      DEBUG_LOG("[N] RAM: %d", freeRam());
+    }
+
+    // Report worst-case stack depth and battery trend so fleet units close
+    // to overflow or with failing cells show up
+    if (adopted_ && countersSynced_ && (millis() - lastDiag_ > DIAG_INTERVAL)) {
+      lastDiag_ = millis();
+      sendStackReport();
+      sendBatteryReport();
+      sendDiagReport();
+    }
+
+    stats_.loopTime(micros() - loopStart);
+
+    // Idle for 10 ms, but not past a received frame. The log goes out
+    // meanwhile.
+    if (!sleepUntilWindow()) {
+      for (uint8_t i = 0; i < 10 && !scratch_.rxLen; i++) {
+        logDrain();
+        delay(1);
+      }
+    }
+  }
+
+  void sendData(const char* msg) {
+    if (!adopted_) {
+      DEBUG_LOG("[N] Not adopted!");
+      return;
+    }
+
+    // Check if already transmitting to prevent re-entrancy
+    if (transmitting_) {
+      DEBUG_LOG("[N] TX busy, dropped");
+      stats_.bump(DIAG_TX_BUSY);
+      return;
+    }
+
+    transmitting_ = true; // Set lock
+    radio_.idle(); // Ensure LoRa is not in RX mode
+
+    int len = strlen(msg);
+    DEBUG_LOG("[N] Send: %s", msg);
+
+    if (len > PAYLOAD_MAX) {
+      DEBUG_LOG("[N] Msg too long");
+      transmitting_ = false;
+      radio_.receive();
+      return;
+    }
+
+    // The frame is built, encrypted and authenticated in one pass: every
+    // ciphertext block is produced in place in the packet, fed to the MAC
+    // and pushed to the radio FIFO before the next one is encrypted.
+    ScratchLease frameLease(scratch_, SCRATCH_FRAME);
+    ScratchLease cipherLease(scratch_, SCRATCH_CIPHER);
+    ScratchLease hmacLease(scratch_, SCRATCH_HMAC);
+    CipherScratch& c = scratch_.cipher;
+
+    // Always at least one padding byte, so a 16 byte message takes two blocks
+    SecureFrame<uint8_t> frame(scratch_.frame, SecureFrame<uint8_t>::lenFor(len));
+    int paddedLen = frame.ciphertextLen();
+
+    // Build header: type + SERIAL_ID + counter32 + nonce(8) + origLen
+    frame.setHeader(MSG_DATA, serialId_);
+    frame.setCounter(txCounter_);
+    frame.setOrigLen(len);
+
+    // Prepare IV (SERIAL_ID + counter32 + nonce)
+    memcpy(c.cbc.iv, serialId_, 4);  // Use first 4 bytes of UUID for IV
+    memcpy(c.cbc.iv + 4, &txCounter_, 4);  // 32-bit counter
+    // Generate random nonce for remaining 8 bytes
+    uint8_t* nonce = frame.nonce();
+    for (int i = 0; i < WIRE_NONCE_LEN; i++) {
+      nonce[i] = random(256);
+      c.cbc.iv[i + 8] = nonce[i];
+    }
+
+    energyMark(ENERGY_CPU, ENERGY_CPU_CRYPTO, ENERGY_CRYPTO_FRAME);
+
+    // Set key
+    aes_.setKey(sessionKey_, 16);
+
+    // HMAC covers: type + SERIAL_ID + counter + nonce + origLen + ciphertext
+    hmacBegin(scratch_.hmac, sessionKey_, 16);
+    hmacUpdate(scratch_.hmac, frame.data(), WIRE_SECURE_HEADER_LEN);
+
+    // Reset watchdog before transmission
+    wdt_reset();
+
+    radio_.beginPacket();
+    radio_.write(frame.data(), WIRE_SECURE_HEADER_LEN);
+
+    // Encrypt blocks (CBC mode) straight from msg, padded with 0x80 00..
+    uint8_t* ciphertext = frame.ciphertext();
+    const uint8_t* iv = c.cbc.iv;
+    for (int i = 0; i < paddedLen; i += 16) {
+      // XOR plaintext with IV for CBC mode
+      for (int j = 0; j < 16; j++) {
+        int k = i + j;
+        uint8_t b = k < len ? (uint8_t)msg[k] : (k == len ? 0x80 : 0x00);
+        c.cbc.block[j] = b ^ iv[j];
+      }
+      // Encrypt block into its final place in the packet
+      aes_.encryptBlock(ciphertext + i, c.cbc.block);
+      hmacUpdate(scratch_.hmac, ciphertext + i, 16);
+      radio_.write(ciphertext + i, 16);
+      // Use ciphertext as IV for next block
+      iv = ciphertext + i;
+    }
+
+    hmacFinish(scratch_.hmac, frame.hmac());
+    radio_.write(frame.hmac(), WIRE_HMAC_LEN);
+    energyMark(ENERGY_CPU, ENERGY_CPU_ACTIVE);
+
+    txCounter_++;  // Increment counter
+
+    // Use non-blocking endPacket with timeout
+    bool sent = endPacket();
+    unsigned long txStart = millis();
+    while (!sent && (millis() - txStart < 2000)) {  // 2 second timeout
+      wdt_reset();
+      delay(10);
+    }
+
+    if (sent || (millis() - txStart >= 2000)) {
+      if (sent) {
+        DEBUG_LOG("[N] Encrypted sent");
+      } else {
+        DEBUG_LOG("[N] TX timeout!");
+      }
+    }
+
+    transmitting_ = false; // Release lock
+    radio_.receive();
+    stackCheckpoint(STACK_PATH_TX);
+    blink(1);
+    wdt_reset();
+  }
+
+  // Radio RX callback, runs in ISR context: only drain the FIFO into the rx
+  // slice, all parsing and crypto happens from loop(). Public so a host
+  // harness running several nodes can raise it on the right instance.
+  void receive(int ps) {
+    if (ps == 0) return;
+
+    if (scratch_.rxLen) { // Previous frame not dispatched yet, drop
+      stats_.bump(DIAG_RX_OVERRUN);
+      return;
+    }
+
+    scratch_.rxLen = radio_.read(scratch_.rx, ps > 255 ? 255 : ps, RX_FRAME_MAX);
+    rxAt_ = micros();
+  }
+
+private:
+  // diag;stack;<peak bytes>;<min free bytes>;<path>
+  void sendStackReport() {
+    stackCheckpoint(STACK_PATH_LOOP);
+
+    char m[32];
+    snprintf(m, sizeof(m), "diag;stack;%u;%u;%u",
+             stackStats.peak,
+             stackStats.minFree,
+             stackStats.path);
+    sendData(m);
+  }
+
+  // diag;batt;<mV>;<trend mV/hour>
+  void sendBatteryReport() {
+    char m[32];
+    snprintf(m, sizeof(m), "diag;batt;%u;%d",
+             battery_.millivolts(),
+             battery_.trendMvPerHour());
+    sendData(m);
+  }
+
+  // MSG_DIAG: the health counters, authenticated but in the clear. The
+  // counters start over once the report is on the air.
+  void sendDiagReport() {
+    if (transmitting_) {
+      stats_.bump(DIAG_TX_BUSY);
+      return;
+    }
+
+    ScratchLease lease(scratch_, SCRATCH_FRAME);
+    DiagFrame<uint8_t> frame(scratch_.frame);
+    frame.setHeader(MSG_DIAG, serialId_);
+    frame.setCounter(txCounter_);
+    stats_.snapshot(frame.payload());
+    computeHMAC(scratch_, sessionKey_, 16, frame.data(), frame.SIGNED_LEN, frame.hmac());
+    txCounter_++;
+
+    wdt_reset();
+
+    radio_.idle();
+    radio_.beginPacket();
+    radio_.write(frame.data(), frame.LEN);
+    if (endPacket()) {
+      DEBUG_LOG("[N] Diag sent");
+    }
+    radio_.receive();
+  }
+
+  // Blocking send of the packet written since beginPacket(), counted.
+  // The answer may follow, so a sleeping node listens for a while.
+  bool endPacket() {
+    bool ok = radio_.endPacket();
+    stats_.bump(ok ? DIAG_TX_FRAMES : DIAG_TX_FAIL);
+    listenUntil_ = millis() + BEACON_LISTEN_MS;
+    return ok;
+  }
+
+  // Close windows that passed without their beacon, and tell the hub when
+  // the node starts or stops sleeping between them
+  void pollBeacon() {
+    unsigned long now = millis();
+    while (beacon_.locked() && (long)(now - beacon_.windowEnd()) > 0) {
+      stats_.bump(DIAG_BEACON_MISSED);
+      if (!beacon_.miss()) {
+        DEBUG_LOG("[N] Beacon lost");
+      }
+    }
+
+    bool windows = beacon_.locked() && device_.rxWindows();
+    if (windows == windows_ || !isReady() || transmitting_) return;
+
+    windows_ = windows;
+    beacon_.unsettle();  // The sleep timer takes over millis(), or hands it back
+    sendData(windows ? "rx;beacon" : "rx;continuous");
+  }
+
+  // Radio and MCU asleep until the next window, unless anything is left
+  // to do or to hear first. False if the node did not sleep.
+  bool sleepUntilWindow() {
+    bool awake = awake_;
+    awake_ = false;
+    if (!windows_ || awake || scratch_.rxLen || pendingResponse_ || transmitting_) return false;
+
+    unsigned long now = millis();
+    if ((long)(listenUntil_ - now) > 0) return false;
+
+    long wait = (long)(beacon_.windowStart() - now);
+    if (wait < (long)SLEEP_STEP_MIN_MS) return false;  // Window open or nearly
+
+    logSettle();
+    radio_.sleep();
+    sleepMs(wait);
+    radio_.receive();
+    return true;
+  }
+
+#if OTA_ENABLED
+  // After the first sync: confirm an image on trial, or report that the
+  // bootloader rolled one back. An image that cannot sync within
+  // OTA_TRIAL_MS counts as a failed boot.
+  void pollOta() {
+    if (otaChecked_) return;
+
+    if (isReady()) {
+      otaChecked_ = true;
+      uint16_t id;
+      uint8_t state = ota_.bootReport(id);
+      if (state != OTA_NONE) sendOtaStatus(id, state, 0);
+    } else if (otaTrial_ && millis() > OTA_TRIAL_MS) {
+      DEBUG_LOG("[N] OTA trial timeout");
+      otaReset();
+    }
+  }
+
+  // MSG_OTA_STATUS, on the MSG_DATA counter like MSG_DIAG
+  void sendOtaStatus(uint16_t updateId, uint8_t state, uint16_t next) {
+    if (transmitting_) {
+      stats_.bump(DIAG_TX_BUSY);
+      return;
+    }
+
+    ScratchLease lease(scratch_, SCRATCH_FRAME);
+    OtaStatusFrame<uint8_t> frame(scratch_.frame);
+    frame.setHeader(MSG_OTA_STATUS, serialId_);
+    frame.setCounter(txCounter_);
+    frame.setUpdateId(updateId);
+    frame.setState(state);
+    frame.setNext(next);
+    computeHMAC(scratch_, sessionKey_, 16, frame.data(), frame.SIGNED_LEN, frame.hmac());
+    txCounter_++;
+
+    wdt_reset();
+
+    radio_.idle();
+    radio_.beginPacket();
+    radio_.write(frame.data(), frame.LEN);
+    if (endPacket()) {
+      DEBUG_LOG("[N] OTA status %u next %u", state, next);
+    }
+    radio_.receive();
+  }
+#endif
+
+#if BULK_ENABLED
+  // Drop a download gone quiet, and put the next frame of an upload on
+  // the air, one per loop()
+  void pollBulk() {
+    unsigned long now = millis();
+    if (bulkRx_.expired(now)) {
+      DEBUG_LOG("[N] Bulk in timed out, have %x", bulkRx_.received());
+      bulkRx_.clear();
+    }
+
+    if (!bulkTx_.active() || !isReady() || transmitting_) return;
+
+    uint8_t index;
+    uint8_t what = bulkTx_.next(now, index);
+    if (what == BULK_SEND_OFFER) {
+      sendBulkOffer();
+    } else if (what == BULK_SEND_FRAGMENT) {
+      sendBulkFragment(index);
+      stayAwake();  // Rest of the window, then the ack
+    } else if (!bulkTx_.active()) {
+      DEBUG_LOG("[N] Bulk out gave up: %u", bulkTx_.result());
+    }
+  }
+
+  // MSG_BULK_OFFER_UP on the MSG_DATA counter, the data sealed under it
+  void sendBulkOffer() {
+    {
+      ScratchLease lease(scratch_, SCRATCH_CIPHER);
+      CipherScratch& c = scratch_.cipher;
+      wdt_reset();
+      EnergySpan energy(ENERGY_CPU, ENERGY_CPU_CRYPTO, ENERGY_CRYPTO_FRAME);
+      bulkTx_.seal(aes_, sessionKey_, serialId_, txCounter_, c.cbc.iv, c.cbc.block);
+    }
+
+    ScratchLease lease(scratch_, SCRATCH_FRAME);
+    BulkOfferFrame<uint8_t> frame(scratch_.frame);
+    frame.setHeader(MSG_BULK_OFFER_UP, serialId_);
+    bulkTx_.offer(frame);
+    computeHMAC(scratch_, sessionKey_, 16, frame.data(), frame.SIGNED_LEN, frame.hmac());
+    txCounter_++;
+
+    if (transmitBulk(frame.data(), frame.LEN)) {
+      DEBUG_LOG("[N] Bulk offer %u", bulkTx_.counter());
+    }
+  }
+
+  void sendBulkFragment(uint8_t index) {
+    ScratchLease lease(scratch_, SCRATCH_FRAME);
+    BulkFragmentFrame<uint8_t> frame(scratch_.frame,
+        BulkFragmentFrame<uint8_t>::lenFor(bulkTx_.fragmentLen(index)));
+    frame.setHeader(MSG_BULK_FRAGMENT_UP, serialId_);
+    bulkTx_.fragment(frame, index);
+    computeHMAC(scratch_, sessionKey_, 16, frame.data(), frame.signedLen(), frame.hmac());
+    transmitBulk(frame.data(), frame.len());
+  }
+
+  // MSG_BULK_ACK_UP for the hub's transfer counter, no counter of our own
+  void sendBulkAck(uint32_t counter, uint8_t state, uint16_t received) {
+    ScratchLease lease(scratch_, SCRATCH_FRAME);
+    BulkAckFrame<uint8_t> frame(scratch_.frame);
+    frame.setHeader(MSG_BULK_ACK_UP, serialId_);
+    frame.setCounter(counter);
+    frame.setState(state);
+    frame.setReceived(received);
+    computeHMAC(scratch_, sessionKey_, 16, frame.data(), frame.SIGNED_LEN, frame.hmac());
+
+    if (transmitBulk(frame.data(), frame.LEN)) {
+      DEBUG_LOG("[N] Bulk ack %u, have %x", state, received);
+    }
+  }
+
+  bool transmitBulk(const uint8_t* p, size_t len) {
+    wdt_reset();
+
+    radio_.idle();
+    radio_.beginPacket();
+    radio_.write(p, len);
+    bool sent = endPacket();
+    radio_.receive();
+    return sent;
+  }
+#endif
+
+  // Replay and duplicate check for frames carrying a hub counter
+  bool freshCounter(uint32_t counter) {
+    if (counter < rxCounter_) {
+      DEBUG_LOG("[N] Replay!");
+      stats_.bump(DIAG_RX_REPLAY);
+      return false;
+    }
+
+    if (counter == lastRxCounter_) {
+      DEBUG_LOG("[N] Duplicate!");
+      stats_.bump(DIAG_RX_DUPLICATE);
+      return false;
+    }
+
+    return true;
+  }
+
+  // Source rate and crypto budget (NodeGuard.h), once the cheap checks of
+  // a frame have passed
+  bool admit(uint8_t source) {
+    uint8_t why = guard_.admit(source, millis());
+    if (why == GUARD_OK) return true;
+
+    DEBUG_LOG("[N] Dropped before the MAC, source %u: %s", source,
+              why == GUARD_RATE ? "rate" : "budget");
+    stats_.bump(why == GUARD_RATE ? DIAG_RX_RATE_LIMITED : DIAG_RX_OVER_BUDGET);
+    return false;
+  }
+
+  // The MAC or tag of an admitted frame, checked since startUs: a frame of
+  // the hub's gives its source the burst back, a failure is charged to the
+  // budget
+  void checked(uint8_t source, bool valid, unsigned long startUs) {
+    if (valid) {
+      guard_.passed(source, millis());
+      return;
+    }
+    stats_.bump(DIAG_RX_BAD_HMAC);
+    guard_.failed(micros() - startUs);
+  }
+
+  // verifyHMAC() of an admitted frame
+  bool verifyFrame(uint8_t source, const uint8_t* key, const uint8_t* p, size_t signedLen,
+                   const uint8_t* hmac) {
+    unsigned long start = micros();
+    bool valid = verifyHMAC(scratch_, key, 16, p, signedLen, hmac);
+    checked(source, valid, start);
+    return valid;
+  }
+
+  void saveKeys() {
+    DEBUG_LOG("[N] Saving...");
+    EEPROM.put(EE_MAGIC_ADDR, (uint16_t)EE_MAGIC);
+
+    for (int i = 0; i < 21; i++)
+      EEPROM.write(EE_PRIV_ADDR + i, privKey_[i]);
+
+    for (int i = 0; i < 16; i++)
+      EEPROM.write(EE_KEY_ADDR + i, sessionKey_[i]);
+  }
+
+  void loadSerialId() {
+    uint16_t m;
+    EEPROM.get(EE_SERIAL_MAGIC_ADDR, m);
+
+    if (m == EE_SERIAL_MAGIC) {
+      for (int i = 0; i < 16; i++)
+        serialId_[i] = EEPROM.read(EE_SERIAL_ADDR + i);
+      return;
+    }
+
+    for (int i = 0; i < 16; i++)
+      EEPROM.write(EE_SERIAL_ADDR + i, serialId_[i]);
+    EEPROM.put(EE_SERIAL_MAGIC_ADDR, (uint16_t)EE_SERIAL_MAGIC);
+  }
+
+  bool load() {
+    uint16_t m;
+    EEPROM.get(EE_MAGIC_ADDR, m);
+
+    if (m != EE_MAGIC) {
+      DEBUG_LOG("[N] No save");
+      return false;
+    }
+
+    for (int i = 0; i < 21; i++)
+      privKey_[i] = EEPROM.read(EE_PRIV_ADDR + i);
+
+    for (int i = 0; i < 16; i++)
+      sessionKey_[i] = EEPROM.read(EE_KEY_ADDR + i);
+
+    loadEpoch();
+    loadGroup();
+
+    DEBUG_LOG("[N] Loaded UUID: %U", logId(serialId_));
+    DEBUG_LOG("[N] Key: %h", logHex(sessionKey_, 16));
+
+    return true;
+  }
+
+  void loadEpoch() {
+    uint16_t m;
+    EEPROM.get(EE_RESYNC_MAGIC_ADDR, m);
+    if (m != EE_RESYNC_MAGIC) return;
+
+    uint32_t adopted;
+    EEPROM.get(EE_ADOPT_EPOCH_ADDR, adopted);
+    EEPROM.get(EE_EPOCH_ADDR, epoch_);
+    if (epoch_ != adopted) epochKey(epoch_);
+    epochs_ = true;
+  }
+
+  // hubPub points into the MSG_ADOPT_RSP, the magic goes last so a reset
+  // halfway leaves the node on challenges only
+  void saveEpoch(const uint8_t* hubPub, uint32_t epoch) {
+    EEPROM.put(EE_RESYNC_MAGIC_ADDR, (uint16_t)0);
+    for (int i = 0; i < WIRE_PUBKEY_LEN; i++)
+      EEPROM.write(EE_HUB_PUB_ADDR + i, hubPub[i]);
+    EEPROM.put(EE_ADOPT_EPOCH_ADDR, epoch);
+    EEPROM.put(EE_EPOCH_ADDR, epoch);
+    EEPROM.put(EE_RESYNC_MAGIC_ADDR, (uint16_t)EE_RESYNC_MAGIC);
+    epoch_ = epoch;
+    epochs_ = true;
+  }
+
+  // Session key for epoch, from the adoption key (NodeWire.h)
+  void epochKey(uint32_t epoch) {
+    uint8_t in[WIRE_RESYNC_SIGNED_LEN];
+    in[0] = MSG_RESYNC;
+    wireWriteU32(in + WIRE_RESYNC_EPOCH, epoch);
+
+    for (int i = 0; i < 16; i++)
+      sessionKey_[i] = EEPROM.read(EE_KEY_ADDR + i);
+    computeHMAC(scratch_, sessionKey_, 16, in, sizeof(in), scratch_.hmac.inner);
+    memcpy(sessionKey_, scratch_.hmac.inner, 16);
+  }
+
+  void loadGroup() {
+    uint16_t m;
+    EEPROM.get(EE_GROUP_MAGIC_ADDR, m);
+    if (m != EE_GROUP_MAGIC) return;
+
+    for (int i = 0; i < 16; i++)
+      groupKey_[i] = EEPROM.read(EE_GROUP_KEY_ADDR + i);
+    EEPROM.get(EE_GROUP_COUNTER_ADDR, groupRx_);
+    groupSaved_ = groupRx_;
+    grouped_ = true;
+  }
+
+  // A group frame was taken. Past the bound in EEPROM the next one is
+  // saved by saveGroupCounter(), after the frame has been acted on.
+  void groupAccepted(uint32_t counter) {
+    groupRx_ = counter + 1;
+    if (groupRx_ > groupSaved_) groupSavePending_ = true;
+  }
+
+  void saveGroupCounter() {
+    if (!groupSavePending_) return;
+    groupSavePending_ = false;
+    groupSaved_ = groupRx_ + GROUP_COUNTER_RESERVE;
+    EEPROM.put(EE_GROUP_COUNTER_ADDR, groupSaved_);
+  }
+
+  void clear() {
+    DEBUG_LOG("[N] CLEAR!");
+    EEPROM.put(EE_MAGIC_ADDR, (uint16_t)0);
+    EEPROM.put(EE_GROUP_MAGIC_ADDR, (uint16_t)0);
+    EEPROM.put(EE_RESYNC_MAGIC_ADDR, (uint16_t)0);
+    adopted_ = false;
+    grouped_ = false;
+    epochs_ = false;
+    blink(5, 50);
+  }
+
+  // random() per node: the serial ID differs between nodes, the low ADC
+  // bits between boots, and whatever state random() has is kept (the
+  // simulator's per-board seed). Unseeded, every AVR node draws the same
+  // numbers and backs off in step with the others.
+  void seedRandom() {
+    uint32_t seed = random(0x7FFFFFFFL);
+    for (uint8_t i = 0; i < WIRE_ID_LEN; i++) seed = (seed ^ serialId_[i]) * 16777619UL;
+    for (uint8_t i = 0; i < 16; i++) seed = (seed ^ (analogRead(VBAT_PIN) & 3)) * 16777619UL;
+    randomSeed(seed);
+  }
+
+  void sendDiscovery() {
+    // Send discovery packet: type + SERIAL_ID (16 bytes)
+    ScratchLease lease(scratch_, SCRATCH_FRAME);
+    DiscoveryFrame<uint8_t> frame(scratch_.frame);
+    frame.setHeader(MSG_DISCOVERY, serialId_);
+
+    wdt_reset();  // Reset watchdog before transmission
+
+    radio_.beginPacket();
+    radio_.write(frame.data(), frame.LEN);
+    if (endPacket()) {
+      DEBUG_LOG("[N] Discovery sent (UUID: %U)", logId(serialId_));
+    }
+
+    radio_.receive();
+  }
+
+  void sendChallenge() {
+    // Generate random nonce for challenge
+    for (int i = 0; i < 8; i++) {
+      challengeNonce_[i] = random(256);
+    }
+
+    // Build challenge packet: type + SERIAL_ID + txCounter + rxCounter + nonce + HMAC
+    ScratchLease lease(scratch_, SCRATCH_FRAME);
+    ChallengeFrame<uint8_t> frame(scratch_.frame);
+    frame.setHeader(MSG_CHALLENGE, serialId_);
+    frame.setTx(txCounter_);
+    frame.setRx(rxCounter_);
+    memcpy(frame.nonce(), challengeNonce_, WIRE_NONCE_LEN);
+
+    // Compute HMAC over the packet (except HMAC itself)
+    uint8_t* hmac = frame.hmac();
+    computeHMAC(scratch_, sessionKey_, 16, frame.data(), frame.SIGNED_LEN, hmac);
+
+    DEBUG_LOG("[N] Challenge HMAC: %h", logHex(hmac, WIRE_HMAC_LEN));
+
+    wdt_reset();  // Reset watchdog before transmission
+
+    radio_.beginPacket();
+    radio_.write(frame.data(), frame.LEN);  // Send with HMAC
+    if (endPacket()) {
+      DEBUG_LOG("[N] Challenge sent - TX: %u, RX: %u, Nonce: %h",
+                txCounter_, rxCounter_, logHex(challengeNonce_, WIRE_NONCE_LEN));
+      guard_.solicit(millis());
+    }
+
+    radio_.receive();
+  }
+
+  void sendAdopt() {
+    DEBUG_LOG("[N] Adopt req...");
+
+    // Generate fresh keys for each adoption attempt
+    DEBUG_LOG("[N] Gen fresh keys...");
+    uECC_set_rng(&getRng);
+
+    // Reset watchdog before key generation (can take time)
+    wdt_reset();
+
+    // Public key is generated straight into its place in the packet
+    ScratchLease lease(scratch_, SCRATCH_FRAME);
+    AdoptRequestFrame<uint8_t> frame(scratch_.frame);
+    uint8_t* pubKey = frame.pubKey();
+    energyMark(ENERGY_CPU, ENERGY_CPU_CRYPTO, ENERGY_CRYPTO_ECDH);
+    bool generated = uECC_make_key(pubKey, privKey_, uECC_secp160r1());
+    energyMark(ENERGY_CPU, ENERGY_CPU_ACTIVE);
+    if (!generated) {
+      DEBUG_LOG("[N] Key gen FAIL!");
+      return;
+    }
+    stackCheckpoint(STACK_PATH_ECDH_KEYGEN);
+
+    wdt_reset();  // Reset after key generation
+
+    DEBUG_LOG("[N] NewPriv: %h", logHex(privKey_, 20));
+    DEBUG_LOG("[N] NewPub: %h", logHex(pubKey, 40));
+
+    // Send FULL public key: type + SERIAL_ID + pubKey(40 bytes)
+    frame.setHeader(MSG_ADOPT_REQ, serialId_);
+
+    DEBUG_LOG("[N] Pkt size: %u", frame.LEN);
+
+    radio_.beginPacket();
+    radio_.write(frame.data(), frame.LEN);
+    if (endPacket()) {
+      DEBUG_LOG("[N] Sent OK");
+    } else {
+      DEBUG_LOG("[N] Send FAIL!");
+    }
+
+    // Go back to receive mode
+    radio_.receive();
+
+    blink(3, 50);
+  }
+
+  void handleAdopt(uint8_t* p, int len) {
+    AdoptResponseFrame<const uint8_t> frame(p, len);
+    if (!frame.valid()) {
+      DEBUG_LOG("[N] Bad rsp");
+      stats_.bump(DIAG_RX_MALFORMED);
+      return;
+    }
+
+    // Compare 16-byte UUID
+    if (!frame.isFor(serialId_)) {
+      DEBUG_LOG("[N] Wrong UUID");
+      stats_.bump(DIAG_RX_WRONG_ID);
+      return;
+    }
+
+    adopt_.stop();
+    if (frame.status() != 1) {
+      DEBUG_LOG("[N] Rejected");
+      return;
+    }
+
+    DEBUG_LOG("[N] ADOPTED!");
+
+    const uint8_t* hubPub = frame.hubPubKey();  // Full public key
+
+    DEBUG_LOG("[N] HubPub: %h", logHex(hubPub, 20));
+
+    // Reset watchdog before ECDH
+    wdt_reset();
+
+    // ECDH shared secret
+    ScratchLease lease(scratch_, SCRATCH_CIPHER);
+    uint8_t* secret = scratch_.cipher.secret;
+    energyMark(ENERGY_CPU, ENERGY_CPU_CRYPTO, ENERGY_CRYPTO_ECDH);
+    bool shared = uECC_shared_secret(hubPub, privKey_, secret, uECC_secp160r1());
+    energyMark(ENERGY_CPU, ENERGY_CPU_ACTIVE);
+    if (!shared) {
+      DEBUG_LOG("[N] ECDH FAIL!");
+      return;
+    }
+    stackCheckpoint(STACK_PATH_ECDH_SHARED);
+
+    DEBUG_LOG("[N] Secret: %h", logHex(secret, 20));
+
+    // KDF: XOR fold to 16 bytes
+    for (int i = 0; i < 16; i++) {
+      sessionKey_[i] = secret[i] ^ secret[(i + 4) % 20];
+    }
+
+    DEBUG_LOG("[N] Session: %h", logHex(sessionKey_, 16));
+
+    adopted_ = true;
+    saveKeys();
+    saveEpoch(hubPub, frame.epoch());
+    discovery_.stop();
+    challenge_.start(millis(), 0);
+    blink(10, 100);
+  }
+
+  void handleCommand(uint8_t* p, int len) {
+    // Whole blocks with origLen inside them, so the NUL written after the
+    // plaintext below stays in the frame
+    SecureFrame<uint8_t> frame(p, len);
+    if (!frame.valid()) {
+      DEBUG_LOG("[N] Bad cmd size");
+      stats_.bump(DIAG_RX_MALFORMED);
+      return;
+    }
+
+    // Compare 16-byte UUID
+    if (!frame.isFor(serialId_)) {
+      DEBUG_LOG("[N] Cmd wrong UUID");
+      stats_.bump(DIAG_RX_WRONG_ID);
+      return;
+    }
+
+    // Counter validation (prevent replay attacks), before paying for the MAC
+    uint32_t counter = frame.counter();
+    if (!freshCounter(counter)) return;
+    if (!admit(GUARD_NODE)) return;
+
+    // Verify HMAC (last 32 bytes of packet)
+    if (!verifyFrame(GUARD_NODE, sessionKey_, p, frame.signedLen(), frame.hmac())) {
+      DEBUG_LOG("[N] HMAC FAIL!");
+      return;
+    }
+
+    DEBUG_LOG("[N] HMAC OK");
+    DEBUG_LOG("[N] Counter: %u", counter);
+
+    ScratchLease lease(scratch_, SCRATCH_CIPHER);
+    char* plaintext = decrypt(frame, sessionKey_);
+
+    // Update counters after successful decryption
+    lastRxCounter_ = counter;
+    rxCounter_ = counter + 1;
+
+    DEBUG_LOG("[N] Command: %s", plaintext);
+
+    // Execute command
+    device_.handleCommand(*this, plaintext);
+  }
+
+  // Decrypt an authenticated frame in place (CBC mode), the plaintext
+  // replaces the ciphertext in the rx slice and is NUL terminated. The IV
+  // starts with the frame's own ID field, SERIAL_ID or a group ID. The
+  // caller holds the cipher slice.
+  char* decrypt(const SecureFrame<uint8_t>& frame, const uint8_t* key) {
+    CipherScratch& c = scratch_.cipher;
+    uint32_t counter = frame.counter();
+    uint8_t* ciphertext = frame.ciphertext();
+    size_t ciphertextLen = frame.ciphertextLen();
+
+    // Prepare IV (ID + counter32 + nonce from packet)
+    memcpy(c.cbc.iv, frame.serialId(), 4);
+    memcpy(c.cbc.iv + 4, &counter, 4);  // 32-bit counter
+    memcpy(c.cbc.iv + 8, frame.nonce(), WIRE_NONCE_LEN);  // 8-byte nonce from packet
+
+    // Reset watchdog before decryption
+    wdt_reset();
+
+    energyMark(ENERGY_CPU, ENERGY_CPU_CRYPTO, ENERGY_CRYPTO_FRAME);
+
+    // Set key
+    aes_.setKey(key, 16);
+
+    uint8_t* plaintext = ciphertext;
+
+    for (size_t i = 0; i < ciphertextLen; i += 16) {
+      // Keep current ciphertext, it is the IV for the next block
+      memcpy(c.cbc.block, ciphertext + i, 16);
+      // Decrypt block
+      aes_.decryptBlock(plaintext + i, c.cbc.block);
+      // XOR with IV (previous ciphertext block)
+      for (int j = 0; j < 16; j++) {
+        plaintext[i + j] ^= c.cbc.iv[j];
+      }
+      memcpy(c.cbc.iv, c.cbc.block, 16);
+    }
+
+    energyMark(ENERGY_CPU, ENERGY_CPU_ACTIVE);
+
+    // Null terminate
+    plaintext[frame.origLen()] = 0;
+    return (char*)plaintext;
+  }
+
+  // Group ID, key and counter from the hub, under the session key like a
+  // command. Replaces any previous group.
+  void handleGroupJoin(uint8_t* p, int len) {
+    SecureFrame<uint8_t> frame(p, len);
+    if (!frame.valid() || frame.origLen() != WIRE_GROUP_JOIN_LEN) {
+      DEBUG_LOG("[N] Bad group join");
+      stats_.bump(DIAG_RX_MALFORMED);
+      return;
+    }
+
+    if (!frame.isFor(serialId_)) {
+      stats_.bump(DIAG_RX_WRONG_ID);
+      return;
+    }
+
+    uint32_t counter = frame.counter();
+    if (!freshCounter(counter)) return;
+    if (!admit(GUARD_NODE)) return;
+
+    if (!verifyFrame(GUARD_NODE, sessionKey_, p, frame.signedLen(), frame.hmac())) {
+      DEBUG_LOG("[N] Group join HMAC FAIL!");
+      return;
+    }
+
+    ScratchLease lease(scratch_, SCRATCH_CIPHER);
+    const uint8_t* join = (const uint8_t*)decrypt(frame, sessionKey_);
+
+    lastRxCounter_ = counter;
+    rxCounter_ = counter + 1;
+
+    memcpy(groupKey_, join + WIRE_GROUP_JOIN_KEY, 16);
+    groupRx_ = wireReadU32(join + WIRE_GROUP_JOIN_COUNTER);
+    grouped_ = true;
+
+    for (int i = 0; i < 16; i++) {
+      EEPROM.write(EE_GROUP_ID_ADDR + i, join[WIRE_GROUP_JOIN_ID + i]);
+      EEPROM.write(EE_GROUP_KEY_ADDR + i, groupKey_[i]);
+    }
+    EEPROM.put(EE_GROUP_COUNTER_ADDR, groupRx_);
+    EEPROM.put(EE_GROUP_MAGIC_ADDR, (uint16_t)EE_GROUP_MAGIC);
+    groupSaved_ = groupRx_;
+    groupSavePending_ = false;
+
+    DEBUG_LOG("[N] Joined group %h", logHex(join + WIRE_GROUP_JOIN_ID, 16));
+
+    // The hub joins members back to back, spread the answers like group
+    // command replies
+    replyAt_ = millis() + random(GROUP_REPLY_SPREAD);
+    queueResponse("group;ok");
+  }
+
+  // One frame for every member. Members answer at random within
+  // GROUP_REPLY_SPREAD so their replies do not all collide at the hub.
+  void handleGroupCommand(uint8_t* p, int len) {
+    SecureFrame<uint8_t> frame(p, len);
+    if (!frame.valid()) {
+      DEBUG_LOG("[N] Bad group cmd size");
+      stats_.bump(DIAG_RX_MALFORMED);
+      return;
+    }
+
+    if (!grouped_ || !inGroup(frame.serialId())) {
+      stats_.bump(DIAG_RX_WRONG_ID);
+      return;
+    }
+
+    uint32_t counter = frame.counter();
+    if (counter < groupRx_) {
+      // The hub repeats group commands, members that got one see the copies
+      DEBUG_LOG("[N] Group replay!");
+      stats_.bump(counter + 1 == groupRx_ ? DIAG_RX_DUPLICATE : DIAG_RX_REPLAY);
+      return;
+    }
+    if (!admit(GUARD_GROUP)) return;
+
+    if (!verifyFrame(GUARD_GROUP, groupKey_, p, frame.signedLen(), frame.hmac())) {
+      DEBUG_LOG("[N] Group HMAC FAIL!");
+      return;
+    }
+
+    ScratchLease lease(scratch_, SCRATCH_CIPHER);
+    char* plaintext = decrypt(frame, groupKey_);
+
+    groupAccepted(counter);
+
+    DEBUG_LOG("[N] Group command: %s", plaintext);
+
+    replyAt_ = millis() + random(GROUP_REPLY_SPREAD);
+    device_.handleCommand(*this, plaintext);
+  }
+
+  // Siren fast path: tag check, counter check, device, and everything
+  // else after the device has acted. The ID picks the key: our own
+  // SERIAL_ID for the session key, the group ID for the group key.
+  void handleTrigger(uint8_t* p, int len) {
+    TriggerFrame<const uint8_t> frame(p, len);
+    if (!frame.valid()) {
+      stats_.bump(DIAG_RX_MALFORMED);
+      return;
+    }
+
+    bool group = !frame.isFor(serialId_);
+    if (group && (!grouped_ || !inGroup(frame.serialId()))) {
+      stats_.bump(DIAG_RX_WRONG_ID);
+      return;
+    }
+
+    uint32_t counter = frame.counter();
+    if (group) {
+      if (counter < groupRx_) {
+        stats_.bump(counter + 1 == groupRx_ ? DIAG_RX_DUPLICATE : DIAG_RX_REPLAY);
+        return;
+      }
+    } else if (!freshCounter(counter)) {
+      return;
+    }
+    uint8_t source = group ? GUARD_GROUP : GUARD_NODE;
+    if (!admit(source)) return;
+
+    bool valid;
+    unsigned long start = micros();
+    {
+      ScratchLease lease(scratch_, SCRATCH_CIPHER);
+      EnergySpan energy(ENERGY_CPU, ENERGY_CPU_CRYPTO, ENERGY_CRYPTO_FRAME);
+      valid = frame.verify(aes_, group ? groupKey_ : sessionKey_, scratch_.cipher.cbc.block);
+    }
+    checked(source, valid, start);
+    if (!valid) return;
+    if (group) replyAt_ = millis() + random(GROUP_REPLY_SPREAD);
+
+    device_.trigger(*this, frame.action());
+    unsigned long us = micros() - rxAt_;
+    stats_.triggerTime(us);
+
+    if (group) {
+      groupAccepted(counter);
+    } else {
+      lastRxCounter_ = counter;
+      rxCounter_ = counter + 1;
+    }
+
+    DEBUG_LOG("[N] Trigger %u in %u us", frame.action(), us);
+  }
+
+  bool inGroup(const uint8_t* groupId) {
+    for (int i = 0; i < 16; i++) {
+      if (EEPROM.read(EE_GROUP_ID_ADDR + i) != groupId[i]) return false;
+    }
+    return true;
+  }
+
+  void handleBeacon(uint8_t* p, int len) {
+    BeaconFrame<const uint8_t> frame(p, len);
+    if (!frame.valid()) {
+      stats_.bump(DIAG_RX_MALFORMED);
+      return;
+    }
+
+    uint16_t period = beacon_.locked() ? beacon_.period() : 0;
+    if (!beacon_.onBeacon(frame.seq(), frame.period(), millis())) return;
+    if (beacon_.period() != period) {
+      DEBUG_LOG("[N] Beacon lock, period %u", frame.period());
+    }
+
+    if (frame.flags() & BEACON_PENDING) listenUntil_ = millis() + BEACON_LISTEN_MS;
+  }
+
+  // The hub is busy: every request still being retried waits as asked
+  void handleRetry(uint8_t* p, int len) {
+    RetryFrame<const uint8_t> frame(p, len);
+    if (!frame.valid()) {
+      stats_.bump(DIAG_RX_MALFORMED);
+      return;
+    }
+    if (!frame.isFor(serialId_)) {
+      stats_.bump(DIAG_RX_WRONG_ID);
+      return;
+    }
+
+    DEBUG_LOG("[N] Hub busy, retry in ms %u", frame.waitMs());
+
+    unsigned long now = millis();
+    discovery_.hint(now, frame.waitMs());
+    challenge_.hint(now, frame.waitMs());
+    adopt_.hint(now, frame.waitMs());
+  }
+
+  // New key epoch for every node: the epoch first, the signature only for
+  // a higher one (about a second of CPU), then the key and counters from
+  // zero. The node is in sync as soon as it has the key.
+  void handleResync(uint8_t* p, int len) {
+    ResyncFrame<const uint8_t> frame(p, len);
+    if (!frame.valid()) {
+      stats_.bump(DIAG_RX_MALFORMED);
+      return;
+    }
+    if (!adopted_ || !epochs_ || frame.epoch() <= epoch_) return;
+    if (!guard_.admitSignature(millis())) {
+      // Too many to check: if the epoch is real our challenge fails and
+      // the hub sends it again, to a node that asked for it
+      DEBUG_LOG("[N] Resync unchecked, epoch %u", frame.epoch());
+      stats_.bump(DIAG_RX_RESYNC_SKIPPED);
+      if (!challenge_.active() && guard_.confirm(millis())) challenge_.start(millis(), 0);
+      return;
+    }
+
+    bool verified;
+    {
+      ScratchLease frameLease(scratch_, SCRATCH_FRAME);
+      ScratchLease hmacLease(scratch_, SCRATCH_HMAC);
+      SHA256& sha = scratch_.hmac.sha;
+      uint8_t* hash = scratch_.hmac.inner;
+      sha.reset();
+      sha.update(p, frame.SIGNED_LEN);
+      sha.finalize(hash, 32);
+
+      uint8_t* hubPub = scratch_.frame;
+      for (int i = 0; i < WIRE_PUBKEY_LEN; i++)
+        hubPub[i] = EEPROM.read(EE_HUB_PUB_ADDR + i);
+
+      wdt_reset();
+      EnergySpan energy(ENERGY_CPU, ENERGY_CPU_CRYPTO, ENERGY_CRYPTO_ECDSA);
+      verified = uECC_verify(hubPub, hash, 32, frame.signature(), uECC_secp160r1());
+      stackCheckpoint(STACK_PATH_ECDSA_VERIFY);
+    }
+    if (!verified) {
+      DEBUG_LOG("[N] Resync signature FAIL!");
+      stats_.bump(DIAG_RX_BAD_HMAC);
+      return;
+    }
+    guard_.signatureHeld();
+
+    epoch_ = frame.epoch();
+    EEPROM.put(EE_EPOCH_ADDR, epoch_);
+    epochKey(epoch_);
+
+    txCounter_ = 0;
+    rxCounter_ = 0;
+    lastRxCounter_ = 0xFFFFFFFF;
+#if BULK_ENABLED
+    bulkLostFrom_ = 0;
+#endif
+
+    DEBUG_LOG("[N] Resync, epoch %u", epoch_);
+
+    // Every node got this frame at the same moment: first telemetry at a
+    // random point of the interval, or they all report together from now on
+    lastSend_ = millis() - random(TELEMETRY_INTERVAL);
+
+    countersSynced_ = true;
+    challenge_.stop();
+  }
+
+  void handleDiscoveryAck(uint8_t* p, int len) {
+    DiscoveryFrame<const uint8_t> frame(p, len);
+    if (!frame.valid()) {
+      DEBUG_LOG("[N] Bad discovery ack");
+      stats_.bump(DIAG_RX_MALFORMED);
+      return;
+    }
+
+    // Verify it's for our node
+    if (!frame.isFor(serialId_)) {
+      DEBUG_LOG("[N] Wrong UUID in discovery ack");
+      stats_.bump(DIAG_RX_WRONG_ID);
+      return;
+    }
+
+    DEBUG_LOG("[N] Discovery ACK received - stopping discovery");
+    discoveryAcked_ = true; // Stop sending discovery packets
+    discovery_.stop();
+    blink(2);
+  }
+
+  void handleHubChallenge(uint8_t* p, int len) {
+    ChallengeFrame<const uint8_t> in(p, len);
+    if (!in.valid()) {
+      DEBUG_LOG("[N] Bad hub challenge");
+      stats_.bump(DIAG_RX_MALFORMED);
+      return;
+    }
+
+    // Verify it's for our node
+    if (!in.isFor(serialId_)) {
+      DEBUG_LOG("[N] Wrong UUID in hub challenge");
+      stats_.bump(DIAG_RX_WRONG_ID);
+      return;
+    }
+
+    // It carries no nonce of ours and moves our window to the hub's
+    // counters: behind the window it is an old one replayed. A hub that
+    // lost its counters comes back through our challenge or MSG_RESYNC.
+    if (countersSynced_ && in.tx() < rxCounter_) {
+      DEBUG_LOG("[N] Hub challenge behind the window");
+      stats_.bump(DIAG_RX_REPLAY);
+      return;
+    }
+
+    // Answering costs two MACs and a send, so the source rate applies first
+    if (!admit(GUARD_NODE)) return;
+
+    // Verify HMAC (last 32 bytes)
+    if (!verifyFrame(GUARD_NODE, sessionKey_, p, in.SIGNED_LEN, in.hmac())) {
+      DEBUG_LOG("[N] Hub challenge HMAC FAIL!");
+      return;
+    }
+
+    DEBUG_LOG("[N] Hub challenge HMAC OK");
+
+    // Extract hub's counters
+    uint32_t hubTxCounter = in.tx();
+    uint32_t hubRxCounter = in.rx();
+
+    DEBUG_LOG("[N] Hub challenge - Hub TX: %u, Hub RX: %u", hubTxCounter, hubRxCounter);
+
+    // Sync our TX counter with what hub expects
+    if (hubRxCounter != txCounter_) {
+      DEBUG_LOG("[N] Adjusting TX counter: %u -> %u", txCounter_, hubRxCounter);
+      txCounter_ = hubRxCounter;
+    }
+
+    // Sync our RX counter with hub's TX
+    rxCounter_ = hubTxCounter;
+    lastRxCounter_ = 0xFFFFFFFF;
+
+    // Send response using same MSG_CHALLENGE_RSP message type
+    ScratchLease lease(scratch_, SCRATCH_FRAME);
+    ChallengeFrame<uint8_t> out(scratch_.frame);
+    out.setHeader(MSG_CHALLENGE_RSP, serialId_);
+    out.setTx(txCounter_);
+    out.setRx(rxCounter_);
+    memcpy(out.nonce(), in.nonce(), WIRE_NONCE_LEN);  // Echo back the hub's nonce
+
+    // Compute HMAC
+    computeHMAC(scratch_, sessionKey_, 16, out.data(), out.SIGNED_LEN, out.hmac());
+
+    // Send response
+    radio_.beginPacket();
+    radio_.write(out.data(), out.LEN);
+    if (endPacket()) {
+      DEBUG_LOG("[N] Hub challenge response sent");
+      countersSynced_ = true;
+      challenge_.stop();
+      blink(2, 100);
+    } else {
+      DEBUG_LOG("[N] Hub challenge response FAIL!");
+    }
+
+    radio_.receive();
+  }
+
+  void handleChallengeResponse(uint8_t* p, int len) {
+    ChallengeFrame<const uint8_t> frame(p, len);
+    if (!frame.valid()) {
+      DEBUG_LOG("[N] Bad challenge rsp");
+      stats_.bump(DIAG_RX_MALFORMED);
+      return;
+    }
+
+    // Verify it's for our node
+    if (!frame.isFor(serialId_)) {
+      DEBUG_LOG("[N] Wrong UUID in rsp");
+      stats_.bump(DIAG_RX_WRONG_ID);
+      return;
+    }
+
+    // Only the answer to our own challenge out, with its nonce
+    if (!challenge_.active() || memcmp(frame.nonce(), challengeNonce_, WIRE_NONCE_LEN) != 0) {
+      DEBUG_LOG("[N] Nonce mismatch!");
+      stats_.bump(DIAG_RX_BAD_NONCE);
+      return;
+    }
+    if (!admit(GUARD_NODE)) return;
+
+    // Verify HMAC (last 32 bytes)
+    if (!verifyFrame(GUARD_NODE, sessionKey_, p, frame.SIGNED_LEN, frame.hmac())) {
+      DEBUG_LOG("[N] Challenge HMAC FAIL!");
+      return;
+    }
+
+    DEBUG_LOG("[N] Challenge HMAC OK");
+
+    // Extract hub's counter
+    uint32_t hubTxCounter = frame.tx();
+
+    // Sync counters
+    rxCounter_ = hubTxCounter;  // Hub's TX becomes our expected RX
+    lastRxCounter_ = 0xFFFFFFFF;  // Reset duplicate detection
+
+    DEBUG_LOG("[N] Counters synced! Our TX: %u, Hub TX (our RX): %u, Hub RX: %u",
+              txCounter_, rxCounter_, frame.rx());
+
+    countersSynced_ = true;
+    challenge_.stop();
+    blink(3, 50); // Indicate sync success
+  }
+
+#if OTA_ENABLED
+  void handleOtaOffer(uint8_t* p, int len) {
+    OtaOfferFrame<const uint8_t> frame(p, len);
+    if (!frame.valid()) {
+      DEBUG_LOG("[N] Bad OTA offer");
+      stats_.bump(DIAG_RX_MALFORMED);
+      return;
+    }
+
+    if (!frame.isFor(serialId_)) {
+      stats_.bump(DIAG_RX_WRONG_ID);
+      return;
+    }
+
+    uint32_t counter = frame.counter();
+    if (!freshCounter(counter)) return;
+    if (!admit(GUARD_NODE)) return;
+
+    if (!verifyFrame(GUARD_NODE, sessionKey_, p, frame.SIGNED_LEN, frame.hmac())) {
+      DEBUG_LOG("[N] OTA offer HMAC FAIL!");
+      return;
+    }
+
+    lastRxCounter_ = counter;
+    rxCounter_ = counter + 1;
+
+    DEBUG_LOG("[N] OTA offer %u", frame.updateId());
+
+    uint8_t state = ota_.offer(frame);
+    sendOtaStatus(frame.updateId(), state, ota_.next());
+  }
+
+  void handleOtaChunk(uint8_t* p, int len) {
+    OtaChunkFrame<const uint8_t> frame(p, len);
+    if (!frame.valid()) {
+      DEBUG_LOG("[N] Bad OTA chunk");
+      stats_.bump(DIAG_RX_MALFORMED);
+      return;
+    }
+
+    if (!frame.isFor(serialId_)) {
+      stats_.bump(DIAG_RX_WRONG_ID);
+      return;
+    }
+
+    // Chunks carry no counter: the update ID and offset stand in for it
+    if (!ota_.wants(frame)) return;
+    if (!admit(GUARD_NODE)) return;
+
+    if (!verifyFrame(GUARD_NODE, sessionKey_, p, frame.signedLen(), frame.hmac())) {
+      DEBUG_LOG("[N] OTA chunk HMAC FAIL!");
+      return;
+    }
+
+    uint8_t state = ota_.chunk(frame, scratch_);
+    if (state == OTA_NONE) return;
+
+    sendOtaStatus(frame.updateId(), state, ota_.next());
+    if (state == OTA_STAGED) {
+      DEBUG_LOG("[N] OTA staged, rebooting");
+      delay(100);
+      otaReset();
+    }
+  }
+#endif
+
+#if BULK_ENABLED
+  // A download from the hub takes the buffer, unless an upload holds it
+  void handleBulkOffer(uint8_t* p, int len) {
+    BulkOfferFrame<const uint8_t> frame(p, len);
+    if (!frame.valid()) {
+      DEBUG_LOG("[N] Bad bulk offer");
+      stats_.bump(DIAG_RX_MALFORMED);
+      return;
+    }
+
+    if (!frame.isFor(serialId_)) {
+      stats_.bump(DIAG_RX_WRONG_ID);
+      return;
+    }
+
+    uint32_t counter = frame.counter();
+    if (!freshCounter(counter)) return;
+    if (!admit(GUARD_NODE)) return;
+
+    if (!verifyFrame(GUARD_NODE, sessionKey_, p, frame.SIGNED_LEN, frame.hmac())) {
+      DEBUG_LOG("[N] Bulk offer HMAC FAIL!");
+      return;
+    }
+
+    lastRxCounter_ = counter;
+    rxCounter_ = counter + 1;
+
+    uint8_t state = bulkTx_.active() ? BULK_BUSY : bulkRx_.offer(frame, millis());
+    DEBUG_LOG("[N] Bulk in: kind %u, %u bytes, state %u", frame.kind(), frame.size(), state);
+    sendBulkAck(counter, state, 0);
+  }
+
+  // Fragments of the download in progress go into the buffer. Any other
+  // is dropped before the MAC unless it polls, and then the hub learns
+  // that its transfer is done or gone.
+  void handleBulkFragment(uint8_t* p, int len) {
+    BulkFragmentFrame<const uint8_t> frame(p, len);
+    if (!frame.valid()) {
+      DEBUG_LOG("[N] Bad bulk fragment");
+      stats_.bump(DIAG_RX_MALFORMED);
+      return;
+    }
+
+    if (!frame.isFor(serialId_)) {
+      stats_.bump(DIAG_RX_WRONG_ID);
+      return;
+    }
+
+    // A poll that fits nothing costs a MAC and an ack, so it is only
+    // answered for the transfer in progress, the one handed over, or once
+    // for a transfer we lost: a replayed old poll ends here
+    uint32_t counter = frame.counter();
+    bool fits = bulkRx_.fits(frame);
+    bool current = bulkRx_.active() && counter == bulkRx_.counter();
+    if (!fits && !(frame.poll() &&
+                   (current || bulkRx_.finished(counter) || counter >= bulkLostFrom_))) {
+      return;
+    }
+    if (!admit(GUARD_NODE)) return;
+
+    if (!verifyFrame(GUARD_NODE, sessionKey_, p, frame.signedLen(), frame.hmac())) {
+      DEBUG_LOG("[N] Bulk fragment HMAC FAIL!");
+      return;
+    }
+
+    if (!fits) {
+      if (current) {
+        sendBulkAck(counter, BULK_RECEIVING, bulkRx_.received());
+      } else if (bulkRx_.finished(counter)) {
+        sendBulkAck(counter, BULK_DONE, 0);
+      } else {
+        bulkLostFrom_ = counter + 1;
+        sendBulkAck(counter, BULK_UNKNOWN, 0);
+      }
+      return;
+    }
+
+    if (!bulkRx_.fragment(frame, millis())) {
+      if (frame.poll()) sendBulkAck(counter, BULK_RECEIVING, bulkRx_.received());
+      return;
+    }
+
+    uint8_t state;
+    {
+      ScratchLease lease(scratch_, SCRATCH_CIPHER);
+      CipherScratch& c = scratch_.cipher;
+      wdt_reset();
+      EnergySpan energy(ENERGY_CPU, ENERGY_CPU_CRYPTO, ENERGY_CRYPTO_FRAME);
+      state = bulkRx_.open(aes_, sessionKey_, serialId_, c.cbc.iv, c.cbc.block);
+    }
+
+    DEBUG_LOG("[N] Bulk in complete: kind %u, %u bytes, state %u",
+              bulkRx_.kind(), bulkRx_.len(), state);
+    sendBulkAck(counter, state, bulkRx_.received());
+    if (state == BULK_DONE) device_.bulk(*this, bulkRx_.kind(), bulkRx_.data(), bulkRx_.len());
+  }
+
+  // The hub's progress on our upload
+  void handleBulkAck(uint8_t* p, int len) {
+    BulkAckFrame<const uint8_t> frame(p, len);
+    if (!frame.valid()) {
+      DEBUG_LOG("[N] Bad bulk ack");
+      stats_.bump(DIAG_RX_MALFORMED);
+      return;
+    }
+
+    if (!frame.isFor(serialId_)) {
+      stats_.bump(DIAG_RX_WRONG_ID);
+      return;
+    }
+
+    // Late acks of earlier offers cost nothing
+    if (!bulkTx_.active() || frame.counter() != bulkTx_.counter()) return;
+    if (!admit(GUARD_NODE)) return;
+
+    if (!verifyFrame(GUARD_NODE, sessionKey_, p, frame.SIGNED_LEN, frame.hmac())) {
+      DEBUG_LOG("[N] Bulk ack HMAC FAIL!");
+      return;
+    }
+
+    bulkTx_.onAck(frame.state(), frame.received(), millis());
+    if (!bulkTx_.active()) {
+      DEBUG_LOG("[N] Bulk out finished: %u", bulkTx_.result());
+    }
+  }
+#endif
+
+  void dispatch(uint8_t* buf, int len) {
+    if (buf[0] == MSG_TRIGGER) {
+      handleTrigger(buf, len);
+      stats_.bump(DIAG_RX_FRAMES);
+      stats_.packet(LoRa.packetRssi(), LoRa.packetSnr());
+      listenUntil_ = millis() + BEACON_LISTEN_MS;
+      return;
+    }
+
+    int rssi = LoRa.packetRssi();
+    DEBUG_LOG("[N] RX RSSI: %d", rssi);
+    stats_.bump(DIAG_RX_FRAMES);
+    stats_.packet(rssi, LoRa.packetSnr());
+
+    if (buf[0] == MSG_BEACON) {
+      handleBeacon(buf, len);
+      return;
+    }
+
+    if (buf[0] == MSG_ADOPT_RSP) {
+      handleAdopt(buf, len);
+    } else if (buf[0] == MSG_COMMAND) {
+      handleCommand(buf, len);
+    } else if (buf[0] == MSG_DISCOVERY_ACK) {
+      handleDiscoveryAck(buf, len);
+    } else if (buf[0] == MSG_RETRY) {
+      handleRetry(buf, len);
+    } else if (buf[0] == MSG_CHALLENGE) {
+      handleHubChallenge(buf, len);
+    } else if (buf[0] == MSG_CHALLENGE_RSP) {
+      handleChallengeResponse(buf, len);
+    } else if (buf[0] == MSG_RESYNC) {
+      handleResync(buf, len);
+    } else if (buf[0] == MSG_GROUP_JOIN) {
+      handleGroupJoin(buf, len);
+    } else if (buf[0] == MSG_GROUP_COMMAND) {
+      handleGroupCommand(buf, len);
+#if OTA_ENABLED
+    } else if (buf[0] == MSG_OTA_OFFER) {
+      handleOtaOffer(buf, len);
+    } else if (buf[0] == MSG_OTA_CHUNK) {
+      handleOtaChunk(buf, len);
+#endif
+#if BULK_ENABLED
+    } else if (buf[0] == MSG_BULK_OFFER) {
+      handleBulkOffer(buf, len);
+    } else if (buf[0] == MSG_BULK_FRAGMENT) {
+      handleBulkFragment(buf, len);
+    } else if (buf[0] == MSG_BULK_ACK) {
+      handleBulkAck(buf, len);
+#endif
+    } else {
+      return;  // Another node's uplink
+    }
+
+    // More from the hub may follow, a sleeping node keeps listening
+    listenUntil_ = millis() + BEACON_LISTEN_MS;
+  }
+
+  // LoRa.onReceive() takes a plain function pointer
+  static void onRx(int ps) {
+    instance_->receive(ps);
+  }
+
+  static NodeCore* instance_;
+
+  Device device_;
+  uint8_t serialId_[16];
+
+  ScratchArena scratch_;
+  NodeRadio radio_;
+  BatteryMonitor battery_;
+  NodeStats stats_;
+  RxGuard guard_;
+  BeaconSync beacon_;
+
+  uint8_t privKey_[21]; // secp160r1 = 20 bytes + 1 for alignment
+  uint8_t sessionKey_[16];
+  uint8_t groupKey_[16]; // Group ID stays in EEPROM, see inGroup()
+  uint32_t groupRx_ = 0; // Lowest group counter accepted
+  uint32_t groupSaved_ = 0; // Bound in EEPROM, groupRx_ after a reboot
+  bool groupSavePending_ = false;
+  bool grouped_ = false;
+
+  bool adopted_ = false;
+  bool epochs_ = false;  // Hub key stored, MSG_RESYNC taken
+  uint32_t epoch_ = 0;   // The session key's, see epochKey()
+
+  uint32_t txCounter_ = 0; // Counter for data sent to hub
+  uint32_t rxCounter_ = 0; // Expected counter for commands from hub
+  uint32_t lastRxCounter_ = 0xFFFFFFFF; // Last received counter
+  uint8_t challengeNonce_[8]; // Nonce for challenge-response
+
+  bool countersSynced_ = false; // Flag to track if counters are synced after boot
+  bool discoveryAcked_ = false; // Flag to track if hub acknowledged discovery
+  bool transmitting_ = false; // Lock to prevent simultaneous transmissions
+  bool pendingResponse_ = false; // Flag for deferred response
+  char pendingMsg_[16]; // Buffer for deferred response
+  unsigned long replyAt_ = 0; // Not before this, see handleGroupCommand()
+  volatile unsigned long rxAt_ = 0; // micros() when the ISR took the frame in rx
+
+  bool windows_ = false; // Sleeping between beacon windows, as last told to the hub
+  bool awake_ = false; // stayAwake() since the last sleep check
+  unsigned long listenUntil_ = 0; // Not asleep before this
+
+  unsigned long lastSend_ = 0;
+  Backoff discovery_{DISCOVERY_INTERVAL, RETRY_MAX};
+  Backoff challenge_{CHALLENGE_INTERVAL, RETRY_MAX};
+  Backoff adopt_{ADOPT_INTERVAL, RETRY_MAX};
+  unsigned long lastDiag_ = 0;
+  bool btnDown_ = false;
+
+#if OTA_ENABLED
+  NodeOta ota_;
+  bool otaTrial_ = false;    // Running an update the bootloader just installed
+  bool otaChecked_ = false;  // Boot report done
+#endif
+
+#if BULK_ENABLED
+  uint8_t bulkBuf_[BULK_BUFFER];  // One transfer at a time, either direction
+  BulkSender bulkTx_{bulkBuf_, BULK_BUFFER, BULK_RETRY_MS};
+  BulkAssembly bulkRx_{bulkBuf_, BULK_BUFFER};
+  uint32_t bulkLostFrom_ = 0;  // Polls of lost transfers answered from this counter on
+#endif
+
+  AES128 aes_;
+};
+
+template <class Device>
+NodeCore<Device>* NodeCore<Device>::instance_ = nullptr;
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <Arduino.h>
+#include <SHA256.h>
+
+#include "NodeScratch.h"
+#include "NodeEnergy.h"
+
+// HMAC = SHA256((key XOR opad) || SHA256((key XOR ipad) || message))
+//
+// Streaming form: hmacBegin(), any number of hmacUpdate(), hmacFinish().
+// The caller holds the SCRATCH_HMAC lease for the whole sequence.
+inline void hmacBegin(HmacScratch& s, const uint8_t* key, size_t keyLen) {
+  // Prepare key block (pad or hash if needed)
+  memset(s.pad, 0, 64);
+  if (keyLen <= 64) {
+    memcpy(s.pad, key, keyLen);
+  } else {
+    s.sha.reset();
+    s.sha.update(key, keyLen);
+    s.sha.finalize(s.pad, 32);
+  }
+
+  // Turn key block into ipad
+  for (int i = 0; i < 64; i++) {
+    s.pad[i] ^= 0x36;
+  }
+
+  // Inner hash: SHA256((key XOR ipad) || message)
+  s.sha.reset();
+  s.sha.update(s.pad, 64);
+}
+
+inline void hmacUpdate(HmacScratch& s, const uint8_t* data, size_t dataLen) {
+  s.sha.update(data, dataLen);
+}
+
+// hmac may point into the packet being authenticated (e.g. right after the
+// covered bytes) or at s.inner.
+inline void hmacFinish(HmacScratch& s, uint8_t* hmac) {
+  s.sha.finalize(s.inner, 32);
+
+  // Turn ipad into opad
+  for (int i = 0; i < 64; i++) {
+    s.pad[i] ^= 0x36 ^ 0x5C;
+  }
+
+  // Outer hash: SHA256((key XOR opad) || innerHash)
+  s.sha.reset();
+  s.sha.update(s.pad, 64);
+  s.sha.update(s.inner, 32);
+  s.sha.finalize(hmac, 32);
+}
+
+// HMAC-SHA256 for packet authentication
+inline void computeHMAC(ScratchArena& arena, const uint8_t* key, size_t keyLen, const uint8_t* data, size_t dataLen, uint8_t* hmac) {
+  ScratchLease lease(arena, SCRATCH_HMAC);
+  EnergySpan energy(ENERGY_CPU, ENERGY_CPU_CRYPTO, ENERGY_CRYPTO_HMAC);
+  hmacBegin(arena.hmac, key, keyLen);
+  hmacUpdate(arena.hmac, data, dataLen);
+  hmacFinish(arena.hmac, hmac);
+}
+
+inline bool verifyHMAC(ScratchArena& arena, const uint8_t* key, size_t keyLen, const uint8_t* data, size_t dataLen, const uint8_t* receivedHmac) {
+  // The outer hash lands in the inner hash buffer once it has been consumed
+  uint8_t* computedHmac = arena.hmac.inner;
+  computeHMAC(arena, key, keyLen, data, dataLen, computedHmac);
+
+  // Constant-time comparison to prevent timing attacks
+  uint8_t result = 0;
+  for (int i = 0; i < 32; i++) {
+    result |= computedHmac[i] ^ receivedHmac[i];
+  }
+
+  return result == 0;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+// Binary delta format for firmware updates: the new image as a stream of
+// operations against the running (base) image.
+//
+//   0x00..0x7F  LITERAL  op + 1 bytes follow, copied to the output
+//   0x80..0xBF  COPY     len = ((op & 0x3F) << 8 | next byte) + 4, then the
+//                        base offset as uint16 LE: len bytes from the base
+//   0xC0..0xFF  FILL     len = (op & 0x3F) + 3, then one byte repeated len
+//                        times
+//
+// Code that did not change between two builds mostly moves as a whole,
+// so a release is a handful of COPYs around the changed functions, and
+// erased or zeroed areas are FILLs. The encoder lives with the hub
+// (lib/HubProtocol/src/OtaDelta.cpp) and in tools/ota/ota.py.
+//
+// OtaDeltaDecoder takes the delta in pieces of any size, so it can run as
+// the chunks arrive, and hands whole operations to a sink:
+//
+//   struct Sink {
+//     bool literal(const uint8_t* p, uint16_t len);
+//     bool copy(uint16_t from, uint16_t len);
+//     bool fill(uint8_t b, uint16_t len);
+//   };
+//
+// The sink bounds-checks against the base and output sizes; returning
+// false stops decoding for good.
+//
+// Plain C++ without Arduino, shared with the hub.
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define DELTA_LITERAL 0x00
+#define DELTA_COPY 0x80
+#define DELTA_FILL 0xC0
+
+#define DELTA_LITERAL_MAX 128
+#define DELTA_COPY_MIN 4
+#define DELTA_COPY_MAX (0x3FFF + DELTA_COPY_MIN)
+#define DELTA_FILL_MIN 3
+#define DELTA_FILL_MAX (0x3F + DELTA_FILL_MIN)
+
+class OtaDeltaDecoder {
+public:
+  void reset() {
+    phase_ = PHASE_OP;
+    failed_ = false;
+  }
+
+  bool failed() const { return failed_; }
+
+  // True between operations, where a complete delta must end
+  bool idle() const { return phase_ == PHASE_OP && !failed_; }
+
+  template <class Sink>
+  bool feed(const uint8_t* p, size_t n, Sink& sink) {
+    if (failed_) return false;
+
+    while (n) {
+      switch (phase_) {
+        case PHASE_OP: {
+          uint8_t op = *p++;
+          n--;
+          if (op < DELTA_COPY) {
+            len_ = op + 1;
+            phase_ = PHASE_LITERAL;
+          } else if (op < DELTA_FILL) {
+            len_ = (uint16_t)(op & 0x3F) << 8;
+            phase_ = PHASE_COPY_LEN;
+          } else {
+            len_ = (op & 0x3F) + DELTA_FILL_MIN;
+            phase_ = PHASE_FILL;
+          }
+          break;
+        }
+
+        case PHASE_LITERAL: {
+          uint16_t take = n < len_ ? n : len_;
+          if (!sink.literal(p, take)) return fail();
+          p += take;
+          n -= take;
+          len_ -= take;
+          if (!len_) phase_ = PHASE_OP;
+          break;
+        }
+
+        case PHASE_COPY_LEN:
+          len_ = (len_ | *p++) + DELTA_COPY_MIN;
+          n--;
+          phase_ = PHASE_COPY_FROM_LO;
+          break;
+
+        case PHASE_COPY_FROM_LO:
+          from_ = *p++;
+          n--;
+          phase_ = PHASE_COPY_FROM_HI;
+          break;
+
+        case PHASE_COPY_FROM_HI:
+          from_ |= (uint16_t)*p++ << 8;
+          n--;
+          phase_ = PHASE_OP;
+          if (!sink.copy(from_, len_)) return fail();
+          break;
+
+        case PHASE_FILL:
+          n--;
+          phase_ = PHASE_OP;
+          if (!sink.fill(*p++, len_)) return fail();
+          break;
+      }
+    }
+    return true;
+  }
+
+private:
+  enum Phase : uint8_t {
+    PHASE_OP,
+    PHASE_LITERAL,
+    PHASE_COPY_LEN,
+    PHASE_COPY_FROM_LO,
+    PHASE_COPY_FROM_HI,
+    PHASE_FILL,
+  };
+
+  bool fail() {
+    failed_ = true;
+    return false;
+  }
+
+  Phase phase_ = PHASE_OP;
+  bool failed_ = false;
+  uint16_t len_ = 0;
+  uint16_t from_ = 0;
+};
@@ -0,0 +1,167 @@
+#pragma once
+
+// Energy trace: timestamps every power-relevant state change so a host tool
+// (tools/energy/energy.py) can turn a run into mAh per day and a breakdown
+// per activity.
+//
+// The node is split into independent power domains, each in exactly one
+// state at a time:
+//
+//   Domain        States                        arg
+//   ENERGY_RADIO  sleep, standby, rx, tx        tx: spreading factor
+//   ENERGY_CPU    active, crypto, sleep         crypto: ENERGY_CRYPTO_*
+//   ENERGY_ADC    off, on (divider + ADC)
+//   ENERGY_LED    off, on
+//
+// energyMark() appends to a small ring in RAM and energyFlush(), called
+// from loop(), prints the pending events as
+//
+//   @E <micros> <domain> <state> <arg>
+//
+// so no serial output happens inside the paths being measured. A full ring
+// drops events. The next flush prints what the ring kept, then
+//
+//   @E drop <n>
+//   @E snap <micros> <radio state> <arg> <cpu state> <arg> <adc ...> <led ...>
+//
+// The tool does not count the time between the two: the states in it are
+// unknown. The snapshot gives every domain's state again. On the device the flush itself keeps the CPU busy for a
+// few ms per event at 38400 baud, so CPU active time is over-counted a
+// little; radio, ADC and LED times are not affected.
+//
+// Off unless ENERGY_TRACE is 1: every call compiles to nothing.
+
+#include <Arduino.h>
+
+#ifndef ENERGY_TRACE
+#define ENERGY_TRACE 0
+#endif
+
+#ifndef ENERGY_TRACE_DEPTH
+#define ENERGY_TRACE_DEPTH 16
+#endif
+
+#define ENERGY_RADIO 0
+#define ENERGY_CPU 1
+#define ENERGY_ADC 2
+#define ENERGY_LED 3
+#define ENERGY_DOMAINS 4
+
+#define ENERGY_RADIO_SLEEP 0
+#define ENERGY_RADIO_STANDBY 1
+#define ENERGY_RADIO_RX 2
+#define ENERGY_RADIO_TX 3
+
+#define ENERGY_CPU_ACTIVE 0
+#define ENERGY_CPU_CRYPTO 1
+#define ENERGY_CPU_SLEEP 2
+
+#define ENERGY_CRYPTO_HMAC 1    // Standalone HMAC compute or verify
+#define ENERGY_CRYPTO_FRAME 2   // CBC encrypt/decrypt with its HMAC
+#define ENERGY_CRYPTO_ECDH 3
+#define ENERGY_CRYPTO_ECDSA 4   // Signature verify, MSG_RESYNC
+
+#define ENERGY_OFF 0
+#define ENERGY_ON 1
+
+#if ENERGY_TRACE
+
+struct EnergyEvent {
+  uint32_t us;
+  uint8_t code;  // domain << 4 | state
+  uint8_t arg;
+};
+
+struct EnergyTrace {
+  EnergyEvent ring[ENERGY_TRACE_DEPTH];
+  uint8_t head;
+  uint8_t count;
+  uint16_t dropped;
+  uint8_t state[ENERGY_DOMAINS];
+  uint8_t arg[ENERGY_DOMAINS];
+};
+
+static EnergyTrace energyTrace;
+
+inline void energyMark(uint8_t domain, uint8_t state, uint8_t arg = 0) {
+  EnergyTrace& t = energyTrace;
+  if (t.state[domain] == state && t.arg[domain] == arg) return;
+  t.state[domain] = state;
+  t.arg[domain] = arg;
+
+  if (t.count == ENERGY_TRACE_DEPTH) {
+    t.dropped++;
+    return;
+  }
+  EnergyEvent& e = t.ring[(uint8_t)(t.head + t.count) % ENERGY_TRACE_DEPTH];
+  e.us = micros();
+  e.code = domain << 4 | state;
+  e.arg = arg;
+  t.count++;
+}
+
+inline void energyFlush() {
+  EnergyTrace& t = energyTrace;
+  while (t.count) {
+    const EnergyEvent& e = t.ring[t.head];
+    Serial.print(F("@E "));
+    Serial.print(e.us);
+    Serial.print(' ');
+    Serial.print(e.code >> 4);
+    Serial.print(' ');
+    Serial.print(e.code & 0x0F);
+    Serial.print(' ');
+    Serial.println(e.arg);
+    t.head = (t.head + 1) % ENERGY_TRACE_DEPTH;
+    t.count--;
+  }
+
+  // The ring holds the events before the drops; what follows is a gap
+  // until this snapshot
+  if (t.dropped) {
+    Serial.print(F("@E drop "));
+    Serial.println(t.dropped);
+    t.dropped = 0;
+
+    Serial.print(F("@E snap "));
+    Serial.print(micros());
+    for (uint8_t d = 0; d < ENERGY_DOMAINS; d++) {
+      Serial.print(' ');
+      Serial.print(t.state[d]);
+      Serial.print(' ');
+      Serial.print(t.arg[d]);
+    }
+    Serial.println();
+  }
+}
+
+// Puts a domain in a state for a scope and restores the previous one, so
+// spans nest (an HMAC inside a larger crypto span)
+class EnergySpan {
+public:
+  EnergySpan(uint8_t domain, uint8_t state, uint8_t arg = 0)
+      : domain_(domain), state_(energyTrace.state[domain]), arg_(energyTrace.arg[domain]) {
+    energyMark(domain, state, arg);
+  }
+
+  ~EnergySpan() {
+    energyMark(domain_, state_, arg_);
+  }
+
+private:
+  uint8_t domain_;
+  uint8_t state_;
+  uint8_t arg_;
+};
+
+#else
+
+inline void energyMark(uint8_t, uint8_t, uint8_t = 0) {}
+inline void energyFlush() {}
+
+class EnergySpan {
+public:
+  EnergySpan(uint8_t, uint8_t, uint8_t = 0) {}
+};
+
+#endif
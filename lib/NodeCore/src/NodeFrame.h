@@ -0,0 +1,477 @@
+#pragma once
+
+// Typed, zero-copy views over raw frame buffers, one per message type.
+//
+// A view is a pointer and a length; accessors return pointers into the
+// buffer or decode little-endian fields in place, setters write them. The
+// byte type picks read-only (const uint8_t) or writable (uint8_t) access:
+//
+//   ChallengeFrame<const uint8_t> in(buf, len);
+//   if (!in.valid()) return;
+//   uint32_t tx = in.tx();
+//
+//   ChallengeFrame<uint8_t> out(scratch.frame);
+//   out.setTx(txCounter);
+//   radio.write(out.data(), out.LEN);
+//
+// Lengths are compile-time constants checked against the offsets in
+// NodeWire.h below. valid() is the only place a received length is checked:
+// once it passes, every accessor stays inside the frame, and a
+// SecureFrame's ciphertext is a whole number of blocks with room for the
+// NUL written after the plaintext. Like NodeWire.h this needs no Arduino,
+// so host tools and the hub use the same views.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "NodeWire.h"
+
+static_assert(WIRE_ID + WIRE_ID_LEN == WIRE_DISCOVERY_LEN, "discovery layout");
+static_assert(WIRE_ADOPT_PUBKEY == WIRE_DISCOVERY_LEN, "adopt request layout");
+static_assert(WIRE_ADOPT_PUBKEY + WIRE_PUBKEY_LEN == WIRE_ADOPT_REQ_LEN, "adopt request layout");
+static_assert(WIRE_ADOPT_STATUS == WIRE_DISCOVERY_LEN, "adopt response layout");
+static_assert(WIRE_ADOPT_HUB_PUBKEY == WIRE_ADOPT_STATUS + 1, "adopt response layout");
+static_assert(WIRE_ADOPT_EPOCH == WIRE_ADOPT_HUB_PUBKEY + WIRE_PUBKEY_LEN, "adopt response layout");
+static_assert(WIRE_ADOPT_EPOCH + 4 == WIRE_ADOPT_RSP_LEN, "adopt response layout");
+static_assert(WIRE_CHALLENGE_TX == WIRE_DISCOVERY_LEN, "challenge layout");
+static_assert(WIRE_CHALLENGE_RX == WIRE_CHALLENGE_TX + 4, "challenge layout");
+static_assert(WIRE_CHALLENGE_NONCE == WIRE_CHALLENGE_RX + 4, "challenge layout");
+static_assert(WIRE_CHALLENGE_NONCE + WIRE_NONCE_LEN == WIRE_CHALLENGE_SIGNED_LEN, "challenge layout");
+static_assert(WIRE_CHALLENGE_SIGNED_LEN + WIRE_HMAC_LEN == WIRE_CHALLENGE_LEN, "challenge layout");
+static_assert(WIRE_SECURE_COUNTER == WIRE_DISCOVERY_LEN, "secure frame layout");
+static_assert(WIRE_SECURE_NONCE == WIRE_SECURE_COUNTER + 4, "secure frame layout");
+static_assert(WIRE_SECURE_ORIG_LEN == WIRE_SECURE_NONCE + WIRE_NONCE_LEN, "secure frame layout");
+static_assert(WIRE_SECURE_HEADER_LEN == WIRE_SECURE_ORIG_LEN + 1, "secure frame layout");
+static_assert(WIRE_DIAG_COUNTER == WIRE_DISCOVERY_LEN, "diag layout");
+static_assert(WIRE_DIAG_PAYLOAD == WIRE_DIAG_COUNTER + 4, "diag layout");
+static_assert(WIRE_OTA_OFFER_COUNTER == WIRE_DISCOVERY_LEN, "ota offer layout");
+static_assert(WIRE_OTA_OFFER_ID == WIRE_OTA_OFFER_COUNTER + 4, "ota offer layout");
+static_assert(WIRE_OTA_OFFER_BASE_CRC == WIRE_OTA_OFFER_ID + 2, "ota offer layout");
+static_assert(WIRE_OTA_OFFER_IMAGE_LEN == WIRE_OTA_OFFER_BASE_CRC + 4, "ota offer layout");
+static_assert(WIRE_OTA_OFFER_DELTA_LEN == WIRE_OTA_OFFER_IMAGE_LEN + 2, "ota offer layout");
+static_assert(WIRE_OTA_OFFER_SIGNATURE == WIRE_OTA_OFFER_DELTA_LEN + 2, "ota offer layout");
+static_assert(WIRE_OTA_OFFER_SIGNATURE + WIRE_SIGNATURE_LEN == WIRE_OTA_OFFER_SIGNED_LEN, "ota offer layout");
+static_assert(WIRE_OTA_OFFER_SIGNED_LEN + WIRE_HMAC_LEN == WIRE_OTA_OFFER_LEN, "ota offer layout");
+static_assert(WIRE_OTA_CHUNK_ID == WIRE_DISCOVERY_LEN, "ota chunk layout");
+static_assert(WIRE_OTA_CHUNK_OFFSET == WIRE_OTA_CHUNK_ID + 2, "ota chunk layout");
+static_assert(WIRE_OTA_CHUNK_DATA == WIRE_OTA_CHUNK_OFFSET + 2, "ota chunk layout");
+static_assert(WIRE_OTA_STATUS_COUNTER == WIRE_DISCOVERY_LEN, "ota status layout");
+static_assert(WIRE_OTA_STATUS_ID == WIRE_OTA_STATUS_COUNTER + 4, "ota status layout");
+static_assert(WIRE_OTA_STATUS_STATE == WIRE_OTA_STATUS_ID + 2, "ota status layout");
+static_assert(WIRE_OTA_STATUS_NEXT == WIRE_OTA_STATUS_STATE + 1, "ota status layout");
+static_assert(WIRE_OTA_STATUS_SIGNED_LEN == WIRE_OTA_STATUS_NEXT + 2, "ota status layout");
+static_assert(WIRE_OTA_STATUS_SIGNED_LEN + WIRE_HMAC_LEN == WIRE_OTA_STATUS_LEN, "ota status layout");
+static_assert(WIRE_TRIGGER_COUNTER == WIRE_DISCOVERY_LEN, "trigger layout");
+static_assert(WIRE_TRIGGER_ACTION == WIRE_TRIGGER_COUNTER + 4, "trigger layout");
+static_assert(WIRE_TRIGGER_TAG == WIRE_TRIGGER_ACTION + 1, "trigger layout");
+static_assert(WIRE_TRIGGER_TAG + WIRE_TRIGGER_TAG_LEN == WIRE_TRIGGER_LEN, "trigger layout");
+static_assert(1 + WIRE_TRIGGER_ID_SIGNED + 4 + 1 == WIRE_BLOCK_LEN, "trigger tag block");
+static_assert(WIRE_BEACON_PERIOD == WIRE_BEACON_SEQ + 2, "beacon layout");
+static_assert(WIRE_BEACON_FLAGS == WIRE_BEACON_PERIOD + 2, "beacon layout");
+static_assert(WIRE_BEACON_FLAGS + 1 == WIRE_BEACON_LEN, "beacon layout");
+static_assert(WIRE_RETRY_WAIT == WIRE_DISCOVERY_LEN, "retry layout");
+static_assert(WIRE_RETRY_WAIT + 2 == WIRE_RETRY_LEN, "retry layout");
+static_assert(WIRE_RESYNC_SIGNATURE == WIRE_RESYNC_EPOCH + 4, "resync layout");
+static_assert(WIRE_RESYNC_SIGNED_LEN == WIRE_RESYNC_SIGNATURE, "resync layout");
+static_assert(WIRE_RESYNC_SIGNATURE + WIRE_SIGNATURE_LEN == WIRE_RESYNC_LEN, "resync layout");
+static_assert(WIRE_BULK_OFFER_COUNTER == WIRE_DISCOVERY_LEN, "bulk offer layout");
+static_assert(WIRE_BULK_OFFER_KIND == WIRE_BULK_OFFER_COUNTER + 4, "bulk offer layout");
+static_assert(WIRE_BULK_OFFER_SIZE == WIRE_BULK_OFFER_KIND + 1, "bulk offer layout");
+static_assert(WIRE_BULK_OFFER_CRC == WIRE_BULK_OFFER_SIZE + 2, "bulk offer layout");
+static_assert(WIRE_BULK_OFFER_NONCE == WIRE_BULK_OFFER_CRC + 4, "bulk offer layout");
+static_assert(WIRE_BULK_OFFER_NONCE + WIRE_NONCE_LEN == WIRE_BULK_OFFER_SIGNED_LEN, "bulk offer layout");
+static_assert(WIRE_BULK_OFFER_SIGNED_LEN + WIRE_HMAC_LEN == WIRE_BULK_OFFER_LEN, "bulk offer layout");
+static_assert(WIRE_BULK_FRAGMENT_COUNTER == WIRE_DISCOVERY_LEN, "bulk fragment layout");
+static_assert(WIRE_BULK_FRAGMENT_INDEX == WIRE_BULK_FRAGMENT_COUNTER + 4, "bulk fragment layout");
+static_assert(WIRE_BULK_FRAGMENT_DATA == WIRE_BULK_FRAGMENT_INDEX + 1, "bulk fragment layout");
+static_assert(WIRE_BULK_ACK_COUNTER == WIRE_DISCOVERY_LEN, "bulk ack layout");
+static_assert(WIRE_BULK_ACK_STATE == WIRE_BULK_ACK_COUNTER + 4, "bulk ack layout");
+static_assert(WIRE_BULK_ACK_RECEIVED == WIRE_BULK_ACK_STATE + 1, "bulk ack layout");
+static_assert(WIRE_BULK_ACK_SIGNED_LEN == WIRE_BULK_ACK_RECEIVED + 2, "bulk ack layout");
+static_assert(WIRE_BULK_ACK_SIGNED_LEN + WIRE_HMAC_LEN == WIRE_BULK_ACK_LEN, "bulk ack layout");
+static_assert(BULK_FRAGMENT_MAX % WIRE_BLOCK_LEN == 0, "bulk fragments are whole blocks");
+static_assert(BULK_LEN_MAX < BULK_FRAGMENTS_MAX * BULK_FRAGMENT_MAX, "bulk padding past the last fragment");
+static_assert(BULK_FRAGMENTS_MAX <= BULK_POLL, "bulk index overlaps BULK_POLL");
+
+inline uint16_t wireReadU16(const uint8_t* p) {
+  return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
+}
+
+inline void wireWriteU16(uint8_t* p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+inline uint32_t wireReadU32(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline void wireWriteU32(uint8_t* p, uint32_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+  p[2] = v >> 16;
+  p[3] = v >> 24;
+}
+
+// type + SERIAL_ID, common to every frame
+template <class Byte>
+class FrameView {
+public:
+  FrameView(Byte* p, size_t len) : p_(p), len_(len) {}
+
+  Byte* data() const { return p_; }
+  size_t len() const { return len_; }
+
+  uint8_t type() const { return p_[0]; }
+  Byte* serialId() const { return p_ + WIRE_ID; }
+  bool isFor(const uint8_t* serialId) const {
+    return memcmp(p_ + WIRE_ID, serialId, WIRE_ID_LEN) == 0;
+  }
+
+  // Writable views only
+  void setHeader(uint8_t type, const uint8_t* serialId) const {
+    p_[0] = type;
+    memcpy(p_ + WIRE_ID, serialId, WIRE_ID_LEN);
+  }
+
+protected:
+  Byte* p_;
+  size_t len_;
+};
+
+// Frames of one fixed length
+template <class Byte, size_t Len>
+class FixedFrame : public FrameView<Byte> {
+public:
+  static const size_t LEN = Len;
+
+  explicit FixedFrame(Byte* p, size_t len = Len) : FrameView<Byte>(p, len) {}
+
+  bool valid() const { return this->len_ == Len; }
+};
+
+// MSG_DISCOVERY, MSG_DISCOVERY_ACK
+template <class Byte>
+class DiscoveryFrame : public FixedFrame<Byte, WIRE_DISCOVERY_LEN> {
+public:
+  using FixedFrame<Byte, WIRE_DISCOVERY_LEN>::FixedFrame;
+};
+
+// MSG_ADOPT_REQ
+template <class Byte>
+class AdoptRequestFrame : public FixedFrame<Byte, WIRE_ADOPT_REQ_LEN> {
+public:
+  using FixedFrame<Byte, WIRE_ADOPT_REQ_LEN>::FixedFrame;
+
+  Byte* pubKey() const { return this->p_ + WIRE_ADOPT_PUBKEY; }
+};
+
+// MSG_ADOPT_RSP
+template <class Byte>
+class AdoptResponseFrame : public FixedFrame<Byte, WIRE_ADOPT_RSP_LEN> {
+public:
+  using FixedFrame<Byte, WIRE_ADOPT_RSP_LEN>::FixedFrame;
+
+  uint8_t status() const { return this->p_[WIRE_ADOPT_STATUS]; }
+  void setStatus(uint8_t s) const { this->p_[WIRE_ADOPT_STATUS] = s; }
+  Byte* hubPubKey() const { return this->p_ + WIRE_ADOPT_HUB_PUBKEY; }
+  uint32_t epoch() const { return wireReadU32(this->p_ + WIRE_ADOPT_EPOCH); }
+  void setEpoch(uint32_t v) const { wireWriteU32(this->p_ + WIRE_ADOPT_EPOCH, v); }
+};
+
+// MSG_CHALLENGE, MSG_CHALLENGE_RSP
+template <class Byte>
+class ChallengeFrame : public FixedFrame<Byte, WIRE_CHALLENGE_LEN> {
+public:
+  static const size_t SIGNED_LEN = WIRE_CHALLENGE_SIGNED_LEN;
+
+  using FixedFrame<Byte, WIRE_CHALLENGE_LEN>::FixedFrame;
+
+  uint32_t tx() const { return wireReadU32(this->p_ + WIRE_CHALLENGE_TX); }
+  uint32_t rx() const { return wireReadU32(this->p_ + WIRE_CHALLENGE_RX); }
+  void setTx(uint32_t v) const { wireWriteU32(this->p_ + WIRE_CHALLENGE_TX, v); }
+  void setRx(uint32_t v) const { wireWriteU32(this->p_ + WIRE_CHALLENGE_RX, v); }
+
+  Byte* nonce() const { return this->p_ + WIRE_CHALLENGE_NONCE; }
+  Byte* hmac() const { return this->p_ + SIGNED_LEN; }
+};
+
+// MSG_DIAG
+template <class Byte>
+class DiagFrame : public FixedFrame<Byte, WIRE_DIAG_LEN> {
+public:
+  static const size_t SIGNED_LEN = WIRE_DIAG_SIGNED_LEN;
+
+  using FixedFrame<Byte, WIRE_DIAG_LEN>::FixedFrame;
+
+  uint32_t counter() const { return wireReadU32(this->p_ + WIRE_DIAG_COUNTER); }
+  void setCounter(uint32_t v) const { wireWriteU32(this->p_ + WIRE_DIAG_COUNTER, v); }
+
+  Byte* payload() const { return this->p_ + WIRE_DIAG_PAYLOAD; }
+  Byte* hmac() const { return this->p_ + SIGNED_LEN; }
+};
+
+// MSG_OTA_OFFER
+template <class Byte>
+class OtaOfferFrame : public FixedFrame<Byte, WIRE_OTA_OFFER_LEN> {
+public:
+  static const size_t SIGNED_LEN = WIRE_OTA_OFFER_SIGNED_LEN;
+
+  using FixedFrame<Byte, WIRE_OTA_OFFER_LEN>::FixedFrame;
+
+  uint32_t counter() const { return wireReadU32(this->p_ + WIRE_OTA_OFFER_COUNTER); }
+  uint16_t updateId() const { return wireReadU16(this->p_ + WIRE_OTA_OFFER_ID); }
+  uint32_t baseCrc() const { return wireReadU32(this->p_ + WIRE_OTA_OFFER_BASE_CRC); }
+  uint16_t imageLen() const { return wireReadU16(this->p_ + WIRE_OTA_OFFER_IMAGE_LEN); }
+  uint16_t deltaLen() const { return wireReadU16(this->p_ + WIRE_OTA_OFFER_DELTA_LEN); }
+  void setCounter(uint32_t v) const { wireWriteU32(this->p_ + WIRE_OTA_OFFER_COUNTER, v); }
+  void setUpdateId(uint16_t v) const { wireWriteU16(this->p_ + WIRE_OTA_OFFER_ID, v); }
+  void setBaseCrc(uint32_t v) const { wireWriteU32(this->p_ + WIRE_OTA_OFFER_BASE_CRC, v); }
+  void setImageLen(uint16_t v) const { wireWriteU16(this->p_ + WIRE_OTA_OFFER_IMAGE_LEN, v); }
+  void setDeltaLen(uint16_t v) const { wireWriteU16(this->p_ + WIRE_OTA_OFFER_DELTA_LEN, v); }
+
+  Byte* signature() const { return this->p_ + WIRE_OTA_OFFER_SIGNATURE; }
+  Byte* hmac() const { return this->p_ + SIGNED_LEN; }
+};
+
+// MSG_OTA_CHUNK: 1..WIRE_OTA_CHUNK_MAX delta bytes
+template <class Byte>
+class OtaChunkFrame : public FrameView<Byte> {
+public:
+  static constexpr size_t lenFor(size_t deltaLen) {
+    return WIRE_OTA_CHUNK_DATA + deltaLen + WIRE_HMAC_LEN;
+  }
+
+  OtaChunkFrame(Byte* p, size_t len) : FrameView<Byte>(p, len) {}
+
+  bool valid() const {
+    return this->len_ >= lenFor(1) && this->len_ <= lenFor(WIRE_OTA_CHUNK_MAX);
+  }
+
+  uint16_t updateId() const { return wireReadU16(this->p_ + WIRE_OTA_CHUNK_ID); }
+  uint16_t offset() const { return wireReadU16(this->p_ + WIRE_OTA_CHUNK_OFFSET); }
+  void setUpdateId(uint16_t v) const { wireWriteU16(this->p_ + WIRE_OTA_CHUNK_ID, v); }
+  void setOffset(uint16_t v) const { wireWriteU16(this->p_ + WIRE_OTA_CHUNK_OFFSET, v); }
+
+  Byte* delta() const { return this->p_ + WIRE_OTA_CHUNK_DATA; }
+  size_t deltaLen() const { return this->len_ - WIRE_OTA_CHUNK_DATA - WIRE_HMAC_LEN; }
+
+  size_t signedLen() const { return this->len_ - WIRE_HMAC_LEN; }
+  Byte* hmac() const { return this->p_ + signedLen(); }
+};
+
+// MSG_OTA_STATUS
+template <class Byte>
+class OtaStatusFrame : public FixedFrame<Byte, WIRE_OTA_STATUS_LEN> {
+public:
+  static const size_t SIGNED_LEN = WIRE_OTA_STATUS_SIGNED_LEN;
+
+  using FixedFrame<Byte, WIRE_OTA_STATUS_LEN>::FixedFrame;
+
+  uint32_t counter() const { return wireReadU32(this->p_ + WIRE_OTA_STATUS_COUNTER); }
+  uint16_t updateId() const { return wireReadU16(this->p_ + WIRE_OTA_STATUS_ID); }
+  uint8_t state() const { return this->p_[WIRE_OTA_STATUS_STATE]; }
+  uint16_t next() const { return wireReadU16(this->p_ + WIRE_OTA_STATUS_NEXT); }
+  void setCounter(uint32_t v) const { wireWriteU32(this->p_ + WIRE_OTA_STATUS_COUNTER, v); }
+  void setUpdateId(uint16_t v) const { wireWriteU16(this->p_ + WIRE_OTA_STATUS_ID, v); }
+  void setState(uint8_t v) const { this->p_[WIRE_OTA_STATUS_STATE] = v; }
+  void setNext(uint16_t v) const { wireWriteU16(this->p_ + WIRE_OTA_STATUS_NEXT, v); }
+
+  Byte* hmac() const { return this->p_ + SIGNED_LEN; }
+};
+
+// MSG_TRIGGER. The tag needs an AES-128 (rweather AES128 or anything with
+// its setKey() and encryptBlock()) and one block of scratch.
+template <class Byte>
+class TriggerFrame : public FixedFrame<Byte, WIRE_TRIGGER_LEN> {
+public:
+  using FixedFrame<Byte, WIRE_TRIGGER_LEN>::FixedFrame;
+
+  uint32_t counter() const { return wireReadU32(this->p_ + WIRE_TRIGGER_COUNTER); }
+  uint8_t action() const { return this->p_[WIRE_TRIGGER_ACTION]; }
+  void setCounter(uint32_t v) const { wireWriteU32(this->p_ + WIRE_TRIGGER_COUNTER, v); }
+  void setAction(uint8_t v) const { this->p_[WIRE_TRIGGER_ACTION] = v; }
+
+  Byte* tag() const { return this->p_ + WIRE_TRIGGER_TAG; }
+
+  // Writable views only
+  template <class Cipher>
+  void sign(Cipher& aes, const uint8_t* key, uint8_t* block) const {
+    computeTag(aes, key, block);
+    memcpy(tag(), block, WIRE_TRIGGER_TAG_LEN);
+  }
+
+  // Constant time, like the HMAC checks
+  template <class Cipher>
+  bool verify(Cipher& aes, const uint8_t* key, uint8_t* block) const {
+    computeTag(aes, key, block);
+    uint8_t diff = 0;
+    for (int i = 0; i < WIRE_TRIGGER_TAG_LEN; i++) diff |= block[i] ^ tag()[i];
+    return diff == 0;
+  }
+
+private:
+  // Tag into block[0..7], see NodeWire.h. aes is left on the trigger key.
+  template <class Cipher>
+  void computeTag(Cipher& aes, const uint8_t* key, uint8_t* block) const {
+    memset(block, TRIGGER_KEY_BYTE, WIRE_BLOCK_LEN);
+    aes.setKey(key, 16);
+    aes.encryptBlock(block, block);
+    aes.setKey(block, 16);
+
+    block[0] = this->p_[0];
+    memcpy(block + 1, this->p_ + WIRE_ID, WIRE_TRIGGER_ID_SIGNED);
+    memcpy(block + 1 + WIRE_TRIGGER_ID_SIGNED, this->p_ + WIRE_TRIGGER_COUNTER, 5);  // counter, action
+    aes.encryptBlock(block, block);
+  }
+};
+
+// MSG_BEACON. No ID: every node takes it, serialId() does not apply.
+template <class Byte>
+class BeaconFrame : public FixedFrame<Byte, WIRE_BEACON_LEN> {
+public:
+  using FixedFrame<Byte, WIRE_BEACON_LEN>::FixedFrame;
+
+  uint16_t seq() const { return wireReadU16(this->p_ + WIRE_BEACON_SEQ); }
+  uint16_t period() const { return wireReadU16(this->p_ + WIRE_BEACON_PERIOD); }
+  uint8_t flags() const { return this->p_[WIRE_BEACON_FLAGS]; }
+  void setSeq(uint16_t v) const { wireWriteU16(this->p_ + WIRE_BEACON_SEQ, v); }
+  void setPeriod(uint16_t v) const { wireWriteU16(this->p_ + WIRE_BEACON_PERIOD, v); }
+  void setFlags(uint8_t v) const { this->p_[WIRE_BEACON_FLAGS] = v; }
+};
+
+// MSG_RETRY
+template <class Byte>
+class RetryFrame : public FixedFrame<Byte, WIRE_RETRY_LEN> {
+public:
+  using FixedFrame<Byte, WIRE_RETRY_LEN>::FixedFrame;
+
+  uint16_t waitMs() const { return wireReadU16(this->p_ + WIRE_RETRY_WAIT); }
+  void setWaitMs(uint16_t v) const { wireWriteU16(this->p_ + WIRE_RETRY_WAIT, v); }
+};
+
+// MSG_RESYNC. No ID, like MSG_BEACON.
+template <class Byte>
+class ResyncFrame : public FixedFrame<Byte, WIRE_RESYNC_LEN> {
+public:
+  static const size_t SIGNED_LEN = WIRE_RESYNC_SIGNED_LEN;
+
+  using FixedFrame<Byte, WIRE_RESYNC_LEN>::FixedFrame;
+
+  uint32_t epoch() const { return wireReadU32(this->p_ + WIRE_RESYNC_EPOCH); }
+  void setEpoch(uint32_t v) const { wireWriteU32(this->p_ + WIRE_RESYNC_EPOCH, v); }
+  Byte* signature() const { return this->p_ + WIRE_RESYNC_SIGNATURE; }
+};
+
+// MSG_BULK_OFFER, MSG_BULK_OFFER_UP
+template <class Byte>
+class BulkOfferFrame : public FixedFrame<Byte, WIRE_BULK_OFFER_LEN> {
+public:
+  static const size_t SIGNED_LEN = WIRE_BULK_OFFER_SIGNED_LEN;
+
+  using FixedFrame<Byte, WIRE_BULK_OFFER_LEN>::FixedFrame;
+
+  uint32_t counter() const { return wireReadU32(this->p_ + WIRE_BULK_OFFER_COUNTER); }
+  uint8_t kind() const { return this->p_[WIRE_BULK_OFFER_KIND]; }
+  uint16_t size() const { return wireReadU16(this->p_ + WIRE_BULK_OFFER_SIZE); }
+  uint32_t crc() const { return wireReadU32(this->p_ + WIRE_BULK_OFFER_CRC); }
+  void setCounter(uint32_t v) const { wireWriteU32(this->p_ + WIRE_BULK_OFFER_COUNTER, v); }
+  void setKind(uint8_t v) const { this->p_[WIRE_BULK_OFFER_KIND] = v; }
+  void setSize(uint16_t v) const { wireWriteU16(this->p_ + WIRE_BULK_OFFER_SIZE, v); }
+  void setCrc(uint32_t v) const { wireWriteU32(this->p_ + WIRE_BULK_OFFER_CRC, v); }
+
+  Byte* nonce() const { return this->p_ + WIRE_BULK_OFFER_NONCE; }
+  Byte* hmac() const { return this->p_ + SIGNED_LEN; }
+};
+
+// MSG_BULK_FRAGMENT, MSG_BULK_FRAGMENT_UP: 1..4 blocks of ciphertext
+template <class Byte>
+class BulkFragmentFrame : public FrameView<Byte> {
+public:
+  static constexpr size_t lenFor(size_t cipherLen) {
+    return WIRE_BULK_FRAGMENT_DATA + cipherLen + WIRE_HMAC_LEN;
+  }
+
+  BulkFragmentFrame(Byte* p, size_t len) : FrameView<Byte>(p, len) {}
+
+  bool valid() const {
+    return this->len_ >= lenFor(WIRE_BLOCK_LEN) && this->len_ <= lenFor(BULK_FRAGMENT_MAX) &&
+           cipherLen() % WIRE_BLOCK_LEN == 0;
+  }
+
+  uint32_t counter() const { return wireReadU32(this->p_ + WIRE_BULK_FRAGMENT_COUNTER); }
+  uint8_t index() const { return this->p_[WIRE_BULK_FRAGMENT_INDEX] & ~BULK_POLL; }
+  bool poll() const { return this->p_[WIRE_BULK_FRAGMENT_INDEX] & BULK_POLL; }
+  void setCounter(uint32_t v) const { wireWriteU32(this->p_ + WIRE_BULK_FRAGMENT_COUNTER, v); }
+  void setIndex(uint8_t v, bool poll) const {
+    this->p_[WIRE_BULK_FRAGMENT_INDEX] = v | (poll ? BULK_POLL : 0);
+  }
+
+  Byte* cipher() const { return this->p_ + WIRE_BULK_FRAGMENT_DATA; }
+  size_t cipherLen() const { return this->len_ - WIRE_BULK_FRAGMENT_DATA - WIRE_HMAC_LEN; }
+
+  size_t signedLen() const { return this->len_ - WIRE_HMAC_LEN; }
+  Byte* hmac() const { return this->p_ + signedLen(); }
+};
+
+// MSG_BULK_ACK, MSG_BULK_ACK_UP
+template <class Byte>
+class BulkAckFrame : public FixedFrame<Byte, WIRE_BULK_ACK_LEN> {
+public:
+  static const size_t SIGNED_LEN = WIRE_BULK_ACK_SIGNED_LEN;
+
+  using FixedFrame<Byte, WIRE_BULK_ACK_LEN>::FixedFrame;
+
+  uint32_t counter() const { return wireReadU32(this->p_ + WIRE_BULK_ACK_COUNTER); }
+  uint8_t state() const { return this->p_[WIRE_BULK_ACK_STATE]; }
+  uint16_t received() const { return wireReadU16(this->p_ + WIRE_BULK_ACK_RECEIVED); }
+  void setCounter(uint32_t v) const { wireWriteU32(this->p_ + WIRE_BULK_ACK_COUNTER, v); }
+  void setState(uint8_t v) const { this->p_[WIRE_BULK_ACK_STATE] = v; }
+  void setReceived(uint16_t v) const { wireWriteU16(this->p_ + WIRE_BULK_ACK_RECEIVED, v); }
+
+  Byte* hmac() const { return this->p_ + SIGNED_LEN; }
+};
+
+// MSG_DATA, MSG_COMMAND, MSG_GROUP_JOIN, MSG_GROUP_COMMAND: header + whole
+// CBC blocks + HMAC
+template <class Byte>
+class SecureFrame : public FrameView<Byte> {
+public:
+  static const size_t MIN_LEN = WIRE_SECURE_MIN_LEN;
+
+  // Plaintext plus at least one padding byte, rounded up to whole blocks
+  static constexpr size_t paddedLen(size_t plaintextLen) {
+    return (plaintextLen / WIRE_BLOCK_LEN + 1) * WIRE_BLOCK_LEN;
+  }
+
+  static constexpr size_t lenFor(size_t plaintextLen) {
+    return WIRE_SECURE_HEADER_LEN + paddedLen(plaintextLen) + WIRE_HMAC_LEN;
+  }
+
+  SecureFrame(Byte* p, size_t len) : FrameView<Byte>(p, len) {}
+
+  // Length, block alignment and origLen inside the ciphertext. Covers
+  // everything an unauthenticated frame can get wrong except the HMAC.
+  bool valid() const {
+    if (this->len_ < MIN_LEN) return false;
+    size_t ciphertextLen = this->len_ - WIRE_SECURE_HEADER_LEN - WIRE_HMAC_LEN;
+    return ciphertextLen % WIRE_BLOCK_LEN == 0 && origLen() < ciphertextLen;
+  }
+
+  uint32_t counter() const { return wireReadU32(this->p_ + WIRE_SECURE_COUNTER); }
+  void setCounter(uint32_t v) const { wireWriteU32(this->p_ + WIRE_SECURE_COUNTER, v); }
+
+  Byte* nonce() const { return this->p_ + WIRE_SECURE_NONCE; }
+
+  uint8_t origLen() const { return this->p_[WIRE_SECURE_ORIG_LEN]; }
+  void setOrigLen(uint8_t v) const { this->p_[WIRE_SECURE_ORIG_LEN] = v; }
+
+  Byte* ciphertext() const { return this->p_ + WIRE_SECURE_HEADER_LEN; }
+  size_t ciphertextLen() const { return this->len_ - WIRE_SECURE_HEADER_LEN - WIRE_HMAC_LEN; }
+
+  size_t signedLen() const { return this->len_ - WIRE_HMAC_LEN; }
+  Byte* hmac() const { return this->p_ + signedLen(); }
+};
+
+static_assert(SecureFrame<const uint8_t>::lenFor(0) == WIRE_SECURE_MIN_LEN, "secure frame layout");
@@ -0,0 +1,162 @@
+#pragma once
+
+// What a received frame may cost before it has proven anything.
+//
+// The handlers in NodeCore run every frame through the cheap checks
+// first and the MAC or signature last:
+//
+//   1. length and type      the frame view of the handler
+//   2. address              our SERIAL_ID, or our group's ID
+//   3. counter window       replays and duplicates; challenge responses
+//                           with no challenge out or another nonce; hub
+//                           challenges behind our window; a MSG_RESYNC for
+//                           an epoch we are past; OTA chunks of another
+//                           update or out of turn; bulk fragments of no
+//                           transfer we know
+//   4. source rate          admit(): a token bucket per source
+//   5. crypto budget        admit(): failed-check time left in this window
+//   6. MAC, trigger tag or signature
+//
+// Nothing up to 3 is authenticated, but whatever fails there would fail
+// after the MAC as well, so a replayed or forged frame with an old
+// counter costs nothing. One with a fresh counter costs a MAC: a source
+// gets GUARD_BURST of those at once and one more every GUARD_RATE_MS, and
+// the checks that fail, of all sources together, get GUARD_CPU_US of CPU
+// per GUARD_WINDOW_MS, measured with micros(). A flood then takes at most
+// a tenth of the CPU.
+//
+// Nothing before the MAC tells a forgery with a fresh counter from the
+// hub's next frame, so the hub's frames pay for the limits too. They get
+// it back: a check that holds costs the budget nothing and refills its
+// source to GUARD_BURST (passed()), so a forger has to spend a burst
+// after every frame of the hub's to drop the next one. Frames dropped at
+// 4 and 5 are counted as DIAG_RX_RATE_LIMITED and DIAG_RX_OVER_BUDGET
+// for the hub to see in MSG_DIAG, and retried by the hub like any lost
+// frame.
+//
+// Signatures (MSG_RESYNC, about a second of ECDSA) are paced, as every
+// forged one would cost that second. A check takes the broadcast token,
+// back every GUARD_BROADCAST_RATE_MS or at once if the signature holds.
+// Without it the frame is dropped (DIAG_RX_RESYNC_SKIPPED) and the node
+// challenges the hub, at most once per GUARD_CONFIRM_MS: a node that
+// missed the new epoch fails the challenge, the hub answers with
+// MSG_RESYNC, and each challenge sent earns GUARD_SOLICITED checks for
+// GUARD_SOLICIT_MS. A forger who takes every broadcast token still has
+// to beat the hub's answer to each challenge, GUARD_SOLICITED times.
+
+#include <Arduino.h>
+
+#define GUARD_NODE 0       // Frames with our SERIAL_ID
+#define GUARD_GROUP 1      // Frames with our group's ID
+#define GUARD_BROADCAST 2  // MSG_RESYNC
+#define GUARD_SOURCES 3
+
+#define GUARD_OK 0
+#define GUARD_RATE 1
+#define GUARD_BUDGET 2
+
+#define GUARD_BURST 6
+#define GUARD_RATE_MS 500              // Per source, one more check this often
+#define GUARD_WINDOW_MS 1000
+#define GUARD_CPU_US 100000L           // Failed-check time per window
+#define GUARD_BROADCAST_RATE_MS 10000  // One signature check this often, burst 1
+#define GUARD_SOLICITED 2              // Signature checks per challenge sent
+#define GUARD_SOLICIT_MS 5000
+#define GUARD_CONFIRM_MS 60000UL       // Challenges for skipped signatures
+
+class RxGuard {
+public:
+  RxGuard() {
+    for (uint8_t i = 0; i < GUARD_SOURCES; i++) tokens_[i] = burst(i);
+  }
+
+  // A frame from source passed the cheap checks: GUARD_OK to go on to
+  // the MAC or tag, else why not
+  uint8_t admit(uint8_t source, unsigned long now) {
+    refill(source, now);
+
+    unsigned long windows = (now - windowAt_) / GUARD_WINDOW_MS;
+    if (windows) {
+      windowAt_ += windows * GUARD_WINDOW_MS;
+      long refilled = budgetUs_ + (long)(windows > 16 ? 16 : windows) * GUARD_CPU_US;
+      budgetUs_ = refilled > GUARD_CPU_US ? GUARD_CPU_US : refilled;
+    }
+
+    if (!tokens_[source]) return GUARD_RATE;
+    if (budgetUs_ <= 0) return GUARD_BUDGET;
+    tokens_[source]--;
+    return GUARD_OK;
+  }
+
+  // The admitted frame's check held: it was the hub's
+  void passed(uint8_t source, unsigned long now) {
+    tokens_[source] = burst(source);
+    refillAt_[source] = now;
+  }
+
+  // The admitted frame's check failed after us of CPU; the budget may go
+  // into debt
+  void failed(unsigned long us) {
+    budgetUs_ -= us > (unsigned long)GUARD_CPU_US ? GUARD_CPU_US : (long)us;
+  }
+
+  // A MSG_RESYNC passed the cheap checks: may its signature be checked?
+  bool admitSignature(unsigned long now) {
+    refill(GUARD_BROADCAST, now);
+    if (tokens_[GUARD_BROADCAST]) {
+      tokens_[GUARD_BROADCAST]--;
+      return true;
+    }
+    if (solicited_ && now - solicitedAt_ < GUARD_SOLICIT_MS) {
+      solicited_--;
+      return true;
+    }
+    return false;
+  }
+
+  // The signature held, the check was the hub's
+  void signatureHeld() { tokens_[GUARD_BROADCAST] = burst(GUARD_BROADCAST); }
+
+  // A challenge went out; the hub may answer it with MSG_RESYNC
+  void solicit(unsigned long now) {
+    solicited_ = GUARD_SOLICITED;
+    solicitedAt_ = now;
+  }
+
+  // A signature went unchecked: challenge the hub to find out?
+  bool confirm(unsigned long now) {
+    if (confirmed_ && now - confirmAt_ < GUARD_CONFIRM_MS) return false;
+    confirmed_ = true;
+    confirmAt_ = now;
+    return true;
+  }
+
+private:
+  static uint8_t burst(uint8_t source) { return source == GUARD_BROADCAST ? 1 : GUARD_BURST; }
+
+  static unsigned long rateMs(uint8_t source) {
+    return source == GUARD_BROADCAST ? GUARD_BROADCAST_RATE_MS : GUARD_RATE_MS;
+  }
+
+  void refill(uint8_t source, unsigned long now) {
+    unsigned long earned = (now - refillAt_[source]) / rateMs(source);
+    if (!earned) return;
+
+    if (tokens_[source] + earned >= burst(source)) {
+      tokens_[source] = burst(source);
+      refillAt_[source] = now;
+    } else {
+      tokens_[source] += earned;
+      refillAt_[source] += earned * rateMs(source);
+    }
+  }
+
+  uint8_t tokens_[GUARD_SOURCES];
+  unsigned long refillAt_[GUARD_SOURCES] = {};
+  unsigned long windowAt_ = 0;
+  long budgetUs_ = GUARD_CPU_US;
+  uint8_t solicited_ = 0;
+  unsigned long solicitedAt_ = 0;
+  bool confirmed_ = false;
+  unsigned long confirmAt_ = 0;
+};
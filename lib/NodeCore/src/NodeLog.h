@@ -0,0 +1,288 @@
+#pragma once
+
+// Tokenized debug log: the firmware never holds or prints the messages,
+// only a token per message and its arguments in binary.
+//
+//   DEBUG_LOG("[N] Counter: %u", counter);
+//
+// The compiler hashes the format string into a 16-bit token (FNV-1a folded
+// to 16 bits, 0 reserved), so the string itself never reaches flash. The
+// call stores the token and the arguments in a RAM ring, with interrupts
+// held off for those few stores so onRx() can log too, and returns. loop()
+// drains the ring while idle, only as many characters as the UART buffer
+// takes without waiting, one line per record:
+//
+//   @L <record in hex>
+//
+// tools/log/log.py finds every DEBUG_LOG() in the sources, hashes the
+// format strings the same way and prints the messages again. The format
+// must be a single string literal. Conversions, checked against the
+// argument count at compile time:
+//
+//   %u %x   unsigned integer           varint, 7 bits a byte
+//   %d      signed integer             zigzag varint
+//   %s      char string                length, up to LOG_STRING_MAX chars
+//   %h      logHex(data, len)          length, up to LOG_HEX_MAX bytes
+//   %U      logId(serialId)            16 bytes, printed as a serial ID
+//   %%      a percent sign
+//
+// The length byte of %s and %h has bit 7 set when the value was cut short.
+// %u and %x need an unsigned argument and %d a signed one: the C type
+// picks the encoding. A full ring drops records; the count goes out as
+// token 0 once the ring has drained.
+//
+// A node that resets or hangs on purpose calls logFlush() first, which
+// waits for everything. Off unless DEBUG is 1; the arguments are then
+// still checked but nothing is compiled in.
+
+#include <Arduino.h>
+#if defined(__AVR__)
+#include <avr/interrupt.h>
+#endif
+
+#include "NodeConfig.h"
+
+#ifndef LOG_RING_SIZE
+#define LOG_RING_SIZE 128  // Bytes, a power of two up to 128
+#endif
+
+#define LOG_HEX_MAX 8        // Keys are never printed whole
+#define LOG_STRING_MAX 24
+#define LOG_CUT 0x80        // In the length byte of %s and %h
+#define LOG_TOKEN_DROPPED 0
+
+static_assert(LOG_RING_SIZE <= 128 && !(LOG_RING_SIZE & (LOG_RING_SIZE - 1)),
+              "LOG_RING_SIZE must be a power of two up to 128");
+
+constexpr uint32_t logHash(const char* s, uint32_t h = 2166136261UL) {
+  return *s ? logHash(s + 1, (h ^ (uint8_t)*s) * 16777619UL) : h;
+}
+
+constexpr uint16_t logFold(uint32_t h) {
+  return (uint16_t)(h ^ (h >> 16)) ? (uint16_t)(h ^ (h >> 16)) : 1;
+}
+
+// Conversions in a format, for the argument count check
+constexpr uint8_t logSpecs(const char* s) {
+  return !*s ? 0
+       : *s != '%' ? logSpecs(s + 1)
+       : s[1] == '%' ? logSpecs(s + 2)
+       : 1 + logSpecs(s + 1);
+}
+
+// Forces the token to be a constant, so the string is never emitted
+template <uint16_t T>
+struct LogToken {
+  static const uint16_t value = T;
+};
+
+template <uint8_t N>
+struct LogArity {
+  static const uint8_t value = N;
+};
+
+template <class... Args>
+LogArity<sizeof...(Args)> logArity(Args...);
+
+struct LogHex {
+  const uint8_t* data;
+  uint8_t len;
+};
+
+struct LogId {
+  const uint8_t* data;
+};
+
+inline LogHex logHex(const uint8_t* data, uint8_t len) {
+  return LogHex{data, len};
+}
+
+inline LogId logId(const uint8_t* serialId) {
+  return LogId{serialId};
+}
+
+#if DEBUG
+
+#define DEBUG_LOG(fmt, ...) \
+  do { \
+    static_assert(logSpecs(fmt) == decltype(logArity(__VA_ARGS__))::value, \
+                  "DEBUG_LOG arguments do not match: " fmt); \
+    logWrite(LogToken<logFold(logHash(fmt))>::value, ##__VA_ARGS__); \
+  } while (0)
+
+struct LogRing {
+  uint8_t buf[LOG_RING_SIZE];
+  uint8_t head;      // Length byte of the oldest record
+  uint8_t used;      // Bytes of complete records
+  uint16_t sent;     // Characters of the oldest record's line written
+  uint16_t dropped;
+};
+
+static LogRing logRing;
+
+// Interrupts off for the scope, restored as they were (a record may be
+// written from an ISR)
+class LogLock {
+public:
+#if defined(__AVR__)
+  LogLock() : sreg_(SREG) { cli(); }
+  ~LogLock() { SREG = sreg_; }
+
+private:
+  uint8_t sreg_;
+#else
+  LogLock() {}
+#endif
+};
+
+// Appends one record behind the complete ones; commit() makes it visible
+class LogWriter {
+public:
+  void put(uint8_t b) {
+    LogRing& r = logRing;
+    if (len_ >= LOG_RING_SIZE - r.used) {
+      full_ = true;
+      return;
+    }
+    r.buf[(uint8_t)(r.head + r.used + len_) & (LOG_RING_SIZE - 1)] = b;
+    len_++;
+  }
+
+  void varint(uint32_t v) {
+    while (v >= 0x80) {
+      put((uint8_t)v | 0x80);
+      v >>= 7;
+    }
+    put((uint8_t)v);
+  }
+
+  void bytes(const uint8_t* data, uint8_t len, uint8_t max) {
+    uint8_t n = len > max ? max : len;
+    put(n | (len > max ? LOG_CUT : 0));
+    for (uint8_t i = 0; i < n; i++) put(data[i]);
+  }
+
+  void commit() {
+    LogRing& r = logRing;
+    if (full_) {
+      r.dropped++;
+      return;
+    }
+    r.buf[(uint8_t)(r.head + r.used) & (LOG_RING_SIZE - 1)] = len_ - 1;
+    r.used += len_;
+  }
+
+private:
+  uint8_t len_ = 1;  // The length byte, written last
+  bool full_ = false;
+};
+
+inline void logPut(LogWriter& w, unsigned long v) { w.varint(v); }
+inline void logPut(LogWriter& w, unsigned int v) { w.varint(v); }
+inline void logPut(LogWriter& w, unsigned short v) { w.varint(v); }
+inline void logPut(LogWriter& w, unsigned char v) { w.varint(v); }
+inline void logPut(LogWriter& w, bool v) { w.varint(v); }
+inline void logPut(LogWriter& w, long v) { w.varint((uint32_t)v << 1 ^ (uint32_t)((int32_t)v >> 31)); }
+inline void logPut(LogWriter& w, int v) { logPut(w, (long)v); }
+inline void logPut(LogWriter& w, short v) { logPut(w, (long)v); }
+inline void logPut(LogWriter& w, signed char v) { logPut(w, (long)v); }
+inline void logPut(LogWriter& w, LogHex v) { w.bytes(v.data, v.len, LOG_HEX_MAX); }
+
+inline void logPut(LogWriter& w, LogId v) {
+  for (uint8_t i = 0; i < 16; i++) w.put(v.data[i]);
+}
+
+inline void logPut(LogWriter& w, const char* s) {
+  size_t len = strlen(s);
+  w.bytes((const uint8_t*)s, len > 0xFF ? 0xFF : len, LOG_STRING_MAX);
+}
+
+inline void logPutAll(LogWriter&) {}
+
+template <class T, class... Rest>
+inline void logPutAll(LogWriter& w, T v, Rest... rest) {
+  logPut(w, v);
+  logPutAll(w, rest...);
+}
+
+template <class... Args>
+inline void logWrite(uint16_t token, Args... args) {
+  LogLock lock;
+  LogWriter w;
+  w.put(token);
+  w.put(token >> 8);
+  logPutAll(w, args...);
+  w.commit();
+}
+
+// Next character of the oldest record's line, false if there is none
+inline bool logChar(char& c) {
+  LogRing& r = logRing;
+  if (!r.used) {
+    if (!r.dropped) return false;
+    LogLock lock;
+    LogWriter w;
+    w.put(LOG_TOKEN_DROPPED);
+    w.put(LOG_TOKEN_DROPPED >> 8);
+    w.varint(r.dropped);
+    r.dropped = 0;
+    w.commit();
+  }
+
+  uint8_t len = r.buf[r.head];
+  uint16_t k = r.sent++;
+  if (k < 3) {
+    c = "@L "[k];
+  } else if (k < 3 + 2 * len) {
+    uint8_t b = r.buf[(uint8_t)(r.head + 1 + (k - 3) / 2) & (LOG_RING_SIZE - 1)];
+    uint8_t nibble = k & 1 ? b >> 4 : b & 0x0F;
+    c = nibble < 10 ? '0' + nibble : 'a' + nibble - 10;
+  } else {
+    c = '\n';
+    LogLock lock;
+    r.head = (uint8_t)(r.head + len + 1) & (LOG_RING_SIZE - 1);
+    r.used -= len + 1;
+    r.sent = 0;
+  }
+  return true;
+}
+
+// From loop(): as much as the UART takes without blocking
+inline void logDrain() {
+  char c;
+  while (Serial.availableForWrite() > 0 && logChar(c)) Serial.write(c);
+}
+
+// Ends a line logDrain() left half written, before other output
+inline void logEndLine() {
+  char c;
+  while (logRing.sent && logChar(c)) Serial.write(c);
+}
+
+// Everything, waiting for the UART; before a reset
+inline void logFlush() {
+  char c;
+  while (logChar(c)) Serial.write(c);
+  Serial.flush();
+}
+
+// Waits for the characters already handed to the UART, at most its
+// buffer, so none is cut off when the MCU powers down
+inline void logSettle() {
+  Serial.flush();
+}
+
+#else
+
+#define DEBUG_LOG(fmt, ...) \
+  do { \
+    static_assert(logSpecs(fmt) == decltype(logArity(__VA_ARGS__))::value, \
+                  "DEBUG_LOG arguments do not match: " fmt); \
+  } while (0)
+
+inline void logDrain() {}
+inline void logEndLine() {}
+inline void logFlush() {}
+inline void logSettle() {}
+
+#endif
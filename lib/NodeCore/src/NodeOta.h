@@ -0,0 +1,432 @@
+#pragma once
+
+// Over-the-air firmware updates, node side.
+//
+// The hub offers an update (MSG_OTA_OFFER): the delta's base image CRC,
+// the new image length and the vendor's ECDSA signature over the new
+// image's SHA-256. If the running image is that base, the node erases the
+// stage slot of the external SPI flash and the hub streams the delta
+// (MSG_OTA_CHUNK, see NodeDelta.h) in order, a window at a time. Each
+// chunk is decoded as it arrives and the output goes straight into the
+// stage slot: COPYs read the running image out of program flash, so only
+// the delta crosses the air and nothing but the decoder state is kept in
+// RAM.
+//
+// After the last chunk the staged image is read back, hashed and checked
+// against the signature with OTA_SIGNING_KEY. Only then is the boot record
+// written and the node reset into the bootloader (NodeOtaBoot.h), which
+// installs it and rolls back if the new image never confirms.
+//
+// Off unless OTA_ENABLED is 1. The application then defines the vendor
+// public key:
+//
+//   const uint8_t OTA_SIGNING_KEY[WIRE_PUBKEY_LEN] PROGMEM = { ... };
+//
+// tools/ota/ota.py keygen writes it.
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <EEPROM.h>
+#include <avr/wdt.h>
+#include <uECC.h>
+
+#include "NodeConfig.h"
+#include "NodeScratch.h"
+#include "NodeFrame.h"
+#include "NodeDelta.h"
+#include "NodeOtaBoot.h"
+
+#ifndef OTA_ENABLED
+#define OTA_ENABLED 0
+#endif
+
+#ifndef OTA_FLASH_CS
+#define OTA_FLASH_CS 9
+#endif
+
+#define OTA_FLASH_SPI_FREQUENCY 8E6
+#define OTA_TRIAL_MS 600000UL  // Unconfirmed image is given up after this
+#define OTA_NONE 0xFF          // Nothing to report
+
+extern const uint8_t OTA_SIGNING_KEY[WIRE_PUBKEY_LEN] PROGMEM;
+
+// Running image in program flash
+inline uint8_t otaImageRead(uint16_t addr) {
+#if defined(__AVR__)
+  return pgm_read_byte(addr);
+#else
+  return halImageRead(addr);
+#endif
+}
+
+inline uint16_t otaImageLen() {
+#if defined(__AVR__)
+  extern char __data_load_end;  // End of .text plus .data initializers
+  return (uint16_t)&__data_load_end;
+#else
+  return halImageLen();
+#endif
+}
+
+inline uint32_t otaImageCrc(uint16_t len) {
+  uint32_t crc = OTA_CRC_INIT;
+  for (uint16_t i = 0; i < len; i++) {
+    crc = otaCrc32(crc, otaImageRead(i));
+    if ((i & 0x0FFF) == 0) wdt_reset();
+  }
+  return otaCrcFinish(crc);
+}
+
+// Reset through the bootloader; the AVR BOOTRST fuse sends every reset
+// there, but softReset()'s jump to 0 would skip it
+inline void otaReset() {
+  logFlush();
+#if defined(__AVR__)
+  wdt_enable(WDTO_15MS);
+  while (1);
+#else
+  halReset();
+#endif
+}
+
+// SPI NOR flash (W25Q-style command set) on OTA_FLASH_CS
+class OtaFlash {
+public:
+  bool begin() {
+#if defined(__AVR__)
+    pinMode(OTA_FLASH_CS, OUTPUT);
+    digitalWrite(OTA_FLASH_CS, HIGH);
+    command(CMD_WAKE);
+    select();
+    SPI.transfer(CMD_JEDEC_ID);
+    uint8_t maker = SPI.transfer(0);
+    deselect();
+    present_ = maker != 0x00 && maker != 0xFF;
+#else
+    present_ = halFlashPresent();
+#endif
+    return present_;
+  }
+
+  bool present() const { return present_; }
+
+  void read(uint32_t addr, uint8_t* buf, uint16_t len) {
+#if defined(__AVR__)
+    select();
+    SPI.transfer(CMD_READ);
+    address(addr);
+    for (uint16_t i = 0; i < len; i++) buf[i] = SPI.transfer(0);
+    deselect();
+#else
+    halFlashRead(addr, buf, len);
+#endif
+  }
+
+  // Split at 256 byte program pages
+  void program(uint32_t addr, const uint8_t* buf, uint16_t len) {
+    while (len) {
+      uint16_t room = 256 - (addr & 0xFF);
+      uint16_t n = len < room ? len : room;
+#if defined(__AVR__)
+      command(CMD_WRITE_ENABLE);
+      select();
+      SPI.transfer(CMD_PAGE_PROGRAM);
+      address(addr);
+      for (uint16_t i = 0; i < n; i++) SPI.transfer(buf[i]);
+      deselect();
+      waitReady();
+#else
+      halFlashProgram(addr, buf, n);
+#endif
+      addr += n;
+      buf += n;
+      len -= n;
+    }
+  }
+
+  void erase(uint32_t addr) {
+#if defined(__AVR__)
+    command(CMD_WRITE_ENABLE);
+    select();
+    SPI.transfer(CMD_SECTOR_ERASE);
+    address(addr);
+    deselect();
+    waitReady();
+#else
+    halFlashErase(addr);
+#endif
+  }
+
+private:
+#if defined(__AVR__)
+  static const uint8_t CMD_WRITE_ENABLE = 0x06;
+  static const uint8_t CMD_READ_STATUS = 0x05;
+  static const uint8_t CMD_READ = 0x03;
+  static const uint8_t CMD_PAGE_PROGRAM = 0x02;
+  static const uint8_t CMD_SECTOR_ERASE = 0x20;
+  static const uint8_t CMD_JEDEC_ID = 0x9F;
+  static const uint8_t CMD_WAKE = 0xAB;
+
+  void select() {
+    SPI.beginTransaction(SPISettings(OTA_FLASH_SPI_FREQUENCY, MSBFIRST, SPI_MODE0));
+    digitalWrite(OTA_FLASH_CS, LOW);
+  }
+
+  void deselect() {
+    digitalWrite(OTA_FLASH_CS, HIGH);
+    SPI.endTransaction();
+  }
+
+  void command(uint8_t cmd) {
+    select();
+    SPI.transfer(cmd);
+    deselect();
+  }
+
+  void address(uint32_t addr) {
+    SPI.transfer(addr >> 16);
+    SPI.transfer(addr >> 8);
+    SPI.transfer(addr);
+  }
+
+  // Page program is ~1 ms, sector erase up to ~400 ms
+  void waitReady() {
+    select();
+    SPI.transfer(CMD_READ_STATUS);
+    while (SPI.transfer(0) & 0x01) wdt_reset();
+    deselect();
+  }
+#endif
+
+  bool present_ = false;
+};
+
+class NodeOta {
+public:
+  void begin() {
+    flash_.begin();
+  }
+
+  bool active() const { return active_; }
+  uint16_t updateId() const { return updateId_; }
+  uint16_t next() const { return next_; }
+
+  // An image the bootloader just installed runs on trial
+  bool onTrial() const {
+    OtaRecord r;
+    EEPROM.get(OTA_RECORD_ADDR, r);
+    return r.state == OTA_BOOT_TRIAL;
+  }
+
+  // Once the node has synced with the hub: confirm a trial image, or pick
+  // up a rollback. Returns the state to report for id, or OTA_NONE.
+  uint8_t bootReport(uint16_t& id) {
+    OtaRecord r;
+    EEPROM.get(OTA_RECORD_ADDR, r);
+    id = r.updateId;
+
+    if (r.state == OTA_BOOT_TRIAL) {
+      r.state = OTA_BOOT_IDLE;
+      r.runningId = r.updateId;
+      EEPROM.put(OTA_RECORD_ADDR, r);
+      return OTA_CONFIRMED;
+    }
+    if (r.state == OTA_BOOT_ROLLED_BACK) {
+      r.state = OTA_BOOT_IDLE;
+      EEPROM.put(OTA_RECORD_ADDR, r);
+      return OTA_ROLLED_BACK;
+    }
+    return OTA_NONE;
+  }
+
+  // Authenticated offer: prepare the stage slot, or say why not
+  uint8_t offer(const OtaOfferFrame<const uint8_t>& f) {
+    if (!flash_.present()) return OTA_NO_STORE;
+
+    // The factory image's ID would read as confirmed on a node that never
+    // took an update
+    if (f.updateId() == OTA_FACTORY_ID) return OTA_BAD_IMAGE;
+
+    OtaRecord r;
+    EEPROM.get(OTA_RECORD_ADDR, r);
+    if (r.state == OTA_BOOT_IDLE && r.runningId == f.updateId()) return OTA_CONFIRMED;
+    if (r.state == OTA_BOOT_TRIAL && r.updateId == f.updateId()) return OTA_STAGED;  // Not synced yet
+
+    // Hub missed our answer, carry on where we are
+    if (active_ && updateId_ == f.updateId()) return next_ ? OTA_PROGRESS : OTA_READY;
+    active_ = false;
+
+    if (f.imageLen() == 0 || f.imageLen() > OTA_IMAGE_MAX || f.deltaLen() == 0) {
+      return OTA_BAD_IMAGE;
+    }
+
+    uint16_t baseLen = otaImageLen();
+    if (otaImageCrc(baseLen) != f.baseCrc()) return OTA_WRONG_BASE;
+
+    flash_.erase(OTA_SIGNATURE_ADDR);
+    for (uint32_t a = 0; a < f.imageLen(); a += OTA_SECTOR) {
+      wdt_reset();
+      flash_.erase(OTA_STAGE_ADDR + a);
+    }
+    flash_.program(OTA_SIGNATURE_ADDR, f.signature(), WIRE_SIGNATURE_LEN);
+
+    updateId_ = f.updateId();
+    baseCrc_ = f.baseCrc();
+    baseLen_ = baseLen;
+    imageLen_ = f.imageLen();
+    deltaLen_ = f.deltaLen();
+    next_ = 0;
+    out_ = 0;
+    sinceReport_ = 0;
+    resent_ = false;
+    decoder_.reset();
+    active_ = true;
+    return OTA_READY;
+  }
+
+  // Before the MAC: is a chunk worth checking? Chunks of another update
+  // are not, nor repeats and gaps but the ones that are due a report:
+  // the first, then one a window in case the hub did not hear it. The
+  // unchecked ones only count towards that window.
+  bool wants(const OtaChunkFrame<const uint8_t>& f) {
+    if (!active_ || f.updateId() != updateId_) return false;
+    if (f.offset() == next_ || !resent_) return true;
+    if (sinceReport_ < OTA_WINDOW) sinceReport_++;
+    return sinceReport_ == OTA_WINDOW;
+  }
+
+  // Authenticated chunk that wants() took: decode it into the stage slot.
+  // Returns the state to report, OTA_NONE while inside a window.
+  uint8_t chunk(const OtaChunkFrame<const uint8_t>& f, ScratchArena& scratch) {
+    // Repeat or gap: say where we are
+    if (f.offset() != next_) {
+      resent_ = true;
+      sinceReport_ = 0;
+      return next_ ? OTA_PROGRESS : OTA_READY;
+    }
+
+    if (next_ + f.deltaLen() > deltaLen_) return fail();
+
+    {
+      ScratchLease lease(scratch, SCRATCH_CIPHER);
+      Sink sink{*this, scratch.cipher.page};
+      if (!decoder_.feed(f.delta(), f.deltaLen(), sink)) return fail();
+    }
+
+    next_ += f.deltaLen();
+    resent_ = false;
+
+    if (next_ == deltaLen_) {
+      active_ = false;
+      if (!decoder_.idle() || out_ != imageLen_ || !stage(scratch)) return OTA_BAD_IMAGE;
+      return OTA_STAGED;
+    }
+
+    if (++sinceReport_ < OTA_WINDOW) return OTA_NONE;
+    sinceReport_ = 0;
+    return OTA_PROGRESS;
+  }
+
+private:
+  // Decoder output into the stage slot, through a small RAM buffer
+  struct Sink {
+    NodeOta& ota;
+    uint8_t* buf;
+
+    bool literal(const uint8_t* p, uint16_t len) {
+      if (len > ota.imageLen_ - ota.out_) return false;
+      ota.write(p, len);
+      return true;
+    }
+
+    bool copy(uint16_t from, uint16_t len) {
+      if (len > ota.imageLen_ - ota.out_ || from > ota.baseLen_ || len > ota.baseLen_ - from) {
+        return false;
+      }
+      while (len) {
+        uint8_t n = len < sizeof(CipherScratch) ? len : sizeof(CipherScratch);
+        for (uint8_t i = 0; i < n; i++) buf[i] = otaImageRead(from + i);
+        ota.write(buf, n);
+        from += n;
+        len -= n;
+      }
+      return true;
+    }
+
+    bool fill(uint8_t b, uint16_t len) {
+      if (len > ota.imageLen_ - ota.out_) return false;
+      memset(buf, b, sizeof(CipherScratch));
+      while (len) {
+        uint8_t n = len < sizeof(CipherScratch) ? len : sizeof(CipherScratch);
+        ota.write(buf, n);
+        len -= n;
+      }
+      return true;
+    }
+  };
+
+  void write(const uint8_t* p, uint16_t len) {
+    flash_.program(OTA_STAGE_ADDR + out_, p, len);
+    out_ += len;
+  }
+
+  uint8_t fail() {
+    active_ = false;
+    return OTA_BAD_IMAGE;
+  }
+
+  // Check the signature over what is actually in the stage slot and hand
+  // it to the bootloader
+  bool stage(ScratchArena& scratch) {
+    ScratchLease frameLease(scratch, SCRATCH_FRAME);
+    ScratchLease hmacLease(scratch, SCRATCH_HMAC);
+    uint8_t* buf = scratch.frame;
+    SHA256& sha = scratch.hmac.sha;
+
+    sha.reset();
+    uint32_t crc = OTA_CRC_INIT;
+    for (uint16_t done = 0; done < imageLen_;) {
+      uint8_t n = imageLen_ - done < 64 ? imageLen_ - done : 64;
+      flash_.read(OTA_STAGE_ADDR + done, buf, n);
+      sha.update(buf, n);
+      for (uint8_t i = 0; i < n; i++) crc = otaCrc32(crc, buf[i]);
+      done += n;
+      if ((done & 0x0FFF) == 0) wdt_reset();
+    }
+    uint8_t* hash = scratch.hmac.inner;
+    sha.finalize(hash, 32);
+
+    uint8_t* signature = buf;
+    uint8_t* key = buf + WIRE_SIGNATURE_LEN;
+    flash_.read(OTA_SIGNATURE_ADDR, signature, WIRE_SIGNATURE_LEN);
+    memcpy_P(key, OTA_SIGNING_KEY, WIRE_PUBKEY_LEN);
+    wdt_reset();
+    if (!uECC_verify(key, hash, 32, signature, uECC_secp160r1())) return false;
+
+    OtaRecord r;
+    EEPROM.get(OTA_RECORD_ADDR, r);
+    r.state = OTA_BOOT_PENDING;
+    r.tries = 0;
+    r.updateId = updateId_;
+    r.imageLen = imageLen_;
+    r.imageCrc = otaCrcFinish(crc);
+    r.backupLen = baseLen_;
+    r.backupCrc = baseCrc_;
+    EEPROM.put(OTA_RECORD_ADDR, r);
+    return true;
+  }
+
+  OtaFlash flash_;
+  OtaDeltaDecoder decoder_;
+
+  bool active_ = false;
+  bool resent_ = false;
+  uint8_t sinceReport_ = 0;
+  uint16_t updateId_ = 0;
+  uint16_t baseLen_ = 0;
+  uint32_t baseCrc_ = 0;
+  uint16_t imageLen_ = 0;
+  uint16_t deltaLen_ = 0;
+  uint16_t next_ = 0;  // Delta bytes decoded
+  uint16_t out_ = 0;   // Image bytes staged
+};
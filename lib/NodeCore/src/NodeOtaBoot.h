@@ -0,0 +1,194 @@
+#pragma once
+
+// Firmware update hand-over between the application and the bootloader.
+//
+// The application receives an update, rebuilds the new image in the
+// external SPI flash and checks its signature (NodeOta.h). It then writes
+// an OtaRecord to EEPROM and resets into the bootloader, which runs
+// OtaBoot::run() below:
+//
+//   PENDING     staged image CRC checked, running image backed up
+//   INSTALLING  staged image copied into application flash and checked
+//   TRIAL       new image runs; each boot before it confirms is a try
+//   RESTORING   backup copied back after OTA_BOOT_TRIES failed boots; if
+//               OTA_RESTORE_TRIES copies fail their CRC, whatever the
+//               last one left is started
+//   ROLLED_BACK application reports the failure and goes back to IDLE
+//
+// Every state is written before the work it stands for, so a power cut at
+// any point repeats that step on the next boot. The application confirms
+// a TRIAL image (back to IDLE) once it has synced with the hub.
+//
+// Plain C++ without Arduino: the bootloader, the host HAL and the hub
+// tools share it.
+
+#include <stdint.h>
+#include <stddef.h>
+
+// External flash layout, 4 KB erase sectors
+#define OTA_SECTOR 4096
+#define OTA_SIGNATURE_ADDR 0x00000  // Image signature from the offer
+#define OTA_STAGE_ADDR 0x01000      // New image, rebuilt from the delta
+#define OTA_BACKUP_ADDR 0x09000     // Previous image, written by the bootloader
+#define OTA_FLASH_SIZE 0x11000
+#define OTA_IMAGE_MAX 0x7800        // Application section below a 2 KB bootloader
+
+#define OTA_RECORD_ADDR 64          // EEPROM, after the NodeConfig.h EE_* block
+
+#define OTA_BOOT_IDLE 0xFF          // Erased EEPROM
+#define OTA_BOOT_PENDING 1
+#define OTA_BOOT_INSTALLING 2
+#define OTA_BOOT_TRIAL 3
+#define OTA_BOOT_RESTORING 4
+#define OTA_BOOT_ROLLED_BACK 5
+
+#define OTA_BOOT_TRIES 3
+#define OTA_RESTORE_TRIES 3         // Backup copies that fail their CRC before giving up
+
+#define OTA_FACTORY_ID 0xFFFF       // runningId of erased EEPROM; no update takes it
+
+static_assert(OTA_STAGE_ADDR + OTA_IMAGE_MAX <= OTA_BACKUP_ADDR, "stage slot overlaps backup");
+static_assert(OTA_BACKUP_ADDR + OTA_IMAGE_MAX <= OTA_FLASH_SIZE, "backup slot past flash end");
+
+struct OtaRecord {
+  uint8_t state;
+  uint8_t tries;
+  uint16_t updateId;   // Staged, or on trial
+  uint16_t imageLen;
+  uint32_t imageCrc;
+  uint16_t backupLen;  // Running image when the update was staged
+  uint32_t backupCrc;
+  uint16_t runningId;  // Last confirmed update, OTA_FACTORY_ID for the factory image
+};
+
+// CRC-32 (IEEE, reflected), bitwise to stay small in the bootloader
+inline uint32_t otaCrc32(uint32_t crc, uint8_t b) {
+  crc ^= b;
+  for (uint8_t i = 0; i < 8; i++) {
+    crc = (crc >> 1) ^ (0xEDB88320UL & (0 - (crc & 1)));
+  }
+  return crc;
+}
+
+#define OTA_CRC_INIT 0xFFFFFFFFUL
+#define otaCrcFinish(crc) ((crc) ^ 0xFFFFFFFFUL)
+
+// What OtaBoot needs from the hardware:
+//
+//   struct Port {
+//     void readRecord(OtaRecord& r);
+//     void writeRecord(const OtaRecord& r);
+//     void flashRead(uint32_t addr, uint8_t* buf, uint16_t len);     // external
+//     void flashProgram(uint32_t addr, const uint8_t* buf, uint16_t len);
+//     void flashErase(uint32_t addr);                                 // one sector
+//     uint8_t appRead(uint16_t addr);                                 // application flash
+//     void appWritePage(uint16_t addr, const uint8_t* page);          // APP_PAGE bytes
+//   };
+//
+// flashProgram() never crosses a 256 byte program page.
+template <class Port, uint16_t APP_PAGE>
+class OtaBoot {
+public:
+  explicit OtaBoot(Port& port) : port_(port) {}
+
+  // Run the hand-over state machine; returns when the application may start
+  void run() {
+    OtaRecord r;
+    port_.readRecord(r);
+
+    for (;;) {
+      switch (r.state) {
+        case OTA_BOOT_PENDING:
+          if (r.imageLen > OTA_IMAGE_MAX || r.backupLen > OTA_IMAGE_MAX ||
+              flashCrc(OTA_STAGE_ADDR, r.imageLen) != r.imageCrc ||
+              !backup(r.backupLen, r.backupCrc)) {
+            r.state = OTA_BOOT_IDLE;  // Nothing touched yet, keep running
+            break;
+          }
+          r.state = OTA_BOOT_INSTALLING;
+          break;
+
+        case OTA_BOOT_INSTALLING:
+          install(OTA_STAGE_ADDR, r.imageLen);
+          r.state = appCrc(r.imageLen) == r.imageCrc ? OTA_BOOT_TRIAL : OTA_BOOT_RESTORING;
+          r.tries = 0;
+          break;
+
+        case OTA_BOOT_TRIAL:
+          if (r.tries >= OTA_BOOT_TRIES) {
+            r.state = OTA_BOOT_RESTORING;
+            r.tries = 0;
+            break;
+          }
+          r.tries++;
+          port_.writeRecord(r);
+          return;
+
+        case OTA_BOOT_RESTORING:
+          // A backup that keeps failing its CRC will not get better: after
+          // OTA_RESTORE_TRIES the node runs what is there rather than
+          // erase and rewrite application flash until it wears out
+          install(OTA_BACKUP_ADDR, r.backupLen);
+          if (appCrc(r.backupLen) != r.backupCrc && ++r.tries < OTA_RESTORE_TRIES) break;
+          r.state = OTA_BOOT_ROLLED_BACK;
+          break;
+
+        default:  // IDLE, ROLLED_BACK: the application takes it from here
+          port_.writeRecord(r);
+          return;
+      }
+      port_.writeRecord(r);
+    }
+  }
+
+private:
+  uint32_t flashCrc(uint32_t addr, uint16_t len) {
+    uint8_t buf[32];
+    uint32_t crc = OTA_CRC_INIT;
+    for (uint16_t done = 0; done < len;) {
+      uint16_t n = len - done;
+      if (n > sizeof(buf)) n = sizeof(buf);
+      port_.flashRead(addr + done, buf, n);
+      for (uint16_t i = 0; i < n; i++) crc = otaCrc32(crc, buf[i]);
+      done += n;
+    }
+    return otaCrcFinish(crc);
+  }
+
+  uint32_t appCrc(uint16_t len) {
+    uint32_t crc = OTA_CRC_INIT;
+    for (uint16_t i = 0; i < len; i++) crc = otaCrc32(crc, port_.appRead(i));
+    return otaCrcFinish(crc);
+  }
+
+  // Running image into the backup slot, read back to check
+  bool backup(uint16_t len, uint32_t crc) {
+    for (uint32_t a = 0; a < OTA_IMAGE_MAX; a += OTA_SECTOR) {
+      port_.flashErase(OTA_BACKUP_ADDR + a);
+    }
+
+    uint8_t buf[32];
+    for (uint16_t done = 0; done < len;) {
+      uint16_t n = len - done;
+      if (n > sizeof(buf)) n = sizeof(buf);
+      for (uint16_t i = 0; i < n; i++) buf[i] = port_.appRead(done + i);
+      port_.flashProgram(OTA_BACKUP_ADDR + done, buf, n);
+      done += n;
+    }
+    return flashCrc(OTA_BACKUP_ADDR, len) == crc;
+  }
+
+  // External slot into application flash, one page at a time
+  void install(uint32_t from, uint16_t len) {
+    uint8_t page[APP_PAGE];
+    for (uint16_t addr = 0; addr < len; addr += APP_PAGE) {
+      uint16_t n = len - addr;
+      if (n > APP_PAGE) n = APP_PAGE;
+      port_.flashRead(from + addr, page, n);
+      for (uint16_t i = n; i < APP_PAGE; i++) page[i] = 0xFF;
+      port_.appWritePage(addr, page);
+    }
+  }
+
+  Port& port_;
+};
@@ -0,0 +1,222 @@
+#pragma once
+
+// Thin SX1276 driver that sits alongside the sandeepmistry LoRa library.
+//
+// The library moves every FIFO byte as its own SPI transaction (and on RX
+// also re-reads REG_RX_NB_BYTES per byte through available()). This layer
+// keeps the library for configuration, IRQ handling and TX start, but moves
+// whole FIFO ranges in one burst transaction and skips mode changes the
+// radio is already in.
+//
+// begin() checks the burst path byte for byte against the library path
+// once at boot; if they ever disagree it falls back to the library path.
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <LoRa.h>
+
+#include "NodeConfig.h"
+#include "NodeEnergy.h"
+#include "NodeLog.h"
+
+// SX1276 registers (LoRa mode)
+#define SX_REG_FIFO 0x00
+#define SX_REG_OP_MODE 0x01
+#define SX_REG_FIFO_ADDR_PTR 0x0D
+#define SX_REG_PAYLOAD_LENGTH 0x22
+
+#define RADIO_SPI_FREQUENCY 8E6  // Same as LORA_DEFAULT_SPI_FREQUENCY
+#define RADIO_CHECK_LEN 32
+
+class NodeRadio {
+public:
+  // Call after LoRa.begin() and before LoRa.receive()
+  bool begin() {
+#if defined(__AVR__)
+    pinMode(RFM95_CS, OUTPUT);
+    digitalWrite(RFM95_CS, HIGH);
+    burst_ = selfCheck();
+#endif
+    mode_ = MODE_UNKNOWN;
+    energyMark(ENERGY_RADIO, ENERGY_RADIO_STANDBY);
+    return burst_;
+  }
+
+  bool usesBurst() const { return burst_; }
+  bool receiving() const { return mode_ == MODE_RX; }
+
+  // Only recorded for the energy trace, the library keeps the real setting
+  void setSpreadingFactor(uint8_t sf) {
+    LoRa.setSpreadingFactor(sf);
+    sf_ = sf;
+  }
+
+  void idle() {
+    if (mode_ == MODE_STANDBY) return;
+    LoRa.idle();
+    mode_ = MODE_STANDBY;
+    energyMark(ENERGY_RADIO, ENERGY_RADIO_STANDBY);
+  }
+
+  // Only the registers survive, the FIFO is lost
+  void sleep() {
+    if (mode_ == MODE_SLEEP) return;
+    LoRa.sleep();
+    mode_ = MODE_SLEEP;
+    energyMark(ENERGY_RADIO, ENERGY_RADIO_SLEEP);
+  }
+
+  void receive() {
+    if (mode_ == MODE_RX) return;
+    LoRa.receive();
+    mode_ = MODE_RX;
+    energyMark(ENERGY_RADIO, ENERGY_RADIO_RX);
+  }
+
+  // Leaves the radio in standby with the FIFO pointer at 0
+  int beginPacket() {
+    int ok = LoRa.beginPacket();
+    mode_ = MODE_STANDBY;
+    txLen_ = 0;
+    energyMark(ENERGY_RADIO, ENERGY_RADIO_STANDBY);
+    return ok;
+  }
+
+  void write(const uint8_t* buf, uint8_t len) {
+    if (!burst_) {
+      LoRa.write(buf, len);
+      return;
+    }
+    writeFifo(buf, len);
+    txLen_ += len;
+  }
+
+  int endPacket(bool async = false) {
+    if (burst_) {
+      writeRegister(SX_REG_PAYLOAD_LENGTH, txLen_);
+    }
+    energyMark(ENERGY_RADIO, ENERGY_RADIO_TX, sf_);
+    int ok = LoRa.endPacket(async);
+    // A blocking send ends in standby, an async one is still transmitting
+    mode_ = async ? MODE_UNKNOWN : MODE_STANDBY;
+    if (!async) energyMark(ENERGY_RADIO, ENERGY_RADIO_STANDBY);
+    return ok;
+  }
+
+  // Drain the packet just signalled by onReceive(size). The library has
+  // already pointed the FIFO at the start of the packet.
+  uint8_t read(uint8_t* buf, uint8_t size, uint8_t max) {
+    if (size > max) size = max;
+    if (!burst_) {
+      uint8_t idx = 0;
+      while (LoRa.available() && idx < size) {
+        buf[idx++] = LoRa.read();
+      }
+      return idx;
+    }
+    readFifo(buf, size);
+    return size;
+  }
+
+private:
+  enum Mode : uint8_t { MODE_UNKNOWN, MODE_SLEEP, MODE_STANDBY, MODE_RX };
+
+#if defined(__AVR__)
+  void select() {
+    SPI.beginTransaction(SPISettings(RADIO_SPI_FREQUENCY, MSBFIRST, SPI_MODE0));
+    digitalWrite(RFM95_CS, LOW);
+  }
+
+  void deselect() {
+    digitalWrite(RFM95_CS, HIGH);
+    SPI.endTransaction();
+  }
+
+  uint8_t readRegister(uint8_t reg) {
+    select();
+    SPI.transfer(reg & 0x7F);
+    uint8_t v = SPI.transfer(0x00);
+    deselect();
+    return v;
+  }
+
+  void writeRegister(uint8_t reg, uint8_t v) {
+    select();
+    SPI.transfer(reg | 0x80);
+    SPI.transfer(v);
+    deselect();
+  }
+
+  void readFifo(uint8_t* buf, uint8_t len) {
+    select();
+    SPI.transfer(SX_REG_FIFO & 0x7F);
+    for (uint8_t i = 0; i < len; i++) {
+      buf[i] = SPI.transfer(0x00);
+    }
+    deselect();
+  }
+
+  // Byte loop instead of SPI.transfer(buf, len): that one overwrites the
+  // buffer with MISO data and callers still need the bytes (CBC chaining)
+  void writeFifo(const uint8_t* buf, uint8_t len) {
+    select();
+    SPI.transfer(SX_REG_FIFO | 0x80);
+    for (uint8_t i = 0; i < len; i++) {
+      SPI.transfer(buf[i]);
+    }
+    deselect();
+  }
+
+  // Write a pattern through one path and read it back through the other,
+  // in both directions, and compare the payload length the library keeps.
+  bool selfCheck() {
+    uint8_t pattern[RADIO_CHECK_LEN];
+    uint8_t back[RADIO_CHECK_LEN];
+    for (uint8_t i = 0; i < RADIO_CHECK_LEN; i++) {
+      pattern[i] = (uint8_t)(i * 37 + 11);
+    }
+
+    // Library write, burst read
+    LoRa.beginPacket();
+    LoRa.write(pattern, RADIO_CHECK_LEN);
+    uint8_t libLen = readRegister(SX_REG_PAYLOAD_LENGTH);
+    writeRegister(SX_REG_FIFO_ADDR_PTR, 0);
+    readFifo(back, RADIO_CHECK_LEN);
+    bool ok = libLen == RADIO_CHECK_LEN && memcmp(back, pattern, RADIO_CHECK_LEN) == 0;
+
+    // Burst write, per-byte register read (what the library does)
+    for (uint8_t i = 0; i < RADIO_CHECK_LEN; i++) {
+      pattern[i] = ~pattern[i];
+    }
+    writeRegister(SX_REG_FIFO_ADDR_PTR, 0);
+    writeFifo(pattern, RADIO_CHECK_LEN);
+    writeRegister(SX_REG_FIFO_ADDR_PTR, 0);
+    for (uint8_t i = 0; i < RADIO_CHECK_LEN; i++) {
+      back[i] = readRegister(SX_REG_FIFO);
+    }
+    ok = ok && memcmp(back, pattern, RADIO_CHECK_LEN) == 0;
+
+    // Nothing was sent, reset what beginPacket() set up
+    writeRegister(SX_REG_FIFO_ADDR_PTR, 0);
+    writeRegister(SX_REG_PAYLOAD_LENGTH, 0);
+    LoRa.idle();
+
+    if (ok) {
+      DEBUG_LOG("[N] SPI burst: OK");
+    } else {
+      DEBUG_LOG("[N] SPI burst: MISMATCH, using library path");
+    }
+    return ok;
+  }
+#else
+  // Off-target there is no SPI bus; the library path is always used
+  void writeRegister(uint8_t, uint8_t) {}
+  void readFifo(uint8_t*, uint8_t) {}
+  void writeFifo(const uint8_t*, uint8_t) {}
+#endif
+
+  bool burst_ = false;
+  Mode mode_ = MODE_UNKNOWN;
+  uint8_t txLen_ = 0;
+  uint8_t sf_ = 7;  // Library default
+};
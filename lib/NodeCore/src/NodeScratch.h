@@ -0,0 +1,111 @@
+#pragma once
+
+// Statically allocated scratch arena for frame building and crypto work.
+//
+// Instead of every send/handle function putting its own packet, plaintext,
+// HMAC pads and digests on the stack, they borrow a fixed slice of one
+// arena that lives inside the (global) node object. Peak RAM is then known
+// at link time instead of depending on which call chain happens to nest.
+//
+//   Slice           Size  Users
+//   rx              128   onRx() fills it, loop() dispatch releases it
+//   frame           126   send*() and the hub challenge response
+//   hmac            ~200  HMAC, held across a streamed sendData()
+//   cipher           32   CBC encrypt/decrypt, ECDH shared secret, OTA
+//                         image copies
+//
+// Main-context slices are claimed with a ScratchLease. Claiming a slice that
+// is already held means two users overlap, which is a firmware bug: the
+// node stops and the watchdog resets it rather than corrupting a frame.
+// The rx slice is owned by the ISR while rxLen is 0 and by loop() otherwise.
+
+#include <Arduino.h>
+#include <SHA256.h>
+
+#include "NodeConfig.h"
+#include "NodeFrame.h"
+#include "NodeLog.h"
+
+#define RX_FRAME_MAX 128
+#define TX_FRAME_MAX 126  // 1 + 16 + 4 + 8 + 1 + 64 + 32(HMAC)
+#define PAYLOAD_MAX 63    // Largest plaintext message, 4 blocks with its padding
+
+static_assert(SecureFrame<uint8_t>::lenFor(PAYLOAD_MAX) <= TX_FRAME_MAX, "frame slice too small for MSG_DATA");
+static_assert(WIRE_DIAG_LEN <= TX_FRAME_MAX, "frame slice too small for MSG_DIAG");
+static_assert(WIRE_CHALLENGE_LEN <= TX_FRAME_MAX, "frame slice too small for MSG_CHALLENGE");
+static_assert(WIRE_ADOPT_REQ_LEN <= TX_FRAME_MAX, "frame slice too small for MSG_ADOPT_REQ");
+static_assert(SecureFrame<uint8_t>::lenFor(PAYLOAD_MAX) <= RX_FRAME_MAX, "rx slice too small for MSG_COMMAND");
+static_assert(SecureFrame<uint8_t>::lenFor(WIRE_GROUP_JOIN_LEN) <= RX_FRAME_MAX, "rx slice too small for MSG_GROUP_JOIN");
+static_assert(WIRE_TRIGGER_LEN <= RX_FRAME_MAX, "rx slice too small for MSG_TRIGGER");
+static_assert(WIRE_BEACON_LEN <= RX_FRAME_MAX, "rx slice too small for MSG_BEACON");
+static_assert(WIRE_ADOPT_RSP_LEN <= RX_FRAME_MAX, "rx slice too small for MSG_ADOPT_RSP");
+static_assert(WIRE_RESYNC_LEN <= RX_FRAME_MAX, "rx slice too small for MSG_RESYNC");
+static_assert(WIRE_PUBKEY_LEN <= TX_FRAME_MAX, "frame slice too small for the hub key");
+static_assert(WIRE_OTA_STATUS_LEN <= TX_FRAME_MAX, "frame slice too small for MSG_OTA_STATUS");
+static_assert(WIRE_OTA_OFFER_LEN <= RX_FRAME_MAX, "rx slice too small for MSG_OTA_OFFER");
+static_assert(OtaChunkFrame<uint8_t>::lenFor(WIRE_OTA_CHUNK_MAX) <= RX_FRAME_MAX, "rx slice too small for MSG_OTA_CHUNK");
+static_assert(WIRE_BULK_OFFER_LEN <= RX_FRAME_MAX && WIRE_BULK_OFFER_LEN <= TX_FRAME_MAX, "slices too small for MSG_BULK_OFFER");
+static_assert(BulkFragmentFrame<uint8_t>::lenFor(BULK_FRAGMENT_MAX) <= RX_FRAME_MAX, "rx slice too small for MSG_BULK_FRAGMENT");
+static_assert(BulkFragmentFrame<uint8_t>::lenFor(BULK_FRAGMENT_MAX) <= TX_FRAME_MAX, "frame slice too small for MSG_BULK_FRAGMENT_UP");
+static_assert(WIRE_BULK_ACK_LEN <= RX_FRAME_MAX && WIRE_BULK_ACK_LEN <= TX_FRAME_MAX, "slices too small for MSG_BULK_ACK");
+
+#define SCRATCH_FRAME 0x01
+#define SCRATCH_HMAC 0x02
+#define SCRATCH_CIPHER 0x04
+
+struct HmacScratch {
+  SHA256 sha;
+  uint8_t pad[64];    // Key block, XORed into ipad and then opad in place
+  uint8_t inner[32];  // Inner hash, then the computed HMAC for verification
+};
+
+// Plaintext never gets its own buffer: it is encrypted into the frame and
+// decrypted in place in the rx slice, so only one block of state is needed.
+union CipherScratch {
+  struct {
+    uint8_t block[16];  // Single CBC block
+    uint8_t iv[16];     // CBC chaining value
+  } cbc;
+  uint8_t secret[20];   // ECDH shared secret
+  uint8_t page[32];     // Image bytes on their way to or from flash (NodeOta.h)
+};
+
+struct ScratchArena {
+  uint8_t rx[RX_FRAME_MAX];
+  volatile uint8_t rxLen = 0;
+
+  uint8_t frame[TX_FRAME_MAX];
+  HmacScratch hmac;
+  CipherScratch cipher;
+
+  uint8_t owned = 0;  // SCRATCH_* bits currently claimed from main context
+};
+
+inline void scratchFault(uint8_t slice) {
+  DEBUG_LOG("[N] Scratch overlap: %u", slice);
+  logFlush();
+#if defined(__AVR__)
+  while (1);  // Watchdog resets the node
+#else
+  abort();
+#endif
+}
+
+class ScratchLease {
+public:
+  ScratchLease(ScratchArena& arena, uint8_t slice) : arena_(arena), slice_(slice) {
+    if (arena_.owned & slice_) scratchFault(slice_);
+    arena_.owned |= slice_;
+  }
+
+  ~ScratchLease() {
+    arena_.owned &= ~slice_;
+  }
+
+private:
+  ScratchLease(const ScratchLease&);
+  ScratchLease& operator=(const ScratchLease&);
+
+  ScratchArena& arena_;
+  uint8_t slice_;
+};
@@ -0,0 +1,71 @@
+#pragma once
+
+// MCU sleep for a given time, for nodes waiting for their next receive
+// window (NodeBeacon.h) with the radio asleep.
+//
+// Power-down with the watchdog as the wake-up timer, in the largest of its
+// 16 ms .. 8 s steps that fits, then the remainder awake in delay().
+// Timer0 stops in power-down, so every step is added to millis() by hand
+// (micros() is not corrected). The watchdog oscillator is only good to
+// about 10%, so millis() drifts against real time while the node sleeps;
+// NodeBeacon measures that against the beacons. On return the watchdog is
+// back in reset mode with its 8 s timeout.
+//
+// An energy trace needs a true micros(), so with ENERGY_TRACE the sleep is
+// a delay() marked as CPU sleep. The host build sleeps on the board clock
+// with the board's sleep timer error (hal::Board::sleepPpm).
+
+#include <Arduino.h>
+#include <avr/wdt.h>
+#if defined(__AVR__)
+#include <avr/sleep.h>
+#include <avr/interrupt.h>
+#endif
+
+#include "NodeEnergy.h"
+
+#define SLEEP_STEP_MIN_MS 16UL  // WDTO_15MS, nominal
+#define SLEEP_STEP_MAX 9        // WDTO_8S: SLEEP_STEP_MIN_MS << 9
+
+#if defined(__AVR__)
+extern volatile unsigned long timer0_millis;  // Arduino core, wiring.c
+
+// Only used to wake the CPU from power-down
+EMPTY_INTERRUPT(WDT_vect);
+#endif
+
+inline void sleepMs(unsigned long ms) {
+  EnergySpan energy(ENERGY_CPU, ENERGY_CPU_SLEEP);
+
+#if defined(__AVR__) && !ENERGY_TRACE
+  while (ms >= SLEEP_STEP_MIN_MS) {
+    uint8_t step = SLEEP_STEP_MAX;
+    while ((SLEEP_STEP_MIN_MS << step) > ms) step--;
+
+    // Interrupt mode only: the timeout wakes the CPU instead of resetting it
+    cli();
+    wdt_reset();
+    MCUSR &= ~_BV(WDRF);
+    WDTCSR = _BV(WDCE) | _BV(WDE);
+    WDTCSR = _BV(WDIE) | (step & 8 ? _BV(WDP3) : 0) | (step & 7);
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    sleep_enable();
+    sleep_bod_disable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+
+    unsigned long slept = SLEEP_STEP_MIN_MS << step;
+    cli();
+    timer0_millis += slept;
+    sei();
+    ms -= slept;
+  }
+  wdt_enable(WDTO_8S);
+  delay(ms);
+#elif defined(__AVR__)
+  delay(ms);
+#else
+  halSleep(ms);
+#endif
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+// Stack high-water-mark instrumentation.
+//
+// Before main() runs, all RAM between the end of .bss and the top of the
+// stack is painted with STACK_CANARY. Any byte the stack (or an ISR nested
+// on it) ever touches loses the pattern, so scanning up from the bottom for
+// the first overwritten byte gives the true worst-case depth since boot.
+//
+// stackCheckpoint(path) re-measures after an operation and remembers which
+// path first pushed the mark deeper. Scanning costs roughly 6 cycles per
+// free byte, so checkpoints only sit after rare or already expensive work.
+
+#include <Arduino.h>
+
+#define STACK_CANARY 0xC5
+
+// Paths that can set a new stack high-water mark
+#define STACK_PATH_BOOT 0
+#define STACK_PATH_LOOP 1         // loop() itself or an ISR nested on it
+#define STACK_PATH_RX 2           // Frame dispatch, HMAC verify, decrypt
+#define STACK_PATH_TX 3           // sendData(): encrypt + HMAC
+#define STACK_PATH_ECDH_KEYGEN 4  // uECC_make_key()
+#define STACK_PATH_ECDH_SHARED 5  // uECC_shared_secret()
+#define STACK_PATH_ECDSA_VERIFY 6 // uECC_verify() of a MSG_RESYNC
+
+struct StackStats {
+  uint16_t peak;     // Deepest stack use since boot (bytes)
+  uint16_t minFree;  // Untouched bytes left between .bss/heap and stack
+  uint8_t path;      // STACK_PATH_* that set the current peak
+};
+
+static StackStats stackStats;
+
+#if defined(__AVR__)
+
+extern uint8_t _end;
+extern uint8_t __stack;
+extern char* __brkval;
+
+// Runs from .init1, before the stack pointer is set up and r1 is cleared,
+// so it must not touch the stack or rely on compiler registers.
+static void __attribute__((naked, used, section(".init1"))) stackPaint() {
+  __asm volatile (
+    "    ldi r30, lo8(_end)\n"
+    "    ldi r31, hi8(_end)\n"
+    "    ldi r24, %0\n"
+    "    ldi r25, hi8(__stack)\n"
+    "    rjmp 2f\n"
+    "1:  st Z+, r24\n"
+    "2:  cpi r30, lo8(__stack)\n"
+    "    cpc r31, r25\n"
+    "    brlo 1b\n"
+    "    breq 1b\n"
+    :: "M" (STACK_CANARY));
+}
+
+inline void stackCheckpoint(uint8_t path) {
+  // Heap allocations live above .bss, start scanning past them
+  const uint8_t* p = __brkval ? (const uint8_t*)__brkval : &_end;
+  uint16_t unused = 0;
+  while (p <= &__stack && *p == STACK_CANARY) {
+    p++;
+    unused++;
+  }
+
+  uint16_t peak = (uint16_t)(&__stack - p) + 1;
+  if (peak > stackStats.peak) {
+    stackStats.peak = peak;
+    stackStats.path = path;
+  }
+  stackStats.minFree = unused;
+}
+
+#else
+
+// No painted stack off-target, keep the API so shared code builds anywhere
+inline void stackCheckpoint(uint8_t) {}
+
+#endif
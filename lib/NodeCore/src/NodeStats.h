@@ -0,0 +1,72 @@
+#pragma once
+
+// Production health counters: what DEBUG output would have shown, kept as
+// numbers. Saturating uint16 event counters (see DIAG_* in NodeWire.h),
+// RSSI and SNR histograms of received frames, the longest loop()
+// iteration and the slowest trigger, all since the last MSG_DIAG report.
+//
+// Everything is bumped from the main context except DIAG_RX_OVERRUN, which
+// the RX ISR owns; snapshot() reads and clears with interrupts off so that
+// count is neither torn nor lost.
+
+#include <Arduino.h>
+
+#include "NodeWire.h"
+
+class NodeStats {
+public:
+  void bump(uint8_t stat) {
+    if (counters_[stat] != 0xFFFF) counters_[stat]++;
+  }
+
+  void packet(int rssi, float snr) {
+    bumpBin(rssi_, (rssi - DIAG_RSSI_MIN) / DIAG_RSSI_STEP);
+    bumpBin(snr_, (int)(snr - DIAG_SNR_MIN) / DIAG_SNR_STEP);
+  }
+
+  void loopTime(unsigned long us) {
+    unsigned long ms = us / 1000;
+    if (ms > worstLoopMs_) worstLoopMs_ = ms > 0xFFFF ? 0xFFFF : ms;
+  }
+
+  void triggerTime(unsigned long us) {
+    if (us > worstTriggerUs_) worstTriggerUs_ = us > 0xFFFF ? 0xFFFF : us;
+  }
+
+  // Write the DIAG_PAYLOAD_LEN byte payload and start a new period
+  void snapshot(uint8_t* p) {
+    p[DIAG_OFF_VERSION] = DIAG_VERSION;
+
+    noInterrupts();
+    for (uint8_t i = 0; i < DIAG_STATS; i++) {
+      p[DIAG_OFF_STATS + 2 * i] = counters_[i];
+      p[DIAG_OFF_STATS + 2 * i + 1] = counters_[i] >> 8;
+    }
+    memcpy(p + DIAG_OFF_RSSI, rssi_, DIAG_HIST_BINS);
+    memcpy(p + DIAG_OFF_SNR, snr_, DIAG_HIST_BINS);
+    p[DIAG_OFF_WORST_LOOP] = worstLoopMs_;
+    p[DIAG_OFF_WORST_LOOP + 1] = worstLoopMs_ >> 8;
+    p[DIAG_OFF_WORST_TRIGGER] = worstTriggerUs_;
+    p[DIAG_OFF_WORST_TRIGGER + 1] = worstTriggerUs_ >> 8;
+
+    for (uint8_t i = 0; i < DIAG_STATS; i++) counters_[i] = 0;
+    memset(rssi_, 0, sizeof(rssi_));
+    memset(snr_, 0, sizeof(snr_));
+    worstLoopMs_ = 0;
+    worstTriggerUs_ = 0;
+    interrupts();
+  }
+
+private:
+  static void bumpBin(uint8_t* bins, int bin) {
+    if (bin < 0) bin = 0;
+    if (bin >= DIAG_HIST_BINS) bin = DIAG_HIST_BINS - 1;
+    if (bins[bin] != 0xFF) bins[bin]++;
+  }
+
+  volatile uint16_t counters_[DIAG_STATS] = {};
+  uint8_t rssi_[DIAG_HIST_BINS] = {};
+  uint8_t snr_[DIAG_HIST_BINS] = {};
+  uint16_t worstLoopMs_ = 0;
+  uint16_t worstTriggerUs_ = 0;
+};
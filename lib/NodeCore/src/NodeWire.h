@@ -0,0 +1,336 @@
+#pragma once
+
+// Over-the-air frame formats, shared by the node firmware and the hub.
+// Plain constants only, so host tools can include it without Arduino.
+// NodeFrame.h has typed views over these layouts.
+//
+//   MSG_DISCOVERY      type + SERIAL_ID                                    17
+//   MSG_DISCOVERY_ACK  type + SERIAL_ID                                    17
+//   MSG_ADOPT_REQ      type + SERIAL_ID + pubKey(40)                       57
+//   MSG_ADOPT_RSP      type + SERIAL_ID + status + hubPubKey(40) + epoch   62
+//   MSG_CHALLENGE      type + SERIAL_ID + tx + rx + nonce(8) + HMAC        65
+//   MSG_CHALLENGE_RSP  type + SERIAL_ID + tx + rx + nonce(8) + HMAC        65
+//   MSG_DATA           type + SERIAL_ID + counter + nonce(8) + origLen
+//   MSG_COMMAND          + ciphertext(16n) + HMAC                   62 + 16n
+//   MSG_DIAG           type + SERIAL_ID + counter + diag(49) + HMAC       102
+//   MSG_OTA_OFFER      type + SERIAL_ID + counter + updateId + baseCrc
+//                        + imageLen + deltaLen + signature(40) + HMAC     103
+//   MSG_OTA_CHUNK      type + SERIAL_ID + updateId + offset
+//                        + delta(1..64) + HMAC                       53 + n
+//   MSG_OTA_STATUS     type + SERIAL_ID + counter + updateId + state
+//                        + next + HMAC                                    58
+//   MSG_GROUP_JOIN     as MSG_COMMAND, plaintext groupId(16) + groupKey(16)
+//                        + groupCounter                                  110
+//   MSG_GROUP_COMMAND  type + GROUP_ID + counter + nonce(8) + origLen
+//                        + ciphertext(16n) + HMAC                   62 + 16n
+//   MSG_TRIGGER        type + SERIAL_ID or GROUP_ID + counter + action
+//                        + tag(8)                                         30
+//   MSG_BEACON         type + seq + period + flags                          6
+//   MSG_RETRY          type + SERIAL_ID + waitMs                           19
+//   MSG_RESYNC         type + epoch + signature(40)                        45
+//   MSG_BULK_OFFER     type + SERIAL_ID + counter + kind + size + crc
+//   MSG_BULK_OFFER_UP    + nonce(8) + HMAC                                 68
+//   MSG_BULK_FRAGMENT  type + SERIAL_ID + counter + index
+//   MSG_BULK_FRAGMENT_UP + ciphertext(16..64) + HMAC                  54 + n
+//   MSG_BULK_ACK       type + SERIAL_ID + counter + state + received
+//   MSG_BULK_ACK_UP      + HMAC                                            56
+//
+// Counters are little-endian uint32. The HMAC is HMAC-SHA256 with the
+// session key over every byte before it. Payloads are AES-128-CBC with
+// IV = SERIAL_ID[0..3] + counter + nonce, padded with 0x80 then zeros.
+// MSG_DIAG is authenticated but not encrypted and shares the MSG_DATA
+// counter.
+//
+// OTA frames are authenticated but not encrypted. An offer takes a hub
+// counter like MSG_COMMAND and a status takes a node counter like
+// MSG_DIAG. Chunks carry no counter: a replayed chunk can only rewrite
+// the same bytes of the same update, and the image signature covers the
+// result. uint16 fields are little-endian too.
+//
+// Multicast: MSG_GROUP_JOIN gives a node, under its session key, the ID,
+// key and next counter of a group. MSG_GROUP_COMMAND is a MSG_COMMAND for
+// every member at once: the group ID stands in for SERIAL_ID, also in the
+// IV, and the group key for the session key. Group counters are their own
+// sequence, kept by each member across reboots.
+//
+// MSG_TRIGGER switches a siren with no HMAC, no ciphertext and no text to
+// parse. The tag is the first 8 bytes of AES-128, under the trigger key,
+// of the single block
+//
+//   type  ID[0..9]  counter  action
+//
+// and the trigger key is AES-128 of 16 bytes of TRIGGER_KEY_BYTE under the
+// session key, or under the group key when the ID is a group's. AES on one
+// block of fixed layout is a PRF, so this is a MAC with a 64 bit tag, and
+// the separate key keeps it apart from every CBC block of other frames.
+// The counter is the command sequence of the node or the group, so a
+// trigger is replay protected exactly like the command it stands in for.
+//
+// MSG_BEACON goes out every period ms (uint16) with seq one higher each
+// time, so a node that sleeps through some can tell how many. It carries
+// no ID and no MAC: it only tells a node on backup power when to listen
+// (NodeBeacon.h), everything heard in the window is authenticated as
+// usual. A forged beacon can move the windows of nodes that accept it,
+// which jamming the real one does as well; locked nodes only take beacons
+// inside their window. BEACON_PENDING says frames held for sleeping nodes
+// follow right after it.
+//
+// MSG_RETRY is the hub's answer to a discovery, challenge or adoption
+// request it cannot take now: try again after waitMs (uint16). It carries
+// no MAC, a node asking to be adopted has no key yet, so a node never
+// waits longer than its own longest backoff for it (NodeBackoff.h). A
+// forged one delays a node no more than a lost answer would.
+//
+// MSG_RESYNC restarts the counters of every node at once, after the hub
+// lost them (a gateway restart, a site-wide outage) and instead of one
+// challenge round trip per node. The epoch (uint32) only ever grows; the
+// session key for it is the first 16 bytes of HMAC-SHA256 under the
+// adoption key (the ECDH result) of type + epoch, and every counter
+// starts again from 0 under that key. A fresh key, not just fresh
+// counters, so frames from before cannot be replayed. A node adopted in
+// an epoch, which MSG_ADOPT_RSP tells it, uses the adoption key itself
+// until the next one.
+//
+// The frame goes to every node, so no session key can authenticate it:
+// the signature is ECDSA secp160r1 over SHA-256 of type + epoch, with the
+// key pair whose public half came in MSG_ADOPT_RSP. Nodes check the epoch
+// first and verify only a higher one, which takes about a second on an
+// ATmega328; a copy of the current epoch costs nothing. A node that missed
+// every copy keeps its old key, so the hub sends the frame again to a node
+// whose challenge fails the HMAC.
+//
+// Bulk transfers carry up to BULK_LEN_MAX bytes in either direction:
+// config blobs, pattern tables and keys down, diagnostics up. The sender
+// offers one under a fresh counter of its own sequence (the hub's command
+// counter, the node's MSG_DATA counter) with the plaintext size, its
+// CRC-32 and a nonce. The plaintext is padded as usual, encrypted as one
+// CBC stream with IV = SERIAL_ID[0..3] + the offer's counter + nonce and
+// cut into fragments of BULK_FRAGMENT_MAX ciphertext bytes, the last one
+// shorter. A fragment carries the offer's counter and its index but no
+// counter of its own, like an OTA chunk: its HMAC keeps forgeries out, and
+// a replayed one can only put the same bytes in the same place of the
+// same transfer.
+//
+// The receiver answers the offer, and every fragment with BULK_POLL in its
+// index, with an ack: the offer's counter, a BULK_* state and a bitmap of
+// the fragments it holds (uint16, bit i for fragment i). The sender sends
+// up to BULK_WINDOW missing fragments, polls with the last one and goes on
+// from the bitmap that comes back; without one it sends the same again.
+// Once every fragment is in, the receiver decrypts the whole transfer and
+// checks padding and CRC, so a transfer is only handed over whole and as
+// offered. An offer sent again takes a new counter and the data is
+// encrypted again under it. Each direction has its own three types, so a
+// frame is never accepted back by the side that sent it.
+
+#define MSG_ADOPT_REQ 0x01
+#define MSG_ADOPT_RSP 0x02
+#define MSG_DATA 0x10
+#define MSG_COMMAND 0x20
+#define MSG_DISCOVERY 0x03 // Discovery packet for non-adopted nodes
+#define MSG_DISCOVERY_ACK 0x04 // Discovery ACK from hub
+#define MSG_CHALLENGE 0x05 // Challenge for counter sync
+#define MSG_CHALLENGE_RSP 0x06 // Challenge response
+#define MSG_DIAG 0x11 // Node health counters
+#define MSG_OTA_STATUS 0x12 // Node progress on a firmware update
+#define MSG_OTA_OFFER 0x21 // Firmware update announcement
+#define MSG_OTA_CHUNK 0x22 // Firmware delta bytes
+#define MSG_GROUP_JOIN 0x23 // Multicast group key for one node
+#define MSG_GROUP_COMMAND 0x24 // Command to every member of a group
+#define MSG_TRIGGER 0x25 // Siren on or off, authenticated with one AES block
+#define MSG_BEACON 0x26 // Hub timing for nodes that sleep between receive windows
+#define MSG_RETRY 0x27 // Hub busy, ask again later
+#define MSG_RESYNC 0x28 // New key epoch, counters from zero, for every node
+#define MSG_BULK_OFFER_UP 0x13 // Node bulk transfer announcement
+#define MSG_BULK_FRAGMENT_UP 0x14 // Node bulk transfer ciphertext
+#define MSG_BULK_ACK_UP 0x15 // Node progress on a hub bulk transfer
+#define MSG_BULK_OFFER 0x29 // Hub bulk transfer announcement
+#define MSG_BULK_FRAGMENT 0x2A // Hub bulk transfer ciphertext
+#define MSG_BULK_ACK 0x2B // Hub progress on a node bulk transfer
+
+#define WIRE_ID_LEN 16
+#define WIRE_NONCE_LEN 8
+#define WIRE_HMAC_LEN 32
+#define WIRE_PUBKEY_LEN 40
+#define WIRE_SIGNATURE_LEN 40
+#define WIRE_BLOCK_LEN 16
+
+#define WIRE_ID 1
+
+#define WIRE_DISCOVERY_LEN 17
+
+#define WIRE_ADOPT_PUBKEY 17      // In the request
+#define WIRE_ADOPT_REQ_LEN 57
+#define WIRE_ADOPT_STATUS 17      // In the response
+#define WIRE_ADOPT_HUB_PUBKEY 18
+#define WIRE_ADOPT_EPOCH 58
+#define WIRE_ADOPT_RSP_LEN 62
+
+#define WIRE_CHALLENGE_TX 17
+#define WIRE_CHALLENGE_RX 21
+#define WIRE_CHALLENGE_NONCE 25
+#define WIRE_CHALLENGE_SIGNED_LEN 33
+#define WIRE_CHALLENGE_LEN 65
+
+#define WIRE_SECURE_COUNTER 17
+#define WIRE_SECURE_NONCE 21
+#define WIRE_SECURE_ORIG_LEN 29
+#define WIRE_SECURE_HEADER_LEN 30
+#define WIRE_SECURE_MIN_LEN (WIRE_SECURE_HEADER_LEN + WIRE_BLOCK_LEN + WIRE_HMAC_LEN)
+
+#define WIRE_DIAG_COUNTER 17
+#define WIRE_DIAG_PAYLOAD 21
+#define WIRE_DIAG_SIGNED_LEN (WIRE_DIAG_PAYLOAD + DIAG_PAYLOAD_LEN)
+#define WIRE_DIAG_LEN (WIRE_DIAG_SIGNED_LEN + WIRE_HMAC_LEN)
+
+#define WIRE_OTA_OFFER_COUNTER 17
+#define WIRE_OTA_OFFER_ID 21
+#define WIRE_OTA_OFFER_BASE_CRC 23
+#define WIRE_OTA_OFFER_IMAGE_LEN 27
+#define WIRE_OTA_OFFER_DELTA_LEN 29
+#define WIRE_OTA_OFFER_SIGNATURE 31
+#define WIRE_OTA_OFFER_SIGNED_LEN 71
+#define WIRE_OTA_OFFER_LEN 103
+
+#define WIRE_OTA_CHUNK_ID 17
+#define WIRE_OTA_CHUNK_OFFSET 19
+#define WIRE_OTA_CHUNK_DATA 21
+#define WIRE_OTA_CHUNK_MAX 64
+
+#define WIRE_OTA_STATUS_COUNTER 17
+#define WIRE_OTA_STATUS_ID 21
+#define WIRE_OTA_STATUS_STATE 23
+#define WIRE_OTA_STATUS_NEXT 24
+#define WIRE_OTA_STATUS_SIGNED_LEN 26
+#define WIRE_OTA_STATUS_LEN 58
+
+// MSG_OTA_STATUS states. next is the delta offset the node wants next
+// while receiving, 0 otherwise.
+#define OTA_READY 0        // Offer accepted, send chunks from next
+#define OTA_PROGRESS 1     // Everything before next is in
+#define OTA_STAGED 2       // Image complete and signature good, rebooting
+#define OTA_CONFIRMED 3    // Running updateId after the reboot
+#define OTA_ROLLED_BACK 4  // updateId failed to start, previous image restored
+#define OTA_WRONG_BASE 5   // Running image is not the delta's base
+#define OTA_BAD_IMAGE 6    // Delta did not decode to a correctly signed image
+#define OTA_NO_STORE 7     // No staging flash
+
+// The node reports after every OTA_WINDOW chunks in order, after the last
+// one, and once after a chunk it did not expect. The hub sends at most a
+// window ahead of the last report.
+#define OTA_WINDOW 4
+
+// MSG_GROUP_JOIN plaintext
+#define WIRE_GROUP_JOIN_ID 0
+#define WIRE_GROUP_JOIN_KEY 16
+#define WIRE_GROUP_JOIN_COUNTER 32
+#define WIRE_GROUP_JOIN_LEN 36
+
+#define WIRE_TRIGGER_COUNTER 17
+#define WIRE_TRIGGER_ACTION 21
+#define WIRE_TRIGGER_TAG 22
+#define WIRE_TRIGGER_TAG_LEN 8
+#define WIRE_TRIGGER_LEN 30
+#define WIRE_TRIGGER_ID_SIGNED 10  // ID bytes in the tag block
+
+// MSG_TRIGGER actions, handed to the device as they are. Devices may
+// take more (sirens: patterns, see SirenPattern.h).
+#define TRIGGER_OFF 0
+#define TRIGGER_ON 1
+
+#define TRIGGER_KEY_BYTE 0x74
+
+#define WIRE_BEACON_SEQ 1
+#define WIRE_BEACON_PERIOD 3
+#define WIRE_BEACON_FLAGS 5
+#define WIRE_BEACON_LEN 6
+
+#define BEACON_PENDING 0x01  // Held frames follow this beacon
+
+#define WIRE_RETRY_WAIT 17
+#define WIRE_RETRY_LEN 19
+
+#define WIRE_RESYNC_EPOCH 1
+#define WIRE_RESYNC_SIGNATURE 5
+#define WIRE_RESYNC_SIGNED_LEN 5  // Hashed for the signature, and the key derivation input
+#define WIRE_RESYNC_LEN 45
+
+#define WIRE_BULK_OFFER_COUNTER 17
+#define WIRE_BULK_OFFER_KIND 21
+#define WIRE_BULK_OFFER_SIZE 22
+#define WIRE_BULK_OFFER_CRC 24
+#define WIRE_BULK_OFFER_NONCE 28
+#define WIRE_BULK_OFFER_SIGNED_LEN 36
+#define WIRE_BULK_OFFER_LEN 68
+
+#define WIRE_BULK_FRAGMENT_COUNTER 17
+#define WIRE_BULK_FRAGMENT_INDEX 21
+#define WIRE_BULK_FRAGMENT_DATA 22
+
+#define WIRE_BULK_ACK_COUNTER 17
+#define WIRE_BULK_ACK_STATE 21
+#define WIRE_BULK_ACK_RECEIVED 22
+#define WIRE_BULK_ACK_SIGNED_LEN 24
+#define WIRE_BULK_ACK_LEN 56
+
+#define BULK_FRAGMENT_MAX 64   // Ciphertext bytes, 4 blocks
+#define BULK_FRAGMENTS_MAX 16  // Bits of received
+#define BULK_LEN_MAX 1023      // Plaintext, padded to BULK_FRAGMENTS_MAX full fragments
+#define BULK_POLL 0x80         // In index: answer with an ack
+#define BULK_WINDOW 4          // Fragments per poll
+
+// MSG_BULK_ACK states
+#define BULK_RECEIVING 0  // Send the fragments received lacks
+#define BULK_DONE 1       // Whole, CRC good, handed over
+#define BULK_BAD_CRC 2    // Whole but not what was offered, failed
+#define BULK_TOO_BIG 3    // Larger than the receiver holds, failed
+#define BULK_BUSY 4       // Buffer held by a transfer the other way, offer again later
+#define BULK_UNKNOWN 5    // No such transfer (timed out, receiver restarted), offer again
+
+// Offer kinds, for the application; the transfer does not look at them
+#define BULK_CONFIG 1
+#define BULK_PATTERNS 2
+#define BULK_KEYS 3
+#define BULK_DIAG 4
+
+// MSG_DIAG payload: counts since the previous report, each saturating
+//
+//   version  stats(DIAG_STATS x uint16 LE)  rssi(8 bins)  snr(8 bins)  worstLoopMs(uint16 LE)
+//   worstTriggerUs(uint16 LE)
+//
+// RSSI bin i counts frames in [DIAG_RSSI_MIN + i * DIAG_RSSI_STEP, +STEP)
+// dBm, SNR likewise in dB; the first and last bins are open-ended.
+// worstTriggerUs is the longest time from a MSG_TRIGGER leaving the radio
+// to the device acting on it, 0 without triggers.
+
+#define DIAG_VERSION 6
+
+#define DIAG_RX_FRAMES 0
+#define DIAG_RX_OVERRUN 1    // Frame arrived before the previous one was handled
+#define DIAG_RX_MALFORMED 2  // Wrong length for its type
+#define DIAG_RX_WRONG_ID 3   // Addressed to another node
+#define DIAG_RX_BAD_HMAC 4
+#define DIAG_RX_REPLAY 5
+#define DIAG_RX_DUPLICATE 6
+#define DIAG_RX_BAD_NONCE 7  // Challenge response to another challenge
+#define DIAG_TX_FRAMES 8
+#define DIAG_TX_FAIL 9       // Radio refused or timed out a send
+#define DIAG_TX_BUSY 10      // sendData() while a send was in progress
+#define DIAG_BEACON_MISSED 11  // Receive window closed without its beacon
+#define DIAG_RX_RATE_LIMITED 12  // Source over its rate, dropped before the MAC (NodeGuard.h)
+#define DIAG_RX_OVER_BUDGET 13   // Crypto budget spent, dropped before the MAC
+#define DIAG_RX_RESYNC_SKIPPED 14  // MSG_RESYNC past the signature checks allowed
+#define DIAG_STATS 15
+
+#define DIAG_HIST_BINS 8
+#define DIAG_RSSI_MIN -130
+#define DIAG_RSSI_STEP 10
+#define DIAG_SNR_MIN -20
+#define DIAG_SNR_STEP 5
+
+#define DIAG_OFF_VERSION 0
+#define DIAG_OFF_STATS 1
+#define DIAG_OFF_RSSI (DIAG_OFF_STATS + 2 * DIAG_STATS)
+#define DIAG_OFF_SNR (DIAG_OFF_RSSI + DIAG_HIST_BINS)
+#define DIAG_OFF_WORST_LOOP (DIAG_OFF_SNR + DIAG_HIST_BINS)
+#define DIAG_OFF_WORST_TRIGGER (DIAG_OFF_WORST_LOOP + 2)
+#define DIAG_PAYLOAD_LEN (DIAG_OFF_WORST_TRIGGER + 2)
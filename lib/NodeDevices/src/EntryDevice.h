@@ -0,0 +1,69 @@
+#pragma once
+
+#include <NodeCore.h>
+
+#ifndef REED_PIN
+#define REED_PIN 8
+#endif
+
+// Entry node: reed switch reporting open/closed state changes
+struct EntryDevice {
+  bool reedState = false; // Current reed switch state
+  bool lastReedState = false; // Previous reed switch state
+
+  void begin() {
+    pinMode(REED_PIN, INPUT_PULLUP);
+
+    // Initialize reed switch state
+    reedState = digitalRead(REED_PIN);
+    lastReedState = reedState;
+    DEBUG_LOG("[N] Reed initial state, open: %u", reedState);
+  }
+
+  template <class Node>
+  void poll(Node& node) {
+    // Check reed switch state change
+    reedState = digitalRead(REED_PIN);
+    if (reedState != lastReedState) {
+      lastReedState = reedState;
+
+      // Debounce delay
+      delay(50);
+      reedState = digitalRead(REED_PIN);
+
+      // If state is still different after debounce, send message
+      if (reedState == lastReedState) {
+        lastReedState = reedState;
+
+        if (node.isReady()) {
+          char msg[16];
+          snprintf(msg, sizeof(msg), "state;%s", reedState ? "true" : "false");
+          DEBUG_LOG("[N] Reed switch changed: %s", msg);
+          node.sendData(msg);
+        } else {
+          DEBUG_LOG("[N] Reed changed but not ready, open: %u", reedState);
+        }
+      }
+    }
+  }
+
+  template <class Node>
+  void handleCommand(Node&, const char*) {
+    DEBUG_LOG("[N] Unknown command");
+  }
+
+  template <class Node>
+  void trigger(Node&, uint8_t) {}
+
+  // No bulk kinds taken yet, see NodeBulk.h
+  template <class Node>
+  void bulk(Node&, uint8_t kind, const uint8_t*, uint16_t len) {
+    DEBUG_LOG("[N] Bulk kind %u not taken, %u bytes", kind, len);
+  }
+
+  bool rxWindows() const { return false; }
+
+  const char* telemetryState() const {
+    return reedState ? "true" : "false";
+  }
+};
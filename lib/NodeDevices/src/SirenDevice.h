@@ -0,0 +1,123 @@
+#pragma once
+
+#include <NodeCore.h>
+
+#include "SirenPattern.h"
+
+#ifndef SIREN_PIN
+#define SIREN_PIN 8
+#endif
+#ifndef MAINS_PIN
+#define MAINS_PIN 5  // Pulled LOW by the supply on the backup battery, else HIGH
+#endif
+
+// Siren node: plays siren patterns on hub command
+//
+//   siren;true                         steady until siren;false
+//   siren;false
+//   siren;pattern;<n>[;<seconds>]      SIREN_PATTERN_*, auto-off after
+//                                      seconds or the pattern's default
+//
+// Each is answered with siren;<bool>, and so is an auto-off once it
+// happens. MSG_TRIGGER takes TRIGGER_OFF, TRIGGER_ON (steady) and
+// SIREN_TRIGGER_PATTERN + n.
+//
+// On the backup battery the node only listens in beacon windows. It stays
+// awake while a pattern plays, since power-down would stop the timers.
+// MAINS_PIN has the pull-up on, so a board without the mains signal wired
+// reads as on mains and keeps listening rather than sleeping at random.
+struct SirenDevice {
+  bool sirenState = false; // Current siren state (on/off)
+
+  void begin() {
+    player_.begin(SIREN_PIN);  // Output low, siren starts off
+    pinMode(MAINS_PIN, INPUT_PULLUP);
+
+    // Initialize siren state
+    sirenState = false;
+    DEBUG_LOG("[N] Siren initialized: OFF");
+  }
+
+  template <class Node>
+  void poll(Node& node) {
+    player_.poll();
+    if (player_.playing()) node.stayAwake();
+
+    // Auto-off ran out
+    if (sirenState && !player_.playing()) {
+      DEBUG_LOG("[N] SIREN AUTO OFF");
+      sirenState = false;
+      node.queueResponse("siren;false");
+    }
+  }
+
+  template <class Node>
+  void handleCommand(Node& node, const char* cmd) {
+    if (strncmp(cmd, "siren;", 6) == 0) {
+      if (strcmp(cmd + 6, "true") == 0) {
+        DEBUG_LOG("[N] SIREN ON");
+        play(node, SIREN_PATTERN_STEADY, 0);
+      } else if (strcmp(cmd + 6, "false") == 0) {
+        DEBUG_LOG("[N] SIREN OFF");
+        stop(node);
+      } else if (strncmp(cmd + 6, "pattern;", 8) == 0) {
+        char* end;
+        unsigned long pattern = strtoul(cmd + 14, &end, 10);
+        unsigned long seconds = *end == ';' ? strtoul(end + 1, nullptr, 10) : 0;
+        DEBUG_LOG("[N] SIREN PATTERN %u", pattern);
+        if (pattern > 0xFF || seconds > 0xFFFF || !play(node, pattern, seconds)) {
+          DEBUG_LOG("[N] Invalid siren pattern");
+        }
+      } else {
+        DEBUG_LOG("[N] Invalid siren value");
+      }
+    } else {
+      DEBUG_LOG("[N] Unknown command");
+    }
+  }
+
+  // Output first, the reply and everything else after it
+  template <class Node>
+  void trigger(Node& node, uint8_t action) {
+    if (action == TRIGGER_OFF) {
+      stop(node);
+    } else if (action == TRIGGER_ON) {
+      play(node, SIREN_PATTERN_STEADY, 0);
+    } else if (action < SIREN_TRIGGER_PATTERN || !play(node, action - SIREN_TRIGGER_PATTERN, 0)) {
+      DEBUG_LOG("[N] Invalid trigger");
+    }
+  }
+
+  // No bulk kinds taken yet, see NodeBulk.h
+  template <class Node>
+  void bulk(Node&, uint8_t kind, const uint8_t*, uint16_t len) {
+    DEBUG_LOG("[N] Bulk kind %u not taken, %u bytes", kind, len);
+  }
+
+  bool rxWindows() const {
+    return digitalRead(MAINS_PIN) == LOW;
+  }
+
+  const char* telemetryState() const {
+    return sirenState ? "true" : "false";
+  }
+
+private:
+  template <class Node>
+  bool play(Node& node, uint8_t pattern, uint16_t seconds) {
+    if (!player_.play(pattern, seconds)) return false;
+    sirenState = true;
+    // Defer response to avoid recursion
+    node.queueResponse("siren;true");
+    return true;
+  }
+
+  template <class Node>
+  void stop(Node& node) {
+    player_.stop();
+    sirenState = false;
+    node.queueResponse("siren;false");
+  }
+
+  SirenPlayer player_;
+};
@@ -0,0 +1,248 @@
+#pragma once
+
+// Siren output patterns, played by the timers instead of loop().
+//
+// A pattern is a run of steps in flash, repeated until it is stopped or
+// its auto-off time is up. A step holds the output for a number of
+// SIREN_TICK_MS ticks, either at a level (sounders with their own
+// oscillator) or as a square wave sweeping linearly between two tones (a
+// bare piezo or a speaker driver):
+//
+//   Timer2  CTC at 100 Hz: next step, sweep, auto-off countdown
+//   Timer1  CTC at twice the tone, every compare toggles the pin
+//
+// On OC1A (pin 9) the timer toggles the pin by itself. On any other pin
+// the compare interrupt does it with one write to the PINx register, about
+// 2% of the CPU at 2.4 kHz. Level steps cost nothing but the
+// 100 Hz tick. The radio ISR and loop() are never kept waiting longer
+// than one of these short interrupts.
+//
+// The host build has no timers: poll() catches the ticks up from millis()
+// and a tone step shows as HIGH on the pin.
+
+#include <Arduino.h>
+
+#ifndef F_CPU
+#define F_CPU 8000000UL
+#endif
+
+#define SIREN_TICK_MS 10
+#define SIREN_TICK_TOP (F_CPU / 1024 / (1000 / SIREN_TICK_MS) - 1)  // Timer2 at clk/1024
+
+#define SIREN_STEP_OFF 0
+#define SIREN_STEP_ON 1
+
+// Timer1 TOP at clk/8 for a square wave of hz
+#define SIREN_TONE(hz) ((uint16_t)(F_CPU / 8 / 2 / (hz) - 1))
+
+static_assert(SIREN_TICK_TOP < 256, "Timer2 tick does not fit 8 bits");
+
+struct SirenStep {
+  uint16_t from;  // SIREN_STEP_OFF, SIREN_STEP_ON or a SIREN_TONE()
+  uint16_t to;    // Tone at the end of the step, from for a steady one
+  uint8_t ticks;
+};
+
+struct SirenPatternInfo {
+  uint8_t first;      // Index into SIREN_STEPS
+  uint8_t count;
+  uint16_t autoOffS;  // Default auto-off, 0 to play until stopped
+};
+
+static const SirenStep SIREN_STEPS[] PROGMEM = {
+  // Steady
+  {SIREN_STEP_ON, SIREN_STEP_ON, 250},
+  // Pulse: 1 Hz, half on
+  {SIREN_STEP_ON, SIREN_STEP_ON, 50},
+  {SIREN_STEP_OFF, SIREN_STEP_OFF, 50},
+  // Warble: two tones, 4 changes a second
+  {SIREN_TONE(1800), SIREN_TONE(1800), 25},
+  {SIREN_TONE(2400), SIREN_TONE(2400), 25},
+  // Wail: slow sweep up and down
+  {SIREN_TONE(800), SIREN_TONE(2400), 150},
+  {SIREN_TONE(2400), SIREN_TONE(800), 150},
+  // Yelp: fast sweep up
+  {SIREN_TONE(800), SIREN_TONE(2400), 20},
+  // Chirp: two short beeps, for arming and disarming
+  {SIREN_TONE(2800), SIREN_TONE(2800), 8},
+  {SIREN_STEP_OFF, SIREN_STEP_OFF, 8},
+  {SIREN_TONE(2800), SIREN_TONE(2800), 8},
+  {SIREN_STEP_OFF, SIREN_STEP_OFF, 76},
+};
+
+#define SIREN_PATTERN_STEADY 0
+#define SIREN_PATTERN_PULSE 1
+#define SIREN_PATTERN_WARBLE 2
+#define SIREN_PATTERN_WAIL 3
+#define SIREN_PATTERN_YELP 4
+#define SIREN_PATTERN_CHIRP 5
+
+static const SirenPatternInfo SIREN_PATTERNS[] PROGMEM = {
+  {0, 1, 0},
+  {1, 2, 0},
+  {3, 2, 0},
+  {5, 2, 0},
+  {7, 1, 0},
+  {8, 4, 1},
+};
+
+#define SIREN_PATTERN_COUNT (sizeof(SIREN_PATTERNS) / sizeof(SIREN_PATTERNS[0]))
+
+// MSG_TRIGGER action for SIREN_PATTERN_STEADY + n, after TRIGGER_OFF and
+// TRIGGER_ON
+#define SIREN_TRIGGER_PATTERN 2
+
+class SirenPlayer;
+
+#if defined(__AVR__)
+// The one player the timer interrupts drive and its pin, set by begin().
+// The toggle ISR reads the pin directly so it saves next to no registers.
+static SirenPlayer* sirenIsrPlayer = nullptr;
+static volatile uint8_t* sirenPinReg = nullptr;
+static uint8_t sirenPinMask = 0;
+#endif
+
+class SirenPlayer {
+public:
+  void begin(uint8_t pin) {
+    pin_ = pin;
+    pinMode(pin_, OUTPUT);
+    digitalWrite(pin_, LOW);
+
+#if defined(__AVR__)
+    sirenIsrPlayer = this;
+    sirenPinReg = portInputRegister(digitalPinToPort(pin_));
+    sirenPinMask = digitalPinToBitMask(pin_);
+
+    TCCR2A = _BV(WGM21);  // CTC, stopped until play()
+    TCCR2B = 0;
+    OCR2A = SIREN_TICK_TOP;
+    TIMSK2 = _BV(OCIE2A);
+
+    TCCR1A = 0;
+    TCCR1B = _BV(WGM12);  // CTC on OCR1A, stopped until a tone step
+    TIMSK1 = pin_ == 9 ? 0 : _BV(OCIE1A);
+#endif
+  }
+
+  // seconds 0 takes the pattern's own auto-off. False for an unknown
+  // pattern, which leaves the output as it was.
+  bool play(uint8_t pattern, uint16_t seconds = 0) {
+    if (pattern >= SIREN_PATTERN_COUNT) return false;
+
+    SirenPatternInfo info;
+    memcpy_P(&info, &SIREN_PATTERNS[pattern], sizeof(info));
+    if (!seconds) seconds = info.autoOffS;
+
+    noInterrupts();
+    pattern_ = pattern;
+    first_ = info.first;
+    count_ = info.count;
+    autoOffTicks_ = (uint32_t)seconds * (1000 / SIREN_TICK_MS);
+    index_ = 0;
+    playing_ = true;
+    load();
+#if defined(__AVR__)
+    TCNT2 = 0;
+    TCCR2B = _BV(CS22) | _BV(CS21) | _BV(CS20);  // clk/1024
+#else
+    lastTickMs_ = millis();
+#endif
+    interrupts();
+    return true;
+  }
+
+  void stop() {
+    noInterrupts();
+#if defined(__AVR__)
+    TCCR2B = 0;
+#endif
+    playing_ = false;
+    output(SIREN_STEP_OFF);
+    interrupts();
+  }
+
+  bool playing() const { return playing_; }
+  uint8_t pattern() const { return pattern_; }
+
+  // Timer2 compare, every SIREN_TICK_MS
+  void tick() {
+    if (!playing_) return;
+
+    if (autoOffTicks_ && --autoOffTicks_ == 0) {
+#if defined(__AVR__)
+      TCCR2B = 0;
+#endif
+      playing_ = false;
+      output(SIREN_STEP_OFF);
+      return;
+    }
+
+    if (++elapsed_ >= step_.ticks) {
+      if (++index_ == count_) index_ = 0;
+      load();
+    } else if (step_.from != step_.to) {
+      int32_t span = (int32_t)step_.to - step_.from;
+      output(step_.from + span * elapsed_ / step_.ticks);
+    }
+  }
+
+  // From the device's poll(): catches the ticks up on the host
+  void poll() {
+#if !defined(__AVR__)
+    while (playing_ && millis() - lastTickMs_ >= SIREN_TICK_MS) {
+      lastTickMs_ += SIREN_TICK_MS;
+      tick();
+    }
+#endif
+  }
+
+private:
+  void load() {
+    memcpy_P(&step_, &SIREN_STEPS[first_ + index_], sizeof(step_));
+    elapsed_ = 0;
+    output(step_.from);
+  }
+
+  void output(uint16_t top) {
+#if defined(__AVR__)
+    if (top > SIREN_STEP_ON) {
+      OCR1A = top;
+      if (TCNT1 >= top) TCNT1 = 0;  // Past the new TOP it would run to 0xFFFF
+      if (!(TCCR1B & _BV(CS11))) {
+        if (pin_ == 9) TCCR1A = _BV(COM1A0);  // Toggle OC1A on compare
+        TCCR1B = _BV(WGM12) | _BV(CS11);      // clk/8
+      }
+      return;
+    }
+    TCCR1B = _BV(WGM12);
+    TCCR1A = 0;
+#endif
+    digitalWrite(pin_, top == SIREN_STEP_OFF ? LOW : HIGH);
+  }
+
+  uint8_t pin_ = 0;
+  volatile bool playing_ = false;
+  uint8_t pattern_ = 0;
+  uint8_t first_ = 0;
+  uint8_t count_ = 0;
+  uint8_t index_ = 0;
+  uint8_t elapsed_ = 0;
+  uint32_t autoOffTicks_ = 0;  // 0 plays until stop()
+  SirenStep step_;
+
+#if !defined(__AVR__)
+  unsigned long lastTickMs_ = 0;
+#endif
+};
+
+#if defined(__AVR__)
+ISR(TIMER2_COMPA_vect) {
+  sirenIsrPlayer->tick();
+}
+
+// Tone steps on pins other than OC1A: writing PINx toggles the pin
+ISR(TIMER1_COMPA_vect) {
+  *sirenPinReg = sirenPinMask;
+}
+#endif
@@ -0,0 +1,102 @@
+#pragma once
+
+// Host stand-in for the parts of the Arduino core the node firmware uses.
+// Pins, ADC, clock and RNG are backed by hal::board (see NodeHal.h).
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "NodeHal.h"
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define DEFAULT 1
+#define INTERNAL 3
+
+#define DEC 10
+#define HEX 16
+#define BIN 2
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+#define A6 20
+#define A7 21
+
+#define PROGMEM
+#define PSTR(s) (s)
+#define memcpy_P memcpy
+#define strlen_P strlen
+#define pgm_read_byte(addr) (*(const uint8_t*)(addr))
+#define pgm_read_word(addr) (*(const uint16_t*)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t*)(addr))
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+
+#define digitalPinToInterrupt(p) ((p) == 2 ? 0 : ((p) == 3 ? 1 : -1))
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+void analogReference(uint8_t mode);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+class HalSerial {
+public:
+  void begin(unsigned long) {}
+  void flush() { fflush(stdout); }
+  int availableForWrite() { return 64; }  // stdout never keeps the node waiting
+  size_t write(uint8_t c) { return putchar(c) == c ? 1 : 0; }
+
+  size_t print(const __FlashStringHelper* s) { return print(reinterpret_cast<const char*>(s)); }
+  size_t print(const char* s) { return fputs(s, stdout) >= 0 ? strlen(s) : 0; }
+  size_t print(char c) { return putchar(c) == c ? 1 : 0; }
+  size_t print(unsigned char v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(int v, int base = DEC) { return print((long)v, base); }
+  size_t print(unsigned int v, int base = DEC) { return print((unsigned long)v, base); }
+  size_t print(long v, int base = DEC) {
+    if (base == DEC) return printf("%ld", v);
+    return print((unsigned long)v, base);
+  }
+  size_t print(unsigned long v, int base = DEC) {
+    if (base == HEX) return printf("%lX", v);
+    return printf("%lu", v);
+  }
+  size_t print(double v, int digits = 2) { return printf("%.*f", digits, v); }
+
+  size_t println() { return print('\n'); }
+  template <class T>
+  size_t println(T v) { size_t n = print(v); return n + println(); }
+  template <class T>
+  size_t println(T v, int base) { size_t n = print(v, base); return n + println(); }
+};
+
+extern HalSerial Serial;
@@ -0,0 +1,27 @@
+#pragma once
+
+// Host stand-in for the AVR EEPROM library, backed by hal::board->eeprom.
+
+#include <Arduino.h>
+
+class EEPROMClass {
+public:
+  uint8_t read(int idx) { return hal::board->eeprom[idx]; }
+  void write(int idx, uint8_t val) { hal::board->eeprom[idx] = val; }
+  void update(int idx, uint8_t val) { hal::board->eeprom[idx] = val; }
+  uint16_t length() { return HAL_EEPROM_SIZE; }
+
+  template <class T>
+  T& get(int idx, T& t) {
+    memcpy(&t, hal::board->eeprom + idx, sizeof(T));
+    return t;
+  }
+
+  template <class T>
+  const T& put(int idx, const T& t) {
+    memcpy(hal::board->eeprom + idx, &t, sizeof(T));
+    return t;
+  }
+};
+
+extern EEPROMClass EEPROM;
@@ -0,0 +1,133 @@
+// Entry point for running a firmware sketch (setup()/loop()) on the host.
+//
+//   program [--seconds N] [--key HEX32] [--id HEX32] [--seed N]
+//           [--replay FILE]
+//
+// Runs the sketch on the default board for N virtual seconds (default 60)
+// and prints every transmitted frame. --key stores an adopted session so
+// the node boots straight into counter sync, --id the serial ID it runs
+// as. --replay hands the radio the frames of a capture (NodeCapture.h) on
+// its channel and SF, at their captured times from REPLAY_START_US on, as
+// if heard on air; with the --id and --key of a captured node the
+// firmware gets that node's traffic. Host programs that define their own
+// main() (benchmarks, the simulator) never pull this file in.
+
+#include <Arduino.h>
+#include <NodeCapture.h>
+
+#define REPLAY_START_US 5000000ULL  // Booted and listening by then
+#define REPLAY_TX_RSSI -70          // For frames the capture point sent, which
+#define REPLAY_TX_SNR 10.0f         // were never received there
+
+void setup();
+void loop();
+
+static bool parseKey(const char* hex, uint8_t* key) {
+  if (strlen(hex) != 32) return false;
+  for (int i = 0; i < 16; i++) {
+    unsigned v;
+    if (sscanf(hex + 2 * i, "%2x", &v) != 1) return false;
+    key[i] = (uint8_t)v;
+  }
+  return true;
+}
+
+// The capture being replayed, read a record ahead of the clock
+struct ReplayState {
+  FILE* file = nullptr;
+  CaptureRecord next;
+  bool pending = false;
+  uint64_t atUs = 0;    // When next ends on air, on the board clock
+  int64_t firstUs = 0;  // Capture clock of the first frame
+  bool started = false;
+  CaptureClock clock;
+  uint32_t delivered = 0;
+  uint32_t missed = 0;  // Radio not receiving, or on another channel or SF
+};
+
+static ReplayState replay;
+
+static void replayRead() {
+  char line[600];
+  replay.pending = false;
+  while (fgets(line, sizeof(line), replay.file)) {
+    if (!captureParse(line, replay.next) || replay.next.type != CAPTURE_FRAME) continue;
+
+    int64_t us = replay.clock(replay.next.us);
+    if (!replay.started) {
+      replay.firstUs = us;
+      replay.started = true;
+    }
+    replay.atUs = REPLAY_START_US + (uint64_t)(us - replay.firstUs);
+    replay.pending = true;
+    return;
+  }
+}
+
+// Board sleep hook: delivers the frames that end before untilUs
+static void replaySleep(hal::Board& b, uint64_t untilUs) {
+  while (replay.pending && replay.atUs <= untilUs) {
+    if (replay.atUs > b.clockUs) b.clockUs = replay.atUs;
+
+    const CaptureRecord& r = replay.next;
+    if (r.frequency == (uint32_t)b.radio.frequency && r.sf == b.radio.spreadingFactor &&
+        hal::deliver(b, r.frame, r.len, r.tx ? REPLAY_TX_RSSI : r.rssi,
+                     r.tx ? REPLAY_TX_SNR : r.snr)) {
+      replay.delivered++;
+    } else {
+      replay.missed++;
+    }
+    replayRead();
+  }
+  if (untilUs > b.clockUs) b.clockUs = untilUs;
+}
+
+int main(int argc, char** argv) {
+  unsigned long seconds = 60;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+      seconds = strtoul(argv[++i], nullptr, 10);
+    } else if (strcmp(argv[i], "--key") == 0 && i + 1 < argc) {
+      uint8_t key[16];
+      if (!parseKey(argv[++i], key)) {
+        fprintf(stderr, "--key needs 32 hex digits\n");
+        return 2;
+      }
+      hal::provision(hal::defaultBoard, key);
+    } else if (strcmp(argv[i], "--id") == 0 && i + 1 < argc) {
+      uint8_t id[16];
+      if (!parseKey(argv[++i], id)) {
+        fprintf(stderr, "--id needs 32 hex digits\n");
+        return 2;
+      }
+      hal::identify(hal::defaultBoard, id);
+    } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      replay.file = fopen(argv[++i], "r");
+      if (!replay.file) {
+        fprintf(stderr, "cannot read %s\n", argv[i]);
+        return 2;
+      }
+      replayRead();
+      hal::defaultBoard.sleep = replaySleep;
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      randomSeed(strtoul(argv[++i], nullptr, 10));
+    } else {
+      fprintf(stderr, "usage: %s [--seconds N] [--key HEX32] [--id HEX32] [--seed N]\n"
+                      "       [--replay FILE]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  setup();
+  uint64_t endUs = (uint64_t)seconds * 1000000;
+  while (hal::board->clockUs < endUs) {
+    loop();
+  }
+
+  if (replay.file) {
+    printf("[HAL] replay: %u frames delivered, %u missed\n", replay.delivered, replay.missed);
+    fclose(replay.file);
+  }
+  return 0;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+// Host stand-in for the sandeepmistry LoRa library, backed by the radio
+// of hal::board. Only the API the node firmware uses is provided.
+
+#include <Arduino.h>
+
+class LoRaClass {
+public:
+  void setPins(int ss, int reset, int dio0);
+  int begin(long frequency);
+  void end();
+
+  void setSpreadingFactor(int sf);
+  void setSignalBandwidth(long sbw);
+  void setCodingRate4(int denominator);
+  void setPreambleLength(long length);
+  void setSyncWord(int sw);
+  void setTxPower(int level, int outputPin = 0);
+
+  int beginPacket(int implicitHeader = false);
+  int endPacket(bool async = false);
+  size_t write(uint8_t byte);
+  size_t write(const uint8_t* buffer, size_t size);
+
+  void onReceive(void (*callback)(int));
+  void receive(int size = 0);
+  void idle();
+  void sleep();
+
+  int available();
+  int read();
+  int peek();
+  int packetRssi();
+  float packetSnr();
+};
+
+extern LoRaClass LoRa;
@@ -0,0 +1,357 @@
+#include "NodeHal.h"
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <LoRa.h>
+#include <EEPROM.h>
+
+#include "NodeConfig.h"
+#include "NodeOtaBoot.h"
+
+HalSerial Serial;
+SPIClass SPI;
+LoRaClass LoRa;
+EEPROMClass EEPROM;
+
+namespace hal {
+
+Board::Board() {
+  memset(pinIn, HIGH, sizeof(pinIn));
+  for (int i = 0; i < 8; i++) analog[i] = 900;  // About 3.9 V through the divider
+  memset(eeprom, 0xFF, sizeof(eeprom));
+  memset(flash, 0xFF, sizeof(flash));
+}
+
+Board defaultBoard;
+Board* board = &defaultBoard;
+
+void sleepUs(uint64_t us) {
+  uint64_t until = board->clockUs + us;
+  if (board->sleep) {
+    board->sleep(*board, until);
+  } else {
+    board->clockUs = until;
+  }
+}
+
+uint32_t airtimeUs(uint8_t len, int sf, long bw, int cr, long preamble) {
+  double tSym = (double)(1L << sf) / bw * 1e6;
+  int de = tSym > 16000 ? 1 : 0;  // Low data rate optimize
+  double tPreamble = (preamble + 4.25) * tSym;
+  double num = 8.0 * len - 4.0 * sf + 28 + 16;  // Explicit header, CRC on
+  double den = 4.0 * (sf - 2 * de);
+  double n = ceil(num / den) * cr;
+  if (n < 0) n = 0;
+  return (uint32_t)(tPreamble + (8 + n) * tSym);
+}
+
+bool deliver(Board& b, const uint8_t* frame, uint8_t len, int rssi, float snr) {
+  if (b.radio.mode != RADIO_RX) return false;
+
+  memcpy(b.radio.rxBuf, frame, len);
+  b.radio.rxLen = len;
+  b.radio.rxPos = 0;
+  b.radio.rssi = rssi;
+  b.radio.snr = snr;
+  b.radio.rxFrames++;
+
+  if (b.radio.onReceive) {
+    Board* prev = board;
+    board = &b;
+    b.radio.onReceive(len);
+    board = prev;
+  }
+  return true;
+}
+
+void provision(Board& b, const uint8_t* sessionKey, const uint8_t* hubPubKey) {
+  uint16_t magic = EE_MAGIC;
+  memcpy(b.eeprom + EE_MAGIC_ADDR, &magic, sizeof(magic));
+  memset(b.eeprom + EE_PRIV_ADDR, 0x01, 21);
+  memcpy(b.eeprom + EE_KEY_ADDR, sessionKey, 16);
+  if (!hubPubKey) return;
+
+  magic = EE_RESYNC_MAGIC;
+  memcpy(b.eeprom + EE_RESYNC_MAGIC_ADDR, &magic, sizeof(magic));
+  memcpy(b.eeprom + EE_HUB_PUB_ADDR, hubPubKey, WIRE_PUBKEY_LEN);
+  memset(b.eeprom + EE_ADOPT_EPOCH_ADDR, 0, 8);  // Adopted and current epoch
+}
+
+void identify(Board& b, const uint8_t* serialId) {
+  uint16_t magic = EE_SERIAL_MAGIC;
+  memcpy(b.eeprom + EE_SERIAL_MAGIC_ADDR, &magic, sizeof(magic));
+  memcpy(b.eeprom + EE_SERIAL_ADDR, serialId, 16);
+}
+
+// OtaBoot port over the board arrays, pages as on the ATmega328
+struct BootPort {
+  Board& b;
+
+  void readRecord(OtaRecord& r) { memcpy(&r, b.eeprom + OTA_RECORD_ADDR, sizeof(r)); }
+  void writeRecord(const OtaRecord& r) { memcpy(b.eeprom + OTA_RECORD_ADDR, &r, sizeof(r)); }
+
+  void flashRead(uint32_t addr, uint8_t* buf, uint16_t len) {
+    memcpy(buf, b.spiFlash + addr, len);
+  }
+
+  void flashProgram(uint32_t addr, const uint8_t* buf, uint16_t len) {
+    for (uint16_t i = 0; i < len; i++) b.spiFlash[addr + i] &= buf[i];
+  }
+
+  void flashErase(uint32_t addr) {
+    memset(b.spiFlash + addr / OTA_SECTOR * OTA_SECTOR, 0xFF, OTA_SECTOR);
+  }
+
+  uint8_t appRead(uint16_t addr) { return b.flash[addr]; }
+
+  void appWritePage(uint16_t addr, const uint8_t* page) {
+    memcpy(b.flash + addr, page, 128);
+  }
+};
+
+void bootloader(Board& b) {
+  if (!b.spiFlash) return;
+
+  BootPort port{b};
+  OtaBoot<BootPort, 128>(port).run();
+
+  // The bootloader does not know the length of what it installed
+  OtaRecord r;
+  port.readRecord(r);
+  if (r.state == OTA_BOOT_TRIAL) {
+    b.imageLen = r.imageLen;
+  } else if (r.state == OTA_BOOT_ROLLED_BACK) {
+    b.imageLen = r.backupLen;
+  }
+}
+
+static uint32_t nextRandom(Board& b) {
+  // xorshift32
+  uint32_t x = b.rng;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  b.rng = x;
+  return x;
+}
+
+static void printFrame(Board& b, const uint8_t* frame, uint8_t len) {
+  printf("[HAL] %10.3f ms TX %3u:", b.clockUs / 1000.0, len);
+  for (uint8_t i = 0; i < len; i++) printf(" %02x", frame[i]);
+  printf("\n");
+}
+
+}  // namespace hal
+
+void halReset() {
+  if (hal::board->reset) {
+    hal::board->reset(*hal::board);
+    return;
+  }
+  printf("[HAL] reset requested, exiting\n");
+  exit(0);
+}
+
+void halSleep(unsigned long ms) {
+  hal::Board& b = *hal::board;
+  int64_t asked = (int64_t)ms * 1000;
+  int64_t slept = asked + asked * b.sleepPpm / 1000000;
+  b.bootUs += slept - asked;  // millis() only moves by what was asked for
+  b.sleptUs += slept;
+  hal::sleepUs(slept);
+}
+
+uint8_t halImageRead(uint16_t addr) {
+  return addr < HAL_FLASH_SIZE ? hal::board->flash[addr] : 0xFF;
+}
+
+uint16_t halImageLen() {
+  return hal::board->imageLen;
+}
+
+bool halFlashPresent() {
+  return hal::board->spiFlash != nullptr;
+}
+
+void halFlashRead(uint32_t addr, uint8_t* buf, uint16_t len) {
+  hal::BootPort{*hal::board}.flashRead(addr, buf, len);
+}
+
+void halFlashProgram(uint32_t addr, const uint8_t* buf, uint16_t len) {
+  hal::BootPort{*hal::board}.flashProgram(addr, buf, len);
+}
+
+void halFlashErase(uint32_t addr) {
+  hal::BootPort{*hal::board}.flashErase(addr);
+}
+
+// Arduino core
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  if (pin < HAL_PINS) hal::board->pinMode[pin] = mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  if (pin < HAL_PINS) hal::board->pinOut[pin] = val ? HIGH : LOW;
+}
+
+int digitalRead(uint8_t pin) {
+  if (pin >= HAL_PINS) return LOW;
+  if (hal::board->pinMode[pin] == OUTPUT) return hal::board->pinOut[pin];
+  return hal::board->pinIn[pin];
+}
+
+int analogRead(uint8_t pin) {
+  uint8_t ch = pin >= A0 ? pin - A0 : pin;
+  return ch < 8 ? hal::board->analog[ch] : 0;
+}
+
+void analogReference(uint8_t) {}
+
+unsigned long millis() {
+  return (unsigned long)((hal::board->clockUs - hal::board->bootUs) / 1000);
+}
+
+unsigned long micros() {
+  return (unsigned long)(hal::board->clockUs - hal::board->bootUs);
+}
+
+void delay(unsigned long ms) {
+  hal::sleepUs((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  hal::sleepUs(us);
+}
+
+long random(long howbig) {
+  if (howbig <= 0) return 0;
+  return hal::nextRandom(*hal::board) % howbig;
+}
+
+long random(long howsmall, long howbig) {
+  if (howsmall >= howbig) return howsmall;
+  return howsmall + random(howbig - howsmall);
+}
+
+void randomSeed(unsigned long seed) {
+  if (seed != 0) hal::board->rng = (uint32_t)seed;
+}
+
+// LoRa
+
+void LoRaClass::setPins(int, int, int) {}
+
+int LoRaClass::begin(long frequency) {
+  hal::board->radio.frequency = frequency;
+  hal::board->radio.setMode(hal::RADIO_STANDBY, hal::board->clockUs);
+  return 1;
+}
+
+void LoRaClass::end() {
+  hal::board->radio.setMode(hal::RADIO_SLEEP, hal::board->clockUs);
+}
+
+void LoRaClass::setSpreadingFactor(int sf) {
+  if (sf < 6) sf = 6;
+  if (sf > 12) sf = 12;
+  hal::board->radio.spreadingFactor = sf;
+}
+
+void LoRaClass::setSignalBandwidth(long sbw) {
+  hal::board->radio.bandwidth = sbw;
+}
+
+void LoRaClass::setCodingRate4(int denominator) {
+  if (denominator < 5) denominator = 5;
+  if (denominator > 8) denominator = 8;
+  hal::board->radio.codingRate = denominator;
+}
+
+void LoRaClass::setPreambleLength(long length) {
+  hal::board->radio.preambleLength = length;
+}
+
+void LoRaClass::setSyncWord(int sw) {
+  hal::board->radio.syncWord = sw;
+}
+
+void LoRaClass::setTxPower(int level, int) {
+  hal::board->radio.txPower = level;
+}
+
+int LoRaClass::beginPacket(int) {
+  hal::Radio& r = hal::board->radio;
+  if (r.mode == hal::RADIO_TX) return 0;
+  r.setMode(hal::RADIO_STANDBY, hal::board->clockUs);
+  r.txLen = 0;
+  return 1;
+}
+
+int LoRaClass::endPacket(bool) {
+  hal::Board& b = *hal::board;
+  hal::Radio& r = b.radio;
+  r.setMode(hal::RADIO_TX, b.clockUs);
+  r.txFrames++;
+  if (r.transmit) {
+    r.transmit(b, r.txBuf, r.txLen);
+  } else {
+    hal::printFrame(b, r.txBuf, r.txLen);
+  }
+  hal::sleepUs(hal::airtimeUs(r.txLen, r.spreadingFactor, r.bandwidth, r.codingRate, r.preambleLength));
+  r.setMode(hal::RADIO_STANDBY, b.clockUs);
+  return 1;
+}
+
+size_t LoRaClass::write(uint8_t byte) {
+  return write(&byte, 1);
+}
+
+size_t LoRaClass::write(const uint8_t* buffer, size_t size) {
+  hal::Radio& r = hal::board->radio;
+  if (r.txLen + size > HAL_RADIO_FIFO) size = HAL_RADIO_FIFO - r.txLen;
+  memcpy(r.txBuf + r.txLen, buffer, size);
+  r.txLen += size;
+  return size;
+}
+
+void LoRaClass::onReceive(void (*callback)(int)) {
+  hal::board->radio.onReceive = callback;
+}
+
+void LoRaClass::receive(int) {
+  hal::board->radio.setMode(hal::RADIO_RX, hal::board->clockUs);
+}
+
+void LoRaClass::idle() {
+  hal::board->radio.setMode(hal::RADIO_STANDBY, hal::board->clockUs);
+}
+
+void LoRaClass::sleep() {
+  hal::board->radio.setMode(hal::RADIO_SLEEP, hal::board->clockUs);
+}
+
+int LoRaClass::available() {
+  hal::Radio& r = hal::board->radio;
+  return r.rxLen - r.rxPos;
+}
+
+int LoRaClass::read() {
+  hal::Radio& r = hal::board->radio;
+  if (r.rxPos >= r.rxLen) return -1;
+  return r.rxBuf[r.rxPos++];
+}
+
+int LoRaClass::peek() {
+  hal::Radio& r = hal::board->radio;
+  if (r.rxPos >= r.rxLen) return -1;
+  return r.rxBuf[r.rxPos];
+}
+
+int LoRaClass::packetRssi() {
+  return hal::board->radio.rssi;
+}
+
+float LoRaClass::packetSnr() {
+  return hal::board->radio.snr;
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+// Host hardware abstraction for running node firmware on Linux.
+//
+// Every peripheral the firmware touches (clock, GPIO, ADC, EEPROM, the
+// SX1276, the OTA staging flash, its own program image and the RNG) lives
+// in a hal::Board. The Arduino/LoRa/EEPROM shims
+// always act on hal::board, so a host program can run one node with the
+// default board or several by switching the pointer between them.
+//
+// Time is virtual: delay() advances the board clock instead of sleeping,
+// and a blocking LoRa.endPacket() advances it by the frame's airtime.
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace hal {
+
+#define HAL_PINS 24
+#define HAL_EEPROM_SIZE 1024
+#define HAL_RADIO_FIFO 256
+#define HAL_FLASH_SIZE 32768        // ATmega328 program flash
+#define HAL_SPI_FLASH_SIZE 0x20000  // OTA staging flash, 4 KB sectors
+
+enum RadioMode : uint8_t {
+  RADIO_SLEEP,
+  RADIO_STANDBY,
+  RADIO_TX,
+  RADIO_RX,
+};
+
+struct Board;
+
+struct Radio {
+  RadioMode mode = RADIO_SLEEP;
+  long frequency = 0;
+  int spreadingFactor = 7;
+  long bandwidth = 125000;
+  int codingRate = 5;       // 4/5
+  long preambleLength = 8;
+  int syncWord = 0x12;
+  int txPower = 17;
+
+  uint8_t txBuf[HAL_RADIO_FIFO];
+  uint8_t txLen = 0;
+
+  uint8_t rxBuf[HAL_RADIO_FIFO];
+  uint8_t rxLen = 0;
+  uint8_t rxPos = 0;
+  int rssi = 0;
+  float snr = 0;
+
+  void (*onReceive)(int) = nullptr;
+
+  // Called from endPacket() with the finished frame, before the clock is
+  // advanced by its airtime. Default prints the frame to stdout.
+  void (*transmit)(Board& board, const uint8_t* frame, uint8_t len) = nullptr;
+
+  uint32_t txFrames = 0;
+  uint32_t rxFrames = 0;
+
+  // Time spent in each mode, up to modeSinceUs for the current one
+  uint64_t modeUs[4] = {};
+  uint64_t modeSinceUs = 0;
+
+  void setMode(RadioMode m, uint64_t nowUs) {
+    modeUs[mode] += nowUs - modeSinceUs;
+    modeSinceUs = nowUs;
+    mode = m;
+  }
+};
+
+struct Board {
+  uint64_t clockUs = 0;
+  uint64_t bootUs = 0;  // clockUs at the last reset, millis() counts from here
+
+  // Called instead of advancing clockUs directly, so a scheduler can
+  // suspend the node until untilUs (see the network simulator)
+  void (*sleep)(Board& board, uint64_t untilUs) = nullptr;
+
+  // Error of the MCU sleep timer in ppm: halSleep(t) lasts t * (1 + ppm/1e6)
+  // while millis() moves by t, as with the AVR watchdog (NodeSleep.h)
+  int32_t sleepPpm = 0;
+  uint64_t sleptUs = 0;  // Total time in halSleep()
+
+  // Called for the firmware's software reset; default exits the process
+  void (*reset)(Board& board) = nullptr;
+
+  uint8_t pinMode[HAL_PINS] = {};
+  uint8_t pinOut[HAL_PINS] = {};   // Level driven by the firmware
+  uint8_t pinIn[HAL_PINS];         // Level driven from outside
+  uint16_t analog[8];              // Raw 10-bit ADC value per channel
+
+  uint8_t eeprom[HAL_EEPROM_SIZE];
+  uint32_t rng = 0x9E3779B9;
+
+  // What would be in program flash: the running image is flash[0, imageLen).
+  // The native firmware does not execute it, the OTA code reads and
+  // replaces it.
+  uint8_t flash[HAL_FLASH_SIZE];
+  uint16_t imageLen = 0;
+
+  // External NOR flash: erase sets a sector to 0xFF, programming only
+  // clears bits. Null means no chip fitted.
+  uint8_t* spiFlash = nullptr;
+
+  Radio radio;
+
+  void* user = nullptr;
+
+  Board();
+};
+
+extern Board defaultBoard;
+extern Board* board;
+
+// Advance the current board clock, honouring its sleep hook
+void sleepUs(uint64_t us);
+
+// Time on air in microseconds for an explicit-header, CRC-on LoRa frame
+uint32_t airtimeUs(uint8_t len, int sf, long bw, int cr, long preamble);
+
+// Put a frame into the board's RX FIFO and raise the receive callback.
+// Only succeeds while the radio is in continuous RX.
+bool deliver(Board& b, const uint8_t* frame, uint8_t len, int rssi, float snr);
+
+// Store an adopted session so the firmware boots straight into counter sync.
+// With hubPubKey the node was adopted in epoch 0 and takes MSG_RESYNC.
+void provision(Board& b, const uint8_t* sessionKey, const uint8_t* hubPubKey = nullptr);
+
+// Store serialId as the one kept from a first boot, in place of the build's
+void identify(Board& b, const uint8_t* serialId);
+
+// Run the OTA bootloader hand-over (NodeOtaBoot.h) on the board's flash,
+// as the AVR bootloader does on every reset
+void bootloader(Board& b);
+
+}  // namespace hal
+
+// Firmware software reset (the AVR build jumps to 0)
+void halReset();
+
+// MCU power-down for ms by the inaccurate sleep timer, see Board::sleepPpm
+void halSleep(unsigned long ms);
+
+// Program image and OTA staging flash of the current board
+uint8_t halImageRead(uint16_t addr);
+uint16_t halImageLen();
+bool halFlashPresent();
+void halFlashRead(uint32_t addr, uint8_t* buf, uint16_t len);
+void halFlashProgram(uint32_t addr, const uint8_t* buf, uint16_t len);
+void halFlashErase(uint32_t addr);
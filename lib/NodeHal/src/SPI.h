@@ -0,0 +1,27 @@
+#pragma once
+
+// Host stand-in for the Arduino SPI library. The firmware only talks to
+// the radio through LoRa.h off-target, so nothing is ever clocked out.
+
+#include <Arduino.h>
+
+#define MSBFIRST 1
+#define SPI_MODE0 0x00
+
+class SPISettings {
+public:
+  SPISettings() {}
+  SPISettings(uint32_t, uint8_t, uint8_t) {}
+};
+
+class SPIClass {
+public:
+  void begin() {}
+  void end() {}
+  void beginTransaction(SPISettings) {}
+  void endTransaction() {}
+  uint8_t transfer(uint8_t) { return 0; }
+  void usingInterrupt(uint8_t) {}
+};
+
+extern SPIClass SPI;
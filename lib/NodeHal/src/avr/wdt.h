@@ -0,0 +1,13 @@
+#pragma once
+
+// Host stand-in for <avr/wdt.h>: there is no watchdog off-target.
+
+#define WDTO_15MS 0
+#define WDTO_1S 6
+#define WDTO_2S 7
+#define WDTO_4S 8
+#define WDTO_8S 9
+
+inline void wdt_reset() {}
+inline void wdt_disable() {}
+inline void wdt_enable(int) {}
@@ -0,0 +1,527 @@
+#include "Hub.h"
+
+#include <algorithm>
+
+Hub::Hub(Scheduler& sched, Medium& medium, const HubConfig& cfg, size_t nodes)
+  : sched_(sched), medium_(medium), cfg_(cfg), sessions_(nodes), engine_(sessions_) {
+  demodulators = cfg.demodulators;
+
+  uECC_set_rng(&getRng);
+  uECC_make_key(pubKey_, privKey_, uECC_secp160r1());
+
+  if (cfg_.beaconMs) {
+    nextBeaconUs_ = HUB_BEACON_START_US;
+    sched_.at(nextBeaconUs_, [this] { beaconTick(); });
+  }
+}
+
+void Hub::addNode(SimNode* node, const uint8_t* sessionKey) {
+  HubSession* s = engine_.addSession(node->serialId, sessionKey);
+  if (s) s->user = node;
+  nodes_.push_back(node);
+
+  std::array<uint8_t, 16> key;
+  memcpy(key.data(), sessionKey, 16);
+  adoptionKeys_.push_back(key);
+}
+
+void Hub::restart(uint64_t downUs) {
+  down_ = true;
+  queue_.clear();
+  held_.clear();
+  sleeping_.clear();
+  pumpScheduled_ = false;
+  challengeSlotUs_ = 0;
+  for (auto& u : uploads_) u.reset();
+  sched_.after(downUs, [this] { boot(); });
+}
+
+// Keys and epoch come back from storage, counters do not
+void Hub::boot() {
+  down_ = false;
+  engine_.sessions().forEach([](HubSession& s) {
+    s.txCounter = 0;
+    s.rxExpected = 0;
+    s.flags = 0;
+  });
+  if (!cfg_.resync) return;
+
+  epoch_++;
+  for (size_t i = 0; i < nodes_.size(); i++) {
+    HubSession* s = engine_.sessions().find(nodes_[i]->serialId);
+    if (s) engine_.resync(*s, adoptionKeys_[i].data(), epoch_);
+  }
+  engine_.buildResync(epoch_, privKey_, resyncFrame_);
+  resyncTick(HUB_RESYNC_REPEATS);
+}
+
+void Hub::resyncTick(int repeats) {
+  for (const Channel& ch : channelsOf(nodes_)) {
+    bool hold = false;
+    for (SimNode* n : nodes_) {
+      hold |= n->channel.frequency == ch.frequency && n->channel.sf == ch.sf && sleeping(n);
+    }
+    stats_.resyncs++;
+    send(ch, resyncFrame_, WIRE_RESYNC_LEN, HUB_TRAFFIC_CONTROL, hold);
+  }
+
+  if (repeats) sched_.after(HUB_RESYNC_REPEAT_US, [this, repeats] { resyncTick(repeats - 1); });
+}
+
+std::vector<Channel> Hub::channelsOf(const std::vector<SimNode*>& nodes) {
+  std::vector<Channel> channels;
+  for (SimNode* n : nodes) {
+    bool seen = false;
+    for (const Channel& ch : channels) {
+      seen |= ch.frequency == n->channel.frequency && ch.sf == n->channel.sf;
+    }
+    if (!seen) channels.push_back(n->channel);
+  }
+  return channels;
+}
+
+bool Hub::sleeping(const SimNode* node) const {
+  return std::find(sleeping_.begin(), sleeping_.end(), node) != sleeping_.end();
+}
+
+bool Hub::listening(const Channel& ch) const {
+  if (transmitting || down_) return false;
+  for (long f : cfg_.channels) {
+    if (f == ch.frequency) return true;
+  }
+  return false;
+}
+
+void Hub::onFrame(const uint8_t* frame, uint8_t len, int, float) {
+  HubStatus status = engine_.receive(frame, len, event_);
+
+  switch (status) {
+    case HUB_OK:
+      break;
+    case HUB_BAD_HMAC:
+      stats_.hmacFailures++;
+      if (event_.type == MSG_CHALLENGE && epoch_) {
+        stats_.resyncs++;
+        sendTo((SimNode*)event_.session->user, resyncFrame_, WIRE_RESYNC_LEN);
+      }
+      return;
+    case HUB_REPLAY:
+      stats_.replays++;
+      return;
+    case HUB_UNKNOWN_NODE:
+      stats_.unknownNode++;
+      return;
+    default:
+      stats_.malformed++;
+      return;
+  }
+
+  if (!event_.session) return;
+  SimNode* node = (SimNode*)event_.session->user;
+
+  if (event_.type == MSG_CHALLENGE) {
+    stats_.challenges++;
+    if (cfg_.challengeRate > 0) {
+      uint64_t slot = std::max(sched_.now(), challengeSlotUs_);
+      challengeSlotUs_ = slot + (uint64_t)(1e6 / cfg_.challengeRate);
+      if (slot > sched_.now()) {
+        uint8_t pkt[WIRE_RETRY_LEN];
+        uint32_t waitMs = std::min<uint64_t>((slot - sched_.now()) / 1000, 0xFFFF);
+        stats_.retries++;
+        send(node->channel, pkt, engine_.buildRetry(node->serialId, waitMs, pkt));
+        return;
+      }
+    }
+    send(node->channel, event_.reply, event_.replyLen);
+  } else if (event_.type == MSG_DATA) {
+    stats_.dataFrames++;
+    if (strcmp(event_.text, "group;ok") == 0) {
+      // A node is in one group at a time, the last one it joined
+      for (size_t g = groups_.size(); g-- > 0;) {
+        Group& gr = groups_[g];
+        auto it = std::find(gr.members.begin(), gr.members.end(), node);
+        if (it == gr.members.end()) continue;
+        gr.joined[it - gr.members.begin()] = true;
+        break;
+      }
+      return;
+    }
+    if (strcmp(event_.text, "rx;beacon") == 0) {
+      if (!sleeping(node)) sleeping_.push_back(node);
+      return;
+    }
+    if (strcmp(event_.text, "rx;continuous") == 0) {
+      sleeping_.erase(std::remove(sleeping_.begin(), sleeping_.end(), node), sleeping_.end());
+      return;
+    }
+    if (onMessage) onMessage(*node, event_.text);
+  } else if (event_.type == MSG_DIAG) {
+    HubDiag diag;
+    if (!decodeDiag(event_.diag, diag)) return;
+    stats_.diagFrames++;
+    for (int i = 0; i < DIAG_STATS; i++) stats_.nodeStats[i] += diag.stats[i];
+    if (diag.worstLoopMs > stats_.nodeWorstLoopMs) stats_.nodeWorstLoopMs = diag.worstLoopMs;
+    if (diag.worstTriggerUs > stats_.nodeWorstTriggerUs) {
+      stats_.nodeWorstTriggerUs = diag.worstTriggerUs;
+    }
+  } else if (event_.type == MSG_OTA_STATUS) {
+    for (auto& t : ota_) {
+      if (&t->session() != event_.session || t->finished()) continue;
+      t->onStatus(event_, sched_.now() / 1000);
+      if (!t->finished()) break;
+
+      if (t->phase() == OTA_PHASE_DONE) {
+        stats_.otaConfirmed++;
+      } else {
+        stats_.otaFailed++;
+      }
+      if (onOtaFinished) onOtaFinished(*node, *t);
+      break;
+    }
+  } else if (event_.type == MSG_BULK_OFFER_UP || event_.type == MSG_BULK_FRAGMENT_UP) {
+    onBulkFrame(node);
+  } else if (event_.type == MSG_BULK_ACK_UP) {
+    for (auto& t : bulk_) {
+      if (&t->session() != event_.session || t->finished()) continue;
+      t->onAck(event_, sched_.now() / 1000);
+      if (!t->finished()) break;
+
+      if (t->result() == BULK_DONE) {
+        stats_.bulkDelivered++;
+      } else {
+        stats_.bulkFailed++;
+      }
+      if (onBulkFinished) onBulkFinished(*node, *t);
+      break;
+    }
+  }
+}
+
+// An upload's offer or fragment; the ack goes out at once
+void Hub::onBulkFrame(SimNode* node) {
+  size_t i = std::find(nodes_.begin(), nodes_.end(), node) - nodes_.begin();
+  if (i == nodes_.size()) return;
+  if (uploads_.size() < nodes_.size()) uploads_.resize(nodes_.size());
+  if (!uploads_[i]) uploads_[i].reset(new BulkReceiver());
+
+  BulkReceiver& r = *uploads_[i];
+  uint8_t pkt[HUB_FRAME_MAX];
+  size_t len = r.onFrame(engine_, *event_.session, event_, sched_.now() / 1000, pkt);
+  if (len) send(node->channel, pkt, len, HUB_TRAFFIC_BULK);
+
+  if (!r.complete()) return;
+  stats_.bulkReceived++;
+  if (onBulkReceived) onBulkReceived(*node, r.kind(), r.data(), r.len());
+}
+
+void Hub::sendCommand(SimNode* node, const char* cmd) {
+  HubSession* s = engine_.sessions().find(node->serialId);
+  if (!s) return;
+
+  uint8_t nonce[WIRE_NONCE_LEN];
+  for (int i = 0; i < WIRE_NONCE_LEN; i++) nonce[i] = random(256);
+
+  uint8_t pkt[HUB_FRAME_MAX];
+  size_t len = engine_.buildCommand(*s, cmd, strlen(cmd), nonce, pkt);
+  if (!len) return;
+
+  stats_.commands++;
+  sendTo(node, pkt, len);
+}
+
+void Hub::sendTrigger(SimNode* node, uint8_t action) {
+  HubSession* s = engine_.sessions().find(node->serialId);
+  if (!s) return;
+
+  uint8_t pkt[HUB_FRAME_MAX];
+  size_t len = engine_.buildTrigger(*s, action, pkt);
+  stats_.triggers++;
+  sendTo(node, pkt, len);
+}
+
+int Hub::addGroup(const std::vector<SimNode*>& members) {
+  Group g;
+  for (int i = 0; i < WIRE_ID_LEN; i++) g.group.id[i] = random(256);
+  for (int i = 0; i < 16; i++) g.group.key[i] = random(256);
+  g.group.txCounter = 0;
+  g.members = members;
+  g.joined.assign(members.size(), false);
+  groups_.push_back(g);
+
+  int group = groups_.size() - 1;
+  joinTick(group);
+  return group;
+}
+
+void Hub::joinTick(int group) {
+  Group& g = groups_[group];
+  bool pending = false;
+
+  for (size_t i = 0; i < g.members.size(); i++) {
+    if (g.joined[i]) continue;
+    pending = true;
+
+    HubSession* s = engine_.sessions().find(g.members[i]->serialId);
+    if (!s) continue;
+
+    uint8_t nonce[WIRE_NONCE_LEN];
+    for (int k = 0; k < WIRE_NONCE_LEN; k++) nonce[k] = random(256);
+
+    uint8_t pkt[HUB_FRAME_MAX];
+    size_t len = engine_.buildGroupJoin(*s, g.group, nonce, pkt);
+    stats_.groupJoins++;
+    sendTo(g.members[i], pkt, len);
+  }
+
+  if (pending) sched_.after(HUB_GROUP_JOIN_RETRY_US, [this, group] { joinTick(group); });
+}
+
+size_t Hub::groupJoined(int group) const {
+  const Group& g = groups_[group];
+  return std::count(g.joined.begin(), g.joined.end(), true);
+}
+
+void Hub::sendGroupCommand(int group, const char* cmd) {
+  Group& g = groups_[group];
+
+  uint8_t nonce[WIRE_NONCE_LEN];
+  for (int i = 0; i < WIRE_NONCE_LEN; i++) nonce[i] = random(256);
+
+  uint8_t pkt[HUB_FRAME_MAX];
+  size_t len = engine_.buildGroupCommand(g.group, cmd, strlen(cmd), nonce, pkt);
+  if (!len) return;
+
+  groupSend(group, std::vector<uint8_t>(pkt, pkt + len), HUB_GROUP_REPEATS);
+}
+
+void Hub::sendGroupTrigger(int group, uint8_t action) {
+  uint8_t pkt[HUB_FRAME_MAX];
+  size_t len = engine_.buildGroupTrigger(groups_[group].group, action, pkt);
+  groupSend(group, std::vector<uint8_t>(pkt, pkt + len), HUB_GROUP_REPEATS);
+}
+
+// The same frame on every channel with a member on it, held for the next
+// beacon when any member on the channel sleeps
+void Hub::groupSend(int group, const std::vector<uint8_t>& frame, int repeats) {
+  const std::vector<SimNode*>& members = groups_[group].members;
+  for (const Channel& ch : channelsOf(members)) {
+    bool hold = false;
+    for (SimNode* m : members) {
+      hold |= m->channel.frequency == ch.frequency && m->channel.sf == ch.sf && sleeping(m);
+    }
+
+    stats_.groupCommands++;
+    send(ch, frame.data(), frame.size(), HUB_TRAFFIC_CONTROL, hold);
+  }
+
+  if (repeats) {
+    sched_.after(HUB_GROUP_REPEAT_US, [this, group, frame, repeats] {
+      groupSend(group, frame, repeats - 1);
+    });
+  }
+}
+
+void Hub::updateFirmware(SimNode* node, const OtaUpdate& update) {
+  HubSession* s = engine_.sessions().find(node->serialId);
+  if (!s) return;
+
+  // A window, the node writing it to flash and its report, with room to spare
+  uint32_t reportMs = hal::airtimeUs(WIRE_OTA_STATUS_LEN, node->channel.sf, 125000, 5, 8) / 1000;
+  ota_.emplace_back(new OtaTransfer(engine_, *s, update, 3000 + 2 * reportMs));
+
+  if (!otaTicking_) {
+    otaTicking_ = true;
+    otaStartUs_ = sched_.now();
+    sched_.after(HUB_OTA_TICK_US, [this] { otaTick(); });
+  }
+}
+
+void Hub::sendBulk(SimNode* node, uint8_t kind, const uint8_t* data, size_t len) {
+  HubSession* s = engine_.sessions().find(node->serialId);
+  if (!s) return;
+
+  uint8_t nonce[WIRE_NONCE_LEN];
+  for (int i = 0; i < WIRE_NONCE_LEN; i++) nonce[i] = random(256);
+
+  // The last fragment of a window and the node's ack, with room to spare
+  uint32_t ackMs = hal::airtimeUs(WIRE_BULK_ACK_LEN, node->channel.sf, 125000, 5, 8) / 1000;
+  bulk_.emplace_back(new BulkTransfer(engine_, *s, kind, data, len, nonce,
+                                      sched_.now() / 1000, 3000 + 2 * ackMs));
+  if (!bulk_.back()->started()) {
+    stats_.bulkFailed++;
+    if (onBulkFinished) onBulkFinished(*node, *bulk_.back());
+    return;
+  }
+
+  if (!bulkTicking_) {
+    bulkTicking_ = true;
+    bulkStartUs_ = sched_.now();
+    sched_.after(HUB_OTA_TICK_US, [this] { bulkTick(); });
+  }
+}
+
+// One OTA frame per tick at most, only into an empty queue so commands and
+// challenge replies never wait behind a window
+void Hub::otaTick() {
+  uint64_t now = sched_.now();
+  bool budget = stats_.otaAirtimeUs <= HUB_OTA_DUTY * (now - otaStartUs_);
+
+  // Oldest unfinished transfers first
+  std::vector<OtaTransfer*> running;
+  for (auto& t : ota_) {
+    if (!t->finished() && running.size() < HUB_OTA_PARALLEL) running.push_back(t.get());
+  }
+
+  if (budget && queue_.empty() && now >= busyUntil_) {
+    for (size_t k = 0; k < running.size(); k++) {
+      OtaTransfer& t = *running[(otaNext_ + k) % running.size()];
+
+      uint8_t frame[HUB_FRAME_MAX];
+      size_t len = t.poll(now / 1000, frame);
+      if (t.finished()) {  // Gave up waiting for the node
+        stats_.otaFailed++;
+        if (onOtaFinished) onOtaFinished(*(SimNode*)t.session().user, t);
+        continue;
+      }
+      if (!len) continue;
+
+      sendTo((SimNode*)t.session().user, frame, len, HUB_TRAFFIC_OTA);
+      otaNext_ = otaNext_ + k + 1;
+      break;
+    }
+  }
+
+  otaTicking_ = !running.empty();
+  if (otaTicking_) sched_.after(HUB_OTA_TICK_US, [this] { otaTick(); });
+}
+
+// otaTick() for bulk transfers, within their own budget
+void Hub::bulkTick() {
+  uint64_t now = sched_.now();
+  bool budget = stats_.bulkAirtimeUs <= HUB_BULK_DUTY * (now - bulkStartUs_);
+
+  std::vector<BulkTransfer*> running;
+  for (auto& t : bulk_) {
+    if (!t->finished() && running.size() < HUB_BULK_PARALLEL) running.push_back(t.get());
+  }
+
+  if (budget && queue_.empty() && now >= busyUntil_) {
+    for (size_t k = 0; k < running.size(); k++) {
+      BulkTransfer& t = *running[(bulkNext_ + k) % running.size()];
+
+      uint8_t frame[HUB_FRAME_MAX];
+      size_t len = t.poll(now / 1000, frame);
+      if (t.finished()) {  // Out of retries
+        stats_.bulkFailed++;
+        if (onBulkFinished) onBulkFinished(*(SimNode*)t.session().user, t);
+        continue;
+      }
+      if (!len) continue;
+
+      sendTo((SimNode*)t.session().user, frame, len, HUB_TRAFFIC_BULK);
+      bulkNext_ = bulkNext_ + k + 1;
+      break;
+    }
+  }
+
+  bulkTicking_ = !running.empty();
+  if (bulkTicking_) sched_.after(HUB_OTA_TICK_US, [this] { bulkTick(); });
+}
+
+void Hub::sendTo(SimNode* node, const uint8_t* frame, uint8_t len, uint8_t traffic) {
+  send(node->channel, frame, len, traffic, sleeping(node));
+}
+
+// Replies go out one at a time, processingUs after the frame that caused them
+void Hub::send(const Channel& ch, const uint8_t* frame, uint8_t len, uint8_t traffic,
+               bool hold) {
+  if (down_) return;
+
+  Pending p;
+  p.ch = ch;
+  p.len = len;
+  p.traffic = traffic;
+  memcpy(p.frame, frame, len);
+
+  if (hold) {
+    stats_.held++;
+    held_.push_back(p);
+    return;
+  }
+
+  queue_.push_back(p);
+  if (!pumpScheduled_) schedulePump(sched_.now() + cfg_.processingUs);
+}
+
+void Hub::schedulePump(uint64_t at) {
+  pumpScheduled_ = true;
+  pumpAt_ = at;
+  sched_.at(at, [this, at] {
+    if (pumpScheduled_ && pumpAt_ == at) pump();
+  });
+}
+
+void Hub::pump() {
+  pumpScheduled_ = false;
+  if (queue_.empty()) return;
+
+  if (sched_.now() < busyUntil_) {
+    schedulePump(busyUntil_ + 1000);
+    return;
+  }
+
+  // Nothing that would still be on air when the next beacon is due
+  Pending& p = queue_.front();
+  uint64_t end = sched_.now() + hal::airtimeUs(p.len, p.ch.sf, 125000, 5, 8);
+  if (cfg_.beaconMs && end + HUB_BEACON_GUARD_US > nextBeaconUs_) {
+    schedulePump(nextBeaconUs_ + 1000);
+    return;
+  }
+
+  uint32_t airtime = medium_.transmit(*this, p.frame, p.len, p.ch, cfg_.txPower,
+                                      125000, 5, 8);
+  busyUntil_ = sched_.now() + airtime;
+  if (p.traffic == HUB_TRAFFIC_OTA) {
+    stats_.otaFrames++;
+    stats_.otaAirtimeUs += airtime;
+  } else if (p.traffic == HUB_TRAFFIC_BULK) {
+    stats_.bulkFrames++;
+    stats_.bulkAirtimeUs += airtime;
+  }
+  queue_.pop_front();
+
+  if (!queue_.empty()) schedulePump(busyUntil_ + 1000);
+}
+
+// A beacon on every channel a node is on, ahead of everything queued, then
+// the frames held for sleeping nodes. The reservation in pump() keeps the
+// air free, so the first goes out on time.
+void Hub::beaconTick() {
+  std::vector<Channel> channels;
+  if (!down_) channels = channelsOf(nodes_);  // Off the air the period runs on
+
+  std::deque<Pending> next;
+  for (const Channel& ch : channels) {
+    uint8_t flags = 0;
+    for (const Pending& h : held_) {
+      if (h.ch.frequency == ch.frequency && h.ch.sf == ch.sf) flags |= BEACON_PENDING;
+    }
+
+    Pending p;
+    p.ch = ch;
+    p.traffic = HUB_TRAFFIC_CONTROL;
+    p.len = engine_.buildBeacon(beaconSeq_, cfg_.beaconMs, flags, p.frame);
+    next.push_back(p);
+    stats_.beacons++;
+  }
+  beaconSeq_++;
+
+  next.insert(next.end(), held_.begin(), held_.end());
+  next.insert(next.end(), queue_.begin(), queue_.end());
+  queue_.swap(next);
+  held_.clear();
+
+  nextBeaconUs_ += (uint64_t)cfg_.beaconMs * 1000;
+  sched_.at(nextBeaconUs_, [this] { beaconTick(); });
+  pump();
+}
@@ -0,0 +1,245 @@
+#pragma once
+
+// Stand-in hub for the simulator.
+//
+// Puts the HubProtocol engine on the air: answers node challenges,
+// verifies and decrypts MSG_DATA, sends encrypted MSG_COMMANDs and siren
+// triggers, keeps multicast groups and drives firmware updates. Nodes are
+// pre-provisioned, so discovery and adoption are not modelled. Decoded
+// messages are handed to onMessage for the site driver to score.
+//
+// With beaconMs set the hub sends MSG_BEACON on every channel in use and
+// keeps the air free for it. Frames for nodes that said "rx;beacon" wait
+// for the next beacon, which then carries BEACON_PENDING; answers to a
+// node's own frames go out at once, the node listens after sending.
+//
+// With challengeRate set the hub answers that many challenges a second at
+// most, as a backend doing the session work would. Past that a node gets
+// MSG_RETRY with the next free slot, each slot going to one node.
+//
+// Bulk transfers (NodeBulk.h) go down like firmware updates, in the gaps
+// and within their own airtime budget. Each node gets a BulkReceiver on
+// its first upload; its acks go out at once, like a challenge reply.
+//
+// restart() takes the hub off the air and brings it back with every
+// session's counters lost, as a gateway restart does. With resync set it
+// then starts the next key epoch and sends MSG_RESYNC on every channel in
+// use, HUB_RESYNC_REPEATS more times after that, and again to any node
+// whose challenge fails the HMAC (it missed them all and is still on the
+// old key). Without it every node has to sync by challenge. Uploads in
+// progress are lost with the rest of the hub's RAM.
+
+#include <NodeCore.h>
+#include <HubEngine.h>
+#include <OtaTransfer.h>
+#include <BulkTransfer.h>
+
+#include <array>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "SimNode.h"
+
+#define HUB_OTA_DUTY 0.10     // OTA downlink budget, as in the EU868 10% sub-band
+#define HUB_OTA_TICK_US 20000
+#define HUB_OTA_PARALLEL 2    // Transfers in progress, the rest queue behind them
+#define HUB_BULK_DUTY 0.10    // Bulk downlink budget, apart from OTA's
+#define HUB_BULK_PARALLEL 2
+#define HUB_GROUP_JOIN_RETRY_US 15000000ULL  // Join again until the member answers
+#define HUB_GROUP_REPEATS 2                  // Copies of a group command after the first
+#define HUB_GROUP_REPEAT_US 1500000ULL
+#define HUB_BEACON_START_US 1000000ULL
+#define HUB_BEACON_GUARD_US 2000  // Nothing may still be on air this close to a beacon
+#define HUB_RESYNC_REPEATS 2      // Copies of a MSG_RESYNC after the first
+#define HUB_RESYNC_REPEAT_US 2000000ULL
+
+// Whose airtime a queued frame counts against
+#define HUB_TRAFFIC_CONTROL 0
+#define HUB_TRAFFIC_OTA 1
+#define HUB_TRAFFIC_BULK 2
+
+struct HubConfig {
+  int demodulators = 8;           // Concurrent receptions (gateway paths)
+  uint32_t processingUs = 20000;  // Frame in to reply on air
+  int txPower = 17;
+  std::vector<long> channels;     // Frequencies it listens on, any SF
+  uint16_t beaconMs = 0;          // MSG_BEACON period, 0 for none
+  double challengeRate = 0;       // Challenges answered per second, 0 for all
+  bool resync = true;             // MSG_RESYNC after restart(), else challenges only
+};
+
+struct HubStats {
+  uint32_t challenges = 0;
+  uint32_t retries = 0;           // MSG_RETRY sent instead of a challenge response
+  uint32_t dataFrames = 0;
+  uint32_t diagFrames = 0;
+  uint32_t hmacFailures = 0;
+  uint32_t replays = 0;
+  uint32_t malformed = 0;
+  uint32_t unknownNode = 0;
+  uint32_t commands = 0;
+  uint32_t triggers = 0;
+  uint32_t groupJoins = 0;
+  uint32_t groupCommands = 0;     // Frames on air, one per channel in use
+  uint32_t beacons = 0;
+  uint32_t held = 0;              // Frames that waited for a beacon
+  uint32_t resyncs = 0;           // MSG_RESYNC frames on air
+
+  uint32_t otaFrames = 0;
+  uint64_t otaAirtimeUs = 0;
+  uint32_t otaConfirmed = 0;
+  uint32_t otaFailed = 0;
+
+  uint32_t bulkFrames = 0;        // Down, acks for uploads included
+  uint64_t bulkAirtimeUs = 0;
+  uint32_t bulkDelivered = 0;
+  uint32_t bulkFailed = 0;
+  uint32_t bulkReceived = 0;      // Uploads put together
+
+  // Sums over all MSG_DIAG reports, as the nodes counted them
+  uint32_t nodeStats[DIAG_STATS] = {};
+  uint16_t nodeWorstLoopMs = 0;
+  uint16_t nodeWorstTriggerUs = 0;
+};
+
+class Hub : public Endpoint {
+public:
+  Hub(Scheduler& sched, Medium& medium, const HubConfig& cfg, size_t nodes);
+
+  // The hub's adoption key pair, public half. Nodes check MSG_RESYNC
+  // against it.
+  const uint8_t* publicKey() const { return pubKey_; }
+
+  // node adopted in epoch 0 with sessionKey
+  void addNode(SimNode* node, const uint8_t* sessionKey);
+
+  // Off the air now, back after downUs with the counters lost
+  void restart(uint64_t downUs);
+
+  uint32_t epoch() const { return epoch_; }
+
+  // Encrypt cmd for node and queue it for transmission
+  void sendCommand(SimNode* node, const char* cmd);
+
+  // MSG_TRIGGER with action (TRIGGER_ON, TRIGGER_OFF) for node
+  void sendTrigger(SimNode* node, uint8_t action);
+
+  // Multicast group over members. Joins go out like commands and again
+  // every HUB_GROUP_JOIN_RETRY_US to members that have not answered.
+  int addGroup(const std::vector<SimNode*>& members);
+
+  // One MSG_GROUP_COMMAND for the whole group, once per channel its
+  // members listen on. Nobody acknowledges a multicast frame in time to
+  // resend it, so the same frame goes out HUB_GROUP_REPEATS more times;
+  // members that already have it drop the copies as duplicates.
+  void sendGroupCommand(int group, const char* cmd);
+
+  // sendGroupCommand() for a MSG_TRIGGER
+  void sendGroupTrigger(int group, uint8_t action);
+
+  // Members that have answered their join
+  size_t groupJoined(int group) const;
+
+  // Node said it sleeps between beacons
+  bool sleeping(const SimNode* node) const;
+
+  // Update node's firmware. HUB_OTA_PARALLEL transfers run side by side, a
+  // frame at a time whenever the hub is idle and within HUB_OTA_DUTY of
+  // airtime; one fills the gaps while the other waits for its node.
+  void updateFirmware(SimNode* node, const OtaUpdate& update);
+
+  // Send data to node as a bulk transfer of kind (BULK_CONFIG, ...),
+  // scheduled like updateFirmware() within HUB_BULK_DUTY
+  void sendBulk(SimNode* node, uint8_t kind, const uint8_t* data, size_t len);
+
+  bool listening(const Channel& ch) const override;
+  void onFrame(const uint8_t* frame, uint8_t len, int rssi, float snr) override;
+
+  const HubStats& stats() const { return stats_; }
+
+  std::function<void(SimNode& node, const char* msg)> onMessage;
+  std::function<void(SimNode& node, const OtaTransfer& t)> onOtaFinished;
+  std::function<void(SimNode& node, const BulkTransfer& t)> onBulkFinished;
+  std::function<void(SimNode& node, uint8_t kind, const uint8_t* data, size_t len)>
+      onBulkReceived;
+
+private:
+  struct Pending {
+    Channel ch;
+    uint8_t len;
+    uint8_t traffic;  // HUB_TRAFFIC_*
+    uint8_t frame[HUB_FRAME_MAX];
+  };
+
+  struct Group {
+    HubGroup group;
+    std::vector<SimNode*> members;
+    std::vector<bool> joined;
+  };
+
+  void boot();
+  void resyncTick(int repeats);
+
+  // Every channel and SF at least one of nodes is on, in order of nodes
+  static std::vector<Channel> channelsOf(const std::vector<SimNode*>& nodes);
+
+  void joinTick(int group);
+  void groupSend(int group, const std::vector<uint8_t>& frame, int repeats);
+
+  // send(), or held for the next beacon when node sleeps
+  void sendTo(SimNode* node, const uint8_t* frame, uint8_t len,
+              uint8_t traffic = HUB_TRAFFIC_CONTROL);
+  void send(const Channel& ch, const uint8_t* frame, uint8_t len,
+            uint8_t traffic = HUB_TRAFFIC_CONTROL, bool hold = false);
+  void schedulePump(uint64_t at);
+  void pump();
+  void otaTick();
+  void bulkTick();
+  void onBulkFrame(SimNode* node);
+  void beaconTick();
+
+  Scheduler& sched_;
+  Medium& medium_;
+  HubConfig cfg_;
+
+  SessionTable sessions_;
+  HubEngine engine_;
+  HubEvent event_;
+
+  std::deque<Pending> queue_;
+  bool pumpScheduled_ = false;
+  uint64_t pumpAt_ = 0;      // Only the latest scheduled pump() runs
+  uint64_t busyUntil_ = 0;
+
+  std::vector<SimNode*> nodes_;
+  std::vector<const SimNode*> sleeping_;
+  std::deque<Pending> held_;  // Until the next beacon
+  uint64_t nextBeaconUs_ = 0;
+  uint16_t beaconSeq_ = 0;
+
+  uint64_t challengeSlotUs_ = 0;  // Next free challenge slot
+
+  uint8_t privKey_[21];
+  uint8_t pubKey_[WIRE_PUBKEY_LEN];
+  std::vector<std::array<uint8_t, 16>> adoptionKeys_;  // As nodes_, from storage
+  bool down_ = false;
+  uint32_t epoch_ = 0;
+  uint8_t resyncFrame_[WIRE_RESYNC_LEN];  // The current epoch's, when epoch_ > 0
+
+  std::vector<Group> groups_;
+
+  std::vector<std::unique_ptr<OtaTransfer>> ota_;
+  size_t otaNext_ = 0;       // Round robin over the transfers
+  uint64_t otaStartUs_ = 0;
+  bool otaTicking_ = false;
+
+  std::vector<std::unique_ptr<BulkTransfer>> bulk_;
+  size_t bulkNext_ = 0;
+  uint64_t bulkStartUs_ = 0;
+  bool bulkTicking_ = false;
+  std::vector<std::unique_ptr<BulkReceiver>> uploads_;  // As nodes_, from the first offer
+
+  HubStats stats_;
+};
@@ -0,0 +1,188 @@
+#include "Medium.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <NodeHal.h>
+#include <NodeConfig.h>
+#include <NodeCapture.h>
+
+// Keep finished frames around this long for overlap checks, longer than
+// the airtime of any frame the firmware can send
+#define RECENT_US 10000000ULL
+
+double snrFloorDb(int sf) {
+  static const double floors[] = {-7.5, -10.0, -12.5, -15.0, -17.5, -20.0};
+  if (sf < 7) sf = 7;
+  if (sf > 12) sf = 12;
+  return floors[sf - 7];
+}
+
+static double dbmToMw(double dbm) {
+  return pow(10.0, dbm / 10.0);
+}
+
+Medium::Medium(Scheduler& sched, const MediumConfig& cfg, uint32_t seed)
+  : sched_(sched), cfg_(cfg), rng_(seed) {}
+
+void Medium::attach(Endpoint* e) {
+  e->index = (int)endpoints_.size();
+  endpoints_.push_back(e);
+}
+
+void Medium::finalize() {
+  size_t n = endpoints_.size();
+  shadowing_.assign(n * n, 0.0f);
+
+  std::normal_distribution<float> shadow(0.0f, (float)cfg_.shadowingDb);
+  for (size_t a = 0; a < n; a++) {
+    for (size_t b = a + 1; b < n; b++) {
+      float s = cfg_.shadowingDb > 0 ? shadow(rng_) : 0.0f;
+      shadowing_[a * n + b] = s;  // Links are symmetric
+      shadowing_[b * n + a] = s;
+    }
+  }
+}
+
+double Medium::pathLossDb(const Endpoint& a, const Endpoint& b) const {
+  double dx = a.pos.x - b.pos.x;
+  double dy = a.pos.y - b.pos.y;
+  double d = sqrt(dx * dx + dy * dy);
+  if (d < 1.0) d = 1.0;
+
+  double loss = cfg_.refLossDb + 10.0 * cfg_.exponent * log10(d);
+  return loss + shadowing_[a.index * endpoints_.size() + b.index];
+}
+
+uint32_t Medium::transmit(Endpoint& from, const uint8_t* frame, uint8_t len,
+                          const Channel& ch, int txPower, long bandwidth,
+                          int codingRate, long preamble) {
+  prune();
+
+  uint32_t airtime = hal::airtimeUs(len, ch.sf, bandwidth, codingRate, preamble);
+
+  Transmission* t = new Transmission;
+  t->from = &from;
+  t->ch = ch;
+  t->txPower = txPower;
+  t->start = sched_.now();
+  t->end = t->start + airtime;
+  t->bandwidth = bandwidth;
+  t->codingRate = codingRate;
+  t->preamble = preamble;
+  t->len = len;
+  memcpy(t->frame, frame, len);
+
+  from.transmitting = true;
+  from.airtimeUs += airtime;
+  from.txFrames++;
+  frames_++;
+
+  // Receivers lock on at the preamble
+  for (Endpoint* e : endpoints_) {
+    if (e == &from) continue;
+    if (!e->listening(ch)) {
+      if (e->transmitting) e->lost.interrupted++;
+      continue;
+    }
+
+    double rssi = txPower - pathLossDb(from, *e);
+    if (rssi - NOISE_FLOOR_DBM < snrFloorDb(ch.sf)) {
+      e->lost.belowFloor++;
+      continue;
+    }
+
+    if (e->locked >= e->demodulators) {
+      e->lost.noDemod++;
+      continue;
+    }
+
+    e->locked++;
+    t->receivers.push_back(Reception{e, rssi});
+  }
+
+  recent_.push_back(t);
+  sched_.at(t->end, [this, t] { finish(t); });
+  return airtime;
+}
+
+void Medium::finish(Transmission* t) {
+  t->from->transmitting = false;
+  if (t->from == captureAt_) record(*t, true, t->txPower, 0);
+
+  std::uniform_real_distribution<double> uniform(0.0, 1.0);
+
+  for (const Reception& r : t->receivers) {
+    Endpoint* e = r.rx;
+    e->locked--;
+
+    bool keptListening = e->listening(t->ch);
+    for (const Transmission* o : recent_) {
+      if (o->from == e && o->start < t->end && o->end > t->start) {
+        keptListening = false;
+        break;
+      }
+    }
+
+    if (!keptListening) {
+      e->lost.interrupted++;
+    } else if (collided(*t, r)) {
+      e->lost.collisions++;
+    } else if (cfg_.lossRate > 0 && uniform(rng_) < cfg_.lossRate) {
+      e->lost.randomLoss++;
+    } else {
+      e->rxFrames++;
+      if (e == captureAt_) record(*t, false, (int)lround(r.rssi), (float)(r.rssi - NOISE_FLOOR_DBM));
+      e->onFrame(t->frame, t->len, (int)lround(r.rssi), (float)(r.rssi - NOISE_FLOOR_DBM));
+    }
+  }
+}
+
+void Medium::capture(const Endpoint* at, FILE* out) {
+  captureAt_ = at;
+  captureOut_ = out;
+  captureBandwidth_ = 0;
+}
+
+// NodeCapture.h writes to anything with write(uint8_t)
+struct CaptureFile {
+  FILE* f;
+  void write(uint8_t c) { fputc(c, f); }
+};
+
+// Frames go in when they end on air, so the records are in time order
+void Medium::record(const Transmission& t, bool tx, int rssi, float snr) {
+  CaptureFile out{captureOut_};
+  if (t.bandwidth != captureBandwidth_ || t.codingRate != captureCodingRate_ ||
+      t.preamble != capturePreamble_) {
+    captureBandwidth_ = t.bandwidth;
+    captureCodingRate_ = t.codingRate;
+    capturePreamble_ = t.preamble;
+    captureSetup(out, t.bandwidth, t.codingRate, t.preamble, SYNC_WORD);
+  }
+  captureFrame(out, (uint32_t)t.end, t.ch.frequency, t.ch.sf, tx, rssi, snr, t.frame, t.len);
+}
+
+// Sum every same channel, same SF frame that overlaps t at this receiver
+bool Medium::collided(const Transmission& t, const Reception& r) const {
+  double interferenceMw = 0;
+
+  for (const Transmission* o : recent_) {
+    if (o == &t || o->from == r.rx) continue;
+    if (o->ch.frequency != t.ch.frequency || o->ch.sf != t.ch.sf) continue;
+    if (o->start >= t.end || o->end <= t.start) continue;
+
+    interferenceMw += dbmToMw(o->txPower - pathLossDb(*o->from, *r.rx));
+  }
+
+  if (interferenceMw == 0) return false;
+  return r.rssi - 10.0 * log10(interferenceMw) < CAPTURE_DB;
+}
+
+void Medium::prune() {
+  uint64_t now = sched_.now();
+  while (!recent_.empty() && recent_.front()->end + RECENT_US < now) {
+    delete recent_.front();
+    recent_.pop_front();
+  }
+}
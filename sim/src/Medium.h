@@ -0,0 +1,150 @@
+#pragma once
+
+// Virtual RF medium shared by every node and the hub.
+//
+// Propagation is log-distance path loss with per-link log-normal
+// shadowing, sampled once per link so a badly placed node stays badly
+// placed for the whole run. A frame is received when, for its whole time
+// on air:
+//
+//   - the receiver is listening on the same channel and spreading factor
+//     and has a free demodulator (a node has one, a gateway several)
+//   - the SNR clears the demodulation floor for that spreading factor
+//   - every overlapping frame on the same channel and SF is at least
+//     CAPTURE_DB weaker (different SFs are treated as orthogonal)
+//   - the receiver is still listening when it ends (half duplex: a node
+//     that starts transmitting loses whatever it was receiving)
+//   - it survives the configured random loss
+//
+// Lost frames are counted per receiver and by cause, so a report can tell
+// collisions from range problems.
+//
+// One endpoint can be captured (NodeCapture.h): every frame it receives
+// and every frame it sends, as a sniffer next to it would record them.
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <deque>
+#include <random>
+#include <vector>
+
+#include "Scheduler.h"
+
+#define CAPTURE_DB 6.0
+#define NOISE_FLOOR_DBM -117.0  // -174 + 10log10(125 kHz) + 6 dB NF
+
+struct MediumConfig {
+  double refLossDb = 40.0;      // Path loss at 1 m
+  double exponent = 2.7;        // Log-distance exponent
+  double shadowingDb = 4.0;     // Per-link shadowing sigma
+  double lossRate = 0.0;        // Extra random frame loss
+};
+
+struct Position {
+  double x = 0;
+  double y = 0;
+};
+
+struct Channel {
+  long frequency;
+  int sf;
+};
+
+struct LossStats {
+  uint32_t collisions = 0;
+  uint32_t belowFloor = 0;    // Listening, but SNR under the demodulation floor
+  uint32_t noDemod = 0;       // All demodulators busy
+  uint32_t interrupted = 0;   // Receiver transmitting at the start or during the frame
+  uint32_t randomLoss = 0;
+};
+
+// Anything with a radio: a firmware node or the hub
+class Endpoint {
+public:
+  virtual ~Endpoint() {}
+
+  // Would a frame on ch be picked up right now (ignoring signal level)?
+  virtual bool listening(const Channel& ch) const = 0;
+
+  // A complete frame arrived
+  virtual void onFrame(const uint8_t* frame, uint8_t len, int rssi, float snr) = 0;
+
+  Position pos;
+  int demodulators = 1;
+
+  int index = -1;       // Assigned by Medium::attach()
+  int locked = 0;       // Receptions in progress
+  bool transmitting = false;
+
+  uint64_t airtimeUs = 0;
+  uint32_t txFrames = 0;
+  uint32_t rxFrames = 0;
+  LossStats lost;
+};
+
+class Medium {
+public:
+  Medium(Scheduler& sched, const MediumConfig& cfg, uint32_t seed);
+
+  void attach(Endpoint* e);
+
+  // Sample per-link shadowing, call once after every endpoint is attached
+  void finalize();
+
+  double pathLossDb(const Endpoint& a, const Endpoint& b) const;
+
+  // Put a frame on air starting now. Returns its airtime in microseconds.
+  uint32_t transmit(Endpoint& from, const uint8_t* frame, uint8_t len,
+                    const Channel& ch, int txPower, long bandwidth,
+                    int codingRate, long preamble);
+
+  uint32_t frames() const { return frames_; }
+
+  // Write what at hears and sends to out as capture records from now on
+  void capture(const Endpoint* at, FILE* out);
+
+private:
+  struct Reception {
+    Endpoint* rx;
+    double rssi;
+  };
+
+  struct Transmission {
+    Endpoint* from;
+    Channel ch;
+    int txPower;
+    uint64_t start;
+    uint64_t end;
+    long bandwidth;
+    int codingRate;
+    long preamble;
+    uint8_t len;
+    uint8_t frame[256];
+    std::vector<Reception> receivers;  // Locked on at the preamble
+  };
+
+  void finish(Transmission* t);
+  bool collided(const Transmission& t, const Reception& r) const;
+  void prune();
+  void record(const Transmission& t, bool tx, int rssi, float snr);
+
+  Scheduler& sched_;
+  MediumConfig cfg_;
+  std::mt19937 rng_;
+
+  std::vector<Endpoint*> endpoints_;
+  std::vector<float> shadowing_;  // endpoints x endpoints
+  std::deque<Transmission*> recent_;
+
+  uint32_t frames_ = 0;
+
+  const Endpoint* captureAt_ = nullptr;
+  FILE* captureOut_ = nullptr;
+  long captureBandwidth_ = 0;     // Of the last setup record written
+  int captureCodingRate_ = 0;
+  long capturePreamble_ = 0;
+};
+
+// Minimum SNR for demodulation at SF7..SF12 (SX1276 datasheet)
+double snrFloorDb(int sf);
@@ -0,0 +1,125 @@
+#include "OtaImages.h"
+
+#include <NodeOta.h>
+
+#include <random>
+
+#define IMAGE_FUNCTIONS 110
+#define IMAGE_VECTORS 26
+#define IMAGE_DATA_LEN 1800
+
+const uint8_t SIM_OTA_PRIVATE_KEY[21] = {
+  0x00, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a,
+  0x3b, 0x3c, 0x3d, 0x3e, 0x3f, 0x40, 0x41, 0x42, 0x43, 0x44,
+};
+
+const uint8_t OTA_SIGNING_KEY[WIRE_PUBKEY_LEN] PROGMEM = {
+  0x31, 0x4d, 0xc9, 0xfc, 0x84, 0xa8, 0x3e, 0x30, 0x7d, 0x59,
+  0x91, 0x8d, 0xc9, 0xfc, 0x38, 0xef, 0xbc, 0xb7, 0x20, 0xdf,
+  0x46, 0x61, 0xfa, 0xa1, 0xb1, 0x51, 0x68, 0xff, 0x1f, 0x58,
+  0xf3, 0x18, 0x97, 0xd1, 0x57, 0x55, 0xdd, 0xed, 0x96, 0x77,
+};
+
+namespace {
+
+// A function body: instruction words, with CALLs by callee index
+struct Function {
+  std::vector<uint16_t> words;
+  std::vector<int> calls;  // Callee per word, -1 for a plain instruction
+};
+
+void emit(std::vector<uint8_t>& out, uint16_t w) {
+  out.push_back(w);
+  out.push_back(w >> 8);
+}
+
+// Functions back to back after the vector table, then the data block
+std::vector<uint8_t> link(const std::vector<Function>& fns, const std::vector<uint8_t>& data) {
+  std::vector<uint32_t> addr(fns.size());
+  uint32_t at = IMAGE_VECTORS * 4;
+  for (size_t i = 0; i < fns.size(); i++) {
+    addr[i] = at;
+    at += fns[i].words.size() * 2;
+  }
+
+  std::vector<uint8_t> out;
+  for (int v = 0; v < IMAGE_VECTORS; v++) {
+    emit(out, 0x940C);  // JMP
+    emit(out, addr[v % fns.size()] / 2);
+  }
+  for (const Function& f : fns) {
+    for (size_t w = 0; w < f.words.size(); w++) {
+      int callee = f.calls[w];
+      emit(out, callee < 0 ? f.words[w] : addr[callee] / 2);
+    }
+  }
+  out.insert(out.end(), data.begin(), data.end());
+  return out;
+}
+
+}  // namespace
+
+OtaImages makeOtaImages(uint32_t seed) {
+  std::mt19937 rng(seed);
+
+  // Compiled code reuses a limited set of instruction words
+  std::vector<uint16_t> opcodes(600);
+  for (uint16_t& op : opcodes) op = rng();
+
+  auto makeFunction = [&](int callees) {
+    Function f;
+    int words = 20 + rng() % 180;
+    for (int w = 0; w < words; w++) {
+      if (w + 1 < words && rng() % 12 == 0) {
+        f.words.push_back(0x940E);  // CALL, target word follows
+        f.calls.push_back(-1);
+        f.words.push_back(0);
+        f.calls.push_back(rng() % callees);
+        w++;
+      } else {
+        f.words.push_back(opcodes[rng() % opcodes.size()]);
+        f.calls.push_back(-1);
+      }
+    }
+    f.words.push_back(0x9508);  // RET
+    f.calls.push_back(-1);
+    return f;
+  };
+
+  std::vector<Function> fns;
+  for (int i = 0; i < IMAGE_FUNCTIONS; i++) fns.push_back(makeFunction(IMAGE_FUNCTIONS));
+
+  // Strings and tables, with zero runs
+  std::vector<uint8_t> data;
+  while (data.size() < IMAGE_DATA_LEN) {
+    if (rng() % 8 == 0) {
+      data.insert(data.end(), 4 + rng() % 24, 0);
+    } else {
+      data.push_back(0x20 + rng() % 0x5F);
+    }
+  }
+
+  OtaImages images;
+  images.base = link(fns, data);
+
+  // The release: a new function in the middle, two edited ones, a
+  // changed string
+  const int inserted = IMAGE_FUNCTIONS / 2;
+  for (Function& f : fns) {
+    for (int& c : f.calls) {
+      if (c >= inserted) c++;
+    }
+  }
+  fns.insert(fns.begin() + inserted, makeFunction(IMAGE_FUNCTIONS + 1));
+  for (int edit : {IMAGE_FUNCTIONS / 4, IMAGE_FUNCTIONS * 3 / 4}) {
+    Function& f = fns[edit];
+    for (int k = 0; k < 6; k++) {
+      size_t w = rng() % f.words.size();
+      if (f.calls[w] < 0 && f.words[w] != 0x940E) f.words[w] = opcodes[rng() % opcodes.size()];
+    }
+  }
+  for (int k = 0; k < 12; k++) data[100 + k] = 'A' + k;
+
+  images.next = link(fns, data);
+  return images;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+// Firmware images for the simulator's OTA campaign.
+//
+// The native firmware does not run from its program flash, so the boards
+// carry a synthetic AVR-like image instead: a vector table, functions of
+// random instruction words with absolute CALLs between them, and a data
+// block. The update inserts a function and edits two others, so every
+// CALL behind the insertion point changes too, as in a real rebuild.
+// That is the case the delta has to handle well to stay small on air.
+
+#include <stdint.h>
+
+#include <vector>
+
+// Test signing key pair (secp160r1). Nodes verify with OTA_SIGNING_KEY,
+// which the simulator defines from the public half.
+extern const uint8_t SIM_OTA_PRIVATE_KEY[21];
+
+struct OtaImages {
+  std::vector<uint8_t> base;  // What every node runs at boot
+  std::vector<uint8_t> next;  // The update
+};
+
+OtaImages makeOtaImages(uint32_t seed);
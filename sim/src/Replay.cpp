@@ -0,0 +1,64 @@
+#include "Replay.h"
+
+#include <math.h>
+#include <stdio.h>
+
+#include <NodeHal.h>
+#include <NodeCapture.h>
+
+bool Replay::load(const char* path) {
+  FILE* f = fopen(path, "r");
+  if (!f) return false;
+
+  // LoRa library defaults until a setup record says otherwise
+  long bandwidth = 125000;
+  int codingRate = 5;
+  long preamble = 8;
+
+  CaptureClock clock;
+  CaptureRecord r;
+  char line[600];
+  while (fgets(line, sizeof(line), f)) {
+    if (!captureParse(line, r)) continue;
+
+    if (r.type == CAPTURE_SETUP) {
+      bandwidth = r.bandwidth;
+      codingRate = r.codingRate;
+      preamble = r.preamble;
+    } else if (r.type == CAPTURE_LOST) {
+      lost_ += r.lost;
+    } else {
+      Frame fr;
+      fr.ch = Channel{(long)r.frequency, r.sf};
+      fr.startUs = clock(r.us) - hal::airtimeUs(r.len, r.sf, bandwidth, codingRate, preamble);
+      fr.tx = r.tx;
+      fr.rssi = r.rssi;
+      fr.bandwidth = bandwidth;
+      fr.codingRate = codingRate;
+      fr.preamble = preamble;
+      fr.data.assign(r.frame, r.frame + r.len);
+      frames_.push_back(std::move(fr));
+    }
+  }
+  fclose(f);
+  return !frames_.empty();
+}
+
+void Replay::start(const Endpoint& at, uint64_t startUs) {
+  pos = at.pos;
+
+  int64_t first = frames_.front().startUs;
+  for (const Frame& fr : frames_) {
+    if (fr.startUs < first) first = fr.startUs;
+  }
+
+  for (size_t i = 0; i < frames_.size(); i++) {
+    const Frame& fr = frames_[i];
+    int txPower = fr.tx ? fr.rssi : (int)lround(fr.rssi + medium_.pathLossDb(*this, at));
+    sched_.at(startUs + (fr.startUs - first), [this, &fr, txPower] {
+      medium_.transmit(*this, fr.data.data(), (uint8_t)fr.data.size(), fr.ch, txPower,
+                       fr.bandwidth, fr.codingRate, fr.preamble);
+      sent++;
+    });
+  }
+}
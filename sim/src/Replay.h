@@ -0,0 +1,53 @@
+#pragma once
+
+// Frames of a capture (NodeCapture.h) put on air again.
+//
+// The replay sits where the capture was taken, next to the hub, and sends
+// each frame at its captured time relative to the first, on its captured
+// channel and SF, with the TX power that makes the hub hear it at the
+// captured RSSI. Frames the capture point sent itself go out at their TX
+// power. Overlapping frames overlap again, so recorded traffic from a
+// real site (a sniffer) or another run (sim --capture) contends with the
+// simulated nodes as it did there, and the hub sees every frame again as
+// a replay attempt.
+
+#include <stdint.h>
+
+#include <vector>
+
+#include "Medium.h"
+
+class Replay : public Endpoint {
+public:
+  Replay(Scheduler& sched, Medium& medium) : sched_(sched), medium_(medium) {}
+
+  // False if the file cannot be read or has no frames
+  bool load(const char* path);
+
+  // Next to at, first frame on air at startUs. After Medium::finalize().
+  void start(const Endpoint& at, uint64_t startUs);
+
+  bool listening(const Channel&) const override { return false; }
+  void onFrame(const uint8_t*, uint8_t, int, float) override {}
+
+  size_t frames() const { return frames_.size(); }
+  uint32_t lostInCapture() const { return lost_; }
+  uint32_t sent = 0;
+
+private:
+  struct Frame {
+    int64_t startUs;  // Capture clock
+    Channel ch;
+    bool tx;
+    int rssi;
+    long bandwidth;
+    int codingRate;
+    long preamble;
+    std::vector<uint8_t> data;
+  };
+
+  Scheduler& sched_;
+  Medium& medium_;
+  std::vector<Frame> frames_;
+  uint32_t lost_ = 0;
+};
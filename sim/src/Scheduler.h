@@ -0,0 +1,54 @@
+#pragma once
+
+// Discrete-event scheduler for the network simulator.
+//
+// Everything in the simulation (node wake-ups, the end of a frame on air,
+// hub transmissions, reed switch events) is an event at an absolute
+// virtual time in microseconds. Events at the same time run in the order
+// they were scheduled, so a run is fully determined by its seed.
+
+#include <stdint.h>
+
+#include <functional>
+#include <queue>
+#include <vector>
+
+class Scheduler {
+public:
+  uint64_t now() const { return now_; }
+
+  void at(uint64_t t, std::function<void()> fn) {
+    if (t < now_) t = now_;
+    queue_.push(Event{t, seq_++, std::move(fn)});
+  }
+
+  void after(uint64_t us, std::function<void()> fn) {
+    at(now_ + us, std::move(fn));
+  }
+
+  // Run events until the queue is empty or the next one is past endUs
+  void run(uint64_t endUs) {
+    while (!queue_.empty() && queue_.top().t <= endUs) {
+      Event e = queue_.top();
+      queue_.pop();
+      now_ = e.t;
+      e.fn();
+    }
+    now_ = endUs;
+  }
+
+private:
+  struct Event {
+    uint64_t t;
+    uint64_t seq;
+    std::function<void()> fn;
+
+    bool operator>(const Event& o) const {
+      return t != o.t ? t > o.t : seq > o.seq;
+    }
+  };
+
+  std::priority_queue<Event, std::vector<Event>, std::greater<Event>> queue_;
+  uint64_t now_ = 0;
+  uint64_t seq_ = 0;
+};
@@ -0,0 +1,133 @@
+#include "SimNode.h"
+
+// makecontext() only passes int arguments portably, so the node being
+// started is handed over through here
+static SimNode* starting = nullptr;
+
+SimNode::SimNode(Scheduler& sched, Medium& medium, const uint8_t* id, bool isSiren)
+  : siren(isSiren), sched_(sched), medium_(medium) {
+  memcpy(serialId, id, 16);
+  channel = Channel{(long)FREQ, 7};
+
+  board.user = this;
+  board.sleep = sleep;
+  board.reset = reset;
+  board.radio.transmit = transmit;
+}
+
+void SimNode::boot(uint64_t bootUs) {
+  stack_.resize(SIM_STACK_SIZE);
+  getcontext(&ctx_);
+  ctx_.uc_stack.ss_sp = stack_.data();
+  ctx_.uc_stack.ss_size = stack_.size();
+  ctx_.uc_link = nullptr;
+
+  uint32_t life = ++life_;
+  sched_.at(bootUs, [this, life] {
+    if (life != life_) return;
+    starting = this;
+    makecontext(&ctx_, (void (*)())run, 0);
+    resume();
+  });
+}
+
+void SimNode::run() {
+  SimNode* n = starting;
+  n->setup();
+  for (;;) n->loop();
+}
+
+void SimNode::resume() {
+  hal::Board* prev = hal::board;
+  hal::board = &board;
+  board.clockUs = sched_.now();
+  swapcontext(&caller_, &ctx_);
+  hal::board = prev;
+}
+
+void SimNode::sleep(hal::Board& b, uint64_t untilUs) {
+  SimNode* n = (SimNode*)b.user;
+  n->applyPlan();
+  uint32_t life = n->life_;
+  n->sched_.at(untilUs, [n, life] {
+    if (life == n->life_) n->resume();
+  });
+  swapcontext(&n->ctx_, &n->caller_);
+}
+
+// Runs on the node's own stack, which is abandoned: boot() starts over on
+// it once the scheduler is back in the main context
+void SimNode::reset(hal::Board& b) {
+  SimNode* n = (SimNode*)b.user;
+  n->reboots++;
+
+  hal::bootloader(b);
+  b.radio.setMode(hal::RADIO_SLEEP, b.clockUs);
+  b.radio.rxLen = 0;
+  b.bootUs = b.clockUs + SIM_REBOOT_US;
+
+  n->restart();
+  n->boot(b.bootUs);
+
+  ucontext_t dead;
+  swapcontext(&dead, &n->caller_);
+}
+
+// The parked firmware is simply never resumed: boot() starts a new life
+// and its pending wake-up finds the old one gone
+void SimNode::powerCycle(uint64_t offUs) {
+  reboots++;
+
+  board.clockUs = sched_.now();
+  board.radio.setMode(hal::RADIO_SLEEP, board.clockUs);
+  board.radio.rxLen = 0;
+  hal::bootloader(board);
+  board.bootUs = board.clockUs + offUs;
+
+  restart();
+  boot(board.bootUs);
+}
+
+void SimNode::transmit(hal::Board& b, const uint8_t* frame, uint8_t len) {
+  SimNode* n = (SimNode*)b.user;
+  n->applyPlan();
+
+  hal::Radio& r = b.radio;
+  n->medium_.transmit(*n, frame, len, n->channel, r.txPower, r.bandwidth,
+                      r.codingRate, r.preambleLength);
+}
+
+// The firmware always configures FREQ and SF7; the site plan wins so the
+// HAL's airtime and the medium agree
+void SimNode::applyPlan() {
+  board.radio.frequency = channel.frequency;
+  board.radio.spreadingFactor = channel.sf;
+}
+
+bool SimNode::listening(const Channel& ch) const {
+  return board.radio.mode == hal::RADIO_RX &&
+         ch.frequency == channel.frequency &&
+         ch.sf == channel.sf;
+}
+
+void SimNode::onFrame(const uint8_t* frame, uint8_t len, int rssi, float snr) {
+  // Raise the DIO0 callback on this instance, not through the static
+  // NodeCore::instance_ that every node of the same type shares
+  board.radio.onReceive = nullptr;
+  if (!hal::deliver(board, frame, len, rssi, snr)) return;
+
+  if (len >= 17 && memcmp(frame + 1, serialId, 16) == 0) addressedFrames++;
+
+  hal::Board* prev = hal::board;
+  hal::board = &board;
+  receive(len);
+  hal::board = prev;
+}
+
+bool SimNode::upload(uint8_t kind, const uint8_t* data, uint16_t len) {
+  hal::Board* prev = hal::board;
+  hal::board = &board;
+  bool queued = sendBulk(kind, data, len);
+  hal::board = prev;
+  return queued;
+}
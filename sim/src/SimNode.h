@@ -0,0 +1,115 @@
+#pragma once
+
+// One firmware instance in the simulator.
+//
+// Each node owns a hal::Board and runs NodeCore's begin()/loop() on its own
+// coroutine stack. Whenever the firmware waits (delay(), a blocking
+// endPacket()) the board's sleep hook parks the coroutine and schedules a
+// wake-up, so hundreds of nodes share one thread and one virtual clock.
+//
+// A software reset runs the OTA bootloader on the board and boots a fresh
+// firmware instance a moment later, as the watchdog reset does on AVR. A
+// power cycle does the same from outside, for a site-wide outage.
+
+#include <NodeCore.h>
+
+#include <ucontext.h>
+
+#include <new>
+
+#include <vector>
+
+#include "Medium.h"
+
+#define SIM_STACK_SIZE (64 * 1024)
+#define SIM_REBOOT_US 50000  // Reset to the first instruction of the firmware
+
+class SimNode : public Endpoint {
+public:
+  SimNode(Scheduler& sched, Medium& medium, const uint8_t* serialId, bool siren);
+  virtual ~SimNode() {}
+
+  // Schedule begin() at bootUs
+  void boot(uint64_t bootUs);
+
+  // Power lost now and back after offUs. RAM is gone, EEPROM and flash
+  // stay. Only from the scheduler, never while the firmware runs.
+  void powerCycle(uint64_t offUs);
+
+  virtual bool ready() const = 0;
+
+  bool listening(const Channel& ch) const override;
+  void onFrame(const uint8_t* frame, uint8_t len, int rssi, float snr) override;
+
+  // Have the firmware send data up as a bulk transfer of kind. False while
+  // it has one in progress, or when built without BULK_ENABLED.
+  bool upload(uint8_t kind, const uint8_t* data, uint16_t len);
+
+  uint8_t serialId[16];
+  bool siren;
+  Channel channel;       // Site plan; overrides what the firmware configures
+
+  hal::Board board;
+  std::vector<uint8_t> spiFlash;  // Backs board.spiFlash when fitted
+
+  uint32_t addressedFrames = 0;  // Frames received that carry our SERIAL_ID
+  uint32_t reboots = 0;
+
+protected:
+  virtual void setup() = 0;
+  virtual void loop() = 0;
+  virtual void receive(int size) = 0;
+  virtual bool sendBulk(uint8_t kind, const uint8_t* data, uint16_t len) = 0;
+
+  // Fresh firmware state for the next boot, RAM does not survive a reset
+  virtual void restart() = 0;
+
+private:
+  static void run();
+  static void sleep(hal::Board& board, uint64_t untilUs);
+  static void reset(hal::Board& board);
+  static void transmit(hal::Board& board, const uint8_t* frame, uint8_t len);
+
+  void resume();
+  void applyPlan();
+
+  Scheduler& sched_;
+  Medium& medium_;
+
+  ucontext_t ctx_;
+  ucontext_t caller_;
+  std::vector<uint8_t> stack_;
+  uint32_t life_ = 0;  // Boots so far; wake-ups from an earlier one are dropped
+};
+
+template <class Device>
+class FirmwareNode : public SimNode {
+public:
+  FirmwareNode(Scheduler& sched, Medium& medium, const uint8_t* serialId, bool siren)
+    : SimNode(sched, medium, serialId, siren), node(this->serialId) {}
+
+  NodeCore<Device> node;
+
+  bool ready() const override { return node.isReady(); }
+
+protected:
+  void setup() override { node.begin(); }
+  void loop() override { node.loop(); }
+  void receive(int size) override { node.receive(size); }
+
+  bool sendBulk(uint8_t kind, const uint8_t* data, uint16_t len) override {
+#if BULK_ENABLED
+    return node.sendBulk(kind, data, len);
+#else
+    (void)kind;
+    (void)data;
+    (void)len;
+    return false;
+#endif
+  }
+
+  void restart() override {
+    node.~NodeCore<Device>();
+    new (&node) NodeCore<Device>(this->serialId);
+  }
+};
@@ -0,0 +1,884 @@
+// Multi-node LoRa network simulator.
+//
+// Runs the real entry and siren firmware (NodeCore plus the device
+// policies from lib/NodeDevices) for a whole site against a virtual RF
+// medium and a stand-in hub, then reports delivery, latency and duty
+// cycle. Every node starts adopted, so the run covers boot challenges,
+// telemetry, reed switch events and siren commands, and optionally
+// site-wide alarms, a firmware update rolled out over the air, bulk
+// transfers both ways and a site-wide power outage.
+//
+//   program [options]
+//     --entries N        entry nodes (200)
+//     --sirens N         siren nodes (10)
+//     --seconds N        simulated time (600)
+//     --radius M         nodes placed uniformly in a disc around the hub (300)
+//     --channels N       channels, nodes assigned round robin (1)
+//     --sf N|auto        spreading factor, auto picks the lowest SF with
+//                        --margin dB of SNR headroom to the hub (7)
+//     --margin DB        auto SF headroom (5)
+//     --exponent N       path loss exponent (2.7)
+//     --shadowing DB     per-link shadowing sigma (4)
+//     --loss P           extra random frame loss, 0..1 (0)
+//     --hub-paths N      concurrent hub receptions (8)
+//     --hub-rate N       challenges the hub answers per second, the rest
+//                        get MSG_RETRY; 0 for all (0)
+//     --boot-spread S    nodes power up within S seconds; 0 is a site-wide
+//                        power cycle (10)
+//     --events N         reed switch changes per entry node per hour (4)
+//     --commands N       siren commands per siren per hour (6)
+//     --alarms N         site-wide alarms per hour, each switching every
+//                        siren on or off; best with --commands 0 (0)
+//     --multicast 0|1    alarms as one group command instead of one command
+//                        per siren (1)
+//     --trigger 0|1      alarms as MSG_TRIGGER instead of "siren;<bool>"
+//                        commands (1)
+//     --ota N            update the firmware of the first N nodes, starting
+//                        30 s in (0)
+//     --bulk BYTES       the hub sends a BULK_CONFIG blob of BYTES to every
+//                        node, starting 30 s in; needs BULK_ENABLED (0)
+//     --upload BYTES     every node sends a BULK_DIAG blob of BYTES up,
+//                        starting 30 s in and again every 5 s while it
+//                        is busy; the hub's copy is compared (0)
+//     --beacon MS        hub beacon period, 0 for none (0)
+//     --mains-loss S     sirens lose mains power S seconds in and sleep
+//                        between beacons, -1 for never (-1)
+//     --outage S         the whole site loses power S seconds in for
+//                        OUTAGE_US; nodes come back within --boot-spread,
+//                        the hub HUB_BOOT_US after power, -1 for never (-1)
+//     --resync 0|1       the hub resyncs every node with one MSG_RESYNC
+//                        after the outage instead of per-node challenges (1)
+//     --capture FILE     write what the hub hears and sends as capture
+//                        records (NodeCapture.h) for tools/capture
+//     --capture-keys FILE  write the ID and adoption key of every node, for
+//                        tools/capture/capture.py --keys
+//     --replay FILE      put the frames of a capture on air again from the
+//                        hub's position, at the RSSI the hub heard them
+//                        with, starting at 0 (Replay.h)
+//     --seed N           (1)
+
+#include <NodeCore.h>
+#include <EntryDevice.h>
+#include <SirenDevice.h>
+
+#include <math.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "Hub.h"
+#include "Medium.h"
+#include "OtaImages.h"
+#include "Replay.h"
+#include "Scheduler.h"
+#include "SimNode.h"
+
+#define CHANNEL_SPACING 200000L
+#define BOOT_SPREAD_US 10000000ULL
+#define DUTY_CYCLE_LIMIT 0.01       // EU868 g1 sub-band
+#define IN_FLIGHT_US 10000000ULL    // Outcomes younger than this are not scored
+#define OTA_START_US 30000000ULL
+#define OTA_UPDATE_ID 1
+#define BULK_START_US 30000000ULL
+#define BULK_UPLOAD_RETRY_US 5000000ULL  // Node still busy with the last transfer
+#define ALARM_START_US 30000000ULL  // Siren group joined by then
+#define ALARM_SAMPLE_US 5000
+#define ALARM_TIMEOUT_US 10000000ULL
+#define SYNC_SAMPLE_US 100000
+#define SLEEP_PPM_MAX 50000         // Watchdog oscillator error, +-5%
+#define OUTAGE_US 5000000ULL
+#define HUB_BOOT_US 20000000ULL     // Gateway power on to the hub on air
+
+// Siren current on the backup battery in mA, from tools/energy/currents.json.
+// The MCU in power-down with the watchdog running takes about 5 uA.
+static const double RADIO_MA[4] = {0.0002, 1.6, 87.0, 11.5};  // hal::RadioMode
+#define BASE_MA 0.08
+#define CPU_ACTIVE_MA 3.6
+#define CPU_POWER_DOWN_MA 0.005
+
+struct SiteConfig {
+  int entries = 200;
+  int sirens = 10;
+  unsigned long seconds = 600;
+  double radius = 300;
+  int channels = 1;
+  int sf = 7;                 // 0 = auto
+  double margin = 5;
+  double eventsPerHour = 4;
+  double commandsPerHour = 6;
+  double alarmsPerHour = 0;
+  bool multicast = true;
+  bool trigger = true;
+  int otaNodes = 0;
+  size_t bulkBytes = 0;
+  size_t uploadBytes = 0;
+  long mainsLossS = -1;
+  long outageS = -1;
+  double bootSpreadS = BOOT_SPREAD_US / 1e6;
+  uint32_t seed = 1;
+  const char* capture = nullptr;
+  const char* captureKeys = nullptr;
+  const char* replay = nullptr;
+  MediumConfig medium;
+  HubConfig hub;
+};
+
+// An application-level outcome waiting for the hub to see it
+struct Pending {
+  bool active = false;
+  bool state = false;
+  uint64_t since = 0;
+};
+
+struct Outcomes {
+  uint32_t issued = 0;
+  uint32_t delivered = 0;
+  uint32_t superseded = 0;   // Replaced by a newer one before delivery
+  std::vector<double> latencyMs;
+
+  void issue(Pending& p, bool state, uint64_t now) {
+    if (p.active) superseded++;
+    issued++;
+    p.active = true;
+    p.state = state;
+    p.since = now;
+  }
+
+  void resolve(Pending& p, bool state, uint64_t now) {
+    if (!p.active || p.state != state) return;
+    p.active = false;
+    delivered++;
+    latencyMs.push_back((now - p.since) / 1000.0);
+  }
+};
+
+// Every siren driving its output to state, sampled from the boards
+struct Alarms {
+  uint32_t issued = 0;
+  uint32_t scored = 0;         // Issued with at least one siren to switch
+  uint32_t complete = 0;       // All sirens within ALARM_TIMEOUT_US
+  uint32_t switched = 0;       // Sirens that followed, over all alarms
+  uint32_t targets = 0;
+  std::vector<double> latencyMs;  // Until the last siren, complete alarms only
+};
+
+// What a siren had spent when it went on backup power
+struct Backup {
+  uint64_t radioUs[4] = {};
+  uint64_t sleptUs = 0;
+};
+
+class Site {
+public:
+  explicit Site(const SiteConfig& cfg)
+    : cfg_(cfg), medium_(sched_, cfg.medium, cfg.seed), rng_(cfg.seed) {}
+
+  void build();
+  void run();
+  void report(double wallSeconds) const;
+
+private:
+  void scheduleReed(size_t i, uint64_t delayUs = 0);
+  void scheduleCommand(size_t i, uint64_t delayUs = 0);
+  void scheduleAlarm(uint64_t delayUs = 0);
+  void checkAlarm(bool state, uint32_t idle, uint64_t since);
+  void outage();
+  void checkSync();
+  void onMessage(SimNode& node, const char* msg);
+  void scheduleUpload(size_t i, uint64_t delayUs);
+  void onUpload(SimNode& node, uint8_t kind, const uint8_t* data, size_t len);
+  int pickSf(const SimNode& node) const;
+
+  SiteConfig cfg_;
+  Scheduler sched_;
+  Medium medium_;
+  std::mt19937 rng_;
+
+  std::unique_ptr<Hub> hub_;
+  std::unique_ptr<Replay> replay_;
+  FILE* capture_ = nullptr;
+  std::vector<std::unique_ptr<SimNode>> nodes_;
+  std::vector<Pending> pending_;  // Per node: reed state or siren command
+  std::vector<uint64_t> bootUs_;
+  std::vector<double> syncMs_;    // Boot to first sync, per node that made it;
+                                  // after the outage when there is one
+  std::vector<bool> synced_;
+
+  Outcomes events_;
+  Outcomes commands_;
+
+  std::vector<SimNode*> sirens_;
+  int sirenGroup_ = -1;
+  bool alarmState_ = false;
+  Alarms alarms_;
+  std::vector<Backup> backup_;    // Per siren, from --mains-loss on
+
+  OtaImages images_;
+  OtaUpdate update_;
+  std::vector<double> otaDone_;   // Time of each confirmation
+  uint32_t otaResults_[8] = {};   // Final node state of each transfer
+
+  std::vector<uint8_t> bulkBlob_;  // --bulk, the same for every node
+  std::vector<double> bulkDone_;   // Time of each delivery
+  uint32_t bulkResults_[8] = {};   // BULK_* result of each finished transfer
+  std::vector<std::vector<uint8_t>> uploads_;  // --upload, per node
+  uint32_t uploadsQueued_ = 0;
+  uint32_t uploadsIntact_ = 0;
+  uint32_t uploadsCorrupt_ = 0;
+};
+
+void Site::build() {
+  for (int c = 0; c < cfg_.channels; c++) {
+    cfg_.hub.channels.push_back((long)FREQ + c * CHANNEL_SPACING);
+  }
+  hub_.reset(new Hub(sched_, medium_, cfg_.hub, cfg_.entries + cfg_.sirens));
+  medium_.attach(hub_.get());
+
+  if (cfg_.replay) {
+    replay_.reset(new Replay(sched_, medium_));
+    if (!replay_->load(cfg_.replay)) {
+      fprintf(stderr, "no frames in the capture %s\n", cfg_.replay);
+      exit(1);
+    }
+    medium_.attach(replay_.get());
+  }
+
+  FILE* keys = nullptr;
+  if (cfg_.captureKeys) {
+    keys = fopen(cfg_.captureKeys, "w");
+    if (!keys) {
+      fprintf(stderr, "cannot write %s\n", cfg_.captureKeys);
+      exit(1);
+    }
+    fprintf(keys, "# sim --seed %u: serial ID and adoption key of every node\n", cfg_.seed);
+  }
+
+  std::uniform_real_distribution<double> unit(0.0, 1.0);
+  int total = cfg_.entries + cfg_.sirens;
+
+  images_ = makeOtaImages(cfg_.seed);
+  if (cfg_.otaNodes) {
+    uECC_set_rng(&getRng);
+    if (!otaPrepare(OTA_UPDATE_ID, images_.base.data(), images_.base.size(),
+                    images_.next.data(), images_.next.size(), SIM_OTA_PRIVATE_KEY, update_)) {
+      fprintf(stderr, "cannot prepare the OTA update\n");
+      exit(1);
+    }
+  }
+
+  for (int i = 0; i < total; i++) {
+    bool siren = i >= cfg_.entries;
+
+    uint8_t id[16] = {0};
+    id[6] = 0x40;
+    id[7] = siren ? 0x75 : 0x24;
+    id[8] = 0xa0;
+    id[14] = i >> 8;
+    id[15] = i;
+
+    SimNode* n;
+    if (siren) {
+      n = new FirmwareNode<SirenDevice>(sched_, medium_, id, true);
+    } else {
+      n = new FirmwareNode<EntryDevice>(sched_, medium_, id, false);
+    }
+    nodes_.emplace_back(n);
+    if (siren) sirens_.push_back(n);
+
+    double r = cfg_.radius * sqrt(unit(rng_));
+    double a = 2 * M_PI * unit(rng_);
+    n->pos.x = r * cos(a);
+    n->pos.y = r * sin(a);
+    n->channel.frequency = cfg_.hub.channels[i % cfg_.channels];
+
+    uint8_t key[16];
+    for (int k = 0; k < 16; k++) key[k] = rng_();
+    hal::provision(n->board, key, hub_->publicKey());
+    hub_->addNode(n, key);
+    if (keys) {
+      for (int k = 0; k < 16; k++) fprintf(keys, "%02x", id[k]);
+      fputc(' ', keys);
+      for (int k = 0; k < 16; k++) fprintf(keys, "%02x", key[k]);
+      fputc('\n', keys);
+    }
+
+    n->board.rng = rng_() | 1;
+    n->board.sleepPpm = (int32_t)(n->board.rng % (2 * SLEEP_PPM_MAX + 1)) - SLEEP_PPM_MAX;
+    memcpy(n->board.flash, images_.base.data(), images_.base.size());
+    n->board.imageLen = images_.base.size();
+    n->spiFlash.assign(HAL_SPI_FLASH_SIZE, 0xFF);
+    n->board.spiFlash = n->spiFlash.data();
+    medium_.attach(n);
+  }
+
+  medium_.finalize();
+  if (keys) fclose(keys);
+
+  if (cfg_.capture) {
+    capture_ = fopen(cfg_.capture, "w");
+    if (!capture_) {
+      fprintf(stderr, "cannot write %s\n", cfg_.capture);
+      exit(1);
+    }
+    medium_.capture(hub_.get(), capture_);
+  }
+
+  for (auto& n : nodes_) {
+    n->channel.sf = cfg_.sf ? cfg_.sf : pickSf(*n);
+  }
+
+  pending_.resize(nodes_.size());
+  hub_->onMessage = [this](SimNode& node, const char* msg) { onMessage(node, msg); };
+  hub_->onOtaFinished = [this](SimNode&, const OtaTransfer& t) {
+    if (t.phase() == OTA_PHASE_DONE) otaDone_.push_back(sched_.now() / 1e6);
+    otaResults_[t.result() & 7]++;
+  };
+  hub_->onBulkFinished = [this](SimNode&, const BulkTransfer& t) {
+    if (t.result() == BULK_DONE) bulkDone_.push_back(sched_.now() / 1e6);
+    bulkResults_[t.result() & 7]++;
+  };
+  hub_->onBulkReceived = [this](SimNode& node, uint8_t kind, const uint8_t* data, size_t len) {
+    onUpload(node, kind, data, len);
+  };
+}
+
+int Site::pickSf(const SimNode& node) const {
+  double snr = node.board.radio.txPower - medium_.pathLossDb(node, *hub_) - NOISE_FLOOR_DBM;
+  for (int sf = 7; sf < 12; sf++) {
+    if (snr - snrFloorDb(sf) >= cfg_.margin) return sf;
+  }
+  return 12;
+}
+
+void Site::run() {
+  std::uniform_int_distribution<uint64_t> bootAt(0, (uint64_t)(cfg_.bootSpreadS * 1e6));
+
+  bootUs_.resize(nodes_.size());
+  synced_.assign(nodes_.size(), false);
+  for (size_t i = 0; i < nodes_.size(); i++) {
+    bootUs_[i] = bootAt(rng_);
+    nodes_[i]->boot(bootUs_[i]);
+    if (nodes_[i]->siren) {
+      scheduleCommand(i, BOOT_SPREAD_US);
+    } else {
+      scheduleReed(i, BOOT_SPREAD_US);
+    }
+  }
+
+  sched_.after(SYNC_SAMPLE_US, [this] { checkSync(); });
+
+  if (cfg_.alarmsPerHour > 0 && !sirens_.empty()) {
+    if (cfg_.multicast) {
+      sched_.at(BOOT_SPREAD_US, [this] { sirenGroup_ = hub_->addGroup(sirens_); });
+    }
+    scheduleAlarm(ALARM_START_US);
+  }
+
+  if (cfg_.mainsLossS >= 0) {
+    sched_.at((uint64_t)cfg_.mainsLossS * 1000000, [this] {
+      backup_.resize(sirens_.size());
+      for (size_t i = 0; i < sirens_.size(); i++) {
+        hal::Board& b = sirens_[i]->board;
+        b.pinIn[MAINS_PIN] = LOW;
+        b.radio.setMode(b.radio.mode, sched_.now());
+        memcpy(backup_[i].radioUs, b.radio.modeUs, sizeof(backup_[i].radioUs));
+        backup_[i].sleptUs = b.sleptUs;
+      }
+    });
+  }
+
+  if (cfg_.outageS >= 0) {
+    sched_.at((uint64_t)cfg_.outageS * 1000000, [this] { outage(); });
+  }
+
+  if (cfg_.otaNodes) {
+    sched_.at(OTA_START_US, [this] {
+      for (int i = 0; i < cfg_.otaNodes && i < (int)nodes_.size(); i++) {
+        hub_->updateFirmware(nodes_[i].get(), update_);
+      }
+    });
+  }
+
+  if (cfg_.bulkBytes) {
+    bulkBlob_.resize(cfg_.bulkBytes);
+    for (uint8_t& b : bulkBlob_) b = rng_();
+    sched_.at(BULK_START_US, [this] {
+      for (auto& n : nodes_) {
+        hub_->sendBulk(n.get(), BULK_CONFIG, bulkBlob_.data(), bulkBlob_.size());
+      }
+    });
+  }
+
+  if (cfg_.uploadBytes) {
+    uploads_.resize(nodes_.size());
+    for (size_t i = 0; i < nodes_.size(); i++) {
+      uploads_[i].resize(cfg_.uploadBytes);
+      for (uint8_t& b : uploads_[i]) b = rng_();
+      scheduleUpload(i, BULK_START_US);
+    }
+  }
+
+  if (replay_) replay_->start(*hub_, 0);
+
+  sched_.run((uint64_t)cfg_.seconds * 1000000);
+  if (capture_) fclose(capture_);
+}
+
+void Site::scheduleReed(size_t i, uint64_t delayUs) {
+  if (cfg_.eventsPerHour <= 0) return;
+
+  std::exponential_distribution<double> gap(cfg_.eventsPerHour / 3600e6);
+  sched_.after(delayUs + (uint64_t)gap(rng_), [this, i] {
+    SimNode& n = *nodes_[i];
+    n.board.pinIn[REED_PIN] ^= 1;
+    events_.issue(pending_[i], n.board.pinIn[REED_PIN], sched_.now());
+    scheduleReed(i);
+  });
+}
+
+void Site::scheduleCommand(size_t i, uint64_t delayUs) {
+  if (cfg_.commandsPerHour <= 0) return;
+
+  std::exponential_distribution<double> gap(cfg_.commandsPerHour / 3600e6);
+  sched_.after(delayUs + (uint64_t)gap(rng_), [this, i] {
+    Pending& p = pending_[i];
+    bool on = !(p.active ? p.state : false);
+    commands_.issue(p, on, sched_.now());
+    hub_->sendCommand(nodes_[i].get(), on ? "siren;true" : "siren;false");
+    scheduleCommand(i);
+  });
+}
+
+void Site::scheduleAlarm(uint64_t delayUs) {
+  std::exponential_distribution<double> gap(cfg_.alarmsPerHour / 3600e6);
+  sched_.after(delayUs + (uint64_t)gap(rng_), [this] {
+    alarmState_ = !alarmState_;
+    const char* cmd = alarmState_ ? "siren;true" : "siren;false";
+    uint8_t action = alarmState_ ? TRIGGER_ON : TRIGGER_OFF;
+    alarms_.issued++;
+
+    if (sirenGroup_ >= 0 && cfg_.trigger) {
+      hub_->sendGroupTrigger(sirenGroup_, action);
+    } else if (sirenGroup_ >= 0) {
+      hub_->sendGroupCommand(sirenGroup_, cmd);
+    } else {
+      for (SimNode* n : sirens_) {
+        if (cfg_.trigger) {
+          hub_->sendTrigger(n, action);
+        } else {
+          hub_->sendCommand(n, cmd);
+        }
+      }
+    }
+
+    uint32_t idle = 0;
+    for (SimNode* n : sirens_) {
+      if (n->board.pinOut[SIREN_PIN] == alarmState_) idle++;
+    }
+    if (idle < sirens_.size()) checkAlarm(alarmState_, idle, sched_.now());
+    scheduleAlarm();
+  });
+}
+
+// Sirens already in state when the alarm went out do not count
+void Site::checkAlarm(bool state, uint32_t idle, uint64_t since) {
+  if (state != alarmState_) return;  // The next alarm took over
+
+  uint32_t on = 0;
+  for (SimNode* n : sirens_) {
+    if (n->board.pinOut[SIREN_PIN] == state) on++;
+  }
+
+  uint64_t elapsed = sched_.now() - since;
+  if (on == sirens_.size() || elapsed >= ALARM_TIMEOUT_US) {
+    alarms_.scored++;
+    alarms_.switched += on - idle;
+    alarms_.targets += sirens_.size() - idle;
+    if (on == sirens_.size()) {
+      alarms_.complete++;
+      alarms_.latencyMs.push_back(elapsed / 1000.0);
+    }
+    return;
+  }
+
+  sched_.after(ALARM_SAMPLE_US, [this, state, idle, since] { checkAlarm(state, idle, since); });
+}
+
+// Every node and the hub at once. Sync times start over from the new boots.
+void Site::outage() {
+  std::uniform_int_distribution<uint64_t> bootAt(0, (uint64_t)(cfg_.bootSpreadS * 1e6));
+
+  bool sampling = syncMs_.size() < nodes_.size();
+  syncMs_.clear();
+  synced_.assign(nodes_.size(), false);
+  for (size_t i = 0; i < nodes_.size(); i++) {
+    uint64_t offUs = OUTAGE_US + bootAt(rng_);
+    bootUs_[i] = sched_.now() + offUs;
+    nodes_[i]->powerCycle(offUs);
+  }
+  hub_->restart(OUTAGE_US + HUB_BOOT_US);
+
+  if (!sampling) sched_.after(SYNC_SAMPLE_US, [this] { checkSync(); });
+}
+
+// Boot to the first time each node is ready, sampled until all are
+void Site::checkSync() {
+  for (size_t i = 0; i < nodes_.size(); i++) {
+    if (synced_[i] || !nodes_[i]->ready()) continue;
+    synced_[i] = true;
+    syncMs_.push_back((sched_.now() - bootUs_[i]) / 1000.0);
+  }
+  if (syncMs_.size() < nodes_.size()) sched_.after(SYNC_SAMPLE_US, [this] { checkSync(); });
+}
+
+void Site::scheduleUpload(size_t i, uint64_t delayUs) {
+  sched_.after(delayUs, [this, i] {
+    if (nodes_[i]->upload(BULK_DIAG, uploads_[i].data(), uploads_[i].size())) {
+      uploadsQueued_++;
+    } else {
+      scheduleUpload(i, BULK_UPLOAD_RETRY_US);
+    }
+  });
+}
+
+void Site::onUpload(SimNode& node, uint8_t kind, const uint8_t* data, size_t len) {
+  size_t i;
+  for (i = 0; i < nodes_.size() && nodes_[i].get() != &node; i++) {}
+  if (i == nodes_.size() || uploads_.empty()) return;
+
+  const std::vector<uint8_t>& sent = uploads_[i];
+  if (kind == BULK_DIAG && len == sent.size() && memcmp(data, sent.data(), len) == 0) {
+    uploadsIntact_++;
+  } else {
+    uploadsCorrupt_++;
+  }
+}
+
+// Entry: "state;<bool>" or "telemetry;<mV>;<%>;<bool>" carry the reed state.
+// Siren: "siren;<bool>" acknowledges a command.
+void Site::onMessage(SimNode& node, const char* msg) {
+  size_t i;
+  for (i = 0; i < nodes_.size() && nodes_[i].get() != &node; i++) {}
+  if (i == nodes_.size()) return;
+
+  const char* last = strrchr(msg, ';');
+  if (!last) return;
+  bool state = strcmp(last + 1, "true") == 0;
+
+  if (node.siren) {
+    if (strncmp(msg, "siren;", 6) == 0) commands_.resolve(pending_[i], state, sched_.now());
+  } else if (strncmp(msg, "state;", 6) == 0 || strncmp(msg, "telemetry;", 10) == 0) {
+    events_.resolve(pending_[i], state, sched_.now());
+  }
+}
+
+static double percentile(std::vector<double> v, double p) {
+  if (v.empty()) return 0;
+  std::sort(v.begin(), v.end());
+  size_t k = (size_t)ceil(p * v.size());
+  return v[k ? k - 1 : 0];
+}
+
+static void printOutcomes(const char* name, const Outcomes& o, uint32_t inFlight) {
+  uint32_t scored = o.issued - inFlight;
+  printf("%-10s %u issued, %u delivered (%.1f%%), %u superseded\n", name,
+         o.issued, o.delivered, scored ? 100.0 * o.delivered / scored : 0.0,
+         o.superseded);
+  printf("%-10s latency p50 %.0f ms, p90 %.0f ms, p99 %.0f ms, max %.0f ms\n", "",
+         percentile(o.latencyMs, 0.50), percentile(o.latencyMs, 0.90),
+         percentile(o.latencyMs, 0.99), percentile(o.latencyMs, 1.0));
+}
+
+void Site::report(double wallSeconds) const {
+  double simUs = (double)cfg_.seconds * 1e6;
+
+  uint32_t uplink = 0, downlinkHeard = 0, synced = 0;
+  uint32_t eventsInFlight = 0, commandsInFlight = 0;
+  double dutyMax = 0, dutySum = 0;
+  int overLimit = 0;
+
+  for (size_t i = 0; i < nodes_.size(); i++) {
+    const SimNode& n = *nodes_[i];
+    uplink += n.txFrames;
+    downlinkHeard += n.addressedFrames;
+    if (n.ready()) synced++;
+
+    double duty = n.airtimeUs / simUs;
+    dutySum += duty;
+    dutyMax = std::max(dutyMax, duty);
+    if (duty > DUTY_CYCLE_LIMIT) overLimit++;
+
+    const Pending& p = pending_[i];
+    if (p.active && sched_.now() - p.since < IN_FLIGHT_US) {
+      if (n.siren) {
+        commandsInFlight++;
+      } else {
+        eventsInFlight++;
+      }
+    }
+  }
+
+  const LossStats& lost = hub_->lost;
+  const HubStats& hs = hub_->stats();
+
+  printf("site       %d entry + %d siren nodes, %lu s, radius %.0f m, %d channel(s), ",
+         cfg_.entries, cfg_.sirens, cfg_.seconds, cfg_.radius, cfg_.channels);
+  if (cfg_.sf) {
+    printf("SF%d\n", cfg_.sf);
+  } else {
+    int perSf[13] = {0};
+    for (auto& n : nodes_) perSf[n->channel.sf]++;
+    printf("SF auto:");
+    for (int sf = 7; sf <= 12; sf++) {
+      if (perSf[sf]) printf(" SF%d=%d", sf, perSf[sf]);
+    }
+    printf("\n");
+  }
+
+  printf("uplink     %u frames, %u received by hub (%.1f%%)%s\n", uplink,
+         hub_->rxFrames, uplink ? 100.0 * hub_->rxFrames / uplink : 0.0,
+         replay_ ? ", replayed frames included" : "");
+  printf("           lost at hub: %u collision, %u below floor, %u demod busy, "
+         "%u while transmitting, %u random\n",
+         lost.collisions, lost.belowFloor, lost.noDemod, lost.interrupted, lost.randomLoss);
+  printf("           hub accepted %u data, %u challenges; %u hmac, %u replay, %u malformed\n",
+         hs.dataFrames, hs.challenges, hs.hmacFailures, hs.replays, hs.malformed);
+  if (hs.diagFrames) {
+    const uint32_t* ns = hs.nodeStats;
+    printf("node diag  %u reports: %u rx overrun, %u wrong id, %u hmac, %u replay, %u duplicate, "
+           "%u rate limited, %u over budget, %u resync skipped; %u tx fail, %u tx busy; worst loop %u ms, worst trigger %u us\n",
+           hs.diagFrames, ns[DIAG_RX_OVERRUN], ns[DIAG_RX_WRONG_ID], ns[DIAG_RX_BAD_HMAC],
+           ns[DIAG_RX_REPLAY], ns[DIAG_RX_DUPLICATE], ns[DIAG_RX_RATE_LIMITED], ns[DIAG_RX_OVER_BUDGET],
+           ns[DIAG_RX_RESYNC_SKIPPED], ns[DIAG_TX_FAIL], ns[DIAG_TX_BUSY],
+           hs.nodeWorstLoopMs, hs.nodeWorstTriggerUs);
+  }
+  printf("downlink   %u frames, %u heard by their node (%.1f%%)\n", hub_->txFrames,
+         downlinkHeard, hub_->txFrames ? 100.0 * downlinkHeard / hub_->txFrames : 0.0);
+  printf("sync       %u/%zu nodes synced at end; first sync after boot p50 %.1f s, p90 %.1f s, "
+         "max %.1f s\n", synced, nodes_.size(), percentile(syncMs_, 0.5) / 1000,
+         percentile(syncMs_, 0.9) / 1000, percentile(syncMs_, 1.0) / 1000);
+  if (hs.retries) printf("%-10s hub busy: %u MSG_RETRY\n", "", hs.retries);
+  if (cfg_.outageS >= 0) {
+    printf("outage     at %ld s for %.0f s, hub on air %.0f s after power; ", cfg_.outageS,
+           OUTAGE_US / 1e6, HUB_BOOT_US / 1e6);
+    if (cfg_.hub.resync) {
+      printf("epoch %u, %u MSG_RESYNC\n", hub_->epoch(), hs.resyncs);
+    } else {
+      printf("no resync, challenges only\n");
+    }
+  }
+
+  printOutcomes("events", events_, eventsInFlight);
+  printOutcomes("commands", commands_, commandsInFlight);
+
+  if (alarms_.issued) {
+    printf("alarms     %u issued to %zu sirens, ", alarms_.issued, sirens_.size());
+    const char* how = cfg_.trigger ? "triggers" : "commands";
+    if (sirenGroup_ >= 0) {
+      printf("multicast %s (%zu joined, %u joins, %u group frames)\n", how,
+             hub_->groupJoined(sirenGroup_), hs.groupJoins, hs.groupCommands);
+    } else {
+      printf("unicast %s\n", how);
+    }
+    printf("%-10s every siren switched within %.0f s: %u of %u; %u of %u siren switches\n", "",
+           ALARM_TIMEOUT_US / 1e6, alarms_.complete, alarms_.scored, alarms_.switched,
+           alarms_.targets);
+    printf("%-10s last siren after p50 %.0f ms, p90 %.0f ms, max %.0f ms\n", "",
+           percentile(alarms_.latencyMs, 0.50), percentile(alarms_.latencyMs, 0.90),
+           percentile(alarms_.latencyMs, 1.0));
+  }
+
+  if (cfg_.otaNodes) {
+    uint32_t running = 0, reboots = 0;
+    for (auto& n : nodes_) {
+      if (n->board.imageLen == images_.next.size() &&
+          memcmp(n->board.flash, images_.next.data(), images_.next.size()) == 0) {
+        running++;
+      }
+      reboots += n->reboots;
+    }
+    // A transfer the hub gave up on keeps the node's last report as its
+    // result, one of those on the way to OTA_CONFIRMED
+    printf("ota        image %zu B, delta %zu B (%.1f%%); %d nodes: %u confirmed, "
+           "%u failed (%u rolled back, %u refused, %u given up), %u unfinished; "
+           "%u running it, %u reboots\n",
+           images_.next.size(), update_.delta.size(),
+           100.0 * update_.delta.size() / images_.next.size(), cfg_.otaNodes,
+           hs.otaConfirmed, hs.otaFailed, otaResults_[OTA_ROLLED_BACK],
+           otaResults_[OTA_WRONG_BASE] + otaResults_[OTA_BAD_IMAGE] + otaResults_[OTA_NO_STORE],
+           otaResults_[OTA_READY] + otaResults_[OTA_PROGRESS] + otaResults_[OTA_STAGED],
+           cfg_.otaNodes - hs.otaConfirmed - hs.otaFailed, running, reboots);
+    printf("           %u frames, %.1f s airtime (%.1f s per node)", hs.otaFrames,
+           hs.otaAirtimeUs / 1e6, hs.otaAirtimeUs / 1e6 / cfg_.otaNodes);
+    if (!otaDone_.empty()) {
+      printf("; confirmed after %.0f s p50, %.0f s max",
+             percentile(otaDone_, 0.5) - OTA_START_US / 1e6,
+             percentile(otaDone_, 1.0) - OTA_START_US / 1e6);
+    }
+    printf("\n");
+  }
+
+  if (cfg_.bulkBytes) {
+    uint32_t failed = 0;
+    for (int k = 0; k < 8; k++) {
+      if (k != BULK_DONE) failed += bulkResults_[k];
+    }
+    printf("bulk down  %zu B to %zu nodes: %u delivered, %u too big, %u busy, %u no answer, "
+           "%u bad crc, %zu unfinished\n", bulkBlob_.size(), nodes_.size(), hs.bulkDelivered,
+           bulkResults_[BULK_TOO_BIG], bulkResults_[BULK_BUSY], bulkResults_[BULK_NO_ANSWER],
+           bulkResults_[BULK_BAD_CRC], nodes_.size() - hs.bulkDelivered - failed);
+    printf("           %u frames, %.1f s airtime (%.1f s per node)", hs.bulkFrames,
+           hs.bulkAirtimeUs / 1e6, hs.bulkAirtimeUs / 1e6 / nodes_.size());
+    if (!bulkDone_.empty()) {
+      printf("; delivered after %.0f s p50, %.0f s max",
+             percentile(bulkDone_, 0.5) - BULK_START_US / 1e6,
+             percentile(bulkDone_, 1.0) - BULK_START_US / 1e6);
+    }
+    printf("\n");
+  }
+
+  if (cfg_.uploadBytes) {
+    printf("bulk up    %zu B from %zu nodes: %u queued, %u received intact, %u corrupt\n",
+           cfg_.uploadBytes, nodes_.size(), uploadsQueued_, uploadsIntact_, uploadsCorrupt_);
+  }
+
+  if (!backup_.empty()) {
+    uint64_t since = (uint64_t)cfg_.mainsLossS * 1000000;
+    double spanUs = (double)(sched_.now() - since) * sirens_.size();
+    double radioUs[4] = {}, sleptUs = 0;
+    for (size_t i = 0; i < sirens_.size(); i++) {
+      const hal::Radio& r = sirens_[i]->board.radio;
+      for (int m = 0; m < 4; m++) {
+        radioUs[m] += r.modeUs[m] - backup_[i].radioUs[m];
+        if (r.mode == m) radioUs[m] += sched_.now() - r.modeSinceUs;
+      }
+      sleptUs += sirens_[i]->board.sleptUs - backup_[i].sleptUs;
+    }
+
+    double mA = BASE_MA + CPU_ACTIVE_MA * (1 - sleptUs / spanUs) +
+                CPU_POWER_DOWN_MA * sleptUs / spanUs;
+    for (int m = 0; m < 4; m++) mA += RADIO_MA[m] * radioUs[m] / spanUs;
+
+    printf("backup     %zu sirens from %ld s, beacon every %u ms (%u sent, %u frames held); "
+           "%u beacons missed\n", sirens_.size(), cfg_.mainsLossS, cfg_.hub.beaconMs,
+           hs.beacons, hs.held, hs.nodeStats[DIAG_BEACON_MISSED]);
+    printf("           radio rx %.1f%%, tx %.2f%%, sleep %.1f%%; MCU asleep %.1f%%; "
+           "%.2f mA mean, %.0f h on 1000 mAh\n",
+           100 * radioUs[hal::RADIO_RX] / spanUs, 100 * radioUs[hal::RADIO_TX] / spanUs,
+           100 * radioUs[hal::RADIO_SLEEP] / spanUs, 100 * sleptUs / spanUs, mA, 1000 / mA);
+  }
+
+  printf("duty cycle node mean %.2f%%, max %.2f%%, %d over %.0f%%; hub %.2f%%\n",
+         100.0 * dutySum / nodes_.size(), 100.0 * dutyMax, overLimit,
+         100.0 * DUTY_CYCLE_LIMIT, 100.0 * hub_->airtimeUs / simUs);
+  if (replay_) {
+    printf("replay     %u of %zu captured frames on air, %u lost in the capture\n",
+           replay_->sent, replay_->frames(), replay_->lostInCapture());
+  }
+  printf("medium     %u frames on air; %.1f s wall clock\n", medium_.frames(), wallSeconds);
+}
+
+static bool parse(int argc, char** argv, SiteConfig& cfg) {
+  for (int i = 1; i < argc; i++) {
+    const char* opt = argv[i];
+    if (i + 1 >= argc) return false;
+    const char* val = argv[++i];
+
+    if (strcmp(opt, "--entries") == 0) {
+      cfg.entries = atoi(val);
+    } else if (strcmp(opt, "--sirens") == 0) {
+      cfg.sirens = atoi(val);
+    } else if (strcmp(opt, "--seconds") == 0) {
+      cfg.seconds = strtoul(val, nullptr, 10);
+    } else if (strcmp(opt, "--radius") == 0) {
+      cfg.radius = atof(val);
+    } else if (strcmp(opt, "--channels") == 0) {
+      cfg.channels = atoi(val);
+    } else if (strcmp(opt, "--sf") == 0) {
+      cfg.sf = strcmp(val, "auto") == 0 ? 0 : atoi(val);
+    } else if (strcmp(opt, "--margin") == 0) {
+      cfg.margin = atof(val);
+    } else if (strcmp(opt, "--exponent") == 0) {
+      cfg.medium.exponent = atof(val);
+    } else if (strcmp(opt, "--shadowing") == 0) {
+      cfg.medium.shadowingDb = atof(val);
+    } else if (strcmp(opt, "--loss") == 0) {
+      cfg.medium.lossRate = atof(val);
+    } else if (strcmp(opt, "--hub-paths") == 0) {
+      cfg.hub.demodulators = atoi(val);
+    } else if (strcmp(opt, "--hub-rate") == 0) {
+      cfg.hub.challengeRate = atof(val);
+    } else if (strcmp(opt, "--boot-spread") == 0) {
+      cfg.bootSpreadS = atof(val);
+    } else if (strcmp(opt, "--events") == 0) {
+      cfg.eventsPerHour = atof(val);
+    } else if (strcmp(opt, "--commands") == 0) {
+      cfg.commandsPerHour = atof(val);
+    } else if (strcmp(opt, "--alarms") == 0) {
+      cfg.alarmsPerHour = atof(val);
+    } else if (strcmp(opt, "--multicast") == 0) {
+      cfg.multicast = atoi(val) != 0;
+    } else if (strcmp(opt, "--trigger") == 0) {
+      cfg.trigger = atoi(val) != 0;
+    } else if (strcmp(opt, "--ota") == 0) {
+      cfg.otaNodes = atoi(val);
+    } else if (strcmp(opt, "--bulk") == 0) {
+      cfg.bulkBytes = strtoul(val, nullptr, 10);
+    } else if (strcmp(opt, "--upload") == 0) {
+      cfg.uploadBytes = strtoul(val, nullptr, 10);
+    } else if (strcmp(opt, "--beacon") == 0) {
+      cfg.hub.beaconMs = atoi(val);
+    } else if (strcmp(opt, "--mains-loss") == 0) {
+      cfg.mainsLossS = atol(val);
+    } else if (strcmp(opt, "--outage") == 0) {
+      cfg.outageS = atol(val);
+    } else if (strcmp(opt, "--resync") == 0) {
+      cfg.hub.resync = atoi(val) != 0;
+    } else if (strcmp(opt, "--seed") == 0) {
+      cfg.seed = strtoul(val, nullptr, 10);
+    } else if (strcmp(opt, "--capture") == 0) {
+      cfg.capture = val;
+    } else if (strcmp(opt, "--capture-keys") == 0) {
+      cfg.captureKeys = val;
+    } else if (strcmp(opt, "--replay") == 0) {
+      cfg.replay = val;
+    } else {
+      return false;
+    }
+  }
+
+  return cfg.entries >= 0 && cfg.sirens >= 0 && cfg.entries + cfg.sirens > 0 &&
+         cfg.channels >= 1 && (cfg.sf == 0 || (cfg.sf >= 7 && cfg.sf <= 12)) &&
+         cfg.hub.demodulators >= 1 && cfg.seconds > 0 && cfg.otaNodes >= 0 &&
+         cfg.bulkBytes <= BULK_LEN_MAX && cfg.uploadBytes <= BULK_LEN_MAX &&
+         cfg.bootSpreadS >= 0;
+}
+
+int main(int argc, char** argv) {
+  SiteConfig cfg;
+  if (!parse(argc, argv, cfg)) {
+    fprintf(stderr, "usage: %s [--entries N] [--sirens N] [--seconds N] [--radius M]\n"
+                    "       [--channels N] [--sf N|auto] [--margin DB] [--exponent N]\n"
+                    "       [--shadowing DB] [--loss P] [--hub-paths N] [--hub-rate N]\n"
+                    "       [--boot-spread S] [--events N]\n"
+                    "       [--commands N] [--alarms N] [--multicast 0|1]\n"
+                    "       [--trigger 0|1] [--ota N] [--bulk BYTES] [--upload BYTES]\n"
+                    "       [--beacon MS] [--mains-loss S]\n"
+                    "       [--outage S] [--resync 0|1] [--seed N] [--capture FILE]\n"
+                    "       [--capture-keys FILE] [--replay FILE]\n", argv[0]);
+    return 2;
+  }
+
+  auto start = std::chrono::steady_clock::now();
+
+  Site site(cfg);
+  site.build();
+  site.run();
+
+  auto end = std::chrono::steady_clock::now();
+  site.report(std::chrono::duration<double>(end - start).count());
+  return 0;
+}
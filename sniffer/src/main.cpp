@@ -0,0 +1,105 @@
+// Radio sniffer: continuous receive on one channel and SF, every frame
+// out on the serial port as a capture record (NodeCapture.h).
+//
+// The receive interrupt copies the frame, its time and signal into a free
+// slot and loop() writes the slots out in order. At 38400 baud a long
+// frame takes longer to print than to send, so a burst can fill every
+// slot; what arrives then is counted and reported as CAPTURE_LOST.
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <LoRa.h>
+
+#include <NodeConfig.h>
+#include <NodeCapture.h>
+
+#ifndef SNIFFER_FREQ
+#define SNIFFER_FREQ FREQ
+#endif
+#ifndef SNIFFER_SF
+#define SNIFFER_SF 7
+#endif
+
+#define SNIFFER_SLOTS 3
+#define SNIFFER_BANDWIDTH 125000
+#define SNIFFER_CODING_RATE 5  // 4/5, the LoRa library default
+#define SNIFFER_PREAMBLE 8
+
+struct Slot {
+  uint32_t us;
+  int16_t rssi;
+  float snr;
+  uint8_t len;
+  uint8_t frame[255];
+};
+
+static Slot slots[SNIFFER_SLOTS];
+static volatile uint8_t head;
+static volatile uint8_t count;
+static volatile uint16_t lost;
+
+void onRx(int size) {
+  uint32_t us = micros();
+  if (count == SNIFFER_SLOTS) {
+    if (lost < 0xFFFF) lost++;
+    return;
+  }
+
+  Slot& s = slots[(head + count) % SNIFFER_SLOTS];
+  s.us = us;
+  s.len = 0;
+  uint8_t len = size > (int)sizeof(s.frame) ? sizeof(s.frame) : size;
+  while (s.len < len && LoRa.available()) s.frame[s.len++] = LoRa.read();
+  s.rssi = LoRa.packetRssi();
+  s.snr = LoRa.packetSnr();
+  count++;
+}
+
+void setup() {
+  Serial.begin(38400);
+  pinMode(LED_PIN, OUTPUT);
+
+  LoRa.setPins(RFM95_CS, RFM95_RST, RFM95_DIO0);
+  if (!LoRa.begin(SNIFFER_FREQ)) {
+    while (1) {
+      digitalWrite(LED_PIN, !digitalRead(LED_PIN));
+      delay(100);
+    }
+  }
+  LoRa.setSpreadingFactor(SNIFFER_SF);
+  LoRa.setSignalBandwidth(SNIFFER_BANDWIDTH);
+  LoRa.setCodingRate4(SNIFFER_CODING_RATE);
+  LoRa.setPreambleLength(SNIFFER_PREAMBLE);
+  LoRa.setSyncWord(SYNC_WORD);
+
+  captureSetup(Serial, SNIFFER_BANDWIDTH, SNIFFER_CODING_RATE, SNIFFER_PREAMBLE, SYNC_WORD);
+
+  LoRa.onReceive(onRx);
+  LoRa.receive();
+}
+
+void loop() {
+  if (lost) {
+    noInterrupts();
+    uint16_t n = lost;
+    lost = 0;
+    interrupts();
+    captureLost(Serial, n);
+  }
+
+  if (!count) {
+    delay(1);
+    return;
+  }
+
+  const Slot& s = slots[head];
+  digitalWrite(LED_PIN, HIGH);
+  captureFrame(Serial, s.us, (uint32_t)SNIFFER_FREQ, SNIFFER_SF, false, s.rssi, s.snr,
+               s.frame, s.len);
+  digitalWrite(LED_PIN, LOW);
+
+  noInterrupts();
+  head = (head + 1) % SNIFFER_SLOTS;
+  count--;
+  interrupts();
+}
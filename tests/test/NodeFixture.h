@@ -0,0 +1,95 @@
+#pragma once
+
+// Shared by the test programs that talk to a node through the hub engine:
+// one adopted node on hal::defaultBoard, a hub session for it, and every
+// frame it sends. Each test_* program includes this once.
+
+#include <NodeCore.h>
+#include <HubEngine.h>
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+static const uint8_t SERIAL_ID[16] = {
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x40, 0x75,
+  0xa0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01
+};
+
+static const uint8_t SESSION_KEY[16] = {
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+  0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f
+};
+
+static const uint8_t NONCE[8] = {0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A, 0x5A};
+
+// Records what reaches the device: the last command and bulk transfer,
+// and how many of each
+struct TestDevice {
+  std::string command;
+  unsigned commands = 0;
+  unsigned transfers = 0;
+  std::vector<uint8_t> last;
+
+  void begin() {}
+
+  template <class Node>
+  void poll(Node&) {}
+
+  template <class Node>
+  void handleCommand(Node&, const char* cmd) {
+    command = cmd;
+    commands++;
+  }
+
+  template <class Node>
+  void trigger(Node&, uint8_t) {}
+
+  template <class Node>
+  void bulk(Node&, uint8_t, const uint8_t* data, uint16_t len) {
+    transfers++;
+    last.assign(data, data + len);
+  }
+
+  bool rxWindows() const { return false; }
+
+  const char* telemetryState() const { return "test"; }
+};
+
+static NodeCore<TestDevice> node(SERIAL_ID);
+static TestDevice& device = node.device();
+static SessionTable sessions(4);
+static HubEngine engine(sessions);
+static HubSession* session;
+
+static std::vector<std::vector<uint8_t>> sent;
+
+static inline void capture(hal::Board&, const uint8_t* frame, uint8_t len) {
+  sent.emplace_back(frame, frame + len);
+}
+
+static inline void deliver(const uint8_t* frame, size_t len) {
+  hal::deliver(hal::defaultBoard, frame, len, -60, 9.5f);
+  node.loop();
+}
+
+// Boots the node adopted, with hubPub if given, and syncs its counters
+// with a hub challenge. False, after saying so, if the hub does not take
+// the answer.
+static inline bool bootSynced(const uint8_t* hubPub = nullptr) {
+  session = engine.addSession(SERIAL_ID, SESSION_KEY);
+  hal::provision(hal::defaultBoard, SESSION_KEY, hubPub);
+  hal::defaultBoard.radio.transmit = capture;
+  node.begin();
+
+  uint8_t frame[HUB_FRAME_MAX];
+  deliver(frame, engine.buildChallenge(*session, NONCE, frame));
+  HubEvent ev;
+  if (!node.isReady() || sent.empty() ||
+      engine.receive(sent.back().data(), sent.back().size(), ev) != HUB_OK) {
+    printf("node did not sync\n");
+    return false;
+  }
+  sent.clear();
+  return true;
+}
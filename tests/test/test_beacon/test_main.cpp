@@ -0,0 +1,108 @@
+// BeaconSync (NodeBeacon.h): beacons carry no MAC, so a forged one must
+// not lock a node, nor move a locked node to another period or phase.
+
+#include <NodeBeacon.h>
+#include <unity.h>
+
+#define PERIOD 2000
+
+// Locked at t = PERIOD by beacons 0 and 1
+static BeaconSync lockedSync() {
+  BeaconSync sync;
+  sync.onBeacon(0, PERIOD, 0);
+  sync.onBeacon(1, PERIOD, PERIOD);
+  return sync;
+}
+
+static void test_lock_takes_two_beacons() {
+  BeaconSync sync;
+  TEST_ASSERT_FALSE(sync.onBeacon(7, PERIOD, 1000));
+  TEST_ASSERT_FALSE(sync.locked());
+
+  TEST_ASSERT_TRUE(sync.onBeacon(8, PERIOD, 1000 + PERIOD + 30));
+  TEST_ASSERT_TRUE(sync.locked());
+  TEST_ASSERT_EQUAL_UINT16(PERIOD, sync.period());
+}
+
+static void test_lock_needs_agreeing_beacons() {
+  BeaconSync sync;
+  sync.onBeacon(7, PERIOD, 1000);
+  TEST_ASSERT_FALSE(sync.onBeacon(8, 4000, 1000 + PERIOD));   // Other period
+  TEST_ASSERT_FALSE(sync.onBeacon(9, 4000, 1000 + PERIOD + 500));  // Too early for 4000
+  TEST_ASSERT_FALSE(sync.onBeacon(12, 4000, 1000 + PERIOD + 4500));  // Sequence too far on
+  TEST_ASSERT_FALSE(sync.locked());
+
+  // Two periods on, one beacon missed in between
+  TEST_ASSERT_TRUE(sync.onBeacon(14, 4000, 1000 + PERIOD + 4500 + 8000));
+  TEST_ASSERT_TRUE(sync.locked());
+}
+
+static void test_locked_tracks_window() {
+  BeaconSync sync = lockedSync();
+  TEST_ASSERT_TRUE(sync.onBeacon(2, PERIOD, 2 * PERIOD + 10));
+  TEST_ASSERT_FALSE(sync.onBeacon(3, PERIOD, 2 * PERIOD + 10 + PERIOD / 2));  // Out of window
+}
+
+// A forger's beacons, even two that agree, move nothing: the first is out
+// of the window or the second is
+static void test_forged_period_ignored_while_locked() {
+  BeaconSync sync = lockedSync();
+  unsigned long start = sync.windowStart();
+
+  TEST_ASSERT_FALSE(sync.onBeacon(100, 65535, 2 * PERIOD));
+  TEST_ASSERT_FALSE(sync.onBeacon(101, 65535, 2 * PERIOD + 65535));
+  TEST_ASSERT_EQUAL_UINT16(PERIOD, sync.period());
+  TEST_ASSERT_EQUAL_UINT32(start, sync.windowStart());
+
+  // Out of window, same period, a sequence number far on
+  TEST_ASSERT_FALSE(sync.onBeacon(5000, PERIOD, 2 * PERIOD + 700));
+  TEST_ASSERT_EQUAL_UINT32(start, sync.windowStart());
+
+  // The hub's next beacon is still taken
+  TEST_ASSERT_TRUE(sync.onBeacon(2, PERIOD, 2 * PERIOD));
+}
+
+// A forged sequence number in the window costs nothing: periods are
+// counted by the window, so the hub's next beacon is still taken
+static void test_forged_sequence_in_window() {
+  BeaconSync sync = lockedSync();
+  TEST_ASSERT_TRUE(sync.onBeacon(40000, PERIOD, 2 * PERIOD));
+  TEST_ASSERT_TRUE(sync.onBeacon(3, PERIOD, 3 * PERIOD));
+  TEST_ASSERT_EQUAL_UINT16(PERIOD, sync.period());
+}
+
+// The hub's new period, confirmed within the windows, moves the lock
+static void test_period_change_confirmed_in_window() {
+  BeaconSync sync = lockedSync();
+  TEST_ASSERT_FALSE(sync.onBeacon(2, PERIOD / 2, 2 * PERIOD));
+  TEST_ASSERT_TRUE(sync.miss());  // The window closes with no beacon taken
+  TEST_ASSERT_TRUE(sync.onBeacon(4, PERIOD / 2, 3 * PERIOD));
+  TEST_ASSERT_EQUAL_UINT16(PERIOD / 2, sync.period());
+}
+
+// A lock lost to misses comes back on two of the hub's beacons
+static void test_relock_after_misses() {
+  BeaconSync sync = lockedSync();
+  for (int i = 0; i < BEACON_MISSED_MAX; i++) TEST_ASSERT_TRUE(sync.miss());
+  TEST_ASSERT_FALSE(sync.miss());
+
+  unsigned long now = 20 * PERIOD;
+  TEST_ASSERT_FALSE(sync.onBeacon(20, PERIOD, now));
+  TEST_ASSERT_TRUE(sync.onBeacon(21, PERIOD, now + PERIOD));
+  TEST_ASSERT_TRUE(sync.locked());
+}
+
+void setUp() {}
+void tearDown() {}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_lock_takes_two_beacons);
+  RUN_TEST(test_lock_needs_agreeing_beacons);
+  RUN_TEST(test_locked_tracks_window);
+  RUN_TEST(test_forged_period_ignored_while_locked);
+  RUN_TEST(test_forged_sequence_in_window);
+  RUN_TEST(test_period_change_confirmed_in_window);
+  RUN_TEST(test_relock_after_misses);
+  return UNITY_END();
+}
@@ -0,0 +1,100 @@
+// Bulk transfers into a node (NodeBulk.h, BulkTransfer): a whole transfer
+// from the hub, and what replayed polls may cost the node afterwards.
+
+#include <BulkTransfer.h>
+#include <unity.h>
+
+#include "../NodeFixture.h"
+
+// Node frames since the last call, through the hub. Bulk acks go to t.
+static size_t acks(BulkTransfer* t) {
+  size_t n = 0;
+  for (auto& f : sent) {
+    HubEvent ev;
+    if (engine.receive(f.data(), f.size(), ev) != HUB_OK || ev.type != MSG_BULK_ACK_UP) continue;
+    n++;
+    if (t) t->onAck(ev, millis());
+  }
+  sent.clear();
+  return n;
+}
+
+// Runs t to the end, every fragment delivered twice at once, and keeps
+// the last poll the hub sent
+static void transfer(BulkTransfer& t, std::vector<uint8_t>& poll) {
+  uint8_t frame[HUB_FRAME_MAX];
+  for (int i = 0; i < 1000 && !t.finished(); i++) {
+    size_t len = t.poll(millis(), frame);
+    if (len) {
+      if (frame[0] == MSG_BULK_FRAGMENT && BulkFragmentFrame<const uint8_t>(frame, len).poll()) {
+        poll.assign(frame, frame + len);
+      }
+      deliver(frame, len);
+      if (frame[0] == MSG_BULK_FRAGMENT) deliver(frame, len);
+    }
+    acks(&t);
+    delay(10);
+  }
+}
+
+void setUp() {}
+void tearDown() {}
+
+static std::vector<uint8_t> firstPoll;
+
+// More fragments at once than the guard's burst, each checked twice: an
+// authenticated burst costs the guard nothing
+void test_transfer_arrives_whole() {
+  std::vector<uint8_t> data(200);
+  for (size_t i = 0; i < data.size(); i++) data[i] = i * 7;
+
+  BulkTransfer t(engine, *session, BULK_CONFIG, data.data(), data.size(), NONCE, millis(),
+                 BULK_RETRY_MS);
+  transfer(t, firstPoll);
+  TEST_ASSERT_EQUAL(BULK_DONE, t.result());
+  TEST_ASSERT_EQUAL_UINT(1, device.transfers);
+  TEST_ASSERT_TRUE(device.last == data);
+  TEST_ASSERT_FALSE(firstPoll.empty());
+
+  // A command right after still gets through
+  uint8_t frame[HUB_FRAME_MAX];
+  deliver(frame, engine.buildCommand(*session, "siren;true", 10, NONCE, frame));
+  TEST_ASSERT_EQUAL_UINT(1, device.commands);
+}
+
+// The hub missed the BULK_DONE and polls again
+void test_poll_of_the_finished_transfer_is_answered() {
+  acks(nullptr);
+  for (int i = 0; i < 3; i++) deliver(firstPoll.data(), firstPoll.size());
+  TEST_ASSERT_EQUAL(3, acks(nullptr));
+}
+
+// Once another transfer has been handed over, the first one's poll is
+// answered BULK_UNKNOWN once and then costs nothing
+void test_replayed_old_poll_answered_once() {
+  std::vector<uint8_t> data(40, 0x33), poll;
+  BulkTransfer t(engine, *session, BULK_CONFIG, data.data(), data.size(), NONCE, millis(),
+                 BULK_RETRY_MS);
+  transfer(t, poll);
+  TEST_ASSERT_EQUAL(BULK_DONE, t.result());
+  acks(nullptr);
+
+  deliver(firstPoll.data(), firstPoll.size());
+  TEST_ASSERT_EQUAL(1, sent.size());
+  BulkAckFrame<const uint8_t> ack(sent[0].data());
+  TEST_ASSERT_EQUAL(BULK_UNKNOWN, ack.state());
+  acks(nullptr);
+
+  for (int i = 0; i < 100; i++) deliver(firstPoll.data(), firstPoll.size());
+  TEST_ASSERT_EQUAL(0, acks(nullptr));
+}
+
+int main() {
+  if (!bootSynced()) return 1;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_transfer_arrives_whole);
+  RUN_TEST(test_poll_of_the_finished_transfer_is_answered);
+  RUN_TEST(test_replayed_old_poll_answered_once);
+  return UNITY_END();
+}
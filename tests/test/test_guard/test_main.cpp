@@ -0,0 +1,227 @@
+// RxGuard (NodeGuard.h) and what it leaves a node under a forged flood:
+// frames that pass every check before the MAC but fail it, at a rate
+// above the guard's, are dropped before the MAC, and the hub's own frames
+// still get through.
+
+#include <unity.h>
+
+#include "../NodeFixture.h"
+
+static uint8_t hubPub[WIRE_PUBKEY_LEN];
+static uint8_t hubPriv[21];
+
+// A MSG_COMMAND for the node with a counter far past the hub's and a
+// random MAC: fresh, so it reaches the MAC, and fails it
+static void forge() {
+  uint8_t frame[WIRE_SECURE_MIN_LEN];
+  for (uint8_t& b : frame) b = random(256);
+  frame[0] = MSG_COMMAND;
+  memcpy(frame + WIRE_ID, SERIAL_ID, WIRE_ID_LEN);
+  frame[WIRE_SECURE_COUNTER + 3] |= 0x80;
+  frame[WIRE_SECURE_ORIG_LEN] = 10;
+  deliver(frame, sizeof(frame));
+}
+
+static void command() {
+  uint8_t frame[HUB_FRAME_MAX];
+  deliver(frame, engine.buildCommand(*session, "siren;true", 10, NONCE, frame));
+}
+
+// Everything the node sent since the last call, through the hub
+static bool lastDiag(HubDiag& diag) {
+  bool found = false;
+  for (auto& f : sent) {
+    HubEvent ev;
+    if (engine.receive(f.data(), f.size(), ev) == HUB_OK && ev.type == MSG_DIAG) {
+      found = decodeDiag(ev.diag, diag);
+    }
+  }
+  sent.clear();
+  return found;
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_source_limited_past_its_burst() {
+  RxGuard guard;
+  for (int i = 0; i < GUARD_BURST; i++) TEST_ASSERT_EQUAL(GUARD_OK, guard.admit(GUARD_NODE, 1000));
+  TEST_ASSERT_EQUAL(GUARD_RATE, guard.admit(GUARD_NODE, 1000));
+
+  // Sources are counted apart
+  TEST_ASSERT_EQUAL(GUARD_OK, guard.admit(GUARD_GROUP, 1000));
+
+  TEST_ASSERT_EQUAL(GUARD_RATE, guard.admit(GUARD_NODE, 1000 + GUARD_RATE_MS - 1));
+  TEST_ASSERT_EQUAL(GUARD_OK, guard.admit(GUARD_NODE, 1000 + GUARD_RATE_MS));
+  TEST_ASSERT_EQUAL(GUARD_RATE, guard.admit(GUARD_NODE, 1000 + GUARD_RATE_MS));
+}
+
+// A check that holds gives its source the whole burst back
+void test_passed_check_refills_the_source() {
+  RxGuard guard;
+  for (int i = 0; i < GUARD_BURST; i++) guard.admit(GUARD_NODE, 1000);
+  guard.passed(GUARD_NODE, 1000);
+  for (int i = 0; i < GUARD_BURST; i++) TEST_ASSERT_EQUAL(GUARD_OK, guard.admit(GUARD_NODE, 1000));
+  TEST_ASSERT_EQUAL(GUARD_RATE, guard.admit(GUARD_NODE, 1000));
+}
+
+// Failed checks of any source spend the one budget, until the next window
+void test_failed_checks_spend_the_budget() {
+  RxGuard guard;
+  TEST_ASSERT_EQUAL(GUARD_OK, guard.admit(GUARD_NODE, 0));
+  guard.failed(GUARD_CPU_US);
+  TEST_ASSERT_EQUAL(GUARD_BUDGET, guard.admit(GUARD_GROUP, 0));
+  TEST_ASSERT_EQUAL(GUARD_BUDGET, guard.admit(GUARD_NODE, GUARD_WINDOW_MS - 1));
+  TEST_ASSERT_EQUAL(GUARD_OK, guard.admit(GUARD_GROUP, GUARD_WINDOW_MS));
+}
+
+void test_signature_check_refunded_when_it_holds() {
+  RxGuard guard;
+  TEST_ASSERT_TRUE(guard.admitSignature(0));
+  TEST_ASSERT_FALSE(guard.admitSignature(0));
+
+  guard.signatureHeld();
+  TEST_ASSERT_TRUE(guard.admitSignature(0));
+  TEST_ASSERT_FALSE(guard.admitSignature(GUARD_BROADCAST_RATE_MS - 1));
+  TEST_ASSERT_TRUE(guard.admitSignature(GUARD_BROADCAST_RATE_MS));
+}
+
+// A challenge earns GUARD_SOLICITED checks for GUARD_SOLICIT_MS
+void test_challenge_solicits_signature_checks() {
+  RxGuard guard;
+  TEST_ASSERT_TRUE(guard.admitSignature(1000));
+
+  guard.solicit(2000);
+  for (int i = 0; i < GUARD_SOLICITED; i++) TEST_ASSERT_TRUE(guard.admitSignature(2000));
+  TEST_ASSERT_FALSE(guard.admitSignature(2000));
+
+  guard.solicit(3000);
+  TEST_ASSERT_FALSE(guard.admitSignature(3000 + GUARD_SOLICIT_MS));
+}
+
+void test_skipped_signatures_confirmed_once_a_period() {
+  RxGuard guard;
+  TEST_ASSERT_TRUE(guard.confirm(0));
+  TEST_ASSERT_FALSE(guard.confirm(GUARD_CONFIRM_MS - 1));
+  TEST_ASSERT_TRUE(guard.confirm(GUARD_CONFIRM_MS));
+}
+
+// Four forged frames a second, twice the guard's rate, for a minute, with
+// a real command after every tenth. Each command refills the burst; when
+// the forgeries between two commands have used it up, the command is
+// dropped before its MAC and the hub's retry a rate period later is
+// taken. The node takes every command, the forgeries only delay some.
+void test_commands_get_through_a_forged_flood() {
+  unsigned before = device.commands;
+  unsigned retries = 0;
+  for (int i = 1; i <= 240; i++) {
+    forge();
+    if (i % 10 == 0) {
+      uint8_t frame[HUB_FRAME_MAX];
+      size_t len = engine.buildCommand(*session, "siren;true", 10, NONCE, frame);
+      unsigned taken = device.commands;
+      deliver(frame, len);
+      if (device.commands == taken) {
+        retries++;
+        delay(GUARD_RATE_MS);
+        deliver(frame, len);
+      }
+    }
+    delay(250);
+  }
+  TEST_ASSERT_EQUAL_UINT(24, device.commands - before);
+  TEST_ASSERT_LESS_THAN(24, retries);
+}
+
+void test_flood_reported_in_diag() {
+  // A report for the tests before, which also gives the burst back
+  HubDiag diag;
+  delay(DIAG_INTERVAL);
+  node.loop();
+  lastDiag(diag);
+
+  for (int i = 0; i < 20; i++) forge();
+
+  delay(DIAG_INTERVAL);
+  node.loop();
+
+  TEST_ASSERT_TRUE(lastDiag(diag));
+  TEST_ASSERT_EQUAL_UINT16(GUARD_BURST, diag.stats[DIAG_RX_BAD_HMAC]);
+  TEST_ASSERT_EQUAL_UINT16(20 - GUARD_BURST, diag.stats[DIAG_RX_RATE_LIMITED]);
+}
+
+// The hub's command right after a burst of forgeries is dropped before
+// its MAC; the hub's retry a rate period later gets through
+void test_command_after_a_burst_gets_through_on_retry() {
+  delay(GUARD_BURST * GUARD_RATE_MS);
+  for (int i = 0; i < GUARD_BURST; i++) forge();
+
+  unsigned before = device.commands;
+  uint8_t frame[HUB_FRAME_MAX];
+  size_t len = engine.buildCommand(*session, "siren;true", 10, NONCE, frame);
+  deliver(frame, len);
+  TEST_ASSERT_EQUAL_UINT(0, device.commands - before);
+
+  delay(GUARD_RATE_MS);
+  deliver(frame, len);
+  TEST_ASSERT_EQUAL_UINT(1, device.commands - before);
+}
+
+// A hub challenge the hub has since moved past would take the node's
+// window back to it: it is dropped before its MAC, and not answered
+void test_old_hub_challenge_dropped() {
+  uint8_t challenge[HUB_FRAME_MAX];
+  size_t len = engine.buildChallenge(*session, NONCE, challenge);
+  command();
+
+  sent.clear();
+  deliver(challenge, len);
+  TEST_ASSERT_EQUAL(0, sent.size());
+}
+
+// One forged MSG_RESYNC takes the signature check; the hub's own, right
+// after it, is skipped, but the node challenges and the hub's next copy
+// is checked on the credit the challenge earned
+void test_resync_gets_through_after_a_forged_one() {
+  uint8_t forged[WIRE_RESYNC_LEN];
+  size_t len = engine.buildResync(1, hubPriv, forged);
+  TEST_ASSERT_EQUAL(WIRE_RESYNC_LEN, len);
+  forged[WIRE_RESYNC_SIGNATURE] ^= 1;
+  deliver(forged, len);
+
+  uint8_t resync[WIRE_RESYNC_LEN];
+  engine.buildResync(1, hubPriv, resync);
+  sent.clear();
+  deliver(resync, len);
+  node.loop();
+  size_t challenges = 0;
+  for (auto& f : sent) challenges += f[0] == MSG_CHALLENGE;
+  TEST_ASSERT_EQUAL(1, challenges);
+
+  deliver(resync, len);
+  engine.resync(*session, SESSION_KEY, 1);
+  unsigned before = device.commands;
+  command();
+  TEST_ASSERT_EQUAL_UINT(1, device.commands - before);
+}
+
+int main() {
+  uECC_set_rng(&getRng);
+  uECC_make_key(hubPub, hubPriv, uECC_secp160r1());
+
+  if (!bootSynced(hubPub)) return 1;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_source_limited_past_its_burst);
+  RUN_TEST(test_passed_check_refills_the_source);
+  RUN_TEST(test_failed_checks_spend_the_budget);
+  RUN_TEST(test_signature_check_refunded_when_it_holds);
+  RUN_TEST(test_challenge_solicits_signature_checks);
+  RUN_TEST(test_skipped_signatures_confirmed_once_a_period);
+  RUN_TEST(test_commands_get_through_a_forged_flood);
+  RUN_TEST(test_flood_reported_in_diag);
+  RUN_TEST(test_command_after_a_burst_gets_through_on_retry);
+  RUN_TEST(test_old_hub_challenge_dropped);
+  RUN_TEST(test_resync_gets_through_after_a_forged_one);
+  return UNITY_END();
+}
@@ -0,0 +1,282 @@
+// Host HAL (lib/NodeHal): the virtual clock, the radio and the storage
+// the native firmware, the benchmarks and the simulator all run on.
+
+#include <unity.h>
+
+#include "../NodeFixture.h"
+
+static hal::Board* board;
+static uint64_t sentAtUs;
+
+static void captureAt(hal::Board& b, const uint8_t* frame, uint8_t len) {
+  capture(b, frame, len);
+  sentAtUs = b.clockUs;
+}
+
+static int received;
+
+static void onReceive(int size) { received = size; }
+
+void setUp() {
+  board = new hal::Board();
+  hal::board = board;
+  board->radio.transmit = captureAt;
+  sent.clear();
+  received = 0;
+}
+
+void tearDown() {
+  hal::board = &hal::defaultBoard;
+  delete board;
+}
+
+// Semtech's LoRa calculator, 125 kHz, 4/5, 8 symbol preamble, explicit
+// header and CRC on
+void test_airtime_matches_the_lora_formula() {
+  TEST_ASSERT_EQUAL_UINT32(41216, hal::airtimeUs(10, 7, 125000, 5, 8));
+  TEST_ASSERT_EQUAL_UINT32(123136, hal::airtimeUs(65, 7, 125000, 5, 8));
+  // Low data rate optimization from 16 ms symbols on
+  TEST_ASSERT_EQUAL_UINT32(991232, hal::airtimeUs(10, 12, 125000, 5, 8));
+}
+
+void test_delay_moves_the_board_clock() {
+  unsigned long before = millis();
+  delay(250);
+  TEST_ASSERT_EQUAL_UINT32(before + 250, millis());
+  TEST_ASSERT_EQUAL_UINT32(250000, micros());
+  TEST_ASSERT_EQUAL_UINT32(0, hal::defaultBoard.clockUs);
+}
+
+// The sleep timer runs fast or slow, millis() only hears what was asked for
+void test_sleep_timer_error_only_moves_the_real_clock() {
+  board->sleepPpm = 50000;
+  halSleep(1000);
+  TEST_ASSERT_EQUAL_UINT32(1000, millis());
+  TEST_ASSERT_EQUAL_UINT32(1050000, board->clockUs);
+  TEST_ASSERT_EQUAL_UINT32(1050000, board->sleptUs);
+}
+
+void test_sleep_hook_takes_over_the_clock() {
+  static uint64_t asked;
+  board->sleep = [](hal::Board& b, uint64_t untilUs) {
+    asked = untilUs;
+    b.clockUs = untilUs;
+  };
+  delay(5);
+  TEST_ASSERT_EQUAL_UINT32(5000, asked);
+}
+
+void test_end_packet_sends_and_takes_its_airtime() {
+  LoRa.begin(FREQ);
+  LoRa.beginPacket();
+  uint8_t frame[10] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+  LoRa.write(frame, sizeof(frame));
+  LoRa.endPacket();
+
+  TEST_ASSERT_EQUAL(1, sent.size());
+  TEST_ASSERT_EQUAL(10, sent[0].size());
+  TEST_ASSERT_EQUAL_MEMORY(frame, sent[0].data(), 10);
+  TEST_ASSERT_EQUAL_UINT32(0, sentAtUs);
+  TEST_ASSERT_EQUAL_UINT32(41216, board->clockUs);
+  TEST_ASSERT_EQUAL_UINT32(41216, board->radio.modeUs[hal::RADIO_TX]);
+  TEST_ASSERT_EQUAL(hal::RADIO_STANDBY, board->radio.mode);
+}
+
+void test_frames_only_arrive_while_receiving() {
+  uint8_t frame[3] = {0xaa, 0xbb, 0xcc};
+  LoRa.begin(FREQ);
+  LoRa.onReceive(onReceive);
+  TEST_ASSERT_FALSE(hal::deliver(*board, frame, 3, -80, 7.0f));
+  TEST_ASSERT_EQUAL_INT(0, received);
+
+  LoRa.receive();
+  TEST_ASSERT_TRUE(hal::deliver(*board, frame, 3, -80, 7.0f));
+  TEST_ASSERT_EQUAL_INT(3, received);
+  TEST_ASSERT_EQUAL_INT(-80, LoRa.packetRssi());
+  TEST_ASSERT_EQUAL_INT(3, LoRa.available());
+  TEST_ASSERT_EQUAL_INT(0xaa, LoRa.peek());
+  TEST_ASSERT_EQUAL_INT(0xaa, LoRa.read());
+  TEST_ASSERT_EQUAL_INT(0xbb, LoRa.read());
+  TEST_ASSERT_EQUAL_INT(0xcc, LoRa.read());
+  TEST_ASSERT_EQUAL_INT(-1, LoRa.read());
+
+  LoRa.sleep();
+  TEST_ASSERT_FALSE(hal::deliver(*board, frame, 3, -80, 7.0f));
+}
+
+// deliver() runs the callback on the board it delivers to
+void test_deliver_switches_to_the_receiving_board() {
+  static hal::Board* during;
+  hal::Board other;
+  other.radio.mode = hal::RADIO_RX;
+  other.radio.onReceive = [](int) { during = hal::board; };
+
+  uint8_t frame[1] = {0};
+  TEST_ASSERT_TRUE(hal::deliver(other, frame, 1, -80, 7.0f));
+  TEST_ASSERT_EQUAL(&other, during);
+  TEST_ASSERT_EQUAL(board, hal::board);
+}
+
+void test_eeprom_starts_erased() {
+  TEST_ASSERT_EQUAL_HEX8(0xFF, EEPROM.read(0));
+  EEPROM.write(7, 0x42);
+  TEST_ASSERT_EQUAL_HEX8(0x42, board->eeprom[7]);
+
+  uint32_t v = 0x01020304, back = 0;
+  EEPROM.put(100, v);
+  EEPROM.get(100, back);
+  TEST_ASSERT_EQUAL_UINT32(v, back);
+}
+
+// NOR flash: programming only clears bits, erase sets a whole sector
+void test_spi_flash_behaves_like_nor() {
+  static uint8_t flash[HAL_SPI_FLASH_SIZE];
+  memset(flash, 0xFF, sizeof(flash));
+  board->spiFlash = flash;
+  TEST_ASSERT_TRUE(halFlashPresent());
+
+  uint8_t a = 0xF0, b = 0x3C, out;
+  halFlashProgram(OTA_SECTOR + 5, &a, 1);
+  halFlashProgram(OTA_SECTOR + 5, &b, 1);
+  halFlashRead(OTA_SECTOR + 5, &out, 1);
+  TEST_ASSERT_EQUAL_HEX8(0x30, out);
+
+  halFlashErase(OTA_SECTOR + 100);
+  halFlashRead(OTA_SECTOR + 5, &out, 1);
+  TEST_ASSERT_EQUAL_HEX8(0xFF, out);
+}
+
+// A backup that fails its CRC after every copy is copied OTA_RESTORE_TRIES
+// times, then started as it is and reported rolled back
+void test_bootloader_gives_up_on_a_bad_backup() {
+  static uint8_t flash[HAL_SPI_FLASH_SIZE];
+  static hal::Board b;
+  memset(flash, 0xFF, sizeof(flash));
+  b.spiFlash = flash;
+  for (uint16_t i = 0; i < 256; i++) flash[OTA_BACKUP_ADDR + i] = i;
+
+  OtaRecord r;
+  memset(&r, 0xFF, sizeof(r));
+  r.state = OTA_BOOT_RESTORING;
+  r.tries = 0;
+  r.backupLen = 256;
+  r.backupCrc = 0;  // Not the CRC of anything here
+  memcpy(b.eeprom + OTA_RECORD_ADDR, &r, sizeof(r));
+
+  hal::bootloader(b);
+
+  memcpy(&r, b.eeprom + OTA_RECORD_ADDR, sizeof(r));
+  TEST_ASSERT_EQUAL_UINT8(OTA_BOOT_ROLLED_BACK, r.state);
+  TEST_ASSERT_EQUAL_UINT8(OTA_RESTORE_TRIES, r.tries);
+  TEST_ASSERT_EQUAL_MEMORY(flash + OTA_BACKUP_ADDR, b.flash, 256);
+  TEST_ASSERT_EQUAL_UINT16(256, b.imageLen);
+}
+
+// A battery sample takes a receiving radio out of RX for the conversions
+// only, and leaves a sleeping one asleep
+void test_battery_sample_keeps_the_radio_mode() {
+  NodeRadio radio;
+  BatteryMonitor battery;
+  LoRa.begin(FREQ);
+  radio.begin();
+
+  radio.sleep();
+  battery.sample(radio);
+  TEST_ASSERT_EQUAL(hal::RADIO_SLEEP, board->radio.mode);
+  TEST_ASSERT_TRUE(battery.hasSample());
+
+  radio.receive();
+  battery.sample(radio);
+  TEST_ASSERT_EQUAL(hal::RADIO_RX, board->radio.mode);
+}
+
+// A provisioned node boots into counter sync: one MSG_CHALLENGE within
+// BOOT_SPREAD, under its serial ID
+void test_provisioned_node_boots_into_a_challenge() {
+  static NodeCore<TestDevice> fresh(SERIAL_ID);
+  hal::provision(*board, SESSION_KEY);
+  fresh.begin();
+  TEST_ASSERT_FALSE(fresh.isReady());
+
+  for (int i = 0; i < BOOT_SPREAD / 10 + 10 && sent.empty(); i++) {
+    fresh.loop();
+    delay(10);
+  }
+  TEST_ASSERT_EQUAL(1, sent.size());
+  TEST_ASSERT_EQUAL_HEX8(MSG_CHALLENGE, sent[0][0]);
+  TEST_ASSERT_EQUAL(WIRE_CHALLENGE_LEN, sent[0].size());
+  TEST_ASSERT_EQUAL_MEMORY(SERIAL_ID, sent[0].data() + WIRE_ID, WIRE_ID_LEN);
+}
+
+// The round trips below run on the fixture's node on hal::defaultBoard,
+// booted and synced by the first of them
+static void useSyncedNode() {
+  hal::board = &hal::defaultBoard;
+  if (!session) TEST_ASSERT_TRUE(bootSynced());
+}
+
+// A MAC the node computes is one it verifies, and one bit off it is not
+void test_hmac_round_trip() {
+  static ScratchArena arena;
+  uint8_t data[HUB_FRAME_MAX], mac[32];
+  for (size_t i = 0; i < sizeof(data); i++) data[i] = i * 13 + 1;
+
+  computeHMAC(arena, SESSION_KEY, 16, data, sizeof(data), mac);
+  TEST_ASSERT_TRUE(verifyHMAC(arena, SESSION_KEY, 16, data, sizeof(data), mac));
+  data[sizeof(data) / 2] ^= 1;
+  TEST_ASSERT_FALSE(verifyHMAC(arena, SESSION_KEY, 16, data, sizeof(data), mac));
+}
+
+// sendData() puts one MSG_DATA on air that the hub decrypts
+void test_send_data_round_trip() {
+  useSyncedNode();
+  node.sendData("state;armed");
+
+  TEST_ASSERT_EQUAL(1, sent.size());
+  HubEvent ev;
+  TEST_ASSERT_EQUAL(HUB_OK, engine.receive(sent[0].data(), sent[0].size(), ev));
+  TEST_ASSERT_EQUAL_HEX8(MSG_DATA, ev.type);
+  TEST_ASSERT_EQUAL_STRING("state;armed", ev.text);
+}
+
+// A hub command reaches handleCommand() once, and the answer queued
+// from there reaches the hub
+void test_command_round_trip() {
+  useSyncedNode();
+  const char* cmd = "siren;true";
+  uint8_t frame[HUB_FRAME_MAX];
+  size_t len = engine.buildCommand(*session, cmd, strlen(cmd), NONCE, frame);
+  unsigned before = device.commands;
+  deliver(frame, len);
+  deliver(frame, len);
+  TEST_ASSERT_EQUAL_UINT(1, device.commands - before);
+  TEST_ASSERT_EQUAL_STRING(cmd, device.command.c_str());
+
+  sent.clear();
+  node.queueResponse("siren;true");
+  node.loop();
+  TEST_ASSERT_EQUAL(1, sent.size());
+  HubEvent ev;
+  TEST_ASSERT_EQUAL(HUB_OK, engine.receive(sent[0].data(), sent[0].size(), ev));
+  TEST_ASSERT_EQUAL_STRING("siren;true", ev.text);
+}
+
+int main() {
+  UNITY_BEGIN();
+  RUN_TEST(test_airtime_matches_the_lora_formula);
+  RUN_TEST(test_delay_moves_the_board_clock);
+  RUN_TEST(test_sleep_timer_error_only_moves_the_real_clock);
+  RUN_TEST(test_sleep_hook_takes_over_the_clock);
+  RUN_TEST(test_end_packet_sends_and_takes_its_airtime);
+  RUN_TEST(test_frames_only_arrive_while_receiving);
+  RUN_TEST(test_deliver_switches_to_the_receiving_board);
+  RUN_TEST(test_eeprom_starts_erased);
+  RUN_TEST(test_spi_flash_behaves_like_nor);
+  RUN_TEST(test_bootloader_gives_up_on_a_bad_backup);
+  RUN_TEST(test_battery_sample_keeps_the_radio_mode);
+  RUN_TEST(test_provisioned_node_boots_into_a_challenge);
+  RUN_TEST(test_hmac_round_trip);
+  RUN_TEST(test_send_data_round_trip);
+  RUN_TEST(test_command_round_trip);
+  return UNITY_END();
+}
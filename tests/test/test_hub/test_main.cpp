@@ -0,0 +1,188 @@
+// The hub engine against references: HMAC-SHA256 in every batch
+// implementation against RFC 4231 and the node's own HMAC, AES-128
+// against FIPS-197, and frames both ways between HubEngine and NodeCore.
+
+#include <unity.h>
+
+#include <array>
+
+#include "../NodeFixture.h"
+
+static ScratchArena arena;
+
+static std::vector<uint8_t> unhex(const char* hex) {
+  std::vector<uint8_t> out;
+  for (; hex[0] && hex[1]; hex += 2) {
+    char byte[3] = {hex[0], hex[1], 0};
+    out.push_back(strtoul(byte, nullptr, 16));
+  }
+  return out;
+}
+
+// RFC 4231 test cases 1 to 4 and 6 (case 5 truncates the MAC)
+struct HmacVector {
+  std::vector<uint8_t> key;
+  std::vector<uint8_t> data;
+  std::vector<uint8_t> mac;
+};
+
+static std::vector<HmacVector> rfc4231() {
+  std::vector<uint8_t> key4;
+  for (uint8_t i = 1; i <= 25; i++) key4.push_back(i);
+  const char* data6 = "Test Using Larger Than Block-Size Key - Hash Key First";
+
+  return {
+    {std::vector<uint8_t>(20, 0x0b), {'H', 'i', ' ', 'T', 'h', 'e', 'r', 'e'},
+     unhex("b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7")},
+    {{'J', 'e', 'f', 'e'},
+     std::vector<uint8_t>((const uint8_t*)"what do ya want for nothing?",
+                          (const uint8_t*)"what do ya want for nothing?" + 28),
+     unhex("5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843")},
+    {std::vector<uint8_t>(20, 0xaa), std::vector<uint8_t>(50, 0xdd),
+     unhex("773ea91e36800e46854db8ebd09181a72959098b3ef8c122d9635514ced565fe")},
+    {key4, std::vector<uint8_t>(50, 0xcd),
+     unhex("82558a389a443c0ea4cc819899f2083a85f0faa3e578f8077a2e3ff46729665b")},
+    {std::vector<uint8_t>(131, 0xaa),
+     std::vector<uint8_t>((const uint8_t*)data6, (const uint8_t*)data6 + strlen(data6)),
+     unhex("60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54")},
+  };
+}
+
+void setUp() {}
+void tearDown() {}
+
+void test_node_hmac_matches_rfc4231() {
+  for (const HmacVector& v : rfc4231()) {
+    uint8_t mac[32];
+    computeHMAC(arena, v.key.data(), v.key.size(), v.data.data(), v.data.size(), mac);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(v.mac.data(), mac, 32);
+    TEST_ASSERT_TRUE(verifyHMAC(arena, v.key.data(), v.key.size(), v.data.data(),
+                                v.data.size(), v.mac.data()));
+  }
+}
+
+// Batch jobs take keys of at most 64 bytes, which leaves out case 6
+void test_batch_matches_rfc4231_in_every_impl() {
+  std::vector<HmacVector> vectors = rfc4231();
+  vectors.pop_back();
+
+  std::vector<HmacJob> jobs;
+  for (const HmacVector& v : vectors) {
+    jobs.push_back({v.key.data(), v.key.size(), v.data.data(), v.data.size(), v.mac.data()});
+  }
+
+  for (int impl = HMAC_SCALAR; impl <= hmacBestImpl(); impl++) {
+    uint8_t out[8][32];
+    hmacBatch(jobs.data(), jobs.size(), out, (HmacImpl)impl);
+    for (size_t i = 0; i < jobs.size(); i++) {
+      TEST_ASSERT_EQUAL_HEX8_ARRAY_MESSAGE(vectors[i].mac.data(), out[i], 32,
+                                           hmacImplName((HmacImpl)impl));
+    }
+
+    bool ok[8];
+    TEST_ASSERT_EQUAL(jobs.size(), verifyHmacBatch(jobs.data(), jobs.size(), ok, (HmacImpl)impl));
+  }
+}
+
+// Every frame length the radio carries, against the node's HMAC, with
+// one MAC in five wrong
+void test_batch_matches_node_hmac_for_every_length() {
+  std::vector<uint8_t> data(HUB_FRAME_MAX);
+  for (size_t i = 0; i < data.size(); i++) data[i] = i * 7 + 3;
+
+  std::vector<HmacJob> jobs;
+  std::vector<std::array<uint8_t, 32>> macs(HUB_FRAME_MAX + 1);
+  for (size_t len = 0; len <= HUB_FRAME_MAX; len++) {
+    computeHMAC(arena, SESSION_KEY, 16, data.data(), len, macs[len].data());
+    if (len % 5 == 0) macs[len][len % 32] ^= 1;
+    jobs.push_back({SESSION_KEY, 16, data.data(), len, macs[len].data()});
+  }
+
+  for (int impl = HMAC_SCALAR; impl <= hmacBestImpl(); impl++) {
+    std::vector<std::array<uint8_t, 32>> out(jobs.size());
+    hmacBatch(jobs.data(), jobs.size(), (uint8_t(*)[32])out.data(), (HmacImpl)impl);
+
+    bool ok[HUB_FRAME_MAX + 1];
+    size_t verified = verifyHmacBatch(jobs.data(), jobs.size(), ok, (HmacImpl)impl);
+    TEST_ASSERT_EQUAL_MESSAGE(jobs.size() - (HUB_FRAME_MAX / 5 + 1), verified,
+                              hmacImplName((HmacImpl)impl));
+    for (size_t len = 0; len <= HUB_FRAME_MAX; len++) {
+      TEST_ASSERT_EQUAL(len % 5 != 0, ok[len]);
+      TEST_ASSERT_EQUAL(len % 5 != 0, out[len] == macs[len]);
+    }
+  }
+}
+
+// FIPS-197 appendix C.1
+void test_aes128_matches_fips197() {
+  std::vector<uint8_t> plain = unhex("00112233445566778899aabbccddeeff");
+  std::vector<uint8_t> cipher = unhex("69c4e0d86a7b0430d8cdb78070b4c55a");
+
+  AES128 aes;
+  aes.setKey(SESSION_KEY, 16);
+  uint8_t out[16];
+  aes.encryptBlock(out, plain.data());
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(cipher.data(), out, 16);
+  aes.decryptBlock(out, cipher.data());
+  TEST_ASSERT_EQUAL_HEX8_ARRAY(plain.data(), out, 16);
+}
+
+void test_command_decrypted_by_node() {
+  const char* cmd = "siren;true;with a text longer than one block";
+  uint8_t frame[HUB_FRAME_MAX];
+  deliver(frame, engine.buildCommand(*session, cmd, strlen(cmd), NONCE, frame));
+  TEST_ASSERT_EQUAL_STRING(cmd, device.command.c_str());
+
+  // The same frame again is a replay
+  size_t len = engine.buildCommand(*session, "siren;false", 11, NONCE, frame);
+  deliver(frame, len);
+  TEST_ASSERT_EQUAL_STRING("siren;false", device.command.c_str());
+  device.command.clear();
+  deliver(frame, len);
+  TEST_ASSERT_EQUAL_STRING("", device.command.c_str());
+}
+
+// Node data through receive() and receiveBatch() alike, and replays of it
+void test_node_data_decrypted_by_hub() {
+  sent.clear();
+  node.queueResponse("state;armed");
+  node.loop();
+  node.queueResponse("state;disarmed");
+  node.loop();
+  TEST_ASSERT_EQUAL(2, sent.size());
+
+  HubEvent ev;
+  TEST_ASSERT_EQUAL(HUB_OK, engine.receive(sent[0].data(), sent[0].size(), ev));
+  TEST_ASSERT_EQUAL_HEX8(MSG_DATA, ev.type);
+  TEST_ASSERT_EQUAL_STRING("state;armed", ev.text);
+  TEST_ASSERT_EQUAL(HUB_REPLAY, engine.receive(sent[0].data(), sent[0].size(), ev));
+
+  // The second frame, its replay and the first one's, in one batch
+  const uint8_t* frames[3] = {sent[1].data(), sent[1].data(), sent[0].data()};
+  size_t lens[3] = {sent[1].size(), sent[1].size(), sent[0].size()};
+  HubEvent events[3];
+  HubStatus status[3];
+  engine.receiveBatch(frames, lens, 3, events, status);
+  TEST_ASSERT_EQUAL(HUB_OK, status[0]);
+  TEST_ASSERT_EQUAL_STRING("state;disarmed", events[0].text);
+  TEST_ASSERT_EQUAL(HUB_REPLAY, status[1]);
+  TEST_ASSERT_EQUAL(HUB_REPLAY, status[2]);
+
+  // One bit off anywhere under the MAC
+  std::vector<uint8_t> forged = sent[1];
+  forged[WIRE_SECURE_HEADER_LEN] ^= 1;
+  TEST_ASSERT_EQUAL(HUB_BAD_HMAC, engine.receive(forged.data(), forged.size(), ev));
+}
+
+int main() {
+  if (!bootSynced()) return 1;
+
+  UNITY_BEGIN();
+  RUN_TEST(test_node_hmac_matches_rfc4231);
+  RUN_TEST(test_batch_matches_rfc4231_in_every_impl);
+  RUN_TEST(test_batch_matches_node_hmac_for_every_length);
+  RUN_TEST(test_aes128_matches_fips197);
+  RUN_TEST(test_command_decrypted_by_node);
+  RUN_TEST(test_node_data_decrypted_by_hub);
+  return UNITY_END();
+}
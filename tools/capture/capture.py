@@ -0,0 +1,359 @@
+#!/usr/bin/env python3
+"""Decode, verify and count radio captures.
+
+    ./capture.py decode [capture] [--keys FILE]
+    ./capture.py stats [capture] [--keys FILE]
+
+A capture is a serial log or file with "@C <hex>" records (see
+lib/NodeCore/src/NodeCapture.h), from the sniffer firmware:
+
+    cd sniffer && pio run -t upload && pio device monitor -b 38400 > site.cap
+
+or from the simulator's hub, with the keys of its nodes:
+
+    sim --capture site.cap --capture-keys site.keys
+
+Other lines are ignored. decode prints one line per frame: time, direction,
+channel, signal, type, ID, counter and, with --keys, whether the HMAC or
+trigger tag checks out, and the decrypted payload. stats prints per node
+frames, rate, airtime, duty cycle and signal, and the frames that were on
+air at the same time as another one on the same channel and SF: each one
+a collision the receiver survived (the capture only has frames it got).
+
+--keys is a file of "<serial ID hex> <key hex>" lines, the adoption keys.
+The key of each epoch is derived from them when a MSG_RESYNC goes by, and
+group keys are taken from the MSG_GROUP_JOINs, so a capture from the start
+of a site verifies throughout. HMACs need nothing beyond Python; payloads,
+group keys and trigger tags need AES from the cryptography package
+(pip install cryptography).
+
+Replaying a capture: sim --replay puts it on air next to the simulated hub,
+and a firmware's native build takes it with program --replay.
+"""
+
+import argparse
+import hashlib
+import hmac
+import math
+import re
+import struct
+import sys
+
+CAPTURE_VERSION = 1
+CAPTURE_SETUP, CAPTURE_FRAME, CAPTURE_LOST = 1, 2, 3
+CAPTURE_TX, CAPTURE_SF = 0x80, 0x0F
+
+LINE = re.compile(r"@C ([0-9a-fA-F]+)\s*$")
+
+# NodeWire.h
+NAMES = {
+    0x01: "ADOPT_REQ", 0x02: "ADOPT_RSP", 0x03: "DISCOVERY", 0x04: "DISCOVERY_ACK",
+    0x05: "CHALLENGE", 0x06: "CHALLENGE_RSP", 0x10: "DATA", 0x11: "DIAG",
+    0x12: "OTA_STATUS", 0x13: "BULK_OFFER_UP", 0x14: "BULK_FRAGMENT_UP", 0x15: "BULK_ACK_UP",
+    0x20: "COMMAND", 0x21: "OTA_OFFER", 0x22: "OTA_CHUNK",
+    0x23: "GROUP_JOIN", 0x24: "GROUP_COMMAND", 0x25: "TRIGGER", 0x26: "BEACON",
+    0x27: "RETRY", 0x28: "RESYNC", 0x29: "BULK_OFFER", 0x2A: "BULK_FRAGMENT", 0x2B: "BULK_ACK",
+}
+UPLINK = {0x01, 0x03, 0x05, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15}
+NO_ID = {0x26, 0x28}
+MAC = {0x05, 0x06, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x20, 0x21, 0x22, 0x23, 0x24,
+       0x29, 0x2A, 0x2B}
+SECURE = {0x10, 0x20, 0x23, 0x24}  # Encrypted payload
+COUNTER = {0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x20, 0x21, 0x23, 0x24, 0x25, 0x29, 0x2A, 0x2B}
+BULK_OFFER, BULK_FRAGMENT, BULK_ACK = {0x13, 0x29}, {0x14, 0x2A}, {0x15, 0x2B}
+BULK_POLL = 0x80
+
+MSG_GROUP_JOIN, MSG_GROUP_COMMAND, MSG_TRIGGER = 0x23, 0x24, 0x25
+MSG_ADOPT_RSP, MSG_BEACON, MSG_RETRY, MSG_RESYNC = 0x02, 0x26, 0x27, 0x28
+
+ID, ID_LEN, HMAC_LEN = 1, 16, 32
+SECURE_COUNTER, SECURE_NONCE, SECURE_ORIG_LEN, SECURE_HEADER_LEN = 17, 21, 29, 30
+TRIGGER_ACTION, TRIGGER_TAG, TRIGGER_TAG_LEN, TRIGGER_ID_SIGNED = 21, 22, 8, 10
+TRIGGER_KEY_BYTE = 0x74
+
+
+def airtime_us(length, sf, bw, cr, preamble):
+    # hal::airtimeUs()
+    t_sym = (1 << sf) / bw * 1e6
+    de = 1 if t_sym > 16000 else 0
+    t_preamble = (preamble + 4.25) * t_sym
+    n = math.ceil((8.0 * length - 4.0 * sf + 28 + 16) / (4.0 * (sf - 2 * de))) * cr
+    return int(t_preamble + (8 + max(n, 0)) * t_sym)
+
+
+class Frame:
+    pass
+
+
+def read(src):
+    """Frames of a capture with their times unwrapped, and the lost count"""
+    frames, lost = [], 0
+    bw, cr, preamble = 125000, 5, 8
+    at = None
+    for line in src:
+        m = LINE.search(line)
+        if not m or len(m.group(1)) % 2:
+            continue
+        rec = bytes.fromhex(m.group(1))
+        if rec[0] == CAPTURE_SETUP and len(rec) == 10 and rec[1] == CAPTURE_VERSION:
+            bw, cr, preamble, _ = struct.unpack_from("<IBHB", rec, 2)
+        elif rec[0] == CAPTURE_LOST and len(rec) == 3:
+            lost += struct.unpack_from("<H", rec, 1)[0]
+        elif rec[0] == CAPTURE_FRAME and len(rec) > 13:
+            us, freq, sf, rssi, snr = struct.unpack_from("<IIBhb", rec, 1)
+            # CaptureClock: a step back of less than half the range is one
+            at = us if at is None else at + ((us - at + 0x80000000) & 0xFFFFFFFF) - 0x80000000
+            f = Frame()
+            f.data = rec[13:]
+            f.freq, f.sf, f.tx = freq, sf & CAPTURE_SF, bool(sf & CAPTURE_TX)
+            f.rssi, f.snr = rssi, snr / 4.0
+            f.end = at
+            f.airtime = airtime_us(len(f.data), f.sf, bw, cr, preamble)
+            f.start = f.end - f.airtime
+            frames.append(f)
+    return frames, lost
+
+
+def load_keys(path):
+    keys = {}
+    with open(path) as f:
+        for line in f:
+            line = line.split("#")[0].split()
+            if len(line) == 2:
+                keys[bytes.fromhex(line[0])] = bytes.fromhex(line[1])
+    return keys
+
+
+def aes():
+    try:
+        from cryptography.hazmat.primitives.ciphers import Cipher, algorithms, modes
+    except ImportError:
+        return None
+
+    def run(key, mode, data, decrypt):
+        c = Cipher(algorithms.AES(key), mode)
+        op = c.decryptor() if decrypt else c.encryptor()
+        return op.update(data) + op.finalize()
+
+    return {
+        "ecb": lambda key, block: run(key, modes.ECB(), block, False),
+        "cbc": lambda key, iv, data: run(key, modes.CBC(iv), data, True),
+    }
+
+
+class Keys:
+    """Session keys as the nodes hold them, following the capture"""
+
+    def __init__(self, adoption):
+        self.adoption = adoption
+        self.epochs = []        # Seen in MSG_RESYNC, newest last
+        self.current = {}       # ID -> key that last verified
+        self.groups = {}        # Group ID -> key from MSG_GROUP_JOIN
+        self.aes = aes()
+
+    def candidates(self, ident):
+        if ident in self.groups:
+            return [self.groups[ident]]
+        key = self.adoption.get(ident)
+        if key is None:
+            return []
+        # MSG_RESYNC in NodeWire.h: HMAC-SHA256 under the adoption key of type + epoch
+        derived = [hmac.new(key, struct.pack("<BI", MSG_RESYNC, e), hashlib.sha256).digest()[:16]
+                   for e in reversed(self.epochs)]
+        return [self.current.get(ident, key)] + derived + [key]
+
+    def resync(self, epoch):
+        if epoch not in self.epochs:
+            self.epochs.append(epoch)
+            self.current.clear()
+
+
+def check(f, keys):
+    """Fills f.verdict (ok, BAD, no key, or None without a MAC) and f.plain"""
+    d, t = f.data, f.data[0]
+    f.verdict, f.plain, f.key = None, None, None
+    if t in NO_ID or len(d) < ID + ID_LEN:
+        return
+    ident = d[ID:ID + ID_LEN]
+
+    if t in MAC and len(d) > ID + ID_LEN + HMAC_LEN:
+        cands = keys.candidates(ident)
+        if not cands:
+            f.verdict = "no key"
+            return
+        f.verdict = "BAD"
+        for k in cands:
+            if hmac.compare_digest(hmac.new(k, d[:-HMAC_LEN], hashlib.sha256).digest(), d[-HMAC_LEN:]):
+                f.verdict, f.key = "ok", k
+                if ident not in keys.groups:
+                    keys.current[ident] = k
+                break
+    elif t == MSG_TRIGGER and len(d) == TRIGGER_TAG + TRIGGER_TAG_LEN:
+        cands = keys.candidates(ident)
+        if not cands or not keys.aes:
+            f.verdict = "no key" if not cands else "no AES"
+            return
+        f.verdict = "BAD"
+        block = d[:1] + d[ID:ID + TRIGGER_ID_SIGNED] + d[SECURE_COUNTER:TRIGGER_TAG]
+        for k in cands:
+            tk = keys.aes["ecb"](k, bytes([TRIGGER_KEY_BYTE] * 16))
+            if keys.aes["ecb"](tk, block)[:TRIGGER_TAG_LEN] == d[TRIGGER_TAG:]:
+                f.verdict, f.key = "ok", k
+                break
+
+    if f.key and t in SECURE and keys.aes and len(d) >= SECURE_HEADER_LEN + 16 + HMAC_LEN:
+        iv = d[ID:ID + 4] + d[SECURE_COUNTER:SECURE_ORIG_LEN]
+        f.plain = keys.aes["cbc"](f.key, iv, d[SECURE_HEADER_LEN:-HMAC_LEN])[:d[SECURE_ORIG_LEN]]
+        if t == MSG_GROUP_JOIN and len(f.plain) >= 32:
+            keys.groups[bytes(f.plain[:16])] = bytes(f.plain[16:32])
+
+
+def describe(f):
+    d, t = f.data, f.data[0]
+    parts = [NAMES.get(t, "type %02x" % t)]
+    if t not in NO_ID and len(d) >= ID + ID_LEN:
+        parts.append(d[ID:ID + ID_LEN].hex())
+    try:
+        if t in COUNTER:
+            parts.append("ctr %d" % struct.unpack_from("<I", d, 17))
+        if t in (0x05, 0x06):
+            parts.append("tx %d rx %d" % struct.unpack_from("<II", d, 17))
+        if t == MSG_TRIGGER:
+            parts.append("action %d" % d[TRIGGER_ACTION])
+        if t == MSG_ADOPT_RSP:
+            parts.append("status %d epoch %d" % (d[17], struct.unpack_from("<I", d, 58)[0]))
+        if t == MSG_BEACON:
+            parts.append("seq %d period %d ms flags %x" % struct.unpack_from("<HHB", d, 1))
+        if t == MSG_RETRY:
+            parts.append("wait %d ms" % struct.unpack_from("<H", d, 17))
+        if t == MSG_RESYNC:
+            parts.append("epoch %d" % struct.unpack_from("<I", d, 1))
+        if t == 0x22:
+            parts.append("update %d offset %d" % struct.unpack_from("<HH", d, 17))
+        if t in BULK_OFFER:
+            parts.append("kind %d size %d crc %08x" % struct.unpack_from("<BHI", d, 21))
+        if t in BULK_FRAGMENT:
+            parts.append("fragment %d%s" % (d[21] & ~BULK_POLL, " poll" if d[21] & BULK_POLL else ""))
+        if t in BULK_ACK:
+            parts.append("state %d have %x" % struct.unpack_from("<BH", d, 21))
+    except struct.error:
+        parts.append("short")
+    if f.verdict:
+        parts.append("[%s]" % f.verdict)
+    if f.plain is not None:
+        text = bytes(f.plain)
+        if f.data[0] != MSG_GROUP_JOIN and all(32 <= b < 127 for b in text):
+            parts.append('"%s"' % text.decode())
+        else:
+            parts.append(text.hex())
+    return "  ".join(parts)
+
+
+def process(frames, keys):
+    for f in frames:
+        if f.data[0] == MSG_RESYNC and len(f.data) >= 5:
+            keys.resync(struct.unpack_from("<I", f.data, 1)[0])
+        check(f, keys)
+
+
+def decode(frames, lost):
+    t0 = min(f.start for f in frames) if frames else 0
+    for f in frames:
+        way = "up" if f.data[0] in UPLINK else "down"
+        signal = "tx %3d dBm        " % f.rssi if f.tx else "%5d dBm %6.2f dB" % (f.rssi, f.snr)
+        print("%12.6f  %-4s %7.3f MHz SF%-2d %s  %s" % (
+            (f.end - t0) / 1e6, way, f.freq / 1e6, f.sf, signal, describe(f)))
+    if lost:
+        print("%d frames lost by the writer" % lost)
+
+
+def overlaps(frames):
+    """Marks every frame on air at the same time as another on its channel and SF"""
+    by_channel = {}
+    for f in frames:
+        f.overlap = False
+        by_channel.setdefault((f.freq, f.sf), []).append(f)
+    for group in by_channel.values():
+        group.sort(key=lambda f: f.start)
+        latest = None  # The frame that ends last so far
+        for f in group:
+            if latest and f.start < latest.end:
+                f.overlap = latest.overlap = True
+            if not latest or f.end > latest.end:
+                latest = f
+
+
+def stats(frames, lost, keys_given):
+    if not frames:
+        print("no frames")
+        return
+    overlaps(frames)
+    span = max(f.end for f in frames) - min(f.start for f in frames)
+    minutes = span / 60e6
+
+    nodes = {}
+    for f in frames:
+        t = f.data[0]
+        if t in NO_ID or len(f.data) < ID + ID_LEN:
+            name = "broadcast"
+        else:
+            name = f.data[ID:ID + ID_LEN].hex()
+        n = nodes.setdefault(name, {"up": 0, "down": 0, "air": 0, "rssi": [], "snr": [],
+                                    "overlap": 0, "bad": 0})
+        if t in UPLINK:
+            n["up"] += 1
+            n["air"] += f.airtime
+            n["rssi"].append(f.rssi)
+            n["snr"].append(f.snr)
+        else:
+            n["down"] += 1
+        n["overlap"] += f.overlap
+        n["bad"] += f.verdict == "BAD"
+
+    down_air = sum(f.airtime for f in frames if f.data[0] not in UPLINK)
+    print("%d frames over %.1f s, %d lost by the writer, %d on air together with another"
+          % (len(frames), span / 1e6, lost, sum(f.overlap for f in frames)))
+    print("downlink %.2f s on air, %.2f%% duty cycle" % (down_air / 1e6, 100.0 * down_air / span))
+    print()
+    print("%-32s %6s %7s %6s %9s %6s %6s %6s %7s%s" % (
+        "node", "up", "up/min", "down", "airtime", "duty", "rssi", "snr", "overlap",
+        "    bad" if keys_given else ""))
+    for name in sorted(nodes):
+        n = nodes[name]
+        rssi = "%6.1f" % (sum(n["rssi"]) / len(n["rssi"])) if n["rssi"] else "     -"
+        snr = "%6.1f" % (sum(n["snr"]) / len(n["snr"])) if n["snr"] else "     -"
+        print("%-32s %6d %7.2f %6d %7.2f s %5.2f%% %s %s %7d%s" % (
+            name, n["up"], n["up"] / minutes if minutes else 0, n["down"], n["air"] / 1e6,
+            100.0 * n["air"] / span, rssi, snr, n["overlap"],
+            " %6d" % n["bad"] if keys_given else ""))
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = ap.add_subparsers(dest="cmd", required=True)
+    for name, help in (("decode", "print every frame"), ("stats", "per node rates, airtime and collisions")):
+        p = sub.add_parser(name, help=help)
+        p.add_argument("capture", nargs="?", help="capture or serial log, stdin if omitted")
+        p.add_argument("--keys", help='"<serial ID hex> <adoption key hex>" per line')
+    args = ap.parse_args()
+
+    src = open(args.capture, errors="replace") if args.capture else sys.stdin
+    frames, lost = read(src)
+    keys = Keys(load_keys(args.keys) if args.keys else {})
+    if args.keys:
+        process(frames, keys)
+    else:
+        for f in frames:
+            f.verdict, f.plain = None, None
+
+    if args.cmd == "decode":
+        if args.keys and not keys.aes:
+            print("# no AES (pip install cryptography): HMACs only", file=sys.stderr)
+        decode(frames, lost)
+    else:
+        stats(frames, lost, bool(args.keys))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,219 @@
+#!/usr/bin/env python3
+"""Estimate node battery drain from an energy trace.
+
+    ./energy.py trace.log [--currents currents.json] [--capacity 2400]
+
+The trace is the serial output of a firmware built with -DENERGY_TRACE=1
+(see lib/NodeCore/src/NodeEnergy.h), from a real node or from the native
+build, which runs on a virtual clock:
+
+    cd entry && PLATFORMIO_BUILD_FLAGS=-DENERGY_TRACE=1 pio run -e native \\
+        && .pio/build/native/program --seconds 86400 > trace.log
+
+Other lines in the log are ignored. Every domain is in exactly one state
+at a time; the time spent in each state is multiplied by its current from
+the table, summed, and scaled from the time traced to one day. The
+breakdown shows which activity the charge goes to.
+
+Where the node dropped events ("@E drop"), the states are unknown until
+the snapshot of all domains that follows it ("@E snap"). That gap is left
+out of the time traced, so it is not counted in any state.
+
+The native clock only moves on delay() and airtime, so native traces give
+radio, ADC and LED time but no CPU time for crypto. Use a device trace, or
+the simavr cycle counts (bench/simavr.py), for those.
+"""
+
+import argparse
+import json
+import os
+import re
+import sys
+
+DOMAINS = ["radio", "cpu", "adc", "led"]
+STATES = {
+    "radio": ["sleep", "standby", "rx", "tx"],
+    "cpu": ["active", "crypto", "sleep"],
+    "adc": ["off", "on"],
+    "led": ["off", "on"],
+}
+CRYPTO = {1: "hmac", 2: "frame", 3: "ecdh", 4: "ecdsa"}
+
+# State before the first event of a domain, matching NodeEnergy.h
+INITIAL = {"radio": 0, "cpu": 0, "adc": 0, "led": 0}
+
+EVENT = re.compile(r"@E (\d+) (\d+) (\d+) (\d+)")
+DROP = re.compile(r"@E drop (\d+)")
+SNAP = re.compile(r"@E snap (\d+)((?: \d+){%d})" % (2 * len(DOMAINS)))
+
+
+def activity(domain, state, arg):
+    name = "%s.%s" % (domain, STATES[domain][state])
+    if domain == "radio" and STATES[domain][state] == "tx":
+        return name + ".sf%d" % arg
+    if domain == "cpu" and STATES[domain][state] == "crypto":
+        return name + "." + CRYPTO.get(arg, str(arg))
+    return name
+
+
+def current(table, name):
+    # radio.tx.sf7 -> radio.tx, cpu.crypto.hmac -> cpu.crypto
+    key = name
+    while key:
+        if key in table:
+            return table[key]
+        key = key.rpartition(".")[0]
+    sys.exit("no current for %s in the table" % name)
+
+
+def parse(lines):
+    """Events in order: ("event", us, domain, state, arg), ("drop", n) and
+    ("snap", us, {domain: (state, arg)})."""
+    records = []
+    offset, last = 0, None
+
+    # micros() wraps every 71 minutes on the device
+    def unwrap(us):
+        nonlocal offset, last
+        if last is not None and us + offset < last - (1 << 31):
+            offset += 1 << 32
+        last = us + offset
+        return last
+
+    for line in lines:
+        m = DROP.search(line)
+        if m:
+            records.append(("drop", int(m.group(1))))
+            continue
+        m = SNAP.search(line)
+        if m:
+            fields = [int(g) for g in m.group(2).split()]
+            states = {}
+            for i, d in enumerate(DOMAINS):
+                state, arg = fields[2 * i], fields[2 * i + 1]
+                if state < len(STATES[d]):
+                    states[d] = (state, arg)
+            records.append(("snap", unwrap(int(m.group(1))), states))
+            continue
+        m = EVENT.search(line)
+        if not m:
+            continue
+        us, domain, state, arg = (int(g) for g in m.groups())
+        us = unwrap(us)
+        if domain >= len(DOMAINS) or state >= len(STATES[DOMAINS[domain]]):
+            continue
+        records.append(("event", us, DOMAINS[domain], state, arg))
+    return records
+
+
+def integrate(records):
+    """Seconds spent per activity, and the seconds traced, which leave out
+    the gaps after dropped events."""
+    times = [r[1] for r in records if r[0] != "drop"]
+    if len(times) < 2:
+        sys.exit("trace has fewer than two events")
+
+    now = {d: activity(d, INITIAL[d], 0) for d in DOMAINS}
+    since = {d: times[0] for d in DOMAINS}
+    segment = last = times[0]  # Start and end of the stretch with known states
+    gap = False
+    seconds = {}
+    traced = 0.0
+
+    def add(domain, until):
+        seconds[now[domain]] = seconds.get(now[domain], 0.0) + (until - since[domain]) / 1e6
+        since[domain] = until
+
+    for r in records:
+        if r[0] == "drop":
+            if not gap:
+                for d in DOMAINS:
+                    add(d, last)
+                traced += (last - segment) / 1e6
+                gap = True
+        elif r[0] == "snap":
+            us, states = r[1], r[2]
+            if gap:
+                since = {d: us for d in DOMAINS}
+                segment = us
+                gap = False
+            else:
+                for d in DOMAINS:
+                    add(d, us)
+            for d, (state, arg) in states.items():
+                now[d] = activity(d, state, arg)
+            last = us
+        elif not gap:
+            us, domain, state, arg = r[1:]
+            add(domain, us)
+            now[domain] = activity(domain, state, arg)
+            last = us
+
+    if not gap:
+        for d in DOMAINS:
+            add(d, last)
+        traced += (last - segment) / 1e6
+    return seconds, traced
+
+
+def main():
+    here = os.path.dirname(os.path.abspath(__file__))
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    ap.add_argument("trace", nargs="?", default="-")
+    ap.add_argument("--currents", default=os.path.join(here, "currents.json"))
+    ap.add_argument("--capacity", type=float, default=2400, help="battery capacity in mAh")
+    ap.add_argument("--json", action="store_true", help="machine-readable output")
+    args = ap.parse_args()
+
+    with open(args.currents) as f:
+        table = {k: v for k, v in json.load(f).items() if not k.startswith("_")}
+
+    lines = sys.stdin if args.trace == "-" else open(args.trace)
+    records = parse(lines)
+    seconds, span = integrate(records)
+    events = [r for r in records if r[0] == "event"]
+    drops = sum(r[1] for r in records if r[0] == "drop")
+    if span <= 0:
+        sys.exit("trace covers no time")
+
+    rows = []
+    for name, s in seconds.items():
+        ma = current(table, name)
+        mah_day = ma * s / span * 24
+        rows.append({"activity": name, "seconds": s, "duty": s / span, "mA": ma, "mAh_day": mah_day})
+    base_day = table.get("base", 0.0) * 24
+    rows.append({"activity": "base", "seconds": span, "duty": 1.0, "mA": table.get("base", 0.0),
+                 "mAh_day": base_day})
+    rows.sort(key=lambda r: -r["mAh_day"])
+
+    total = sum(r["mAh_day"] for r in rows)
+    result = {
+        "trace_seconds": span,
+        "events": len(events),
+        "dropped": drops,
+        "average_mA": total / 24,
+        "mAh_day": total,
+        "battery_days": args.capacity / total if total else None,
+        "breakdown": rows,
+    }
+
+    if args.json:
+        json.dump(result, sys.stdout, indent=2)
+        print()
+        return 0
+
+    print("%-22s %10s %8s %8s %10s %6s" % ("activity", "seconds", "duty", "mA", "mAh/day", "share"))
+    for r in rows:
+        print("%-22s %10.2f %7.3f%% %8.3f %10.3f %5.1f%%"
+              % (r["activity"], r["seconds"], 100 * r["duty"], r["mA"], r["mAh_day"],
+                 100 * r["mAh_day"] / total if total else 0))
+    print("\n%.0f s traced, %d events; average %.3f mA, %.1f mAh/day, %.0f days on %.0f mAh"
+          % (span, len(events), total / 24, total, args.capacity / total, args.capacity))
+    if drops:
+        print("warning: %d events dropped on the node, the time until each snapshot is not "
+              "counted; raise ENERGY_TRACE_DEPTH" % drops)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,183 @@
+#!/usr/bin/env python3
+"""Decode the tokenized debug log of a node.
+
+    ./log.py decode [serial.log] [--src DIR ...]
+    ./log.py check [--src DIR ...] [-v]
+
+A firmware built with DEBUG 1 prints no messages, only "@L <hex>" lines
+(see lib/NodeCore/src/NodeLog.h). decode reads a serial log, or stdin
+while it is being written:
+
+    pio device monitor -b 38400 | ./log.py decode
+    cd siren && pio run -e native && .pio/build/native/program | ../tools/log/log.py decode
+
+and prints the messages again, other lines as they are. The table of
+tokens comes from the sources, not the firmware: every DEBUG_LOG() under
+--src (lib, entry and siren by default) is hashed the way the compiler
+does it, so decode the log with the sources the firmware was built from.
+
+check lists format strings that share a token, which the decoder cannot
+tell apart, and fails if there are any; -v prints the whole table.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..")
+SOURCES = ["lib", "entry", "siren"]
+
+TOKEN_DROPPED = 0
+CUT = 0x80
+
+CALL = re.compile(r'DEBUG_LOG\(\s*"((?:[^"\\]|\\.)*)"')
+LINE = re.compile(r"@L ([0-9a-f]+)\s*$")
+SPEC = re.compile(r"%(.)")
+
+
+def token(fmt):
+    # FNV-1a folded to 16 bits, 0 reserved: logHash() and logFold()
+    h = 2166136261
+    for b in fmt.encode():
+        h = ((h ^ b) * 16777619) & 0xFFFFFFFF
+    t = (h ^ (h >> 16)) & 0xFFFF
+    return t or 1
+
+
+def unescape(literal):
+    return literal.encode().decode("unicode_escape")
+
+
+def scan(dirs):
+    """token -> {format: [file:line, ...]}"""
+    table = {}
+    for d in dirs:
+        for path, _, files in os.walk(d):
+            for name in sorted(files):
+                if not name.endswith((".h", ".cpp", ".ino")):
+                    continue
+                full = os.path.join(path, name)
+                with open(full, errors="replace") as f:
+                    text = f.read()
+                for m in CALL.finditer(text):
+                    fmt = unescape(m.group(1))
+                    where = "%s:%d" % (os.path.relpath(full), text.count("\n", 0, m.start()) + 1)
+                    table.setdefault(token(fmt), {}).setdefault(fmt, []).append(where)
+    return table
+
+
+class Record:
+    def __init__(self, data):
+        self.data = data
+        self.at = 0
+
+    def byte(self):
+        if self.at >= len(self.data):
+            raise ValueError("record too short")
+        b = self.data[self.at]
+        self.at += 1
+        return b
+
+    def varint(self):
+        v, shift = 0, 0
+        while True:
+            b = self.byte()
+            v |= (b & 0x7F) << shift
+            shift += 7
+            if not b & 0x80:
+                return v
+
+    def bytes(self):
+        n = self.byte()
+        raw = bytes(self.byte() for _ in range(n & ~CUT))
+        return raw, bool(n & CUT)
+
+
+def render(fmt, rec):
+    def arg(m):
+        c = m.group(1)
+        if c == "%":
+            return "%"
+        if c == "u":
+            return str(rec.varint())
+        if c == "d":
+            v = rec.varint()
+            return str((v >> 1) ^ -(v & 1))
+        if c == "x":
+            return "%X" % rec.varint()
+        if c == "s":
+            raw, cut = rec.bytes()
+            return raw.decode(errors="replace") + ("..." if cut else "")
+        if c == "h":
+            raw, cut = rec.bytes()
+            return raw.hex().upper() + ("..." if cut else "")
+        if c == "U":
+            h = bytes(rec.byte() for _ in range(16)).hex().upper()
+            return "-".join((h[:8], h[8:12], h[12:16], h[16:20], h[20:]))
+        raise ValueError("unknown conversion %%%s" % c)
+
+    return SPEC.sub(arg, fmt)
+
+
+def decode_line(line, table):
+    m = LINE.search(line)
+    if not m or len(m.group(1)) % 2:
+        return line.rstrip("\n")
+    rec = Record(bytes.fromhex(m.group(1)))
+    try:
+        t = rec.byte() | rec.byte() << 8
+        if t == TOKEN_DROPPED:
+            return "[log] %d records dropped, ring full" % rec.varint()
+        formats = table.get(t)
+        if not formats:
+            return "[log] unknown token %04x, sources newer than the firmware? %s" % (t, m.group(1))
+        if len(formats) > 1:
+            return "[log] token %04x is ambiguous (log.py check) %s" % (t, m.group(1))
+        return render(next(iter(formats)), rec)
+    except ValueError as e:
+        return "[log] bad record, %s: %s" % (e, m.group(1))
+
+
+def decode(args, table):
+    src = open(args.log, errors="replace") if args.log else sys.stdin
+    for line in src:
+        print(decode_line(line, table), flush=src is sys.stdin)
+
+
+def check(args, table):
+    clashes = 0
+    for t in sorted(table):
+        formats = table[t]
+        if len(formats) > 1:
+            clashes += 1
+            print("token %04x:" % t)
+            for fmt, where in formats.items():
+                print("  %-40s %s" % (", ".join(where), fmt))
+        elif args.verbose:
+            fmt, where = next(iter(formats.items()))
+            print("%04x  %s  (%s)" % (t, fmt, ", ".join(where)))
+    count = sum(len(f) for f in table.values())
+    print("%d formats, %d tokens, %d clashes" % (count, len(table), clashes))
+    return 1 if clashes else 0
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--src", action="append", help="source directory to scan (repeatable)")
+    sub = ap.add_subparsers(dest="cmd", required=True)
+    p = sub.add_parser("decode", help="print the messages of a log")
+    p.add_argument("log", nargs="?", help="serial log, stdin if omitted")
+    p = sub.add_parser("check", help="look for format strings sharing a token")
+    p.add_argument("-v", "--verbose", action="store_true", help="print every token")
+    args = ap.parse_args()
+
+    table = scan(args.src or [os.path.join(ROOT, d) for d in SOURCES])
+    if args.cmd == "decode":
+        decode(args, table)
+        return 0
+    return check(args, table)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
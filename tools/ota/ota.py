@@ -0,0 +1,245 @@
+#!/usr/bin/env python3
+"""Build signed firmware updates for the nodes' over-the-air path.
+
+    ./ota.py keygen vendor.key
+    ./ota.py pubkey vendor.key
+    ./ota.py build base.bin new.bin --key vendor.key --id 7 -o update.ota
+
+keygen writes a new secp160r1 private key (21 bytes, hex) and prints the
+public half as the OTA_SIGNING_KEY array to paste into the application's
+src/main.cpp; pubkey prints it again. Keep the private key off the hub.
+
+build takes the image the nodes run now and the new one, both as the raw
+.bin PlatformIO leaves next to firmware.elf (.text and .data, which is
+what the node's base CRC covers), and writes the update the hub offers:
+
+    uint16 id, uint32 base CRC, uint16 image length    (little endian)
+    40 bytes signature (r, s) over SHA-256 of the new image
+    the NodeDelta.h operation stream
+
+It is the same encoder as lib/HubProtocol/src/OtaDelta.cpp, so the delta
+comes out byte for byte as the hub would build it, and every delta is
+decoded again and compared before it is written.
+
+Signing needs the python-ecdsa package (pip install ecdsa); the delta
+alone does not.
+"""
+
+import argparse
+import hashlib
+import os
+import struct
+import sys
+import zlib
+
+LITERAL, COPY, FILL = 0x00, 0x80, 0xC0
+LITERAL_MAX = 128
+COPY_MIN, COPY_MAX = 4, 0x3FFF + 4
+FILL_MIN, FILL_MAX = 3, 0x3F + 3
+
+HASH_BITS = 14
+CHAIN_MAX = 32
+
+IMAGE_MAX = 0x7800  # OTA_IMAGE_MAX, application section below the bootloader
+KEY_LEN = 21
+SIGNATURE_LEN = 40
+
+
+def hash4(b, i):
+    v = b[i] | b[i + 1] << 8 | b[i + 2] << 16 | b[i + 3] << 24
+    return ((v * 2654435761) & 0xFFFFFFFF) >> (32 - HASH_BITS)
+
+
+def flush_literals(out, data):
+    for i in range(0, len(data), LITERAL_MAX):
+        part = data[i:i + LITERAL_MAX]
+        out.append(LITERAL | (len(part) - 1))
+        out += part
+
+
+def encode(base, image):
+    """Greedy: the longest COPY from the base, a FILL for runs, else literals."""
+    head = [-1] * (1 << HASH_BITS)
+    chain = [-1] * len(base)
+    for i in range(len(base) - COPY_MIN + 1):
+        h = hash4(base, i)
+        chain[i] = head[h]
+        head[h] = i
+
+    out = bytearray()
+    literal = pos = 0
+    while pos < len(image):
+        left = len(image) - pos
+
+        copy_len = copy_from = 0
+        if left >= COPY_MIN:
+            limit = min(left, COPY_MAX)
+            c, tries = head[hash4(image, pos)], 0
+            while c >= 0 and tries < CHAIN_MAX:
+                n = 0
+                while n < limit and c + n < len(base) and base[c + n] == image[pos + n]:
+                    n += 1
+                if n > copy_len:
+                    copy_len, copy_from = n, c
+                c, tries = chain[c], tries + 1
+
+        run = 1
+        while run < left and run < FILL_MAX and image[pos + run] == image[pos]:
+            run += 1
+
+        if copy_len >= COPY_MIN and copy_len >= run and copy_from <= 0xFFFF:
+            flush_literals(out, image[literal:pos])
+            n = copy_len - COPY_MIN
+            out += bytes([COPY | (n >> 8), n & 0xFF]) + struct.pack("<H", copy_from)
+            pos += copy_len
+            literal = pos
+        elif run >= FILL_MIN:
+            flush_literals(out, image[literal:pos])
+            out += bytes([FILL | (run - FILL_MIN), image[pos]])
+            pos += run
+            literal = pos
+        else:
+            pos += 1
+
+    flush_literals(out, image[literal:pos])
+    return bytes(out)
+
+
+def decode(base, delta, image_len):
+    """Reference decoder with the node's bounds, None if malformed."""
+    out = bytearray()
+    i = 0
+    while i < len(delta):
+        op = delta[i]
+        if op < COPY:
+            n = op + 1
+            chunk = delta[i + 1:i + 1 + n]
+            if len(chunk) != n:
+                return None
+            out += chunk
+            i += 1 + n
+        elif op < FILL:
+            if i + 4 > len(delta):
+                return None
+            n = ((op & 0x3F) << 8 | delta[i + 1]) + COPY_MIN
+            src = struct.unpack_from("<H", delta, i + 2)[0]
+            if src + n > len(base):
+                return None
+            out += base[src:src + n]
+            i += 4
+        else:
+            if i + 2 > len(delta):
+                return None
+            out += bytes([delta[i + 1]]) * ((op & 0x3F) + FILL_MIN)
+            i += 2
+        if len(out) > image_len:
+            return None
+    return bytes(out) if len(out) == image_len else None
+
+
+def curve():
+    try:
+        import ecdsa
+    except ImportError:
+        sys.exit("signing needs python-ecdsa: pip install ecdsa")
+    return ecdsa
+
+
+def load_key(path):
+    ecdsa = curve()
+    with open(path) as f:
+        raw = bytes.fromhex(f.read().strip())
+    if len(raw) != KEY_LEN:
+        sys.exit("%s: expected a %d byte key" % (path, KEY_LEN))
+    return ecdsa.SigningKey.from_string(raw, curve=ecdsa.SECP160r1)
+
+
+def c_array(key):
+    pub = key.get_verifying_key().to_string()  # x || y, as uECC
+    rows = ["  " + ", ".join("0x%02x" % b for b in pub[i:i + 10]) + "," for i in range(0, len(pub), 10)]
+    return ("const uint8_t OTA_SIGNING_KEY[WIRE_PUBKEY_LEN] PROGMEM = {\n"
+            + "\n".join(rows) + "\n};")
+
+
+def sign(key, image):
+    ecdsa = curve()
+    digest = hashlib.sha256(image).digest()
+    while True:
+        r, s = key.sign_digest(digest, sigencode=ecdsa.util.sigencode_strings,
+                               allow_truncate=True)
+        # The order of secp160r1 is 161 bits; uECC carries r and s in 20
+        # bytes and signs again when s does not fit, so do the same
+        if r[0] == 0 and s[0] == 0:
+            return r[1:] + s[1:]
+
+
+def cmd_keygen(args):
+    ecdsa = curve()
+    if os.path.exists(args.key):
+        sys.exit("%s exists, not overwriting" % args.key)
+    key = ecdsa.SigningKey.generate(curve=ecdsa.SECP160r1)
+    fd = os.open(args.key, os.O_WRONLY | os.O_CREAT | os.O_EXCL, 0o600)
+    with os.fdopen(fd, "w") as f:
+        f.write(key.to_string().rjust(KEY_LEN, b"\0").hex() + "\n")
+    print(c_array(key))
+    return 0
+
+
+def cmd_pubkey(args):
+    print(c_array(load_key(args.key)))
+    return 0
+
+
+def cmd_build(args):
+    if not 0 <= args.id < 0xFFFF:
+        sys.exit("update id must be 0..65534")
+    with open(args.base, "rb") as f:
+        base = f.read()
+    with open(args.image, "rb") as f:
+        image = f.read()
+    for name, data in ((args.base, base), (args.image, image)):
+        if not data or len(data) > IMAGE_MAX:
+            sys.exit("%s: %d bytes, the application section holds %d" % (name, len(data), IMAGE_MAX))
+
+    delta = encode(base, image)
+    if len(delta) > 0xFFFF or decode(base, delta, len(image)) != image:
+        sys.exit("delta does not round-trip")
+
+    signature = sign(load_key(args.key), image) if args.key else bytes(SIGNATURE_LEN)
+    header = struct.pack("<HIH", args.id, zlib.crc32(base) & 0xFFFFFFFF, len(image))
+    with open(args.output, "wb") as f:
+        f.write(header + signature + delta)
+
+    print("%s: update %d, %d byte image as a %d byte delta (%.1f%%)%s"
+          % (args.output, args.id, len(image), len(delta), 100.0 * len(delta) / len(image),
+             "" if args.key else ", UNSIGNED"))
+    return 0
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    sub = ap.add_subparsers(dest="command", required=True)
+
+    p = sub.add_parser("keygen", help="new vendor signing key")
+    p.add_argument("key")
+    p.set_defaults(run=cmd_keygen)
+
+    p = sub.add_parser("pubkey", help="print OTA_SIGNING_KEY for a key")
+    p.add_argument("key")
+    p.set_defaults(run=cmd_pubkey)
+
+    p = sub.add_parser("build", help="delta and signature for a new image")
+    p.add_argument("base")
+    p.add_argument("image")
+    p.add_argument("--id", type=int, required=True, help="update id, 0..65534")
+    p.add_argument("--key", help="private key from keygen; without it the update is unsigned "
+                                 "and every node refuses it (delta size checks only)")
+    p.add_argument("-o", "--output", required=True)
+    p.set_defaults(run=cmd_build)
+
+    args = ap.parse_args()
+    return args.run(args)
+
+
+if __name__ == "__main__":
+    sys.exit(main())